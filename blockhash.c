@@ -0,0 +1,207 @@
+/*
+*    QTC: blockhash.c (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "pixelops.h"
+
+#include "blockhash.h"
+
+#define BLOCKHASH_MINBUCKETS 64
+#define BLOCKHASH_AREA 64
+
+#define BLOCKHASH_HASH_INIT 2166136261u
+#define BLOCKHASH_HASH_PRIME 16777619u
+
+/*******************************************************************************
+* Function to create a new block hash                                          *
+*                                                                              *
+* size is the number of pixels covered by the indexed blocks                   *
+*                                                                              *
+* Returns a new block hash or NULL on failure                                  *
+*******************************************************************************/
+struct blockhash *blockhash_create( int size )
+{
+	struct blockhash *blockhash;
+	int numbuckets;
+	int i;
+
+	blockhash = calloc( 1, sizeof( *blockhash ) );
+	if( blockhash == NULL )
+	{
+		perror( "blockhash_create: calloc" );
+		return NULL;
+	}
+
+	numbuckets = BLOCKHASH_MINBUCKETS;
+	while( numbuckets < size / BLOCKHASH_AREA )
+		numbuckets *= 2;
+
+	blockhash->bucketmask = numbuckets - 1;
+	blockhash->numentries = 0;
+	blockhash->maxentries = numbuckets;
+
+	blockhash->buckets = malloc( sizeof( *blockhash->buckets ) * numbuckets );
+	blockhash->entries = malloc( sizeof( *blockhash->entries ) * blockhash->maxentries );
+
+	if( ( blockhash->buckets == NULL ) || ( blockhash->entries == NULL ) )
+	{
+		perror( "blockhash_create: malloc" );
+		blockhash_free( blockhash );
+		return NULL;
+	}
+
+	for( i=0; i<numbuckets; i++ )
+		blockhash->buckets[i] = -1;
+
+	return blockhash;
+}
+
+/*******************************************************************************
+* Function to free a block hash                                                *
+*                                                                              *
+* blockhash is the block hash to free                                          *
+*                                                                              *
+* Modifies blockhash                                                           *
+*******************************************************************************/
+void blockhash_free( struct blockhash *blockhash )
+{
+	free( blockhash->buckets );
+	free( blockhash->entries );
+	free( blockhash );
+}
+
+/*******************************************************************************
+* Function to hash the content of a block                                      *
+*                                                                              *
+* pixels is the image data                                                     *
+* x1, y1, x2, y2 describe the block                                            *
+* width is the width of the complete image                                     *
+* mask is the channel mask to apply before hashing                             *
+*                                                                              *
+* Returns the hash of the block, including its size                            *
+*******************************************************************************/
+unsigned int blockhash_hash( unsigned int *pixels, int x1, int y1, int x2, int y2, int width, unsigned int mask )
+{
+	unsigned int hash;
+	int x, y, i;
+
+	hash = BLOCKHASH_HASH_INIT;
+	hash = ( hash ^ (unsigned int)( x2-x1 ) ) * BLOCKHASH_HASH_PRIME;
+	hash = ( hash ^ (unsigned int)( y2-y1 ) ) * BLOCKHASH_HASH_PRIME;
+
+	for( y=y1; y<y2; y++ )
+	{
+		i = x1 + y*width;
+		for( x=x1; x<x2; x++ )
+			hash = ( hash ^ ( pixels[ i++ ] & mask ) ) * BLOCKHASH_HASH_PRIME;
+	}
+
+	return hash;
+}
+
+/*******************************************************************************
+* Function to add a compressed block to a block hash                           *
+*                                                                              *
+* blockhash is the block hash to add to                                        *
+* hash is the hash of the block                                                *
+* x1, y1, x2, y2 describe the block                                            *
+*                                                                              *
+* Modifies blockhash                                                           *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+int blockhash_add( struct blockhash *blockhash, unsigned int hash, int x1, int y1, int x2, int y2 )
+{
+	struct blockhash_entry *entry;
+	int bucket;
+
+	if( blockhash->numentries >= blockhash->maxentries )
+	{
+		blockhash->maxentries *= 2;
+
+		entry = realloc( blockhash->entries, sizeof( *entry ) * blockhash->maxentries );
+		if( entry == NULL )
+		{
+			perror( "blockhash_add: realloc" );
+			return 0;
+		}
+
+		blockhash->entries = entry;
+	}
+
+	bucket = hash & blockhash->bucketmask;
+
+	entry = &blockhash->entries[ blockhash->numentries ];
+	entry->hash = hash;
+	entry->x1 = x1;
+	entry->y1 = y1;
+	entry->x2 = x2;
+	entry->y2 = y2;
+	entry->next = blockhash->buckets[ bucket ];
+
+	blockhash->buckets[ bucket ] = blockhash->numentries++;
+
+	return 1;
+}
+
+/*******************************************************************************
+* Function to find an indexed block with the same content as a block           *
+*                                                                              *
+* blockhash is the block hash to search                                        *
+* pixels is the image data                                                     *
+* hash is the hash of the block                                                *
+* x1, y1, x2, y2 describe the block                                            *
+* width is the width of the complete image                                     *
+* mask is the channel mask to apply before comparing                           *
+* sx and sy receive the position of the indexed block                          *
+*                                                                              *
+* Returns 1 if a block was found, 0 otherwise                                  *
+*******************************************************************************/
+int blockhash_find( struct blockhash *blockhash, unsigned int *pixels, unsigned int hash, int x1, int y1, int x2, int y2, int width, unsigned int mask, int *sx, int *sy )
+{
+	struct blockhash_entry *entry;
+	int e, y, offset;
+
+	for( e=blockhash->buckets[ hash & blockhash->bucketmask ]; e>=0; e=entry->next )
+	{
+		entry = &blockhash->entries[e];
+
+		if( ( entry->hash != hash ) || ( entry->x2-entry->x1 != x2-x1 ) || ( entry->y2-entry->y1 != y2-y1 ) )
+			continue;
+
+		offset = ( entry->x1-x1 ) + ( entry->y1-y1 )*width;
+
+		for( y=y1; y<y2; y++ )
+		{
+			if( pixelops_differ( &pixels[ x1 + y*width ], &pixels[ x1 + y*width + offset ], x2-x1, mask ) )
+				break;
+		}
+
+		if( y == y2 )
+		{
+			*sx = entry->x1;
+			*sy = entry->y1;
+			return 1;
+		}
+	}
+
+	return 0;
+}
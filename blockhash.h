@@ -0,0 +1,63 @@
+/*
+*    QTC: blockhash.h (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BLOCKHASH_H
+#define BLOCKHASH_H
+
+/*******************************************************************************
+* Structure to hold one block of a block hash                                  *
+*                                                                              *
+* hash is the hash of the block content and size                               *
+* x1, y1, x2, y2 describe the block                                            *
+* next is the index of the next block in the same bucket, -1 for none          *
+*******************************************************************************/
+struct blockhash_entry
+{
+	unsigned int hash;
+	int x1, y1, x2, y2;
+	int next;
+};
+
+/*******************************************************************************
+* Structure to hold all the data associated with a block hash                  *
+*                                                                              *
+* A block hash indexes the blocks of the current frame that were already       *
+* compressed, so repeated content can be copied from them.                     *
+*                                                                              *
+* buckets holds the index of the first block of every bucket, -1 for none      *
+* bucketmask is the number of buckets minus one, a power of two minus one      *
+* entries are the indexed blocks                                               *
+* numentries and maxentries are the used and allocated number of entries       *
+*******************************************************************************/
+struct blockhash
+{
+	int *buckets;
+	unsigned int bucketmask;
+
+	struct blockhash_entry *entries;
+	int numentries, maxentries;
+};
+
+extern struct blockhash *blockhash_create( int size );
+extern void blockhash_free( struct blockhash *blockhash );
+extern unsigned int blockhash_hash( unsigned int *pixels, int x1, int y1, int x2, int y2, int width, unsigned int mask );
+extern int blockhash_add( struct blockhash *blockhash, unsigned int hash, int x1, int y1, int x2, int y2 );
+extern int blockhash_find( struct blockhash *blockhash, unsigned int *pixels, unsigned int hash, int x1, int y1, int x2, int y2, int width, unsigned int mask, int *sx, int *sy );
+
+#endif
@@ -0,0 +1,209 @@
+/*
+*    QTC: blockmap.c (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "blockmap.h"
+
+/*******************************************************************************
+* Function to create a new block map                                           *
+*                                                                              *
+* width and height are the dimension of the images to be mapped                *
+*                                                                              *
+* Returns a new block map or NULL on failure                                   *
+*******************************************************************************/
+struct blockmap *blockmap_create( int width, int height )
+{
+	struct blockmap *map;
+	int size;
+
+	map = malloc( sizeof( *map ) );
+	if( map == NULL )
+	{
+		perror( "blockmap_create: malloc" );
+		return NULL;
+	}
+
+	map->width = width;
+	map->height = height;
+	map->stride = width+1;
+	map->has_changes = 0;
+	map->sibling = NULL;
+
+	size = (width+1)*(height+1);
+
+	map->changes = calloc( size, sizeof( *map->changes ) );
+	map->hedges = calloc( size, sizeof( *map->hedges ) );
+	map->vedges = calloc( size, sizeof( *map->vedges ) );
+
+	if( ( map->changes == NULL ) || ( map->hedges == NULL ) || ( map->vedges == NULL ) )
+	{
+		perror( "blockmap_create: calloc" );
+		blockmap_free( map );
+		return NULL;
+	}
+
+	return map;
+}
+
+/*******************************************************************************
+* Function to free a block map                                                 *
+*                                                                              *
+* map is the block map to free                                                 *
+*                                                                              *
+* Modifies map                                                                 *
+*******************************************************************************/
+void blockmap_free( struct blockmap *map )
+{
+	if( map->sibling != NULL )
+		blockmap_free( map->sibling );
+
+	free( map->changes );
+	free( map->hedges );
+	free( map->vedges );
+	free( map );
+}
+
+/*******************************************************************************
+* Function to get the sibling of a block map                                   *
+* Separately coded planes are compressed at the same time and need a block     *
+* map each, a third plane uses the sibling of the sibling. The sibling is      *
+* created on first use and freed along with the block map.                     *
+*                                                                              *
+* map is the block map the sibling belongs to                                  *
+*                                                                              *
+* Returns the sibling or NULL on failure                                       *
+*******************************************************************************/
+struct blockmap *blockmap_get_sibling( struct blockmap *map )
+{
+	if( map->sibling == NULL )
+		map->sibling = blockmap_create( map->width, map->height );
+
+	return map->sibling;
+}
+
+/*******************************************************************************
+* Function to rebuild the tables of a block map for a new frame                *
+* This is the only place that touches the pixels, in a single linear pass      *
+*                                                                              *
+* map is the block map to update                                               *
+* pixels is the current image data                                             *
+* refpixels is the reference image data, NULL for keyframes                    *
+* mask is the channel mask used during compression                             *
+*                                                                              *
+* Modifies map                                                                 *
+*******************************************************************************/
+void blockmap_update( struct blockmap *map, unsigned int *pixels, unsigned int *refpixels, unsigned int mask )
+{
+	int x, y, i, width, height, stride;
+	unsigned int csum, hsum, vsum;
+	unsigned int *changes, *hedges, *vedges;
+	unsigned int *prow, *crow, *hrow, *vrow;
+
+	width = map->width;
+	height = map->height;
+	stride = map->stride;
+
+	changes = map->changes;
+	hedges = map->hedges;
+	vedges = map->vedges;
+
+	map->has_changes = refpixels != NULL;
+
+	for( y=0; y<height; y++ )
+	{
+		i = y*width;
+		prow = pixels + i;
+
+		crow = changes + (y+1)*stride + 1;
+		hrow = hedges + (y+1)*stride + 1;
+		vrow = vedges + (y+1)*stride + 1;
+
+		csum = hsum = vsum = 0;
+
+		if( refpixels != NULL )
+		{
+			for( x=0; x<width; x++ )
+			{
+				csum += ( ( prow[x] ^ refpixels[i+x] ) & mask ) != 0;
+				crow[x] = crow[x-stride] + csum;
+			}
+		}
+
+		hrow[0] = hrow[-stride];
+		for( x=1; x<width; x++ )
+		{
+			hsum += ( ( prow[x] ^ prow[x-1] ) & mask ) != 0;
+			hrow[x] = hrow[x-stride] + hsum;
+		}
+
+		if( y > 0 )
+		{
+			for( x=0; x<width; x++ )
+			{
+				vsum += ( ( prow[x] ^ prow[x-width] ) & mask ) != 0;
+				vrow[x] = vrow[x-stride] + vsum;
+			}
+		}
+	}
+}
+
+/*******************************************************************************
+* Function to sum up a rectangular area of a summed area table                 *
+*******************************************************************************/
+static inline unsigned int blockmap_sum( unsigned int *table, int stride, int x1, int y1, int x2, int y2 )
+{
+	return table[ x2 + y2*stride ] - table[ x2 + y1*stride ] - table[ x1 + y2*stride ] + table[ x1 + y1*stride ];
+}
+
+/*******************************************************************************
+* Function to check wether a block differs from the reference image            *
+*                                                                              *
+* map is the block map to query                                                *
+* x1, y1, x2, y2 describe the block                                            *
+*                                                                              *
+* Returns 1 if any pixel in the block changed, 0 otherwise                     *
+*******************************************************************************/
+int blockmap_changed( struct blockmap *map, int x1, int y1, int x2, int y2 )
+{
+	if( ! map->has_changes )
+		return 1;
+
+	return blockmap_sum( map->changes, map->stride, x1, y1, x2, y2 ) != 0;
+}
+
+/*******************************************************************************
+* Function to check wether a block is of a single color                        *
+* A block is constant if no pixel differs from its left neighbour and the      *
+* first column does not differ from its upper neighbours                       *
+*                                                                              *
+* map is the block map to query                                                *
+* x1, y1, x2, y2 describe the block                                            *
+*                                                                              *
+* Returns 1 if the block is of a single color, 0 otherwise                     *
+*******************************************************************************/
+int blockmap_constant( struct blockmap *map, int x1, int y1, int x2, int y2 )
+{
+	if( blockmap_sum( map->hedges, map->stride, x1+1, y1, x2, y2 ) != 0 )
+		return 0;
+
+	return blockmap_sum( map->vedges, map->stride, x1, y1+1, x1+1, y2 ) == 0;
+}
@@ -0,0 +1,62 @@
+/*
+*    QTC: blockmap.h (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BLOCKMAP_H
+#define BLOCKMAP_H
+
+/*******************************************************************************
+* Structure to hold all the data associated with a block map                   *
+*                                                                              *
+* A block map holds summed area tables of per pixel properties of a frame.     *
+* They allow the quad tree compressor to answer wether a block changed or is   *
+* of a single color in constant time, no matter how big the block is.          *
+*                                                                              *
+* width and height are the dimension of the mapped image                       *
+* stride is the width of one table row, width+1                                *
+* has_changes indicates wether the changes table is valid (not a keyframe)     *
+* changes counts pixels that differ from the reference image                   *
+* hedges counts pixels that differ from their left neighbour                   *
+* vedges counts pixels that differ from their upper neighbour                  *
+* sibling is a second block map of the same size, or NULL                      *
+*                                                                              *
+* All tables have (width+1)*(height+1) entries, the first row and column are   *
+* always zero. Counts are unsigned and may wrap, differences stay exact.       *
+*******************************************************************************/
+struct blockmap
+{
+	int width, height;
+	int stride;
+
+	int has_changes;
+
+	unsigned int *changes;
+	unsigned int *hedges;
+	unsigned int *vedges;
+
+	struct blockmap *sibling;
+};
+
+extern struct blockmap *blockmap_create( int width, int height );
+extern void blockmap_free( struct blockmap *map );
+extern struct blockmap *blockmap_get_sibling( struct blockmap *map );
+extern void blockmap_update( struct blockmap *map, unsigned int *pixels, unsigned int *refpixels, unsigned int mask );
+extern int blockmap_changed( struct blockmap *map, int x1, int y1, int x2, int y2 );
+extern int blockmap_constant( struct blockmap *map, int x1, int y1, int x2, int y2 );
+
+#endif
@@ -0,0 +1,147 @@
+/*
+*    QTC: bufferpool.c (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "databuffer.h"
+#include "bufferpool.h"
+
+/*******************************************************************************
+* Function to create a new, empty buffer pool                                  *
+*                                                                              *
+* Returns a new buffer pool or NULL on failure                                 *
+*******************************************************************************/
+struct bufferpool *bufferpool_create( void )
+{
+	struct bufferpool *pool;
+
+	pool = malloc( sizeof( *pool ) );
+	if( pool == NULL )
+	{
+		perror( "bufferpool_create: malloc" );
+		return NULL;
+	}
+
+	pool->buffers = NULL;
+	pool->numbuffers = 0;
+	pool->maxbuffers = 0;
+
+	return pool;
+}
+
+/*******************************************************************************
+* Function to free a buffer pool and all databuffers held by it                *
+*                                                                              *
+* pool is the buffer pool to free                                              *
+*                                                                              *
+* Modifies pool                                                                *
+*******************************************************************************/
+void bufferpool_free( struct bufferpool *pool )
+{
+	int i;
+
+	for( i=0; i<pool->numbuffers; i++ )
+		databuffer_free( pool->buffers[i] );
+
+	free( pool->buffers );
+	free( pool );
+}
+
+/*******************************************************************************
+* Function to take an empty databuffer from a buffer pool                      *
+* The smallest unused databuffer that fits size is taken, if there is none the *
+* largest one is grown. A new databuffer is only created if the pool is empty. *
+*                                                                              *
+* pool is the buffer pool to take from, or NULL to always create a databuffer  *
+* size is the number of bytes the databuffer should have room for              *
+*                                                                              *
+* Modifies pool                                                                *
+*                                                                              *
+* Returns an empty databuffer or NULL on failure                               *
+*******************************************************************************/
+struct databuffer *bufferpool_get( struct bufferpool *pool, unsigned int size )
+{
+	struct databuffer *buffer;
+	int i, best;
+
+	if( ( pool == NULL ) || ( pool->numbuffers == 0 ) )
+		return databuffer_create( size );
+
+	best = 0;
+	for( i=1; i<pool->numbuffers; i++ )
+	{
+		if( pool->buffers[ best ]->datasize > size )
+		{
+			if( ( pool->buffers[i]->datasize > size ) && ( pool->buffers[i]->datasize < pool->buffers[ best ]->datasize ) )
+				best = i;
+		}
+		else if( pool->buffers[i]->datasize > pool->buffers[ best ]->datasize )
+		{
+			best = i;
+		}
+	}
+
+	buffer = pool->buffers[ best ];
+	pool->buffers[ best ] = pool->buffers[ --pool->numbuffers ];
+
+	if( ! databuffer_reset( buffer, size ) )
+	{
+		databuffer_free( buffer );
+		return NULL;
+	}
+
+	return buffer;
+}
+
+/*******************************************************************************
+* Function to give a databuffer back to a buffer pool                          *
+*                                                                              *
+* pool is the buffer pool to give the databuffer to, or NULL to free it        *
+* buffer is the databuffer that is no longer used                              *
+*                                                                              *
+* Modifies pool and buffer                                                     *
+*******************************************************************************/
+void bufferpool_put( struct bufferpool *pool, struct databuffer *buffer )
+{
+	struct databuffer **buffers;
+
+	if( pool == NULL )
+	{
+		databuffer_free( buffer );
+		return;
+	}
+
+	if( pool->numbuffers >= pool->maxbuffers )
+	{
+		buffers = realloc( pool->buffers, sizeof( *buffers ) * ( pool->maxbuffers * 2 + 8 ) );
+		if( buffers == NULL )		// The pool stays usable, the buffer is just not kept
+		{
+			perror( "bufferpool_put: realloc" );
+			databuffer_free( buffer );
+			return;
+		}
+
+		pool->buffers = buffers;
+		pool->maxbuffers = pool->maxbuffers * 2 + 8;
+	}
+
+	pool->buffers[ pool->numbuffers++ ] = buffer;
+}
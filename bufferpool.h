@@ -0,0 +1,48 @@
+/*
+*    QTC: bufferpool.h (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+/*******************************************************************************
+* Structure to hold all the data associated with a buffer pool                 *
+*                                                                              *
+* A buffer pool keeps databuffers that are no longer needed so the next frame  *
+* can reuse them instead of allocating new ones. Buffers keep the size they    *
+* grew to, so after a few frames no buffer has to grow anymore.                *
+*                                                                              *
+* buffers are the databuffers that are currently unused                        *
+* numbuffers is the number of unused databuffers                               *
+* maxbuffers is the number of databuffers buffers has room for                 *
+*                                                                              *
+* A buffer pool is not thread safe.                                            *
+*******************************************************************************/
+struct bufferpool
+{
+	struct databuffer **buffers;
+	int numbuffers, maxbuffers;
+};
+
+extern struct bufferpool *bufferpool_create( void );
+extern void bufferpool_free( struct bufferpool *pool );
+extern struct databuffer *bufferpool_get( struct bufferpool *pool, unsigned int size );
+extern void bufferpool_put( struct bufferpool *pool, struct databuffer *buffer );
+
+#endif
@@ -0,0 +1,185 @@
+/*
+*    QTC: colormap.c (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "colormap.h"
+
+#define COLORMAP_HASH( color ) ( ( ( color ) * 2654435761u ) >> 22 )
+
+/*******************************************************************************
+* Function to create a new, empty color map                                    *
+*                                                                              *
+* Returns a new color map or NULL on failure                                   *
+*******************************************************************************/
+struct colormap *colormap_create( void )
+{
+	struct colormap *colormap;
+
+	colormap = malloc( sizeof( *colormap ) );
+	if( colormap == NULL )
+	{
+		perror( "colormap_create: malloc" );
+		return NULL;
+	}
+
+	colormap_clear( colormap );
+
+	return colormap;
+}
+
+/*******************************************************************************
+* Function to free a color map                                                 *
+*                                                                              *
+* colormap is the color map to free                                            *
+*                                                                              *
+* Modifies colormap                                                            *
+*******************************************************************************/
+void colormap_free( struct colormap *colormap )
+{
+	free( colormap );
+}
+
+/*******************************************************************************
+* Function to remove all colors from a color map                               *
+*                                                                              *
+* colormap is the color map to clear                                           *
+*                                                                              *
+* Modifies colormap                                                            *
+*******************************************************************************/
+void colormap_clear( struct colormap *colormap )
+{
+	colormap->numcolors = 0;
+	memset( colormap->used, 0, sizeof( colormap->used ) );
+}
+
+/*******************************************************************************
+* Function to add a color to a color map if it is not in there yet             *
+*                                                                              *
+* colormap is the color map to add to                                          *
+* color is the color to add, without alpha channel                             *
+*                                                                              *
+* Modifies colormap                                                            *
+*                                                                              *
+* Returns 0 if the color map is full, 1 on success                             *
+*******************************************************************************/
+static inline int colormap_add( struct colormap *colormap, unsigned int color )
+{
+	unsigned int slot;
+
+	slot = COLORMAP_HASH( color );
+
+	while( colormap->used[ slot ] )
+	{
+		if( colormap->keys[ slot ] == color )
+			return 1;
+
+		slot = ( slot + 1 ) & ( COLORMAP_HASHSIZE - 1 );
+	}
+
+	if( colormap->numcolors >= COLORMAP_MAXCOLORS )
+		return 0;
+
+	colormap->used[ slot ] = 1;
+	colormap->keys[ slot ] = color;
+	colormap->indices[ slot ] = colormap->numcolors;
+	colormap->colors[ colormap->numcolors++ ] = color;
+
+	return 1;
+}
+
+/*******************************************************************************
+* Function to add all colors of an image to a color map                        *
+*                                                                              *
+* colormap is the color map to update                                          *
+* pixels is the image data                                                     *
+* count is the number of pixels of the image                                   *
+* reset forces the map to start over, for key frames                           *
+*                                                                              *
+* If the colors do not fit into the existing map, the map starts over with     *
+* the colors of the image alone. If they do not fit either the map is cleared. *
+*                                                                              *
+* Modifies colormap                                                            *
+*                                                                              *
+* Returns the index of the first color added by the image, -1 if the image     *
+* has too many colors                                                          *
+*******************************************************************************/
+int colormap_update( struct colormap *colormap, unsigned int *pixels, int count, int reset )
+{
+	unsigned int color, last;
+	int first, i;
+
+	if( reset )
+		colormap_clear( colormap );
+
+	while( 1 )
+	{
+		first = colormap->numcolors;
+		i = 0;
+
+		if( ( count > 0 ) && ( colormap_add( colormap, pixels[0] & COLORMAP_MASK ) ) )
+		{
+			last = pixels[0] & COLORMAP_MASK;
+
+			for( i=1; i<count; i++ )
+			{
+				color = pixels[i] & COLORMAP_MASK;
+
+				if( color == last )
+					continue;
+
+				if( ! colormap_add( colormap, color ) )
+					break;
+
+				last = color;
+			}
+		}
+
+		if( i == count )
+			return first;
+
+		colormap_clear( colormap );
+
+		if( first == 0 )
+			return -1;
+	}
+}
+
+/*******************************************************************************
+* Function to look up the index of a color in a color map                      *
+*                                                                              *
+* colormap is the color map to search                                          *
+* color is the color to look up, it has to be in the map                       *
+*                                                                              *
+* Returns the index of the color                                               *
+*******************************************************************************/
+int colormap_index( struct colormap *colormap, unsigned int color )
+{
+	unsigned int slot;
+
+	color &= COLORMAP_MASK;
+	slot = COLORMAP_HASH( color );
+
+	while( colormap->keys[ slot ] != color )
+		slot = ( slot + 1 ) & ( COLORMAP_HASHSIZE - 1 );
+
+	return colormap->indices[ slot ];
+}
@@ -0,0 +1,56 @@
+/*
+*    QTC: colormap.h (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COLORMAP_H
+#define COLORMAP_H
+
+#define COLORMAP_MAXCOLORS 256
+#define COLORMAP_HASHSIZE 1024
+#define COLORMAP_MASK 0x00FFFFFF
+
+/*******************************************************************************
+* Structure to hold all the data associated with a color map                   *
+*                                                                              *
+* A color map collects the colors of low color images so pixels can be stored  *
+* as one byte index instead of their channels. The map is kept across the      *
+* frames of a video and only grows, so frames only have to add new colors.     *
+*                                                                              *
+* colors are the colors of the map in the order they were added, the alpha     *
+* channel is masked out                                                        *
+* numcolors is the number of colors in the map                                 *
+* keys and indices form a hash table from colors to their index                *
+* used marks the occupied slots of the hash table                              *
+*******************************************************************************/
+struct colormap
+{
+	unsigned int colors[ COLORMAP_MAXCOLORS ];
+	int numcolors;
+
+	unsigned int keys[ COLORMAP_HASHSIZE ];
+	unsigned char indices[ COLORMAP_HASHSIZE ];
+	unsigned char used[ COLORMAP_HASHSIZE ];
+};
+
+extern struct colormap *colormap_create( void );
+extern void colormap_free( struct colormap *colormap );
+extern void colormap_clear( struct colormap *colormap );
+extern int colormap_update( struct colormap *colormap, unsigned int *pixels, int count, int reset );
+extern int colormap_index( struct colormap *colormap, unsigned int color );
+
+#endif
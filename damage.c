@@ -0,0 +1,268 @@
+/*
+*    QTC: damage.c (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "damage.h"
+
+/*******************************************************************************
+* Function to create a new damage map, initially everything is damaged         *
+*                                                                              *
+* width and height are the dimension of the images to be mapped                *
+* tilesize is the width/height of a single tile in pixels                      *
+*                                                                              *
+* Returns a new damage map or NULL on failure                                  *
+*******************************************************************************/
+struct damage *damage_create( int width, int height, int tilesize )
+{
+	struct damage *damage;
+
+	if( tilesize < 1 )
+	{
+		fputs( "damage_create: Invalid tile size\n", stderr );
+		return NULL;
+	}
+
+	damage = malloc( sizeof( *damage ) );
+	if( damage == NULL )
+	{
+		perror( "damage_create: malloc" );
+		return NULL;
+	}
+
+	damage->width = width;
+	damage->height = height;
+	damage->tilesize = tilesize;
+	damage->tilesx = ( width + tilesize - 1 ) / tilesize;
+	damage->tilesy = ( height + tilesize - 1 ) / tilesize;
+
+	damage->tiles = malloc( damage->tilesx * damage->tilesy + 1 );
+	if( damage->tiles == NULL )
+	{
+		perror( "damage_create: malloc" );
+		free( damage );
+		return NULL;
+	}
+
+	damage_add_all( damage );
+
+	return damage;
+}
+
+/*******************************************************************************
+* Function to free a damage map                                                *
+*                                                                              *
+* damage is the damage map to free                                             *
+*                                                                              *
+* Modifies damage                                                              *
+*******************************************************************************/
+void damage_free( struct damage *damage )
+{
+	free( damage->tiles );
+	free( damage );
+}
+
+/*******************************************************************************
+* Functions to mark no tile or every tile of a damage map as damaged           *
+*                                                                              *
+* damage is the damage map to modify                                           *
+*                                                                              *
+* Modifies damage                                                              *
+*******************************************************************************/
+void damage_clear( struct damage *damage )
+{
+	memset( damage->tiles, 0, damage->tilesx * damage->tilesy );
+	damage->count = 0;
+}
+
+/*******************************************************************************
+* Function to mark the whole damage map as damaged                             *
+*                                                                              *
+* damage is the damage map to modify                                           *
+*                                                                              *
+* Modifies damage                                                              *
+*******************************************************************************/
+void damage_add_all( struct damage *damage )
+{
+	memset( damage->tiles, 1, damage->tilesx * damage->tilesy );
+	damage->count = damage->tilesx * damage->tilesy;
+}
+
+/*******************************************************************************
+* Function to mark a single tile as damaged                                    *
+*                                                                              *
+* damage is the damage map to modify                                           *
+* tx and ty are the tile coordinates                                           *
+*                                                                              *
+* Modifies damage                                                              *
+*******************************************************************************/
+void damage_add_tile( struct damage *damage, int tx, int ty )
+{
+	unsigned char *tile;
+
+	tile = &damage->tiles[ tx + ty*damage->tilesx ];
+
+	if( ! *tile )
+	{
+		*tile = 1;
+		damage->count++;
+	}
+}
+
+/*******************************************************************************
+* Function to mark a rectangle as damaged, it is clipped to the image          *
+*                                                                              *
+* damage is the damage map to modify                                           *
+* x and y are the upper left corner of the rectangle                           *
+* width and height are the size of the rectangle                               *
+*                                                                              *
+* Modifies damage                                                              *
+*******************************************************************************/
+void damage_add_rect( struct damage *damage, int x, int y, int width, int height )
+{
+	int tx, ty, tx1, ty1, tx2, ty2;
+
+	if( x < 0 )
+	{
+		width += x;
+		x = 0;
+	}
+
+	if( y < 0 )
+	{
+		height += y;
+		y = 0;
+	}
+
+	if( x+width > damage->width )
+		width = damage->width-x;
+
+	if( y+height > damage->height )
+		height = damage->height-y;
+
+	if( ( width <= 0 ) || ( height <= 0 ) )
+		return;
+
+	tx1 = x / damage->tilesize;
+	ty1 = y / damage->tilesize;
+	tx2 = ( x + width - 1 ) / damage->tilesize;
+	ty2 = ( y + height - 1 ) / damage->tilesize;
+
+	for( ty=ty1; ty<=ty2; ty++ )
+	{
+		for( tx=tx1; tx<=tx2; tx++ )
+			damage_add_tile( damage, tx, ty );
+	}
+}
+
+/*******************************************************************************
+* Function to add all damaged tiles of one damage map to another               *
+* Both maps need to have the same dimensions and tile size                     *
+*                                                                              *
+* damage is the damage map to modify                                           *
+* other is the damage map to add                                               *
+*                                                                              *
+* Modifies damage                                                              *
+*******************************************************************************/
+void damage_merge( struct damage *damage, struct damage *other )
+{
+	int i;
+
+	if( other->count == 0 )
+		return;
+
+	for( i=0; i<damage->tilesx*damage->tilesy; i++ )
+	{
+		if( other->tiles[i] && ! damage->tiles[i] )
+		{
+			damage->tiles[i] = 1;
+			damage->count++;
+		}
+	}
+}
+
+/*******************************************************************************
+* Function to grow the damaged area by one tile to the right and bottom        *
+* Image transforms predict pixels from their left and upper neighbours, so a   *
+* change also affects the pixels right and below of it                         *
+*                                                                              *
+* damage is the damage map to modify                                           *
+*                                                                              *
+* Modifies damage                                                              *
+*******************************************************************************/
+void damage_expand( struct damage *damage )
+{
+	int tx, ty, i;
+	unsigned char *tiles;
+
+	tiles = damage->tiles;
+
+	for( ty=damage->tilesy-1; ty>=0; ty-- )
+	{
+		for( tx=damage->tilesx-1; tx>=0; tx-- )
+		{
+			i = tx + ty*damage->tilesx;
+
+			if( tiles[i] == 1 )
+			{
+				if( tx+1 < damage->tilesx )
+					damage_add_tile( damage, tx+1, ty );
+
+				if( ty+1 < damage->tilesy )
+				{
+					damage_add_tile( damage, tx, ty+1 );
+
+					if( tx+1 < damage->tilesx )
+						damage_add_tile( damage, tx+1, ty+1 );
+				}
+			}
+		}
+	}
+}
+
+/*******************************************************************************
+* Function to check wether a block touches a damaged tile                      *
+*                                                                              *
+* damage is the damage map to query                                            *
+* x1, y1, x2, y2 describe the block                                            *
+*                                                                              *
+* Returns 1 if the block may have changed, 0 if it is known to be unchanged    *
+*******************************************************************************/
+int damage_test( struct damage *damage, int x1, int y1, int x2, int y2 )
+{
+	int ty, tx1, ty1, tx2, ty2;
+
+	if( damage->count == 0 )
+		return 0;
+
+	tx1 = x1 / damage->tilesize;
+	ty1 = y1 / damage->tilesize;
+	tx2 = ( x2 - 1 ) / damage->tilesize;
+	ty2 = ( y2 - 1 ) / damage->tilesize;
+
+	for( ty=ty1; ty<=ty2; ty++ )
+	{
+		if( memchr( &damage->tiles[ tx1 + ty*damage->tilesx ], 1, tx2-tx1+1 ) != NULL )
+			return 1;
+	}
+
+	return 0;
+}
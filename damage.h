@@ -0,0 +1,59 @@
+/*
+*    QTC: damage.h (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMAGE_H
+#define DAMAGE_H
+
+/*******************************************************************************
+* Structure to hold all the data associated with a damage map                  *
+*                                                                              *
+* A damage map tells the quad tree compressor which parts of a frame may have  *
+* changed since the reference frame. Blocks that do not touch any damaged tile *
+* are coded as unchanged without looking at their pixels. The map must cover   *
+* every changed pixel, otherwise the output differs from a full compare.       *
+* The quad tree decompressor fills a damage map with the blocks it wrote.      *
+*                                                                              *
+* width and height are the dimension of the mapped image                       *
+* tilesize is the width/height of a single tile in pixels                      *
+* tilesx and tilesy are the number of tiles per row and column                 *
+* count is the number of damaged tiles                                         *
+* tiles holds one byte per tile, non zero if the tile is damaged               *
+*******************************************************************************/
+struct damage
+{
+	int width, height;
+	int tilesize;
+	int tilesx, tilesy;
+
+	int count;
+
+	unsigned char *tiles;
+};
+
+extern struct damage *damage_create( int width, int height, int tilesize );
+extern void damage_free( struct damage *damage );
+extern void damage_clear( struct damage *damage );
+extern void damage_add_all( struct damage *damage );
+extern void damage_add_rect( struct damage *damage, int x, int y, int width, int height );
+extern void damage_add_tile( struct damage *damage, int tx, int ty );
+extern void damage_merge( struct damage *damage, struct damage *other );
+extern void damage_expand( struct damage *damage );
+extern int damage_test( struct damage *damage, int x1, int y1, int x2, int y2 );
+
+#endif
@@ -19,6 +19,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "databuffer.h"
 
@@ -42,7 +43,7 @@ struct databuffer *databuffer_create( unsigned int size )
 	buffer->bits = 0;
 
 	buffer->pos = 0;
-	buffer->bitpos = 8;
+	buffer->bitpos = 0;
 
 	buffer->datasize = size<=0?1:size;
 	buffer->data = malloc( sizeof( unsigned char ) * buffer->datasize );
@@ -60,6 +61,44 @@ struct databuffer *databuffer_create( unsigned int size )
 	return buffer;
 }
 
+/*******************************************************************************
+* Function to empty a databuffer so it can be used again                       *
+*                                                                              *
+* buffer is the databuffer to empty                                            *
+* size is the number of bytes the databuffer should have room for              *
+*                                                                              *
+* Modifies databuffer                                                          *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+int databuffer_reset( struct databuffer *buffer, unsigned int size )
+{
+	buffer->size = 0;
+	buffer->bits = 0;
+	buffer->wbuffer = 0;
+
+	buffer->pos = 0;
+	buffer->bitpos = 0;
+	buffer->rbuffer = 0;
+
+	if( size >= buffer->datasize )
+	{
+		free( buffer->data );		// The old content is not needed, so it is not copied
+
+		buffer->datasize = size+1;
+		buffer->data = malloc( sizeof( unsigned char ) * buffer->datasize );
+		if( buffer->data == NULL )
+		{
+			perror( "databuffer_reset: malloc" );
+			return 0;
+		}
+	}
+
+	buffer->data[ 0 ] = 0;
+
+	return 1;
+}
+
 /*******************************************************************************
 * Function to free the internal structures of a databuffer                     *
 *                                                                              *
@@ -73,12 +112,60 @@ void databuffer_free( struct databuffer *buffer )
 	free( buffer );
 }
 
+/*******************************************************************************
+* Function to make room for a number of bytes in a databuffer                  *
+*                                                                              *
+* buffer is the databuffer to grow                                             *
+* count is the number of bytes that have to fit behind the current data        *
+*                                                                              *
+* Modifies databuffer                                                          *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static inline int databuffer_reserve( struct databuffer *buffer, unsigned int count )
+{
+	if( buffer->size + count >= buffer->datasize )
+	{
+		while( buffer->size + count >= buffer->datasize )
+			buffer->datasize *= 2;
+
+		buffer->data = realloc( buffer->data, buffer->datasize );
+		if( buffer->data == NULL )
+		{
+			perror( "databuffer_reserve: realloc" );
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*******************************************************************************
+* Function to move all complete bytes of the wbuffer to the data               *
+* There has to be room for 8 more bytes in the data                            *
+*                                                                              *
+* buffer is the databuffer to flush                                            *
+*                                                                              *
+* Modifies databuffer                                                          *
+*******************************************************************************/
+static inline void databuffer_flush( struct databuffer *buffer )
+{
+	while( buffer->bits >= 8 )
+	{
+		buffer->data[ buffer->size++ ] = buffer->wbuffer;
+		buffer->wbuffer >>= 8;
+		buffer->bits -= 8;
+	}
+}
+
 /*******************************************************************************
 * Function to add a number of bits to a databuffer                             *
 *                                                                              *
 * data is the data to be added                                                 *
 * buffer is the databuffer to add to                                           *
-* bits is the number of bits to take from data and add                         *
+* bits is the number of bits to take from data and add, up to 32               *
+*                                                                              *
+* The bits are collected in the wbuffer and written out 32 at a time.          *
 *                                                                              *
 * Modifies databuffer                                                          *
 *                                                                              *
@@ -86,29 +173,28 @@ void databuffer_free( struct databuffer *buffer )
 *******************************************************************************/
 int databuffer_add_bits( unsigned int data, struct databuffer *buffer, int bits )
 {
-	int i;
+	unsigned char *out;
+
+	if( bits <= 0 )
+		return 1;
 
-	for( i=0; i<bits; i++ )
+	buffer->wbuffer |= ( data & ( 0xFFFFFFFFull >> ( 32 - bits ) ) ) << buffer->bits;
+	buffer->bits += bits;
+
+	if( buffer->bits >= 32 )
 	{
-		buffer->wbuffer |= (data&0x01)<<buffer->bits++;
-		data >>= 1;
+		if( ! databuffer_reserve( buffer, 4 ) )
+			return 0;
 
-		if( buffer->bits >= 8 )
-		{
-			buffer->data[ buffer->size++ ] = buffer->wbuffer;
-			if( buffer->size >= buffer->datasize )
-			{
-				buffer->datasize *= 2;
-				buffer->data = realloc( buffer->data, buffer->datasize );
-				if( buffer->data == NULL )
-				{
-					perror( "databuffer_add_bits: realloc" );
-					return 0;
-				}
-			}
-			buffer->wbuffer = 0;
-			buffer->bits = 0;
-		}
+		out = buffer->data + buffer->size;
+		out[0] = buffer->wbuffer;
+		out[1] = buffer->wbuffer >> 8;
+		out[2] = buffer->wbuffer >> 16;
+		out[3] = buffer->wbuffer >> 24;
+
+		buffer->size += 4;
+		buffer->wbuffer >>= 32;
+		buffer->bits -= 32;
 	}
 	
 	return 1;
@@ -129,22 +215,10 @@ int databuffer_add_byte( unsigned char data, struct databuffer *buffer )
 {
 	if( buffer->bits != 0 )
 	{
-		buffer->data[ buffer->size++ ] = buffer->wbuffer;
-		if( buffer->size >= buffer->datasize )
-		{
-			buffer->datasize *= 2;
-			buffer->data = realloc( buffer->data, buffer->datasize );
-			if( buffer->data == NULL )
-			{
-				perror( "databuffer_add_byte: realloc" );
-				return 0;
-			}
-		}
-		buffer->wbuffer = 0;
-		buffer->bits = 0;
+		if( ! databuffer_pad( buffer ) )
+			return 0;
 	}
 
-
 	buffer->data[ buffer->size++ ] = data;
 	if( buffer->size >= buffer->datasize )
 	{
@@ -174,17 +248,14 @@ int databuffer_pad( struct databuffer *buffer )
 {
 	if( buffer->bits != 0 )
 	{
-		buffer->data[ buffer->size++ ] = buffer->wbuffer;
-		if( buffer->size >= buffer->datasize )
-		{
-			buffer->datasize *= 2;
-			buffer->data = realloc( buffer->data, buffer->datasize );
-			if( buffer->data == NULL )
-			{
-				perror( "databuffer_pad: realloc" );
-				return 0;
-			}
-		}
+		if( ! databuffer_reserve( buffer, 8 ) )
+			return 0;
+
+		databuffer_flush( buffer );
+
+		if( buffer->bits != 0 )
+			buffer->data[ buffer->size++ ] = buffer->wbuffer;
+
 		buffer->wbuffer = 0;
 		buffer->bits = 0;
 	}
@@ -192,10 +263,51 @@ int databuffer_pad( struct databuffer *buffer )
 	return 1;
 }
 
+/*******************************************************************************
+* Function to load as many whole bytes into the rbuffer as fit                 *
+*                                                                              *
+* buffer is the databuffer to read from                                        *
+*                                                                              *
+* Modifies databuffer                                                          *
+*******************************************************************************/
+static inline void databuffer_refill( struct databuffer *buffer )
+{
+	unsigned char *in;
+	unsigned long long word;
+	unsigned int count;
+
+	if( buffer->pos + 8 <= buffer->size )		// Load a whole word and keep the bytes that fit
+	{
+		in = buffer->data + buffer->pos;
+		word = (unsigned long long)in[0] | (unsigned long long)in[1]<<8 |
+		       (unsigned long long)in[2]<<16 | (unsigned long long)in[3]<<24 |
+		       (unsigned long long)in[4]<<32 | (unsigned long long)in[5]<<40 |
+		       (unsigned long long)in[6]<<48 | (unsigned long long)in[7]<<56;
+
+		count = ( 63 - buffer->bitpos ) >> 3;
+
+		buffer->rbuffer |= word << buffer->bitpos;
+		buffer->pos += count;
+		buffer->bitpos += count*8;
+		buffer->rbuffer &= 0xFFFFFFFFFFFFFFFFull >> ( 64 - buffer->bitpos );
+	}
+	else
+	{
+		while( ( buffer->bitpos <= 56 ) && ( buffer->pos < buffer->size ) )
+		{
+			buffer->rbuffer |= (unsigned long long)buffer->data[ buffer->pos++ ] << buffer->bitpos;
+			buffer->bitpos += 8;
+		}
+	}
+}
+
 /*******************************************************************************
 * Function to get a number of bits from a databuffer                           *
 *                                                                              *
 * buffer is the databuffer to add to                                           *
+* bits is the number of bits to get, up to 32                                  *
+*                                                                              *
+* Bits past the end of the data read as 0.                                     *
 *                                                                              *
 * Modifies databuffer                                                          *
 *                                                                              *
@@ -203,20 +315,23 @@ int databuffer_pad( struct databuffer *buffer )
 *******************************************************************************/
 unsigned int databuffer_get_bits( struct databuffer *buffer, int bits )
 {
-	unsigned int data = 0;
-	int i;
-	
-	for( i=0; i<bits; i++ )
+	unsigned int data;
+
+	if( bits <= 0 )
+		return 0;
+
+	if( buffer->bitpos < (unsigned int)bits )
 	{
-		if( buffer->bitpos >= 8 )
-		{
-			buffer->rbuffer = buffer->data[ buffer->pos++ ];
-			buffer->bitpos = 0;
-		}
+		databuffer_refill( buffer );
 
-		data |= ((buffer->rbuffer>>buffer->bitpos++)&0x01)<<i;
+		if( buffer->bitpos < (unsigned int)bits )
+			buffer->bitpos = bits;
 	}
 
+	data = buffer->rbuffer & ( 0xFFFFFFFFull >> ( 32 - bits ) );
+	buffer->rbuffer >>= bits;
+	buffer->bitpos -= bits;
+
 	return data;
 }
 
@@ -234,14 +349,187 @@ unsigned char databuffer_get_byte( struct databuffer *buffer )
 {
 	unsigned char data;
 
-	if( buffer->bitpos != 0 )
-	{
-		buffer->rbuffer = buffer->data[ buffer->pos++ ];
-	}
+	if( buffer->bitpos == 0 )
+		return buffer->data[ buffer->pos++ ];
+
+	buffer->rbuffer >>= buffer->bitpos % 8;
+	buffer->bitpos -= buffer->bitpos % 8;
+
+	if( buffer->bitpos == 0 )
+		return buffer->data[ buffer->pos++ ];
 
 	data = buffer->rbuffer;
-	buffer->bitpos = 8;
+	buffer->rbuffer >>= 8;
+	buffer->bitpos -= 8;
+
+	return data;
+}
+
+/*******************************************************************************
+* Function to add a span of bytes to a databuffer                              *
+* Always skips to the next full byte boundary                                  *
+*                                                                              *
+* buffer is the databuffer to add to                                           *
+* count is the number of bytes to add                                          *
+*                                                                              *
+* The caller fills the returned bytes directly, which saves a call and a size  *
+* check per byte for long runs of literal data.                                *
+*                                                                              *
+* Modifies databuffer                                                          *
+*                                                                              *
+* Returns a pointer to the first byte of the span or NULL on failure           *
+*******************************************************************************/
+unsigned char *databuffer_add_span( struct databuffer *buffer, unsigned int count )
+{
+	unsigned char *data;
+
+	if( ! databuffer_pad( buffer ) )
+		return NULL;
+
+	if( ! databuffer_reserve( buffer, count ) )
+		return NULL;
+
+	data = buffer->data + buffer->size;
+	buffer->size += count;
+
+	return data;
+}
+
+/*******************************************************************************
+* Function to get a span of bytes from a databuffer                            *
+* Always skips to the next full byte, discards previous bits                   *
+*                                                                              *
+* buffer is the databuffer to read from                                        *
+* count is the number of bytes to get                                          *
+*                                                                              *
+* Modifies databuffer                                                          *
+*                                                                              *
+* Returns a pointer to the first byte of the span or NULL if the data ends     *
+* before the span                                                              *
+*******************************************************************************/
+unsigned char *databuffer_get_span( struct databuffer *buffer, unsigned int count )
+{
+	unsigned char *data;
+
+	buffer->pos -= buffer->bitpos / 8;		// Give back the whole bytes that were read ahead
+	buffer->bitpos = 0;
+	buffer->rbuffer = 0;
+
+	if( buffer->pos + count > buffer->size )
+		return NULL;
+
+	data = buffer->data + buffer->pos;
+	buffer->pos += count;
 
 	return data;
 }
 
+/*******************************************************************************
+* Function to restart reading a databuffer from the beginning                  *
+*                                                                              *
+* buffer is the databuffer to rewind                                           *
+*                                                                              *
+* Modifies databuffer                                                          *
+*******************************************************************************/
+void databuffer_rewind( struct databuffer *buffer )
+{
+	buffer->pos = 0;
+	buffer->bitpos = 0;
+	buffer->rbuffer = 0;
+}
+
+/*******************************************************************************
+* Function to append the contents of one databuffer to another                 *
+* The data is appended at bit granularity, the destination does not need to    *
+* end on a full byte                                                           *
+*                                                                              *
+* buffer is the databuffer to add to                                           *
+* source is the databuffer to take the data from                               *
+*                                                                              *
+* Modifies databuffer                                                          *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+int databuffer_add_buffer( struct databuffer *buffer, struct databuffer *source )
+{
+	unsigned int i, shift;
+	unsigned char *data;
+
+	if( ! databuffer_reserve( buffer, source->size + 8 ) )
+		return 0;
+
+	databuffer_flush( buffer );
+
+	data = buffer->data + buffer->size;
+	shift = buffer->bits;
+
+	if( shift == 0 )
+	{
+		memcpy( data, source->data, source->size );
+	}
+	else
+	{
+		for( i=0; i<source->size; i++ )
+		{
+			data[i] = buffer->wbuffer | ( source->data[i] << shift );
+			buffer->wbuffer = source->data[i] >> ( 8 - shift );
+		}
+	}
+
+	buffer->size += source->size;
+
+	if( source->bits > 32 )
+	{
+		if( ! databuffer_add_bits( source->wbuffer, buffer, 32 ) )
+			return 0;
+
+		return databuffer_add_bits( source->wbuffer >> 32, buffer, source->bits - 32 );
+	}
+
+	return databuffer_add_bits( source->wbuffer, buffer, source->bits );
+}
+
+/*******************************************************************************
+* Function to overwrite a single bit that has already been added               *
+*                                                                              *
+* buffer is the databuffer to modify                                           *
+* pos is the position of the bit counted from the start of the buffer          *
+* bit is the new value of the bit                                              *
+*                                                                              *
+* Modifies databuffer                                                          *
+*******************************************************************************/
+void databuffer_set_bit( struct databuffer *buffer, unsigned int pos, int bit )
+{
+	unsigned char *data;
+
+	if( pos/8 < buffer->size )
+	{
+		data = &buffer->data[ pos/8 ];
+
+		if( bit )
+			*data |= 1<<(pos%8);
+		else
+			*data &= ~(1<<(pos%8));
+	}
+	else
+	{
+		pos -= buffer->size*8;
+
+		if( bit )
+			buffer->wbuffer |= 1ull<<pos;
+		else
+			buffer->wbuffer &= ~(1ull<<pos);
+	}
+}
+
+/*******************************************************************************
+* Function to get the number of bits added to a databuffer                     *
+*                                                                              *
+* buffer is the databuffer to query                                            *
+*                                                                              *
+* Returns the number of bits in the buffer                                     *
+*******************************************************************************/
+unsigned int databuffer_get_bitsize( struct databuffer *buffer )
+{
+	return buffer->size*8 + buffer->bits;
+}
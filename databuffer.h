@@ -24,21 +24,23 @@
 * Structure to hold all the data associated with a databuffer                  *
 *                                                                              *
 * data is the data held by the databuffer                                      *
-* wbuffer and rbuffer hold incomplete bytes                                    *
+* wbuffer and rbuffer hold bits that are not yet part of data or not yet read  *
 * datasize is the amount of data allocated for the databuffer                  *
 * size is the current amount of data in the databuffer                         *
 * bits is the current number of bits in wbuffer that have not yet been added   *
 * pos is the current read position of the buffer                               *
-* bitpos is the current number of bits in rbuffer                              *
+* bitpos is the current number of unread bits in rbuffer                       *
 *                                                                              *
-* rbuffer and wbuffer buffer the current incomplete byte. A call to            *
-* databuffer_pad or databuffer_add_byte flushes the wbuffer. A call to         *
-* databuffer_get_byte discards the bits in the rbuffer.                        *
+* wbuffer collects up to 63 bits and is flushed to data 32 bits at a time. A   *
+* call to databuffer_pad or databuffer_add_byte flushes all of wbuffer.        *
+* rbuffer is refilled with whole bytes from data. A call to                    *
+* databuffer_get_byte discards the bits of the current byte in rbuffer.        *
+* Bits are stored least significant bit first within each byte.                *
 *******************************************************************************/
 struct databuffer
 {
 	unsigned char *data;
-	unsigned char wbuffer, rbuffer;
+	unsigned long long wbuffer, rbuffer;
 	unsigned int datasize;
 	unsigned int size, bits;
 	unsigned int pos, bitpos;
@@ -46,11 +48,18 @@ struct databuffer
 
 extern struct databuffer *databuffer_create( unsigned int size );
 extern void databuffer_free( struct databuffer *buffer );
+extern int databuffer_reset( struct databuffer *buffer, unsigned int size );
 extern int databuffer_pad( struct databuffer *buffer );
 extern int databuffer_add_bits( unsigned int data, struct databuffer *buffer, int bits );
 extern int databuffer_add_byte( unsigned char data, struct databuffer *buffer );
 extern unsigned int databuffer_get_bits( struct databuffer *buffer, int bits );
 extern unsigned char databuffer_get_byte( struct databuffer *buffer );
+extern unsigned char *databuffer_add_span( struct databuffer *buffer, unsigned int count );
+extern unsigned char *databuffer_get_span( struct databuffer *buffer, unsigned int count );
+extern void databuffer_rewind( struct databuffer *buffer );
+extern int databuffer_add_buffer( struct databuffer *buffer, struct databuffer *source );
+extern void databuffer_set_bit( struct databuffer *buffer, unsigned int pos, int bit );
+extern unsigned int databuffer_get_bitsize( struct databuffer *buffer );
 
 #endif
 
@@ -58,6 +58,40 @@ int image_create( struct image *image, int width, int height, int bgra )
 	}
 }
 
+/*******************************************************************************
+* Function to give an image new dimensions                                     *
+* The pixel data is only allocated again if the number of pixels changes, so   *
+* images can be reused from frame to frame. The pixel data is not preserved.   *
+*                                                                              *
+* image is an image, its pixels have to be NULL or allocated by image_create   *
+* with is the new width of the image                                           *
+* height is the new height of the image                                        *
+* bgra indicates that the pixel data is in bgra ordering                       *
+*                                                                              *
+* Modifies the image struct                                                    *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+int image_resize( struct image *image, int width, int height, int bgra )
+{
+	if( ( image->pixels != NULL ) && ( image->width * image->height == width * height ) )
+	{
+		image->width = width;
+		image->height = height;
+
+		image->colordiff = 0;
+		image->transform = 0;
+
+		image->bgra = bgra;
+
+		return 1;
+	}
+
+	image_free( image );
+
+	return image_create( image, width, height, bgra );
+}
+
 /*******************************************************************************
 * Function to free the internal structures of an image                         *
 *                                                                              *
@@ -88,6 +122,43 @@ void image_copy( struct image *in, struct image *out )
 	memcpy( out->pixels, in->pixels, in->width*in->height*4 );
 }
 
+/*******************************************************************************
+* Function to copy a rectangle of one image into another                       *
+* Both images need to have the same dimensions                                 *
+*                                                                              *
+* in is the source image                                                       *
+* out is the destinatin image                                                  *
+* x1, y1, x2, y2 describe the rectangle                                        *
+*                                                                              *
+* Modifies out                                                                 *
+*******************************************************************************/
+void image_copy_rect( struct image *in, struct image *out, int x1, int y1, int x2, int y2 )
+{
+	int y;
+
+	for( y=y1; y<y2; y++ )
+		memcpy( &out->pixels[ x1 + y*in->width ], &in->pixels[ x1 + y*in->width ], ( x2 - x1 ) * 4 );
+}
+
+/*******************************************************************************
+* Function to exchange the contents of two images                              *
+* Only the image descriptions are exchanged, the pixel data is not copied.     *
+* This is used to turn the current frame into the reference frame of the next  *
+* one, the two images form a double buffer.                                    *
+*                                                                              *
+* a and b are the images to exchange                                           *
+*                                                                              *
+* Modifies a and b                                                             *
+*******************************************************************************/
+void image_swap( struct image *a, struct image *b )
+{
+	struct image tmp;
+
+	tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
 /*******************************************************************************
 * Function to apply the fakeyuf transform to an image                          *
 *                                                                              *
@@ -134,6 +205,34 @@ void image_color_diff_rev( struct image *image )
 	}
 }
 
+/*******************************************************************************
+* Function to apply the reverse fakeyuf transform to a rectangle of an image   *
+* The colordiff flag of the image is not changed                               *
+*                                                                              *
+* image is the image be processed                                              *
+* x1, y1, x2, y2 describe the rectangle                                        *
+*                                                                              *
+* Modifies image                                                               *
+*******************************************************************************/
+void image_color_diff_rev_rect( struct image *image, int x1, int y1, int x2, int y2 )
+{
+	int x, y, i;
+	struct pixel *pixels;
+
+	pixels = image->pixels;
+
+	for( y=y1; y<y2; y++ )
+	{
+		i = x1 + y*image->width;
+		for( x=x1; x<x2; x++ )
+		{
+			pixels[ i ].x += pixels[ i ].y;
+			pixels[ i ].z += pixels[ i ].y;
+			i++;
+		}
+	}
+}
+
 /*******************************************************************************
 * Function to apply the simplified Paeth transform to an image                 *
 *                                                                              *
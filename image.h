@@ -77,11 +77,15 @@ struct image
 };
 
 extern int image_create( struct image *image, int width, int height, int bgra );
+extern int image_resize( struct image *image, int width, int height, int bgra );
 extern void image_free( struct image *image );
 extern void image_copy( struct image *in, struct image *out );
+extern void image_copy_rect( struct image *in, struct image *out, int x1, int y1, int x2, int y2 );
+extern void image_swap( struct image *a, struct image *b );
 
 extern void image_color_diff( struct image *image );
 extern void image_color_diff_rev( struct image *image );
+extern void image_color_diff_rev_rect( struct image *image, int x1, int y1, int x2, int y2 );
 
 extern void image_transform_fast( struct image *image );
 extern void image_transform_fast_rev( struct image *image );
@@ -0,0 +1,409 @@
+/*
+*    QTC: motion.c (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pixelops.h"
+
+#include "motion.h"
+
+#define MOTION_BANDSIZE 32
+#define MOTION_MINVOTES 4
+#define MOTION_MAXMATCHES 8
+
+#define MOTION_HASH_INIT 2166136261u
+#define MOTION_HASH_PRIME 16777619u
+
+/*******************************************************************************
+* Function to create a new motion search                                       *
+*                                                                              *
+* width and height are the dimension of the images to be searched              *
+*                                                                              *
+* Returns a new motion search or NULL on failure                               *
+*******************************************************************************/
+struct motion *motion_create( int width, int height )
+{
+	struct motion *motion;
+
+	motion = calloc( 1, sizeof( *motion ) );
+	if( motion == NULL )
+	{
+		perror( "motion_create: calloc" );
+		return NULL;
+	}
+
+	motion->width = width;
+	motion->height = height;
+	motion->bandsize = MOTION_BANDSIZE;
+	motion->rowbands = ( width + MOTION_BANDSIZE - 1 ) / MOTION_BANDSIZE;
+	motion->colbands = ( height + MOTION_BANDSIZE - 1 ) / MOTION_BANDSIZE;
+	motion->has_ref = 0;
+	motion->numvectors = 0;
+
+	motion->rowhashes = malloc( sizeof( *motion->rowhashes ) * motion->rowbands * height );
+	motion->refrowhashes = malloc( sizeof( *motion->refrowhashes ) * motion->rowbands * height );
+	motion->colhashes = malloc( sizeof( *motion->colhashes ) * motion->colbands * width );
+	motion->refcolhashes = malloc( sizeof( *motion->refcolhashes ) * motion->colbands * width );
+	motion->lines = malloc( sizeof( *motion->lines ) * ( width > height ? width : height ) );
+
+	if( ( motion->rowhashes == NULL ) || ( motion->refrowhashes == NULL ) ||
+	    ( motion->colhashes == NULL ) || ( motion->refcolhashes == NULL ) ||
+	    ( motion->lines == NULL ) )
+	{
+		perror( "motion_create: malloc" );
+		motion_free( motion );
+		return NULL;
+	}
+
+	return motion;
+}
+
+/*******************************************************************************
+* Function to free a motion search                                             *
+*                                                                              *
+* motion is the motion search to free                                          *
+*                                                                              *
+* Modifies motion                                                              *
+*******************************************************************************/
+void motion_free( struct motion *motion )
+{
+	free( motion->rowhashes );
+	free( motion->refrowhashes );
+	free( motion->colhashes );
+	free( motion->refcolhashes );
+	free( motion->lines );
+	free( motion );
+}
+
+/*******************************************************************************
+* Function to hash the lines of all bands of an image                          *
+* Lines of a single color match any other line of that color, so they get the  *
+* hash 0 and are ignored by the search                                         *
+*                                                                              *
+* motion is the motion search                                                  *
+* pixels is the image data                                                     *
+*                                                                              *
+* Modifies motion                                                              *
+*******************************************************************************/
+static void motion_hash( struct motion *motion, unsigned int *pixels )
+{
+	int x, y, b, x1, x2, y1, y2, width, height;
+	unsigned int h, p, first;
+	unsigned int *hashes;
+
+	width = motion->width;
+	height = motion->height;
+
+	for( b=0; b<motion->rowbands; b++ )		// Rows of column bands
+	{
+		x1 = b*motion->bandsize;
+		x2 = x1+motion->bandsize < width ? x1+motion->bandsize : width;
+
+		hashes = &motion->rowhashes[ b*height ];
+
+		for( y=0; y<height; y++ )
+		{
+			if( pixelops_uniform( &pixels[ x1 + y*width ], x2-x1, pixels[ x1 + y*width ], 0x00FFFFFF ) )
+			{
+				hashes[y] = 0;
+				continue;
+			}
+
+			h = MOTION_HASH_INIT;
+			for( x=x1; x<x2; x++ )
+				h = ( h ^ ( pixels[ x + y*width ] & 0x00FFFFFF ) ) * MOTION_HASH_PRIME;
+
+			hashes[y] = h ? h : 1;
+		}
+	}
+
+	for( b=0; b<motion->colbands; b++ )		// Columns of row bands
+	{
+		y1 = b*motion->bandsize;
+		y2 = y1+motion->bandsize < height ? y1+motion->bandsize : height;
+
+		hashes = &motion->colhashes[ b*width ];
+
+		for( x=0; x<width; x++ )
+			hashes[x] = MOTION_HASH_INIT;
+
+		for( y=y1; y<y2; y++ )
+		{
+			for( x=0; x<width; x++ )
+				hashes[x] = ( hashes[x] ^ ( pixels[ x + y*width ] & 0x00FFFFFF ) ) * MOTION_HASH_PRIME;
+		}
+
+		for( x=0; x<width; x++ )
+		{
+			first = pixels[ x + y1*width ] & 0x00FFFFFF;
+
+			for( y=y1+1; y<y2; y++ )
+			{
+				p = pixels[ x + y*width ] & 0x00FFFFFF;
+				if( p != first )
+					break;
+			}
+
+			if( y == y2 )
+				hashes[x] = 0;
+			else if( hashes[x] == 0 )
+				hashes[x] = 1;
+		}
+	}
+}
+
+/*******************************************************************************
+* Function to compare two lines for sorting, by hash and then position         *
+*******************************************************************************/
+static int motion_compare_lines( const void *a, const void *b )
+{
+	const struct motion_line *la, *lb;
+
+	la = a;
+	lb = b;
+
+	if( la->hash != lb->hash )
+		return la->hash < lb->hash ? -1 : 1;
+
+	return la->pos - lb->pos;
+}
+
+/*******************************************************************************
+* Function to count the offsets between changed lines and matching lines of    *
+* the reference frame for all bands of one direction                           *
+*                                                                              *
+* motion is the motion search                                                  *
+* hashes and refhashes are the line hashes of the direction                    *
+* numbands is the number of bands                                              *
+* length is the number of lines per band                                       *
+*                                                                              *
+* Modifies motion                                                              *
+*******************************************************************************/
+static void motion_vote( struct motion *motion, unsigned int *hashes, unsigned int *refhashes, int numbands, int length )
+{
+	int b, i, j, lo, hi, mid, numlines, matches, offset;
+	unsigned int h;
+	struct motion_line *lines;
+
+	lines = motion->lines;
+
+	memset( motion->votes, 0, sizeof( motion->votes ) );
+
+	for( b=0; b<numbands; b++ )
+	{
+		numlines = 0;
+		for( i=0; i<length; i++ )
+		{
+			if( refhashes[ b*length + i ] != 0 )
+			{
+				lines[numlines].hash = refhashes[ b*length + i ];
+				lines[numlines].pos = i;
+				numlines++;
+			}
+		}
+
+		if( numlines == 0 )
+			continue;
+
+		qsort( lines, numlines, sizeof( *lines ), motion_compare_lines );
+
+		for( i=0; i<length; i++ )
+		{
+			h = hashes[ b*length + i ];
+
+			if( ( h == 0 ) || ( h == refhashes[ b*length + i ] ) )
+				continue;
+
+			lo = 0;
+			hi = numlines;
+			while( lo < hi )
+			{
+				mid = ( lo + hi ) / 2;
+				if( lines[mid].hash < h )
+					lo = mid+1;
+				else
+					hi = mid;
+			}
+
+			matches = 0;
+			for( j=lo; ( j<numlines ) && ( lines[j].hash == h ) && ( matches < MOTION_MAXMATCHES ); j++ )
+			{
+				offset = lines[j].pos - i;
+
+				if( ( offset >= -MOTION_RANGE ) && ( offset <= MOTION_RANGE ) && ( offset != 0 ) )
+				{
+					motion->votes[ offset + MOTION_RANGE ]++;
+					matches++;
+				}
+			}
+		}
+	}
+}
+
+/*******************************************************************************
+* Function to add a candidate vector unless it is already known                *
+*                                                                              *
+* dx, dy and numvectors are the candidate list to add to                       *
+* x and y are the vector to add                                                *
+*******************************************************************************/
+static void motion_add_vector( int *dx, int *dy, int *numvectors, int x, int y )
+{
+	int i;
+
+	if( *numvectors >= MOTION_VECTORS )
+		return;
+
+	for( i=0; i<*numvectors; i++ )
+	{
+		if( ( dx[i] == x ) && ( dy[i] == y ) )
+			return;
+	}
+
+	dx[ *numvectors ] = x;
+	dy[ *numvectors ] = y;
+	(*numvectors)++;
+}
+
+/*******************************************************************************
+* Function to add the offsets with the most votes as candidate vectors         *
+*                                                                              *
+* motion is the motion search                                                  *
+* dx, dy and numvectors are the candidate list to add to                       *
+* vertical selects wether the votes are vertical or horizontal offsets         *
+*                                                                              *
+* Modifies motion                                                              *
+*******************************************************************************/
+static void motion_pick( struct motion *motion, int *dx, int *dy, int *numvectors, int vertical )
+{
+	int i, c, best;
+
+	for( c=0; c<MOTION_CANDIDATES; c++ )
+	{
+		best = -1;
+		for( i=0; i<2*MOTION_RANGE+1; i++ )
+		{
+			if( ( motion->votes[i] >= MOTION_MINVOTES ) && ( ( best < 0 ) || ( motion->votes[i] > motion->votes[best] ) ) )
+				best = i;
+		}
+
+		if( best < 0 )
+			break;
+
+		motion->votes[best] = 0;
+
+		if( vertical )
+			motion_add_vector( dx, dy, numvectors, 0, best - MOTION_RANGE );
+		else
+			motion_add_vector( dx, dy, numvectors, best - MOTION_RANGE, 0 );
+	}
+}
+
+/*******************************************************************************
+* Function to find the candidate vectors of a new frame                        *
+* Has to be called for every frame, the line hashes of the frame are kept as   *
+* reference for the next one                                                   *
+*                                                                              *
+* motion is the motion search                                                  *
+* pixels is the image data of the new frame                                    *
+* has_ref indicates that the previous frame is the reference of this one       *
+*                                                                              *
+* Modifies motion                                                              *
+*******************************************************************************/
+void motion_search( struct motion *motion, unsigned int *pixels, int has_ref )
+{
+	int dx[ MOTION_VECTORS ], dy[ MOTION_VECTORS ];
+	int i, numvectors;
+	unsigned int *tmp;
+
+	motion_hash( motion, pixels );
+
+	if( has_ref && motion->has_ref )
+	{
+		numvectors = 0;
+
+		motion_vote( motion, motion->rowhashes, motion->refrowhashes, motion->rowbands, motion->height );
+		motion_pick( motion, dx, dy, &numvectors, 1 );
+
+		motion_vote( motion, motion->colhashes, motion->refcolhashes, motion->colbands, motion->width );
+		motion_pick( motion, dx, dy, &numvectors, 0 );
+
+		for( i=0; i<motion->numvectors; i++ )		// Keep the candidates of the previous frame
+			motion_add_vector( dx, dy, &numvectors, motion->dx[i], motion->dy[i] );
+
+		memcpy( motion->dx, dx, sizeof( dx ) );
+		memcpy( motion->dy, dy, sizeof( dy ) );
+		motion->numvectors = numvectors;
+	}
+
+	tmp = motion->refrowhashes;
+	motion->refrowhashes = motion->rowhashes;
+	motion->rowhashes = tmp;
+
+	tmp = motion->refcolhashes;
+	motion->refcolhashes = motion->colhashes;
+	motion->colhashes = tmp;
+
+	motion->has_ref = 1;
+}
+
+/*******************************************************************************
+* Function to find a candidate vector that moves a reference block onto a      *
+* block of the current frame                                                   *
+*                                                                              *
+* motion is the motion search                                                  *
+* pixels and refpixels are the current and reference image data                *
+* x1, y1, x2, y2 describe the block                                            *
+* mask is the channel mask to apply before comparing                           *
+* dx and dy receive the vector                                                 *
+*                                                                              *
+* Returns 1 if a vector was found, 0 otherwise                                 *
+*******************************************************************************/
+int motion_find( struct motion *motion, unsigned int *pixels, unsigned int *refpixels, int x1, int y1, int x2, int y2, unsigned int mask, int *dx, int *dy )
+{
+	int v, y, i, offset, width;
+
+	width = motion->width;
+
+	for( v=0; v<motion->numvectors; v++ )
+	{
+		if( ( x1+motion->dx[v] < 0 ) || ( x2+motion->dx[v] > width ) ||
+		    ( y1+motion->dy[v] < 0 ) || ( y2+motion->dy[v] > motion->height ) )
+			continue;
+
+		offset = motion->dx[v] + motion->dy[v]*width;
+
+		for( y=y1; y<y2; y++ )
+		{
+			i = x1 + y*width;
+			if( pixelops_differ( pixels+i, refpixels+i+offset, x2-x1, mask ) )
+				break;
+		}
+
+		if( y == y2 )
+		{
+			*dx = motion->dx[v];
+			*dy = motion->dy[v];
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,78 @@
+/*
+*    QTC: motion.h (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MOTION_H
+#define MOTION_H
+
+#define MOTION_RANGE 256
+#define MOTION_CANDIDATES 4
+#define MOTION_VECTORS ( MOTION_CANDIDATES*3 )
+
+/*******************************************************************************
+* Structure to hold a line hash and its position, used for sorting             *
+*******************************************************************************/
+struct motion_line
+{
+	unsigned int hash;
+	int pos;
+};
+
+/*******************************************************************************
+* Structure to hold all the data associated with a motion search               *
+*                                                                              *
+* A motion search finds a few candidate vectors per frame that the quad tree   *
+* compressor tries on every changed block. Vertical motion is found by hashing *
+* the rows of narrow column bands, horizontal motion by hashing the columns of *
+* short row bands, and matching the hashes against those of the reference      *
+* frame. The candidates of the previous frame are tried again.                 *
+*                                                                              *
+* width and height are the dimension of the searched images                    *
+* bandsize is the width of a column band and the height of a row band          *
+* rowbands and colbands are the number of column and row bands                 *
+* rowhashes and colhashes are the line hashes of the current frame             *
+* refrowhashes and refcolhashes are the line hashes of the reference frame     *
+* has_ref indicates wether the reference hashes are valid                      *
+* lines is a scratch buffer to sort the lines of one band                      *
+* votes counts the matched lines per vector component                          *
+* numvectors is the number of candidate vectors                                *
+* dx and dy are the candidate vectors                                          *
+*******************************************************************************/
+struct motion
+{
+	int width, height;
+	int bandsize;
+	int rowbands, colbands;
+
+	unsigned int *rowhashes, *colhashes;
+	unsigned int *refrowhashes, *refcolhashes;
+	int has_ref;
+
+	struct motion_line *lines;
+	int votes[ 2*MOTION_RANGE+1 ];
+
+	int numvectors;
+	int dx[ MOTION_VECTORS ], dy[ MOTION_VECTORS ];
+};
+
+extern struct motion *motion_create( int width, int height );
+extern void motion_free( struct motion *motion );
+extern void motion_search( struct motion *motion, unsigned int *pixels, int has_ref );
+extern int motion_find( struct motion *motion, unsigned int *pixels, unsigned int *refpixels, int x1, int y1, int x2, int y2, unsigned int mask, int *dx, int *dy );
+
+#endif
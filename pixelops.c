@@ -0,0 +1,468 @@
+/*
+*    QTC: pixelops.c (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+#include <immintrin.h>
+#endif
+
+#include "pixelops.h"
+
+/*******************************************************************************
+* Vectorized pixel row kernels used by the quad tree compressor                *
+*                                                                              *
+* The kernels do not exit on the first mismatching pixel. They OR together     *
+* the masked differences of a whole row and test the result once, which is     *
+* faster on the mostly unchanged rows of screen content.                       *
+* AVX2 and SSE2 versions are selected at compile time, the scalar version is   *
+* used for the row tails and on other architectures. All versions produce      *
+* identical results.                                                           *
+*******************************************************************************/
+
+#if defined( __AVX2__ )
+static inline int vector_differ( unsigned int *a, unsigned int *b, int count, unsigned int mask, int *done )
+{
+	__m256i vmask, acc;
+	int i;
+
+	vmask = _mm256_set1_epi32( mask );
+	acc = _mm256_setzero_si256();
+
+	for( i=0; i+8<=count; i+=8 )
+	{
+		acc = _mm256_or_si256( acc, _mm256_xor_si256( _mm256_loadu_si256( (__m256i *)(a+i) ), _mm256_loadu_si256( (__m256i *)(b+i) ) ) );
+	}
+
+	*done = i;
+
+	return ! _mm256_testz_si256( acc, vmask );
+}
+
+static inline int vector_uniform( unsigned int *pixels, int count, unsigned int value, unsigned int mask, int *done )
+{
+	__m256i vmask, vvalue, acc;
+	int i;
+
+	vmask = _mm256_set1_epi32( mask );
+	vvalue = _mm256_set1_epi32( value );
+	acc = _mm256_setzero_si256();
+
+	for( i=0; i+8<=count; i+=8 )
+	{
+		acc = _mm256_or_si256( acc, _mm256_xor_si256( _mm256_loadu_si256( (__m256i *)(pixels+i) ), vvalue ) );
+	}
+
+	*done = i;
+
+	return _mm256_testz_si256( acc, vmask );
+}
+#elif defined( __SSE2__ )
+static inline int vector_test( __m128i acc, __m128i vmask )
+{
+#if defined( __SSE4_1__ )
+	return _mm_testz_si128( acc, vmask );
+#else
+	return _mm_movemask_epi8( _mm_cmpeq_epi32( _mm_and_si128( acc, vmask ), _mm_setzero_si128() ) ) == 0xFFFF;
+#endif
+}
+
+static inline int vector_differ( unsigned int *a, unsigned int *b, int count, unsigned int mask, int *done )
+{
+	__m128i vmask, acc;
+	int i;
+
+	vmask = _mm_set1_epi32( mask );
+	acc = _mm_setzero_si128();
+
+	for( i=0; i+4<=count; i+=4 )
+	{
+		acc = _mm_or_si128( acc, _mm_xor_si128( _mm_loadu_si128( (__m128i *)(a+i) ), _mm_loadu_si128( (__m128i *)(b+i) ) ) );
+	}
+
+	*done = i;
+
+	return ! vector_test( acc, vmask );
+}
+
+static inline int vector_uniform( unsigned int *pixels, int count, unsigned int value, unsigned int mask, int *done )
+{
+	__m128i vmask, vvalue, acc;
+	int i;
+
+	vmask = _mm_set1_epi32( mask );
+	vvalue = _mm_set1_epi32( value );
+	acc = _mm_setzero_si128();
+
+	for( i=0; i+4<=count; i+=4 )
+	{
+		acc = _mm_or_si128( acc, _mm_xor_si128( _mm_loadu_si128( (__m128i *)(pixels+i) ), vvalue ) );
+	}
+
+	*done = i;
+
+	return vector_test( acc, vmask );
+}
+#else
+static inline int vector_differ( unsigned int *a, unsigned int *b, int count, unsigned int mask, int *done )
+{
+	(void)a; (void)b; (void)count; (void)mask;
+	*done = 0;
+	return 0;
+}
+
+static inline int vector_uniform( unsigned int *pixels, int count, unsigned int value, unsigned int mask, int *done )
+{
+	(void)pixels; (void)count; (void)value; (void)mask;
+	*done = 0;
+	return 1;
+}
+#endif
+
+/*******************************************************************************
+* Function to check wether two rows of pixels differ                           *
+*                                                                              *
+* a and b point to the first pixel of the rows                                 *
+* count is the number of pixels to compare                                     *
+* mask is the channel mask to apply before comparing                           *
+*                                                                              *
+* Returns 1 if any masked pixel differs, 0 otherwise                           *
+*******************************************************************************/
+int pixelops_differ( unsigned int *a, unsigned int *b, int count, unsigned int mask )
+{
+	unsigned int acc;
+	int i;
+
+	if( vector_differ( a, b, count, mask, &i ) )
+		return 1;
+
+	acc = 0;
+	for( ; i<count; i++ )
+		acc |= a[i] ^ b[i];
+
+	return ( acc & mask ) != 0;
+}
+
+/*******************************************************************************
+* Function to check wether a row of pixels is of a single color                *
+*                                                                              *
+* pixels points to the first pixel of the row                                  *
+* count is the number of pixels to check                                       *
+* value is the color to compare against                                        *
+* mask is the channel mask to apply before comparing                           *
+*                                                                              *
+* Returns 1 if all masked pixels equal value, 0 otherwise                      *
+*******************************************************************************/
+int pixelops_uniform( unsigned int *pixels, int count, unsigned int value, unsigned int mask )
+{
+	unsigned int acc;
+	int i;
+
+	if( ! vector_uniform( pixels, count, value, mask, &i ) )
+		return 0;
+
+	acc = 0;
+	for( ; i<count; i++ )
+		acc |= pixels[i] ^ value;
+
+	return ( acc & mask ) == 0;
+}
+
+/*******************************************************************************
+* Function to collect the distinct colors of a row of pixels                   *
+* Runs of the previously found color are skipped without a palette search,     *
+* which covers most pixels of text and line art                                *
+*                                                                              *
+* pixels points to the first pixel of the row                                  *
+* count is the number of pixels to check                                       *
+* colors holds the masked colors found so far and receives new ones            *
+* numcolors is the number of colors found so far                               *
+* maxcolors is the maximum number of colors colors can hold                    *
+* mask is the channel mask to apply before comparing                           *
+*                                                                              *
+* Returns the number of colors found, maxcolors+1 if there are more            *
+*******************************************************************************/
+int pixelops_colors( unsigned int *pixels, int count, unsigned int *colors, int numcolors, int maxcolors, unsigned int mask )
+{
+	unsigned int color, last;
+	int i, j;
+
+	if( count <= 0 )
+		return numcolors;
+
+	if( numcolors == 0 )
+		colors[ numcolors++ ] = pixels[0] & mask;
+
+	last = colors[ numcolors-1 ];
+
+	for( i=0; i<count; i++ )
+	{
+		color = pixels[i] & mask;
+
+		if( color == last )
+			continue;
+
+		for( j=0; j<numcolors; j++ )
+		{
+			if( colors[j] == color )
+				break;
+		}
+
+		if( j == numcolors )
+		{
+			if( numcolors >= maxcolors )
+				return maxcolors+1;
+
+			colors[ numcolors++ ] = color;
+		}
+
+		last = color;
+	}
+
+	return numcolors;
+}
+
+/*******************************************************************************
+* Packed pixel layouts used for literal pixels in the image data               *
+*                                                                              *
+* size is the number of bytes of one packed pixel                              *
+* lanes are the bytes of struct pixel stored in order, x=0, y=1, z=2, a=3      *
+* packmasks gather the lanes of four pixels into the first 4*size bytes        *
+* unpackmasks scatter 4*size packed bytes back into four pixels                *
+* storemasks select the bytes of four pixels that are part of the layout       *
+*                                                                              *
+* Bytes that are not part of the layout must never be written, as the other    *
+* channels of the same pixels may be unpacked concurrently by the decoder of   *
+* another plane. With AVX-512 only the layout bytes are stored. SSE has no     *
+* byte granular store besides the non temporal maskmovdqu, so without AVX-512  *
+* only the RGB and BGR layouts are unpacked with vectors, keeping the alpha    *
+* bytes no other plane writes, and partial layouts are unpacked byte by byte.  *
+*******************************************************************************/
+static const struct
+{
+	int size;
+	int lanes[3];
+} layouts[7] =
+{
+	{ 3, { 0, 1, 2 } },		// PIXELOPS_RGB
+	{ 3, { 2, 1, 0 } },		// PIXELOPS_BGR
+	{ 1, { 1, 0, 0 } },		// PIXELOPS_LUMA
+	{ 2, { 0, 2, 0 } },		// PIXELOPS_RGB_CHROMA
+	{ 2, { 2, 0, 0 } },		// PIXELOPS_BGR_CHROMA
+	{ 1, { 0, 0, 0 } },		// PIXELOPS_X
+	{ 1, { 2, 0, 0 } }		// PIXELOPS_Z
+};
+
+#if defined( __SSSE3__ )
+#define Z -128
+
+static const signed char packmasks[7][16] =
+{
+	{ 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, Z, Z, Z, Z },
+	{ 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, Z, Z, Z, Z },
+	{ 1, 5, 9, 13, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z },
+	{ 0, 2, 4, 6, 8, 10, 12, 14, Z, Z, Z, Z, Z, Z, Z, Z },
+	{ 2, 0, 6, 4, 10, 8, 14, 12, Z, Z, Z, Z, Z, Z, Z, Z },
+	{ 0, 4, 8, 12, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z },
+	{ 2, 6, 10, 14, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z }
+};
+
+static const signed char unpackmasks[7][16] =
+{
+	{ 0, 1, 2, Z, 3, 4, 5, Z, 6, 7, 8, Z, 9, 10, 11, Z },
+	{ 2, 1, 0, Z, 5, 4, 3, Z, 8, 7, 6, Z, 11, 10, 9, Z },
+	{ Z, 0, Z, Z, Z, 1, Z, Z, Z, 2, Z, Z, Z, 3, Z, Z },
+	{ 0, Z, 1, Z, 2, Z, 3, Z, 4, Z, 5, Z, 6, Z, 7, Z },
+	{ 1, Z, 0, Z, 3, Z, 2, Z, 5, Z, 4, Z, 7, Z, 6, Z },
+	{ 0, Z, Z, Z, 1, Z, Z, Z, 2, Z, Z, Z, 3, Z, Z, Z },
+	{ Z, Z, 0, Z, Z, Z, 1, Z, Z, Z, 2, Z, Z, Z, 3, Z }
+};
+
+#undef Z
+
+#if defined( __AVX512BW__ ) && defined( __AVX512VL__ )
+static const unsigned short storemasks[7] =
+{
+	0x7777, 0x7777, 0x2222, 0x5555, 0x5555, 0x1111, 0x4444
+};
+#endif
+
+static inline void vector_pack( unsigned char *out, unsigned int *pixels, int count, int layout, int *done )
+{
+	__m128i mask, data;
+	int i, size, word;
+
+	mask = _mm_loadu_si128( (__m128i *)packmasks[ layout ] );
+	size = layouts[ layout ].size * 4;
+
+	for( i=0; i+4<=count; i+=4 )
+	{
+		data = _mm_shuffle_epi8( _mm_loadu_si128( (__m128i *)(pixels+i) ), mask );
+
+		if( size == 4 )
+		{
+			word = _mm_cvtsi128_si32( data );		// Only the packed bytes are stored
+			memcpy( out, &word, 4 );
+		}
+		else
+		{
+			_mm_storel_epi64( (__m128i *)out, data );
+			if( size == 12 )
+			{
+				word = _mm_cvtsi128_si32( _mm_srli_si128( data, 8 ) );
+				memcpy( out+8, &word, 4 );
+			}
+		}
+
+		out += size;
+	}
+
+	*done = i;
+}
+
+static inline void vector_unpack( unsigned int *pixels, unsigned char *in, int count, int layout, int *done )
+{
+	__m128i mask, data;
+	int i, size, word;
+#if ! defined( __AVX512BW__ ) || ! defined( __AVX512VL__ )
+	__m128i keep;
+
+	if( layouts[ layout ].size != 3 )		// Partial layouts need byte granular stores
+	{
+		*done = 0;
+		return;
+	}
+
+	keep = _mm_set1_epi32( 0xFF000000 );
+#endif
+
+	mask = _mm_loadu_si128( (__m128i *)unpackmasks[ layout ] );
+	size = layouts[ layout ].size * 4;
+
+	for( i=0; i+4<=count; i+=4 )
+	{
+		if( size == 4 )
+		{
+			memcpy( &word, in, 4 );		// Only the packed bytes are loaded
+			data = _mm_cvtsi32_si128( word );
+		}
+		else
+		{
+			data = _mm_loadl_epi64( (__m128i *)in );
+			if( size == 12 )
+			{
+				memcpy( &word, in+8, 4 );
+				data = _mm_unpacklo_epi64( data, _mm_cvtsi32_si128( word ) );
+			}
+		}
+
+#if defined( __AVX512BW__ ) && defined( __AVX512VL__ )
+		_mm_mask_storeu_epi8( pixels+i, storemasks[ layout ], _mm_shuffle_epi8( data, mask ) );
+#else
+		data = _mm_or_si128( _mm_shuffle_epi8( data, mask ), _mm_and_si128( _mm_loadu_si128( (__m128i *)(pixels+i) ), keep ) );
+		_mm_storeu_si128( (__m128i *)(pixels+i), data );
+#endif
+
+		in += size;
+	}
+
+	*done = i;
+}
+#else
+static inline void vector_pack( unsigned char *out, unsigned int *pixels, int count, int layout, int *done )
+{
+	(void)out; (void)pixels; (void)count; (void)layout;
+	*done = 0;
+}
+
+static inline void vector_unpack( unsigned int *pixels, unsigned char *in, int count, int layout, int *done )
+{
+	(void)pixels; (void)in; (void)count; (void)layout;
+	*done = 0;
+}
+#endif
+
+/*******************************************************************************
+* Function to get the size of a packed pixel                                   *
+*                                                                              *
+* layout is the packed pixel layout, one of PIXELOPS_*                         *
+*                                                                              *
+* Returns the number of bytes of one packed pixel                              *
+*******************************************************************************/
+int pixelops_packsize( int layout )
+{
+	return layouts[ layout ].size;
+}
+
+/*******************************************************************************
+* Function to pack a row of pixels into bytes                                  *
+*                                                                              *
+* out receives count*pixelops_packsize( layout ) bytes                         *
+* pixels points to the first pixel of the row                                  *
+* count is the number of pixels to pack                                        *
+* layout is the packed pixel layout, one of PIXELOPS_*                         *
+*******************************************************************************/
+void pixelops_pack( unsigned char *out, unsigned int *pixels, int count, int layout )
+{
+	unsigned char *pixel;
+	int i, j, size;
+
+	vector_pack( out, pixels, count, layout, &i );
+
+	size = layouts[ layout ].size;
+	out += i*size;
+
+	for( ; i<count; i++ )
+	{
+		pixel = (unsigned char *)&pixels[i];
+
+		for( j=0; j<size; j++ )
+			*out++ = pixel[ layouts[ layout ].lanes[j] ];
+	}
+}
+
+/*******************************************************************************
+* Function to unpack a row of pixels from bytes                                *
+* Channels that are not part of the layout keep their value and are not        *
+* written, so the other channels can be unpacked into the same row at once     *
+*                                                                              *
+* pixels points to the first pixel of the row                                  *
+* in holds count*pixelops_packsize( layout ) bytes                             *
+* count is the number of pixels to unpack                                      *
+* layout is the packed pixel layout, one of PIXELOPS_*                         *
+*******************************************************************************/
+void pixelops_unpack( unsigned int *pixels, unsigned char *in, int count, int layout )
+{
+	unsigned char *pixel;
+	int i, j, size;
+
+	vector_unpack( pixels, in, count, layout, &i );
+
+	size = layouts[ layout ].size;
+	in += i*size;
+
+	for( ; i<count; i++ )
+	{
+		pixel = (unsigned char *)&pixels[i];
+
+		for( j=0; j<size; j++ )
+			pixel[ layouts[ layout ].lanes[j] ] = *in++;
+	}
+}
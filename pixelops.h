@@ -0,0 +1,38 @@
+/*
+*    QTC: pixelops.h (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PIXELOPS_H
+#define PIXELOPS_H
+
+#define PIXELOPS_RGB 0
+#define PIXELOPS_BGR 1
+#define PIXELOPS_LUMA 2
+#define PIXELOPS_RGB_CHROMA 3
+#define PIXELOPS_BGR_CHROMA 4
+#define PIXELOPS_X 5
+#define PIXELOPS_Z 6
+
+extern int pixelops_differ( unsigned int *a, unsigned int *b, int count, unsigned int mask );
+extern int pixelops_uniform( unsigned int *pixels, int count, unsigned int value, unsigned int mask );
+extern int pixelops_colors( unsigned int *pixels, int count, unsigned int *colors, int numcolors, int maxcolors, unsigned int mask );
+extern int pixelops_packsize( int layout );
+extern void pixelops_pack( unsigned char *out, unsigned int *pixels, int count, int layout );
+extern void pixelops_unpack( unsigned int *pixels, unsigned char *in, int count, int layout );
+
+#endif
@@ -28,7 +28,8 @@
 /*******************************************************************************
 * Function to load a ppm file into an image structure                          *
 *                                                                              *
-* image is the uninitialized image structure to load into                      *
+* image is the image structure to load into, its pixels are reused if the size *
+* fits, they have to be NULL or allocated by image_create                      *
 * filename is the file name of the image file                                  *
 *                                                                              *
 * Returns 0 on failure, 1 on success                                           *
@@ -40,7 +41,6 @@ int ppm_read( struct image *image, char *filename )
 	int width, height, maxval;
 	int i, j;
 	unsigned char *rawpixels;
-	unsigned int *pixels;
 
 	if( filename == NULL )
 	{
@@ -124,54 +124,32 @@ int ppm_read( struct image *image, char *filename )
 			return 0;
 		}
 
-		image->width = width;
-		image->height = height;
-
-		image->colordiff = 0;
-		image->transform = 0;
-		image->bgra = 0;
-
-		rawpixels = malloc( sizeof( unsigned char ) * width * height * 3 + 1 );
-
-		if( rawpixels != NULL )
+		if( ! image_resize( image, width, height, 0 ) )
 		{
-			if( fread( rawpixels, sizeof( *(rawpixels) ), width*height*3, ppm ) != (unsigned int)(width*height*3) )
-			{
-				fputs( "ppm_read: Short read on image data\n", stderr );
-				free( rawpixels );
-				if( ppm != stdin )
-					fclose( ppm );
-				return 0;
-			}
-		}
-		else
-		{
-			perror( "ppm_read" );
 			if( ppm != stdin )
 				fclose( ppm );
 			return 0;
 		}
 
-		image->pixels = malloc( sizeof( unsigned char ) * width * height * 4 );
-		if( image->pixels == NULL )
+		rawpixels = (unsigned char *)image->pixels;		// Read into the pixels, then spread out in place
+
+		if( fread( rawpixels, sizeof( *(rawpixels) ), width*height*3, ppm ) != (unsigned int)(width*height*3) )
 		{
-			perror( "ppm_read" );
-			free( rawpixels );
+			fputs( "ppm_read: Short read on image data\n", stderr );
 			if( ppm != stdin )
 				fclose( ppm );
 			return 0;
 		}
 
-		pixels = (unsigned int *)image->pixels;
-
-		j = 0;
-		for( i=0; i<width*height*3; i+=3 )
+		for( i=width*height-1; i>=0; i-- )		// Back to front, so no raw pixel is overwritten before it is read
 		{
-			pixels[j++] = (*((unsigned int *)(rawpixels+i)))&0x00FFFFFF;
+			j = i*3;
+			image->pixels[i].z = rawpixels[j+2];
+			image->pixels[i].y = rawpixels[j+1];
+			image->pixels[i].x = rawpixels[j];
+			image->pixels[i].a = 0;
 		}
 
-		free( rawpixels );
-
 		if( ppm != stdin )
 			fclose( ppm );
 
@@ -25,50 +25,110 @@
 #include "qti.h"
 #include "tilecache.h"
 #include "image.h"
+#include "blockmap.h"
+#include "damage.h"
+#include "motion.h"
+#include "scroll.h"
+#include "blockhash.h"
+#include "colormap.h"
+#include "pixelops.h"
+#include "threadpool.h"
 
 #include "qtc.h"
 
+#define COPY_MINSIZE 8
+#define PALETTE_MAXSIZE 16
+#define PALETTE_MAXCOLORS 4
+
 
 /*******************************************************************************
-* Functions to wite pixel data to a databuffer from various source formats     *
+* Function to get the channels of a plane                                      *
+* Images in fakeyuv format are coded as a luma and a chroma plane, or as a     *
+* plane of their own for every channel. The chroma channels are stored in the  *
+* order of the image file.                                                     *
 *                                                                              *
-* databuffer is the databuffer to write to                                     *
-* pixel is the pixel to write                                                  *
+* numplanes is the number of planes the channels are split into                *
+* plane is the plane to get the channels of                                    *
+* bgra decides wether to use bgra mode (1) or rgba mode (0)                    *
+* mask receives the channel mask of the plane                                  *
 *                                                                              *
-* Returns 0 on failure, 1 on success                                           *
+* Returns the packed layout of the plane, one of PIXELOPS_*                    *
 *******************************************************************************/
-static inline int put_rgb_pixel( struct databuffer *databuffer, struct pixel pixel )
+static int plane_channels( int numplanes, int plane, int bgra, unsigned int *mask )
 {
-	return ( ( databuffer_add_byte( pixel.x, databuffer ) ) &&
-			 ( databuffer_add_byte( pixel.y, databuffer ) ) &&
-			 ( databuffer_add_byte( pixel.z, databuffer ) ) );
+	if( numplanes == 1 )
+	{
+		*mask = 0x00FFFFFF;
+		return bgra ? PIXELOPS_BGR : PIXELOPS_RGB;
+	}
+	else if( plane == 0 )
+	{
+		*mask = 0x0000FF00;
+		return PIXELOPS_LUMA;
+	}
+	else if( numplanes == 2 )
+	{
+		*mask = 0x00FF00FF;
+		return bgra ? PIXELOPS_BGR_CHROMA : PIXELOPS_RGB_CHROMA;
+	}
+	else if( ( plane == 1 ) != ( bgra != 0 ) )
+	{
+		*mask = 0x000000FF;
+		return PIXELOPS_X;
+	}
+	else
+	{
+		*mask = 0x00FF0000;
+		return PIXELOPS_Z;
+	}
 }
 
-static inline int put_bgr_pixel( struct databuffer *databuffer, struct pixel pixel )
+/*******************************************************************************
+* Function to write a single color to a databuffer                             *
+*                                                                              *
+* databuffer is the databuffer to write to                                     *
+* color is the color to write                                                  *
+* layout is the packed layout of the current pass, one of PIXELOPS_*           *
+* colormap is the color map to write indices of, or NULL for literal colors    *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static inline int put_color( struct databuffer *databuffer, struct pixel color, int layout, struct colormap *colormap )
 {
-	return ( ( databuffer_add_byte( pixel.z, databuffer ) ) &&
-			 ( databuffer_add_byte( pixel.y, databuffer ) ) &&
-			 ( databuffer_add_byte( pixel.x, databuffer ) ) );
-}
+	unsigned char *data;
+	unsigned int value;
 
-static inline int put_luma_pixel( struct databuffer *databuffer, struct pixel pixel )
-{
-	return databuffer_add_byte( pixel.y, databuffer );
-}
+	memcpy( &value, &color, sizeof( value ) );
 
-static inline int put_rgb_chroma_pixel( struct databuffer *databuffer, struct pixel pixel )
-{
-	return ( ( databuffer_add_byte( pixel.x, databuffer ) ) &&
-			 ( databuffer_add_byte( pixel.z, databuffer ) ) );
+	if( colormap != NULL )
+		return databuffer_add_byte( colormap_index( colormap, value ), databuffer );
+
+	data = databuffer_add_span( databuffer, pixelops_packsize( layout ) );
+	if( data == NULL )
+		return 0;
+
+	pixelops_pack( data, &value, 1, layout );
+
+	return 1;
 }
 
-static inline int put_bgr_chroma_pixel( struct databuffer *databuffer, struct pixel pixel )
+/*******************************************************************************
+* Function to write a block vector to a databuffer                             *
+* Both components are stored as little endian 16 bit values                    *
+*                                                                              *
+* databuffer is the databuffer to write to                                     *
+* dx and dy are the components of the vector                                   *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static inline int put_vector( struct databuffer *databuffer, int dx, int dy )
 {
-	return ( ( databuffer_add_byte( pixel.z, databuffer ) ) &&
-			 ( databuffer_add_byte( pixel.x, databuffer ) ) );
+	return ( ( databuffer_add_byte( dx & 0xFF, databuffer ) ) &&
+			 ( databuffer_add_byte( ( dx >> 8 ) & 0xFF, databuffer ) ) &&
+			 ( databuffer_add_byte( dy & 0xFF, databuffer ) ) &&
+			 ( databuffer_add_byte( ( dy >> 8 ) & 0xFF, databuffer ) ) );
 }
 
-
 /*******************************************************************************
 * Function to write pixel data from an image area to a databuffer              *
 *                                                                              *
@@ -76,334 +136,1392 @@ static inline int put_bgr_chroma_pixel( struct databuffer *databuffer, struct pi
 * pixels is an array containing the complete image data                        *
 * x1, x2, y1, y2 describe the sub-area to write                                *
 * with is the width of the complete image                                      *
-* bgra decides wether to use bgra mode (1) or rgba mode (0)                    *
-* colordiff decides wether the image data is in fakeyuv format                 *
-* luma decidec wether to write the luma (1) or chroma (0) channel              *
+* layout is the packed layout of the current pass, one of PIXELOPS_*           *
+* colormap is the color map to write indices of, or NULL for literal colors    *
 *                                                                              *
 * Returns 0 on failure, 1 on success                                           *
 *******************************************************************************/
-static inline int put_pixels( struct databuffer *databuffer, struct pixel *pixels, int x1, int x2, int y1, int y2, int width, int bgra, int colordiff, int luma )
+static inline int put_pixels( struct databuffer *databuffer, struct pixel *pixels, int x1, int x2, int y1, int y2, int width, int layout, struct colormap *colormap )
 {
-	int x, y, i;
+	unsigned char *data;
+	int x, y, i, size;
 
-	if( ! colordiff )
+	if( colormap != NULL )
 	{
-		if( bgra )
-		{
-			for( y=y1; y<y2; y++ )
-			{
-				i = x1 + y*width;
-				for( x=x1; x<x2; x++ )
-					if( ! put_bgr_pixel( databuffer, pixels[i++] ) )
-						return 0;
-			}
-		}
-		else
+		data = databuffer_add_span( databuffer, ( x2-x1 )*( y2-y1 ) );
+		if( data == NULL )
+			return 0;
+
+		for( y=y1; y<y2; y++ )
 		{
-			for( y=y1; y<y2; y++ )
-			{
-				i = x1 + y*width;
-				for( x=x1; x<x2; x++ )
-					if( ! put_rgb_pixel( databuffer, pixels[i++] ) )
-						return 0;
-			}
+			i = x1 + y*width;
+			for( x=x1; x<x2; x++ )
+				*data++ = colormap_index( colormap, ((unsigned int *)pixels)[i++] );
 		}
 	}
 	else
 	{
-		if( luma )
-		{
-			for( y=y1; y<y2; y++ )
-			{
-				i = x1 + y*width;
-				for( x=x1; x<x2; x++ )
-					if( ! put_luma_pixel( databuffer, pixels[i++] ) )
-						return 0;
-			}
-		}
-		else
+		size = ( x2-x1 ) * pixelops_packsize( layout );
+
+		data = databuffer_add_span( databuffer, size*( y2-y1 ) );
+		if( data == NULL )
+			return 0;
+
+		for( y=y1; y<y2; y++ )
 		{
-			if( bgra )
-			{
-				for( y=y1; y<y2; y++ )
-				{
-					i = x1 + y*width;
-					for( x=x1; x<x2; x++ )
-						if( ! put_bgr_chroma_pixel( databuffer, pixels[i++] ) )
-							return 0;
-				}
-			}
-			else
-			{
-				for( y=y1; y<y2; y++ )
-				{
-					i = x1 + y*width;
-					for( x=x1; x<x2; x++ )
-						if( ! put_rgb_chroma_pixel( databuffer, pixels[i++] ) )
-							return 0;
-				}
-			}
+			pixelops_pack( data, (unsigned int *)pixels + x1 + y*width, x2-x1, layout );
+			data += size;
 		}
 	}
 
 	return 1;
 }
 
+#define MARK_LEAF 0
+#define MARK_COPY 1
+#define MARK_DONE 2
+
 /*******************************************************************************
-* Function to compress an image using quad tree compression                    *
+* Structure to hold a position in a segment where a decision was deferred      *
 *                                                                              *
-* input is the input image                                                     *
-* refimage is the reference image, set to NULL for keyframes                   *
-* output is the compressed image                                               *
-* lazyness indicates how many levels to skip at the beginning                  *
-* colordiff enables splitting of channels for colordiff images                 *
+* type is MARK_LEAF for a leaf block whose tile cache lookup was deferred,     *
+* MARK_COPY for the start of a block whose block copy lookup was deferred and  *
+* MARK_DONE for the end of such a block                                        *
+* x1, x2, y1, y2 describe the block                                            *
+* hash is the block hash of MARK_COPY and MARK_DONE blocks                     *
+* commandpos is the bit position of the cache or copy command bit in the       *
+* commanddata, or of the end of the block for MARK_DONE                        *
+* imagepos and imageend delimit the literal pixel data in the imagedata        *
+*******************************************************************************/
+struct qtc_mark
+{
+	int type;
+	int x1, x2, y1, y2;
+	unsigned int hash;
+	unsigned int commandpos;
+	unsigned int imagepos, imageend;
+};
+
+/*******************************************************************************
+* Structure to hold the state of the quad tree compressor                      *
 *                                                                              *
-* Returns 0 on failure, 1 on success                                           *
+* input, refimage, output, lazyness and colordiff are the parameters passed    *
+* to qtc_compress, blockmap, damage and motion are taken from its options      *
+* blockhash indexes the compressed blocks of the slice for block copies, NULL  *
+* if block copies are disabled                                                 *
+* colormap is the color map of the image, NULL if colors are stored literally  *
+* inpixels and refpixels are the pixels of the input and reference image       *
+* mask is the channel mask of the current pass                                 *
+* layout is the packed layout of the current pass, bgra the pixel format       *
+* minsize and maxdepth limit the quad tree                                     *
+* slice is the slice of the output image that is compressed                    *
+* result is the return value of the compression of the slice                   *
+* commanddata and imagedata are the buffers to write to                        *
+* segment is the segment written to, NULL when not compressing in parallel     *
+* splitdepth is the depth at which subtrees are split off, -1 for none         *
+* segments are all segments of the current pass in tree order                  *
+* numsegments and maxsegments are the used and allocated number of segments    *
 *******************************************************************************/
-int qtc_compress( struct image *input, struct image *refimage, struct qti *output, int lazyness, int colordiff )
+struct qtc_encoder
 {
-	struct databuffer *commanddata, *imagedata, *indexdata;
-	int minsize, maxdepth;
+	struct image *input, *refimage;
+	struct qti *output;
+	int lazyness, colordiff;
+	struct blockmap *blockmap;
+	struct damage *damage;
+	struct motion *motion;
+	struct blockhash *blockhash;
+	struct colormap *colormap;
+
 	unsigned int *inpixels, *refpixels;
 	unsigned int mask;
-	int luma, bgra;
+	int layout, bgra;
+	int minsize, maxdepth;
 
-	int qtc_compress_rec( int x1, int y1, int x2, int y2, int depth )
-	{
-		int x, y, sx, sy, i;
-		unsigned int p;
-		struct pixel color;
-		int index;
-		int error;
+	struct qti_slice *slice;
+	int result;
 
-		if( depth >= lazyness )
-		{
-			if( refimage != NULL )
-			{
-				error = 0;
+	struct databuffer *commanddata, *imagedata;
 
-				for( y=y1; y<y2; y++ )
-				{
-					i = x1 + y*input->width;
-					for( x=x1; x<x2; x++ )
-					{
-						if( ( inpixels[ i ] ^ refpixels[ i ] ) & mask )
-						{
-							error = 1;
-							break;
-						}
+	struct qtc_segment *segment;
+	int splitdepth;
 
-						i++;
-					}
-			
-					if( error )
-						break;
-				}
-		
-				if( error )
-				{
-					databuffer_add_bits( 1, commanddata, 1 );
-				}
-				else
-				{
-					databuffer_add_bits( 0, commanddata, 1 );
-					return 1;
-				}
-			}
+	struct qtc_segment **segments;
+	int numsegments, maxsegments;
+};
 
+/*******************************************************************************
+* Structure to hold one part of a bit stream compressed in parallel            *
+*                                                                              *
+* The quad tree is cut at a fixed depth. Every subtree below the cut is        *
+* compressed into private buffers by a worker thread, the upper levels of the  *
+* tree are compressed into segments of their own between the subtrees. All     *
+* segments are spliced back together in tree order afterwards. Tile cache and  *
+* block copy lookups depend on the order of the blocks, so they are deferred   *
+* until then.                                                                  *
+*                                                                              *
+* encoder is the compressor state used for the segment                         *
+* commanddata and imagedata are the private buffers of the segment             *
+* subtree indicates wether the segment holds a subtree                         *
+* x1, y1, x2, y2 and depth describe the subtree                                *
+* result is the return value of the compression of the subtree                 *
+* marks are the positions of the deferred lookups in order                     *
+* nummarks and maxmarks are the used and allocated number of marks             *
+*******************************************************************************/
+struct qtc_segment
+{
+	struct qtc_encoder encoder;
 
-			error = 0;
+	struct databuffer *commanddata, *imagedata;
 
-			p = inpixels[ x1 + y1*input->width ];
+	int subtree;
+	int x1, y1, x2, y2, depth;
+	int result;
 
-			for( y=y1; y<y2; y++ )
-			{
-				i = x1 + y*input->width;
-				for( x=x1; x<x2; x++ )
-				{
-					if( ( p ^ inpixels[ i++ ] ) & mask )
-					{
-						error = 1;
-						break;
-					}
-				}
+	struct qtc_mark *marks;
+	int nummarks, maxmarks;
+};
 
-				if( error )
-					break;
-			}
-		}
-		else
-		{
-			if( refimage != NULL )
-				databuffer_add_bits( 1, commanddata, 1 );
+/*******************************************************************************
+* Function to free a segment                                                   *
+*                                                                              *
+* segment is the segment to free                                               *
+*******************************************************************************/
+static void qtc_segment_free( struct qtc_segment *segment )
+{
+	if( segment->commanddata != NULL )
+		databuffer_free( segment->commanddata );
 
-			error = 1;
-		}
+	if( segment->imagedata != NULL )
+		databuffer_free( segment->imagedata );
 
-		if( error )
-		{
-			databuffer_add_bits( 0, commanddata, 1 );
-			if( depth < maxdepth )
-			{
-				if( ( x2-x1 > minsize ) && ( y2-y1 > minsize ) )
-				{
-					sx = x1 + (x2-x1)/2;
-					sy = y1 + (y2-y1)/2;
+	free( segment->marks );
+	free( segment );
+}
 
-					if( ( ! qtc_compress_rec( x1, y1, sx, sy, depth+1 ) ) ||
-					    ( ! qtc_compress_rec( x1, sy, sx, y2, depth+1 ) ) ||
-					    ( ! qtc_compress_rec( sx, y1, x2, sy, depth+1 ) ) ||
-					    ( ! qtc_compress_rec( sx, sy, x2, y2, depth+1 ) ) )
-					{
-						return 0;
-					}
-				}
-				else
-				{
-					if( x2-x1 > minsize )
-					{
-						sx = x1 + (x2-x1)/2;
-		
-						if( ( ! qtc_compress_rec( x1, y1, sx, y2, depth+1 ) ) ||
-						    ( ! qtc_compress_rec( sx, y1, x2, y2, depth+1 ) ) )
-						{
-							return 0;
-						}
-					}
-					else if ( y2-y1 > minsize )
-					{
-						sy = y1 + (y2-y1)/2;
-		
-						if( ( ! qtc_compress_rec( x1, y1, x2, sy, depth+1 ) ) ||
-						    ( ! qtc_compress_rec( x1, sy, x2, y2, depth+1 ) ) )
-						{
-							return 0;
-						}
-					}
-					else
-					{
-						if( output->has_tilecache )
-						{
-							index = tilecache_write( output->tilecache, inpixels, x1, x2, y1, y2, input->width, mask );
+/*******************************************************************************
+* Function to append a new segment to the segments of an encoder               *
+*                                                                              *
+* encoder is the encoder to add the segment to                                 *
+* subtree indicates wether the segment holds a subtree                         *
+*                                                                              *
+* Returns the new segment or NULL on failure                                   *
+*******************************************************************************/
+static struct qtc_segment *qtc_segment_add( struct qtc_encoder *encoder, int subtree )
+{
+	struct qtc_segment *segment, **segments;
 
-							if( index < 0 )
-							{
-								databuffer_add_bits( 1, commanddata, 1 );
+	if( encoder->numsegments >= encoder->maxsegments )
+	{
+		encoder->maxsegments = encoder->maxsegments > 0 ? encoder->maxsegments*2 : 64;
 
-								if( ! put_pixels( imagedata, input->pixels, x1, x2, y1, y2, input->width, bgra, colordiff, luma ) )
-									return 0;
-							}
-							else
-							{
-								databuffer_add_bits( 0, commanddata, 1 );
-								
-								databuffer_add_bits( index, indexdata, output->tilecache->indexbits );
-							}
-						}
-						else
-						{
-							if( ! put_pixels( imagedata, input->pixels, x1, x2, y1, y2, input->width, bgra, colordiff, luma ) )
-								return 0;
-						}
-					}
-				}
-			}
-			else
-			{
-				if( ! put_pixels( imagedata, input->pixels, x1, x2, y1, y2, input->width, bgra, colordiff, luma ) )
-					return 0;
-			}
-		}
-		else
+		segments = realloc( encoder->segments, sizeof( *segments ) * encoder->maxsegments );
+		if( segments == NULL )
 		{
-			databuffer_add_bits( 1, commanddata, 1 );
-
-			color = input->pixels[ x1 + y1*input->width ];
-
-			if( ! colordiff )
-			{
-				if( bgra )
-				{
-					if( ! put_bgr_pixel( imagedata, color ) )
-						return 0;
-				}
-				else
-				{
-					if( ! put_rgb_pixel( imagedata, color ) )
-						return 0;
-				}
-			}
-			else
-			{
-				if( luma )
-				{
-					if( ! put_luma_pixel( imagedata, color ) )
-						return 0;
-				}
-				else
-				{
-					if( bgra )
-					{
-						if( ! put_bgr_chroma_pixel( imagedata, color ) )
-							return 0;
-					}
-					else
-					{
-						if( ! put_rgb_chroma_pixel( imagedata, color ) )
-							return 0;
-					}
-				}
-			}
+			perror( "qtc_segment_add: realloc" );
+			return NULL;
 		}
 
-		return 1;
+		encoder->segments = segments;
 	}
-	
-	commanddata = output->commanddata;
-	imagedata = output->imagedata;
-	indexdata = output->indexdata;
-	minsize = output->minsize;
-	maxdepth = output->maxdepth;
-
-	bgra = input->bgra;
-
-	output->transform = input->transform;
-	
-	if( colordiff )
-		output->colordiff = 2;
-	else
-		output->colordiff = input->colordiff;
 
-	inpixels = (unsigned int *)input->pixels;
-
-	if( refimage != NULL )
-	{
-		refpixels = (unsigned int *)refimage->pixels;
-		output->keyframe = 0;
-	}
-	else
+	segment = calloc( 1, sizeof( *segment ) );
+	if( segment == NULL )
 	{
-		output->keyframe = 1;
+		perror( "qtc_segment_add: calloc" );
+		return NULL;
 	}
 
-	if( ! colordiff )
+	segment->commanddata = databuffer_create( 256 );
+	segment->imagedata = databuffer_create( 1024 );
+
+	if( ( segment->commanddata == NULL ) || ( segment->imagedata == NULL ) )
 	{
-		mask = 0x00FFFFFF;
-		luma = 0;
-		if( ! qtc_compress_rec( 0, 0, input->width, input->height, 0 ) )
-			return 0;
+		qtc_segment_free( segment );
+		return NULL;
 	}
-	else
-	{
-		mask = 0x0000FF00;
-		luma = 1;
-		if( ! qtc_compress_rec( 0, 0, input->width, input->height, 0 ) )
-			return 0;
 
-		mask = 0x00FF00FF;
-		luma = 0;
-		if( ! qtc_compress_rec( 0, 0, input->width, input->height, 0 ) )
-			return 0;
+	segment->subtree = subtree;
+	segment->result = 1;
+
+	segment->encoder = *encoder;
+	segment->encoder.commanddata = segment->commanddata;
+	segment->encoder.imagedata = segment->imagedata;
+	segment->encoder.segment = segment;
+	segment->encoder.splitdepth = -1;
+	segment->encoder.segments = NULL;
+	segment->encoder.numsegments = segment->encoder.maxsegments = 0;
+
+	encoder->segments[ encoder->numsegments++ ] = segment;
+
+	return segment;
+}
+
+/*******************************************************************************
+* Function to record the current position of a segment for a deferred lookup   *
+*                                                                              *
+* encoder is the encoder state                                                 *
+* type is the kind of mark, one of MARK_*                                      *
+* x1, x2, y1, y2 describe the block                                            *
+* hash is the block hash for MARK_COPY and MARK_DONE                           *
+*                                                                              *
+* Returns the new mark or NULL on failure                                      *
+*******************************************************************************/
+static struct qtc_mark *qtc_segment_add_mark( struct qtc_encoder *encoder, int type, int x1, int x2, int y1, int y2, unsigned int hash )
+{
+	struct qtc_segment *segment;
+	struct qtc_mark *mark;
+
+	segment = encoder->segment;
+
+	if( segment->nummarks >= segment->maxmarks )
+	{
+		segment->maxmarks = segment->maxmarks > 0 ? segment->maxmarks*2 : 64;
+
+		mark = realloc( segment->marks, sizeof( *mark ) * segment->maxmarks );
+		if( mark == NULL )
+		{
+			perror( "qtc_segment_add_mark: realloc" );
+			return NULL;
+		}
+
+		segment->marks = mark;
+	}
+
+	mark = &segment->marks[ segment->nummarks++ ];
+
+	mark->type = type;
+	mark->x1 = x1;
+	mark->x2 = x2;
+	mark->y1 = y1;
+	mark->y2 = y2;
+	mark->hash = hash;
+	mark->commandpos = databuffer_get_bitsize( encoder->commanddata );
+	mark->imagepos = mark->imageend = encoder->imagedata->size;
+
+	return mark;
+}
+
+/*******************************************************************************
+* Function to record a leaf block with a deferred tile cache lookup            *
+* Writes a literal block for now, the lookup is done while splicing            *
+*                                                                              *
+* encoder is the encoder state                                                 *
+* x1, x2, y1, y2 describe the block                                            *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int qtc_segment_add_leaf( struct qtc_encoder *encoder, int x1, int x2, int y1, int y2 )
+{
+	struct qtc_mark *leaf;
+
+	leaf = qtc_segment_add_mark( encoder, MARK_LEAF, x1, x2, y1, y2, 0 );
+	if( leaf == NULL )
+		return 0;
+
+	if( ! databuffer_add_bits( 1, encoder->commanddata, 1 ) )
+		return 0;
+
+	if( ! put_pixels( encoder->imagedata, encoder->input->pixels, x1, x2, y1, y2, encoder->input->width, encoder->layout, encoder->colormap ) )
+		return 0;
+
+	leaf->imageend = encoder->imagedata->size;
+
+	return 1;
+}
+
+/*******************************************************************************
+* Function to get the number of bits of one color in the current pass          *
+*                                                                              *
+* encoder is the encoder state                                                 *
+*                                                                              *
+* Returns the number of bits written per color                                 *
+*******************************************************************************/
+static inline int qtc_color_bits( struct qtc_encoder *encoder )
+{
+	if( encoder->colormap != NULL )
+		return 8;
+	else
+		return pixelops_packsize( encoder->layout ) * 8;
+}
+
+/*******************************************************************************
+* Function to estimate the size of a block coded as palette block              *
+*                                                                              *
+* encoder is the encoder state                                                 *
+* x1, y1, x2, y2 describe the block                                            *
+* colors receives the masked colors of the block                               *
+* numcolors receives the number of colors of the block                         *
+*                                                                              *
+* Returns the estimated size in bits, -1 if the block has too many colors      *
+*******************************************************************************/
+static int qtc_palette_size( struct qtc_encoder *encoder, int x1, int y1, int x2, int y2, unsigned int *colors, int *numcolors )
+{
+	int y, n;
+
+	n = 0;
+
+	for( y=y1; y<y2; y++ )
+	{
+		n = pixelops_colors( encoder->inpixels + x1 + y*encoder->input->width, x2-x1, colors, n, PALETTE_MAXCOLORS, encoder->mask );
+		if( n > PALETTE_MAXCOLORS )
+			return -1;
+	}
+
+	*numcolors = n;
+
+	return 2 + n*qtc_color_bits( encoder ) + (x2-x1)*(y2-y1)*( n > 2 ? 2 : 1 );
+}
+
+/*******************************************************************************
+* Function to estimate the size of a block one level below a palette block     *
+* Unchanged and constant blocks are cheap, others are coded as palette block   *
+* or literally, whichever is smaller                                           *
+*                                                                              *
+* encoder is the encoder state                                                 *
+* x1, y1, x2, y2 describe the block                                            *
+*                                                                              *
+* Returns the estimated size in bits                                           *
+*******************************************************************************/
+static int qtc_palette_child_size( struct qtc_encoder *encoder, int x1, int y1, int x2, int y2 )
+{
+	unsigned int colors[ PALETTE_MAXCOLORS ];
+	int numcolors, size, literal;
+	int y, i;
+
+	if( encoder->refpixels != NULL )
+	{
+		for( y=y1; y<y2; y++ )
+		{
+			i = x1 + y*encoder->input->width;
+			if( pixelops_differ( encoder->inpixels+i, encoder->refpixels+i, x2-x1, encoder->mask ) )
+				break;
+		}
+
+		if( y == y2 )
+			return 1;
+	}
+
+	size = qtc_palette_size( encoder, x1, y1, x2, y2, colors, &numcolors );
+
+	if( ( size >= 0 ) && ( numcolors == 1 ) )
+		return 2 + qtc_color_bits( encoder );
+
+	literal = 2 + (x2-x1)*(y2-y1)*qtc_color_bits( encoder );
+
+	if( ( size < 0 ) || ( size > literal ) )
+		return literal;
+
+	return size;
+}
+
+/*******************************************************************************
+* Function to decide wether a block is coded as palette block                  *
+* The palette block has to be smaller than the literal block, or than the      *
+* estimated size of the subdivided block if the block can be split further     *
+*                                                                              *
+* encoder is the encoder state                                                 *
+* x1, y1, x2, y2 describe the block                                            *
+* depth is the current recursion depth                                         *
+* colors receives the masked colors of the block                               *
+* numcolors receives the number of colors of the block                         *
+*                                                                              *
+* Returns 1 if the block should be coded as palette block, 0 otherwise         *
+*******************************************************************************/
+static int qtc_palette_test( struct qtc_encoder *encoder, int x1, int y1, int x2, int y2, int depth, unsigned int *colors, int *numcolors )
+{
+	int size, split;
+	int sx, sy;
+
+	size = qtc_palette_size( encoder, x1, y1, x2, y2, colors, numcolors );
+	if( size < 0 )
+		return 0;
+
+	sx = x1 + (x2-x1)/2;
+	sy = y1 + (y2-y1)/2;
+
+	if( ( depth < encoder->maxdepth ) && ( x2-x1 > encoder->minsize ) && ( y2-y1 > encoder->minsize ) )
+	{
+		split = qtc_palette_child_size( encoder, x1, y1, sx, sy ) +
+		        qtc_palette_child_size( encoder, x1, sy, sx, y2 ) +
+		        qtc_palette_child_size( encoder, sx, y1, x2, sy ) +
+		        qtc_palette_child_size( encoder, sx, sy, x2, y2 );
+	}
+	else if( ( depth < encoder->maxdepth ) && ( x2-x1 > encoder->minsize ) )
+	{
+		split = qtc_palette_child_size( encoder, x1, y1, sx, y2 ) +
+		        qtc_palette_child_size( encoder, sx, y1, x2, y2 );
+	}
+	else if( ( depth < encoder->maxdepth ) && ( y2-y1 > encoder->minsize ) )
+	{
+		split = qtc_palette_child_size( encoder, x1, y1, x2, sy ) +
+		        qtc_palette_child_size( encoder, x1, sy, x2, y2 );
+	}
+	else
+	{
+		split = (x2-x1)*(y2-y1)*qtc_color_bits( encoder );
+	}
+
+	return size < split;
+}
+
+/*******************************************************************************
+* Function to write a palette block                                            *
+* The number of colors and the color indices go to the command data, the       *
+* colors to the image data                                                     *
+*                                                                              *
+* encoder is the encoder state                                                 *
+* x1, x2, y1, y2 describe the block                                            *
+* colors are the masked colors of the block                                    *
+* numcolors is the number of colors of the block, 1 to 4                       *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int put_palette_block( struct qtc_encoder *encoder, int x1, int x2, int y1, int y2, unsigned int *colors, int numcolors )
+{
+	struct pixel color;
+	unsigned int p;
+	int x, y, i, j, bits;
+
+	if( ! databuffer_add_bits( numcolors-1, encoder->commanddata, 2 ) )
+		return 0;
+
+	for( j=0; j<numcolors; j++ )
+	{
+		memcpy( &color, &colors[j], sizeof( color ) );
+
+		if( ! put_color( encoder->imagedata, color, encoder->layout, encoder->colormap ) )
+			return 0;
+	}
+
+	bits = numcolors > 2 ? 2 : 1;
+
+	for( y=y1; y<y2; y++ )
+	{
+		i = x1 + y*encoder->input->width;
+		for( x=x1; x<x2; x++ )
+		{
+			p = encoder->inpixels[i++] & encoder->mask;
+
+			j = 0;
+			while( colors[j] != p )
+				j++;
+
+			if( ! databuffer_add_bits( j, encoder->commanddata, bits ) )
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int qtc_compress_split( struct qtc_encoder *encoder, int x1, int y1, int x2, int y2, int depth );
+
+/*******************************************************************************
+* Function to recursively compress an image area                               *
+*                                                                              *
+* encoder is the encoder state                                                 *
+* x1, y1, x2, y2 describe the area                                             *
+* depth is the current recursion depth                                         *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int qtc_compress_rec( struct qtc_encoder *encoder, int x1, int y1, int x2, int y2, int depth )
+{
+	int y, sx, sy, i;
+	unsigned int p;
+	struct pixel color;
+	int index, dx, dy;
+	int error, hashed, palette;
+	unsigned int hash;
+	unsigned int colors[ PALETTE_MAXCOLORS ];
+	int numcolors;
+	struct image *input;
+	struct qti *output;
+	unsigned int *inpixels, *refpixels;
+	unsigned int mask;
+	int minsize, maxdepth, layout;
+
+	if( depth == encoder->splitdepth )
+		return qtc_compress_split( encoder, x1, y1, x2, y2, depth );
+
+	input = encoder->input;
+	output = encoder->output;
+	inpixels = encoder->inpixels;
+	refpixels = encoder->refpixels;
+	mask = encoder->mask;
+	minsize = encoder->minsize;
+	maxdepth = encoder->maxdepth;
+	layout = encoder->layout;
+
+	if( depth >= encoder->lazyness )
+	{
+		if( refpixels != NULL )
+		{
+			if( ( encoder->damage != NULL ) && ( ! damage_test( encoder->damage, x1, y1, x2, y2 ) ) )
+			{
+				error = 0;
+			}
+			else if( encoder->blockmap != NULL )
+			{
+				error = blockmap_changed( encoder->blockmap, x1, y1, x2, y2 );
+			}
+			else
+			{
+				error = 0;
+
+				for( y=y1; y<y2; y++ )
+				{
+					i = x1 + y*input->width;
+					if( pixelops_differ( inpixels+i, refpixels+i, x2-x1, mask ) )
+					{
+						error = 1;
+						break;
+					}
+				}
+			}
+	
+			if( error )
+			{
+				databuffer_add_bits( 1, encoder->commanddata, 1 );
+			}
+			else
+			{
+				databuffer_add_bits( 0, encoder->commanddata, 1 );
+				return 1;
+			}
+		}
+
+
+		if( encoder->blockmap != NULL )
+		{
+			error = ! blockmap_constant( encoder->blockmap, x1, y1, x2, y2 );
+		}
+		else
+		{
+			error = 0;
+
+			p = inpixels[ x1 + y1*input->width ];
+
+			for( y=y1; y<y2; y++ )
+			{
+				i = x1 + y*input->width;
+				if( ! pixelops_uniform( inpixels+i, x2-x1, p, mask ) )
+				{
+					error = 1;
+					break;
+				}
+			}
+		}
+	}
+	else
+	{
+		if( refpixels != NULL )
+			databuffer_add_bits( 1, encoder->commanddata, 1 );
+
+		error = 1;
+	}
+
+	if( output->motion )		// Copy moved blocks from the reference image
+	{
+		if( error && ( depth >= encoder->lazyness ) &&
+		    ( motion_find( encoder->motion, inpixels, (unsigned int *)encoder->refimage->pixels, x1, y1, x2, y2, mask, &dx, &dy ) ) )
+		{
+			databuffer_add_bits( 1, encoder->commanddata, 1 );
+
+			return put_vector( encoder->imagedata, dx, dy );
+		}
+
+		databuffer_add_bits( 0, encoder->commanddata, 1 );
+	}
+
+	if( error )
+	{
+		databuffer_add_bits( 0, encoder->commanddata, 1 );
+
+		hashed = 0;
+		hash = 0;
+
+		if( output->blockcopy && ( x2-x1 >= COPY_MINSIZE ) && ( y2-y1 >= COPY_MINSIZE ) )		// Copy repeated blocks of the current frame
+		{
+			if( depth >= encoder->lazyness )
+			{
+				hash = blockhash_hash( inpixels, x1, y1, x2, y2, input->width, mask );
+				hashed = 1;
+
+				if( encoder->segment != NULL )		// Looked up while splicing, the block is compressed for now
+				{
+					if( qtc_segment_add_mark( encoder, MARK_COPY, x1, x2, y1, y2, hash ) == NULL )
+						return 0;
+				}
+				else if( blockhash_find( encoder->blockhash, inpixels, hash, x1, y1, x2, y2, input->width, mask, &dx, &dy ) )
+				{
+					databuffer_add_bits( 1, encoder->commanddata, 1 );
+
+					return put_vector( encoder->imagedata, dx-x1, dy-y1 );
+				}
+			}
+
+			databuffer_add_bits( 0, encoder->commanddata, 1 );
+		}
+
+		palette = 0;
+
+		if( output->palette && ( x2-x1 <= PALETTE_MAXSIZE ) && ( y2-y1 <= PALETTE_MAXSIZE ) )		// Code blocks of few colors as palette and index map
+		{
+			palette = ( depth >= encoder->lazyness ) && ( qtc_palette_test( encoder, x1, y1, x2, y2, depth, colors, &numcolors ) );
+
+			databuffer_add_bits( palette, encoder->commanddata, 1 );
+		}
+
+		if( palette )
+		{
+			if( ! put_palette_block( encoder, x1, x2, y1, y2, colors, numcolors ) )
+				return 0;
+		}
+		else if( depth < maxdepth )
+		{
+			if( ( x2-x1 > minsize ) && ( y2-y1 > minsize ) )
+			{
+				sx = x1 + (x2-x1)/2;
+				sy = y1 + (y2-y1)/2;
+
+				if( ( ! qtc_compress_rec( encoder, x1, y1, sx, sy, depth+1 ) ) ||
+				    ( ! qtc_compress_rec( encoder, x1, sy, sx, y2, depth+1 ) ) ||
+				    ( ! qtc_compress_rec( encoder, sx, y1, x2, sy, depth+1 ) ) ||
+				    ( ! qtc_compress_rec( encoder, sx, sy, x2, y2, depth+1 ) ) )
+				{
+					return 0;
+				}
+			}
+			else
+			{
+				if( x2-x1 > minsize )
+				{
+					sx = x1 + (x2-x1)/2;
+	
+					if( ( ! qtc_compress_rec( encoder, x1, y1, sx, y2, depth+1 ) ) ||
+					    ( ! qtc_compress_rec( encoder, sx, y1, x2, y2, depth+1 ) ) )
+					{
+						return 0;
+					}
+				}
+				else if ( y2-y1 > minsize )
+				{
+					sy = y1 + (y2-y1)/2;
+	
+					if( ( ! qtc_compress_rec( encoder, x1, y1, x2, sy, depth+1 ) ) ||
+					    ( ! qtc_compress_rec( encoder, x1, sy, x2, y2, depth+1 ) ) )
+					{
+						return 0;
+					}
+				}
+				else
+				{
+					if( output->has_tilecache )
+					{
+						if( encoder->segment != NULL )
+						{
+							if( ! qtc_segment_add_leaf( encoder, x1, x2, y1, y2 ) )
+								return 0;
+						}
+						else
+						{
+							index = tilecache_write( encoder->slice->tilecache, inpixels, x1, x2, y1, y2, input->width, mask );
+
+							if( index < 0 )
+							{
+								databuffer_add_bits( 1, encoder->commanddata, 1 );
+
+								if( ! put_pixels( encoder->imagedata, input->pixels, x1, x2, y1, y2, input->width, layout, encoder->colormap ) )
+									return 0;
+							}
+							else
+							{
+								databuffer_add_bits( 0, encoder->commanddata, 1 );
+								
+								databuffer_add_bits( index, encoder->slice->indexdata, encoder->slice->tilecache->indexbits );
+							}
+						}
+					}
+					else
+					{
+						if( ! put_pixels( encoder->imagedata, input->pixels, x1, x2, y1, y2, input->width, layout, encoder->colormap ) )
+							return 0;
+					}
+				}
+			}
+		}
+		else
+		{
+			if( ! put_pixels( encoder->imagedata, input->pixels, x1, x2, y1, y2, input->width, layout, encoder->colormap ) )
+				return 0;
+		}
+
+		if( hashed )		// The block is complete now
+		{
+			if( encoder->segment != NULL )
+			{
+				if( qtc_segment_add_mark( encoder, MARK_DONE, x1, x2, y1, y2, hash ) == NULL )
+					return 0;
+			}
+			else if( ! blockhash_add( encoder->blockhash, hash, x1, y1, x2, y2 ) )
+			{
+				return 0;
+			}
+		}
+	}
+	else
+	{
+		databuffer_add_bits( 1, encoder->commanddata, 1 );
+
+		color = input->pixels[ x1 + y1*input->width ];
+
+		if( ! put_color( encoder->imagedata, color, layout, encoder->colormap ) )
+			return 0;
+	}
+
+	return 1;
+}
+
+/*******************************************************************************
+* Function to split off a subtree for parallel compression                     *
+* Queues the subtree as a segment of its own and starts a new segment for the  *
+* upper tree levels that follow it                                             *
+*                                                                              *
+* encoder is the encoder state                                                 *
+* x1, y1, x2, y2 describe the subtree                                          *
+* depth is the depth of the subtree                                            *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int qtc_compress_split( struct qtc_encoder *encoder, int x1, int y1, int x2, int y2, int depth )
+{
+	struct qtc_segment *segment;
+
+	segment = qtc_segment_add( encoder, 1 );
+	if( segment == NULL )
+		return 0;
+
+	segment->x1 = x1;
+	segment->y1 = y1;
+	segment->x2 = x2;
+	segment->y2 = y2;
+	segment->depth = depth;
+
+	segment = qtc_segment_add( encoder, 0 );
+	if( segment == NULL )
+		return 0;
+
+	encoder->segment = segment;
+	encoder->commanddata = segment->commanddata;
+	encoder->imagedata = segment->imagedata;
+
+	return 1;
+}
+
+/*******************************************************************************
+* Function to compress the subtree of a segment, called by the thread pool     *
+*                                                                              *
+* task is the segment to compress                                              *
+*******************************************************************************/
+static void qtc_compress_task( void *task )
+{
+	struct qtc_segment *segment;
+
+	segment = task;
+
+	if( segment->subtree )
+		segment->result = qtc_compress_rec( &segment->encoder, segment->x1, segment->y1, segment->x2, segment->y2, segment->depth );
+}
+
+/*******************************************************************************
+* Function to move the data of a segment up to a position into the slice       *
+*                                                                              *
+* slice is the slice to append to                                              *
+* segment is the segment to take the data from, its commanddata is read        *
+* commandpos is the current bit position in the commanddata, updated           *
+* imagepos is the current position in the imagedata, updated                   *
+* commandend and imageend are the positions to move up to                      *
+* copy indicates wether the data is appended or dropped                        *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int qtc_splice_data( struct qti_slice *slice, struct qtc_segment *segment, unsigned int *commandpos, unsigned int *imagepos, unsigned int commandend, unsigned int imageend, int copy )
+{
+	unsigned char *data;
+	unsigned int bits, value;
+
+	while( *commandpos < commandend )
+	{
+		bits = commandend - *commandpos < 32 ? commandend - *commandpos : 32;
+		value = databuffer_get_bits( segment->commanddata, bits );
+
+		if( copy && ( ! databuffer_add_bits( value, slice->commanddata, bits ) ) )
+			return 0;
+
+		*commandpos += bits;
+	}
+
+	if( copy && ( imageend > *imagepos ) )
+	{
+		data = databuffer_add_span( slice->imagedata, imageend - *imagepos );
+		if( data == NULL )
+			return 0;
+
+		memcpy( data, segment->imagedata->data + *imagepos, imageend - *imagepos );
+	}
+
+	*imagepos = imageend;
+
+	return 1;
+}
+
+/*******************************************************************************
+* Function to splice the segments of a pass back into the output buffers       *
+* Does the deferred tile cache and block copy lookups in tree order, so the    *
+* tile cache, the block hash index and the output end up the same as with      *
+* serial compression. A block that turns out to be a copy is replaced by its   *
+* vector, even when it spans several segments.                                 *
+*                                                                              *
+* encoder is the encoder state                                                 *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int qtc_compress_splice( struct qtc_encoder *encoder )
+{
+	struct qtc_segment *segment;
+	struct qtc_mark *mark;
+	struct qti_slice *slice;
+	unsigned int commandpos, imagepos, commandsize;
+	int i, j, index, dx, dy, skip;
+
+	slice = encoder->slice;
+	skip = 0;
+
+	for( i=0; i<encoder->numsegments; i++ )
+	{
+		segment = encoder->segments[i];
+
+		if( ! segment->result )
+			return 0;
+
+		if( ( segment->nummarks == 0 ) && ( skip == 0 ) )		// Nothing deferred, append as a whole
+		{
+			if( ( ! databuffer_add_buffer( slice->commanddata, segment->commanddata ) ) ||
+			    ( ! databuffer_add_buffer( slice->imagedata, segment->imagedata ) ) )
+			{
+				return 0;
+			}
+
+			continue;
+		}
+
+		commandsize = databuffer_get_bitsize( segment->commanddata );
+
+		if( ! databuffer_pad( segment->commanddata ) )
+			return 0;
+
+		databuffer_rewind( segment->commanddata );
+		commandpos = imagepos = 0;
+
+		for( j=0; j<segment->nummarks; j++ )
+		{
+			mark = &segment->marks[j];
+
+			if( ! qtc_splice_data( slice, segment, &commandpos, &imagepos, mark->commandpos, mark->imagepos, skip == 0 ) )
+				return 0;
+
+			if( skip > 0 )		// Inside a copied block, which is dropped as a whole
+			{
+				if( mark->type == MARK_COPY )
+					skip++;
+				else if( mark->type == MARK_DONE )
+					skip--;
+			}
+			else if( mark->type == MARK_LEAF )
+			{
+				index = tilecache_write( slice->tilecache, encoder->inpixels, mark->x1, mark->x2, mark->y1, mark->y2, encoder->input->width, encoder->mask );
+
+				if( index >= 0 )
+				{
+					databuffer_get_bits( segment->commanddata, 1 );
+					commandpos++;
+					imagepos = mark->imageend;
+
+					if( ( ! databuffer_add_bits( 0, slice->commanddata, 1 ) ) ||
+					    ( ! databuffer_add_bits( index, slice->indexdata, slice->tilecache->indexbits ) ) )
+					{
+						return 0;
+					}
+				}
+			}
+			else if( mark->type == MARK_COPY )
+			{
+				if( blockhash_find( encoder->blockhash, encoder->inpixels, mark->hash, mark->x1, mark->y1, mark->x2, mark->y2, encoder->input->width, encoder->mask, &dx, &dy ) )
+				{
+					databuffer_get_bits( segment->commanddata, 1 );
+					commandpos++;
+					skip = 1;
+
+					if( ( ! databuffer_add_bits( 1, slice->commanddata, 1 ) ) ||
+					    ( ! put_vector( slice->imagedata, dx-mark->x1, dy-mark->y1 ) ) )
+					{
+						return 0;
+					}
+				}
+			}
+			else if( ! blockhash_add( encoder->blockhash, mark->hash, mark->x1, mark->y1, mark->x2, mark->y2 ) )
+			{
+				return 0;
+			}
+		}
+
+		if( ! qtc_splice_data( slice, segment, &commandpos, &imagepos, commandsize, segment->imagedata->size, skip == 0 ) )
+			return 0;
+	}
+
+	return 1;
+}
+
+/*******************************************************************************
+* Function to compress one pass over one slice of the image                    *
+*                                                                              *
+* encoder is the encoder state, slice has to be set                            *
+* pool is the thread pool to use or NULL to compress serially                  *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int qtc_compress_slice( struct qtc_encoder *encoder, struct threadpool *pool )
+{
+	struct qtc_segment *segment;
+	struct qti_slice *slice;
+	int i, result;
+
+	slice = encoder->slice;
+
+	encoder->blockhash = NULL;
+
+	if( encoder->output->blockcopy )
+	{
+		encoder->blockhash = blockhash_create( encoder->input->width * ( slice->y2-slice->y1 ) );
+		if( encoder->blockhash == NULL )
+			return 0;
+	}
+
+	if( pool == NULL )
+	{
+		encoder->segment = NULL;
+		encoder->commanddata = slice->commanddata;
+		encoder->imagedata = slice->imagedata;
+
+		result = qtc_compress_rec( encoder, 0, slice->y1, encoder->input->width, slice->y2, 0 );
+	}
+	else
+	{
+		encoder->segments = NULL;
+		encoder->numsegments = encoder->maxsegments = 0;
+
+		segment = qtc_segment_add( encoder, 0 );
+		result = segment != NULL;
+
+		if( result )
+		{
+			encoder->segment = segment;
+			encoder->commanddata = segment->commanddata;
+			encoder->imagedata = segment->imagedata;
+
+			result = qtc_compress_rec( encoder, 0, slice->y1, encoder->input->width, slice->y2, 0 );
+		}
+
+		if( result )
+		{
+			threadpool_run( pool, qtc_compress_task, (void **)encoder->segments, encoder->numsegments );
+
+			result = qtc_compress_splice( encoder );
+		}
+
+		for( i=0; i<encoder->numsegments; i++ )
+			qtc_segment_free( encoder->segments[i] );
+
+		free( encoder->segments );
+		encoder->segments = NULL;
+	}
+
+	if( encoder->blockhash != NULL )
+	{
+		blockhash_free( encoder->blockhash );
+		encoder->blockhash = NULL;
+	}
+
+	return result;
+}
+
+/*******************************************************************************
+* Function to compress one slice serially, called by the thread pool           *
+*                                                                              *
+* task is the encoder state of the slice                                       *
+*******************************************************************************/
+static void qtc_compress_slice_task( void *task )
+{
+	struct qtc_encoder *encoder;
+
+	encoder = task;
+
+	encoder->result = qtc_compress_slice( encoder, NULL );
+}
+
+/*******************************************************************************
+* Function to compress a number of slices in parallel                          *
+*                                                                              *
+* encoders are the encoder states of the slices                                *
+* numencoders is the number of slices                                          *
+* pool is the thread pool to use or NULL to compress serially                  *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int qtc_compress_slices( struct qtc_encoder *encoders, int numencoders, struct threadpool *pool )
+{
+	void **tasks;
+	int i, result;
+
+	tasks = malloc( sizeof( *tasks ) * numencoders );
+	if( tasks == NULL )
+	{
+		perror( "qtc_compress_slices: malloc" );
+		return 0;
+	}
+
+	for( i=0; i<numencoders; i++ )
+	{
+		encoders[i].splitdepth = -1;
+		encoders[i].result = 0;
+
+		tasks[i] = &encoders[i];
+	}
+
+	if( pool != NULL )
+	{
+		threadpool_run( pool, qtc_compress_slice_task, tasks, numencoders );
+	}
+	else
+	{
+		for( i=0; i<numencoders; i++ )
+			qtc_compress_slice_task( tasks[i] );
+	}
+
+	result = 1;
+	for( i=0; i<numencoders; i++ )
+		result = result && encoders[i].result;
+
+	free( tasks );
+
+	return result;
+}
+
+/*******************************************************************************
+* Function to compress one pass over the whole image                           *
+* A single slice is compressed with its quad tree split up between threads,    *
+* multiple slices are compressed in parallel with one thread each.             *
+*                                                                              *
+* encoder is the encoder state                                                 *
+* pool is the thread pool to use or NULL to compress serially                  *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int qtc_compress_pass( struct qtc_encoder *encoder, struct threadpool *pool )
+{
+	struct qtc_encoder *encoders;
+	struct qti *output;
+	int i, result;
+
+	output = encoder->output;
+
+	if( encoder->blockmap != NULL )
+		blockmap_update( encoder->blockmap, encoder->inpixels, encoder->refpixels, encoder->mask );
+
+	if( output->numslices == 1 )
+	{
+		encoder->slice = &output->slices[0];
+
+		return qtc_compress_slice( encoder, pool );
+	}
+
+	encoders = malloc( sizeof( *encoders ) * output->numslices );
+	if( encoders == NULL )
+	{
+		perror( "qtc_compress_pass: malloc" );
+		return 0;
+	}
+
+	for( i=0; i<output->numslices; i++ )
+	{
+		encoders[i] = *encoder;
+		encoders[i].slice = &output->slices[i];
+	}
+
+	result = qtc_compress_slices( encoders, output->numslices, pool );
+
+	free( encoders );
+
+	return result;
+}
+
+/*******************************************************************************
+* Function to update the block map of a plane, called by the thread pool       *
+*                                                                              *
+* task is the encoder state of the plane                                       *
+*******************************************************************************/
+static void qtc_compress_update_task( void *task )
+{
+	struct qtc_encoder *encoder;
+
+	encoder = task;
+
+	blockmap_update( encoder->blockmap, encoder->inpixels, encoder->refpixels, encoder->mask );
+}
+
+/*******************************************************************************
+* Function to compress the planes of an image in parallel                      *
+* Every plane of every slice has streams of its own, so all of them are        *
+* compressed at the same time. Each further plane uses the sibling block map   *
+* of the plane before it.                                                      *
+*                                                                              *
+* encoder is the encoder state                                                 *
+* pool is the thread pool to use or NULL to compress serially                  *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int qtc_compress_planes( struct qtc_encoder *encoder, struct threadpool *pool )
+{
+	struct qtc_encoder planes[3], *encoders;
+	struct qti *output;
+	void *tasks[3];
+	int i, j, numplanes, numencoders, result;
+
+	output = encoder->output;
+	numplanes = output->numplanes;
+
+	for( j=0; j<numplanes; j++ )
+	{
+		planes[j] = *encoder;
+		planes[j].layout = plane_channels( numplanes, j, encoder->bgra, &planes[j].mask );
+
+		if( ( j > 0 ) && ( encoder->blockmap != NULL ) )
+		{
+			planes[j].blockmap = blockmap_get_sibling( planes[j-1].blockmap );
+			if( planes[j].blockmap == NULL )
+				return 0;
+		}
+
+		tasks[j] = &planes[j];
+	}
+
+	if( encoder->blockmap != NULL )
+	{
+		if( pool != NULL )
+		{
+			threadpool_run( pool, qtc_compress_update_task, tasks, numplanes );
+		}
+		else
+		{
+			for( j=0; j<numplanes; j++ )
+				qtc_compress_update_task( tasks[j] );
+		}
+	}
+
+	numencoders = output->numslices*numplanes;
+
+	encoders = malloc( sizeof( *encoders ) * numencoders );
+	if( encoders == NULL )
+	{
+		perror( "qtc_compress_planes: malloc" );
+		return 0;
+	}
+
+	for( i=0; i<output->numslices; i++ )
+	{
+		for( j=0; j<numplanes; j++ )
+		{
+			encoders[i*numplanes+j] = planes[j];
+			encoders[i*numplanes+j].slice = &output->slices[i*numplanes+j];
+		}
+	}
+
+	result = qtc_compress_slices( encoders, numencoders, pool );
+
+	free( encoders );
+
+	return result;
+}
+
+/*******************************************************************************
+* Function to compress an image using quad tree compression                    *
+*                                                                              *
+* input is the input image                                                     *
+* refimage is the reference image, set to NULL for keyframes                   *
+* output is the compressed image                                               *
+* lazyness indicates how many levels to skip at the beginning                  *
+* colordiff enables splitting of channels for colordiff images                 *
+* options are the optional settings of the compressor                          *
+*                                                                              *
+* The motion search has to see every frame and refimage has to be the previous *
+* frame. If a scrolled region is found the quad tree compares against the      *
+* shifted reference image and the region is added to damage. Moved blocks are  *
+* always copied from the unshifted reference image.                            *
+* The color map has to see every frame as well, it is kept across frames and   *
+* starts over at key frames.                                                   *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+int qtc_compress( struct image *input, struct image *refimage, struct qti *output, int lazyness, int colordiff, struct qtc_options *options )
+{
+	struct qtc_encoder encoder;
+	struct blockmap *blockmap = options->blockmap;
+	struct damage *damage = options->damage;
+	struct motion *motion = options->motion;
+	struct scroll *scroll = options->scroll;
+	struct colormap *colormap = options->colormap;
+	struct threadpool *pool = options->pool;
+	struct pixel color;
+	int first, i;
+
+	if( ( blockmap != NULL ) && ( ( blockmap->width != input->width ) || ( blockmap->height != input->height ) ) )
+	{
+		fputs( "qtc_compress: block map size mismatch\n", stderr );
+		return 0;
+	}
+
+	if( ( damage != NULL ) && ( ( damage->width != input->width ) || ( damage->height != input->height ) ) )
+	{
+		fputs( "qtc_compress: damage map size mismatch\n", stderr );
+		return 0;
+	}
+
+	if( ( ! colordiff ) && ( output->numplanes > 1 ) )
+	{
+		fputs( "qtc_compress: planes need separate color channels\n", stderr );
+		return 0;
+	}
+
+	if( ( motion != NULL ) && ( ( motion->width != input->width ) || ( motion->height != input->height ) ) )
+	{
+		fputs( "qtc_compress: motion search size mismatch\n", stderr );
+		return 0;
+	}
+
+	if( ( scroll != NULL ) && ( ( scroll->width != input->width ) || ( scroll->height != input->height ) ) )
+	{
+		fputs( "qtc_compress: scroll detection size mismatch\n", stderr );
+		return 0;
+	}
+
+	encoder.input = input;
+	encoder.refimage = refimage;
+	encoder.output = output;
+	encoder.lazyness = lazyness;
+	encoder.colordiff = colordiff;
+	encoder.blockmap = blockmap;
+	encoder.damage = damage;
+	encoder.motion = motion;
+	encoder.blockhash = NULL;
+	encoder.colormap = NULL;
+
+	encoder.minsize = output->minsize;
+	encoder.maxdepth = output->maxdepth;
+	encoder.bgra = input->bgra;
+
+	encoder.slice = NULL;
+	encoder.result = 1;
+
+	encoder.segment = NULL;
+	encoder.splitdepth = pool != NULL ? options->splitdepth : -1;
+	encoder.segments = NULL;
+	encoder.numsegments = encoder.maxsegments = 0;
+
+	output->transform = input->transform;
+	
+	if( colordiff )
+		output->colordiff = 2;
+	else
+		output->colordiff = input->colordiff;
+
+	encoder.inpixels = (unsigned int *)input->pixels;
+
+	if( refimage != NULL )
+	{
+		encoder.refpixels = (unsigned int *)refimage->pixels;
+		output->keyframe = 0;
+	}
+	else
+	{
+		encoder.refpixels = NULL;
+		output->keyframe = 1;
+	}
+
+	output->motion = ( motion != NULL ) && ( refimage != NULL );
+	output->blockcopy = options->blockcopy;
+	output->palette = options->palette;
+	output->scroll = 0;
+	output->numcolors = 0;
+	output->firstcolor = 0;
+
+	if( ( colormap != NULL ) && ( ! colordiff ) )		// Store indices into a color map instead of colors
+	{
+		first = colormap_update( colormap, encoder.inpixels, input->width * input->height, refimage == NULL );
+
+		if( first >= 0 )
+		{
+			encoder.colormap = colormap;
+			output->numcolors = colormap->numcolors;
+			output->firstcolor = first;
+
+			for( i=0; i<colormap->numcolors; i++ )
+			{
+				memcpy( &color, &colormap->colors[i], sizeof( color ) );
+
+				output->colors[i][0] = input->bgra ? color.z : color.x;
+				output->colors[i][1] = color.y;
+				output->colors[i][2] = input->bgra ? color.x : color.z;
+			}
+		}
+	}
+
+	if( ( scroll != NULL ) && ( refimage != NULL ) &&
+	    ( scroll_find( scroll, encoder.inpixels, encoder.refpixels, &output->scrollx1, &output->scrolly1, &output->scrollx2, &output->scrolly2, &output->scrolldx, &output->scrolldy ) ) )
+	{
+		output->scroll = 1;
+
+		memcpy( scroll->pixels, refimage->pixels, input->width * input->height * 4 );
+		scroll_apply( scroll->pixels, input->width, output->scrollx1, output->scrolly1, output->scrollx2, output->scrolly2, output->scrolldx, output->scrolldy );
+		encoder.refpixels = scroll->pixels;
+
+		if( damage != NULL )
+			damage_add_rect( damage, output->scrollx1, output->scrolly1, output->scrollx2-output->scrollx1, output->scrolly2-output->scrolly1 );
+	}
+
+	if( motion != NULL )
+		motion_search( motion, encoder.inpixels, refimage != NULL );
+
+	if( ! colordiff )
+	{
+		encoder.layout = plane_channels( 1, 0, encoder.bgra, &encoder.mask );
+		if( ! qtc_compress_pass( &encoder, pool ) )
+			return 0;
+	}
+	else if( output->numplanes > 1 )
+	{
+		if( ! qtc_compress_planes( &encoder, pool ) )
+			return 0;
+	}
+	else
+	{
+		for( i=0; i<2; i++ )
+		{
+			encoder.layout = plane_channels( 2, i, encoder.bgra, &encoder.mask );
+			if( ! qtc_compress_pass( &encoder, pool ) )
+				return 0;
+		}
 	}
 	
 	return 1;
@@ -417,294 +1535,675 @@ int qtc_compress( struct image *input, struct image *refimage, struct qti *outpu
 * pixels is an array containing the complete image                             *
 * x1, x2, y1, y2 describe the sub-area to write                                *
 * with is the width of the complete image                                      *
-* bgra decides wether to use bgra mode (1) or rgba mode (0)                    *
-* colordiff decides wether the image data is in fakeyuv format                 *
-* luma decidec wether to write the luma (1) or chroma (0) channel              *
+* layout is the packed layout of the current pass, one of PIXELOPS_*           *
+* colors is the color map to read indices into, or NULL for literal colors     *
 *                                                                              *
 * Returns 0 on failure, 1 on success                                           *
 *******************************************************************************/
-static inline void get_pixels( struct databuffer *imagedata, struct pixel *pixels, int x1, int x2, int y1, int y2, int width, int bgra, int colordiff, int luma )
+static inline void get_pixels( struct databuffer *imagedata, struct pixel *pixels, int x1, int x2, int y1, int y2, int width, int layout, struct pixel *colors )
 {
-	int x, y, i;
+	unsigned char *data;
+	int x, y, i, size;
 
-	if( ! colordiff )
+	if( colors != NULL )
+	{
+		data = databuffer_get_span( imagedata, ( x2-x1 )*( y2-y1 ) );
+		if( data == NULL )
+			return;
+
+		for( y=y1; y<y2; y++ )
+		{
+			i = x1 + y*width;
+			for( x=x1; x<x2; x++ )
+				pixels[i++] = colors[ *data++ ];
+		}
+	}
+	else
+	{
+		size = ( x2-x1 ) * pixelops_packsize( layout );
+
+		data = databuffer_get_span( imagedata, size*( y2-y1 ) );
+		if( data == NULL )
+			return;
+
+		for( y=y1; y<y2; y++ )
+		{
+			pixelops_unpack( (unsigned int *)pixels + x1 + y*width, data, x2-x1, layout );
+			data += size;
+		}
+	}
+}
+
+/*******************************************************************************
+* Function to read a block vector from a databuffer                            *
+*                                                                              *
+* imagedata is the databuffer to read from                                     *
+* dx and dy receive the components of the vector                               *
+*******************************************************************************/
+static inline void get_vector( struct databuffer *imagedata, int *dx, int *dy )
+{
+	int x, y;
+
+	x = databuffer_get_byte( imagedata );
+	x |= databuffer_get_byte( imagedata ) << 8;
+	y = databuffer_get_byte( imagedata );
+	y |= databuffer_get_byte( imagedata ) << 8;
+
+	*dx = (short)x;
+	*dy = (short)y;
+}
+
+/*******************************************************************************
+* Function to copy the masked channels of a block from a source image area     *
+*                                                                              *
+* pixels is the output image data                                              *
+* srcpixels is the image data to copy from, may be pixels                      *
+* offset is the distance from the block to the source area                     *
+* x1, x2, y1, y2 describe the block                                            *
+* width is the width of the complete image                                     *
+* mask is the channel mask of the current pass                                 *
+*******************************************************************************/
+static inline void copy_block( unsigned int *pixels, unsigned int *srcpixels, int offset, int x1, int x2, int y1, int y2, int width, unsigned int mask )
+{
+	int x, y, i, b;
+	int lanes[4];
+	unsigned int lane;
+	unsigned char *dst, *src;
+
+	if( ( mask & 0x00FFFFFF ) == 0x00FFFFFF )
+	{
+		for( y=y1; y<y2; y++ )
+		{
+			i = x1 + y*width;
+			for( x=x1; x<x2; x++ )
+			{
+				pixels[i] = ( pixels[i] & ~mask ) | ( srcpixels[i+offset] & mask );
+				i++;
+			}
+		}
+	}
+	else		// Only touch the bytes of the masked channels, the other plane may be decoded concurrently
+	{
+		for( b=0; b<4; b++ )
+		{
+			lane = 0;
+			((unsigned char *)&lane)[b] = 0xFF;
+			lanes[b] = ( lane & mask ) != 0;
+		}
+
+		for( y=y1; y<y2; y++ )
+		{
+			i = x1 + y*width;
+			for( x=x1; x<x2; x++ )
+			{
+				dst = (unsigned char *)&pixels[i];
+				src = (unsigned char *)&srcpixels[i+offset];
+
+				for( b=0; b<4; b++ )
+					if( lanes[b] )
+						dst[b] = src[b];
+				i++;
+			}
+		}
+	}
+}
+
+/*******************************************************************************
+* Function to copy a moved block from the reference image                      *
+* The vector is read from the databuffer, only the masked channels are copied  *
+*                                                                              *
+* imagedata is the databuffer to read the vector from                          *
+* pixels and refpixels are the output and reference image data                 *
+* x1, x2, y1, y2 describe the block                                            *
+* width and height are the dimension of the complete image                     *
+* mask is the channel mask of the current pass                                 *
+*******************************************************************************/
+static inline void get_motion_block( struct databuffer *imagedata, unsigned int *pixels, unsigned int *refpixels, int x1, int x2, int y1, int y2, int width, int height, unsigned int mask )
+{
+	int dx, dy;
+
+	get_vector( imagedata, &dx, &dy );
+
+	if( ( x1+dx < 0 ) || ( x2+dx > width ) || ( y1+dy < 0 ) || ( y2+dy > height ) )
+		return;
+
+	copy_block( pixels, refpixels, dx + dy*width, x1, x2, y1, y2, width, mask );
+}
+
+/*******************************************************************************
+* Function to copy a repeated block from an already decompressed block of the  *
+* same slice                                                                   *
+* The vector is read from the databuffer, only the masked channels are copied  *
+*                                                                              *
+* imagedata is the databuffer to read the vector from                          *
+* pixels is the output image data                                              *
+* x1, x2, y1, y2 describe the block                                            *
+* width is the width of the complete image                                     *
+* slice is the slice the block belongs to                                      *
+* mask is the channel mask of the current pass                                 *
+*******************************************************************************/
+static inline void get_copy_block( struct databuffer *imagedata, unsigned int *pixels, int x1, int x2, int y1, int y2, int width, struct qti_slice *slice, unsigned int mask )
+{
+	int dx, dy;
+
+	get_vector( imagedata, &dx, &dy );
+
+	if( ( x1+dx < 0 ) || ( x2+dx > width ) || ( y1+dy < slice->y1 ) || ( y2+dy > slice->y2 ) )
+		return;
+
+	copy_block( pixels, pixels, dx + dy*width, x1, x2, y1, y2, width, mask );
+}
+
+/*******************************************************************************
+* Function to set the masked channels of a pixel                               *
+* Partial masks are applied byte by byte, the other planes may be decoded      *
+* concurrently                                                                 *
+*                                                                              *
+* pixel is the pixel to write                                                  *
+* color is the color to take the channels from                                 *
+* mask is the channel mask of the current pass                                 *
+*******************************************************************************/
+static inline void set_channels( struct pixel *pixel, struct pixel color, unsigned int mask )
+{
+	unsigned char *dst, *src;
+	int b;
+
+	if( ( mask & 0x00FFFFFF ) == 0x00FFFFFF )
+	{
+		*pixel = color;
+	}
+	else
+	{
+		dst = (unsigned char *)pixel;
+		src = (unsigned char *)&color;
+
+		for( b=0; b<4; b++ )
+			if( ((unsigned char *)&mask)[b] )
+				dst[b] = src[b];
+	}
+}
+
+/*******************************************************************************
+* Function to read a single color from a databuffer                            *
+*                                                                              *
+* imagedata is the databuffer to read from                                     *
+* layout is the packed layout of the current pass, one of PIXELOPS_*           *
+* colors is the color map to read an index into, or NULL for a literal color   *
+*                                                                              *
+* Returns the color, channels that are not read are 0                          *
+*******************************************************************************/
+static inline struct pixel get_color( struct databuffer *imagedata, int layout, struct pixel *colors )
+{
+	struct pixel color;
+	unsigned char *data;
+	unsigned int value;
+
+	if( colors != NULL )
+		return colors[ databuffer_get_byte( imagedata ) ];
+
+	value = 0;
+
+	data = databuffer_get_span( imagedata, pixelops_packsize( layout ) );
+	if( data != NULL )
+		pixelops_unpack( &value, data, 1, layout );
+
+	memcpy( &color, &value, sizeof( color ) );
+
+	return color;
+}
+
+/*******************************************************************************
+* Function to read a palette block                                             *
+* The number of colors and the color indices are read from the command data,   *
+* the colors from the image data                                               *
+*                                                                              *
+* commanddata and imagedata are the databuffers to read from                   *
+* pixels is the output image data                                              *
+* x1, x2, y1, y2 describe the block                                            *
+* width is the width of the complete image                                     *
+* layout is the packed layout of the current pass, one of PIXELOPS_*           *
+* mask is the channel mask of the current pass                                 *
+* colormap is the color map to read indices into, or NULL for literal colors   *
+*******************************************************************************/
+static inline void get_palette_block( struct databuffer *commanddata, struct databuffer *imagedata, struct pixel *pixels, int x1, int x2, int y1, int y2, int width, int layout, unsigned int mask, struct pixel *colormap )
+{
+	struct pixel colors[ PALETTE_MAXCOLORS ];
+	int x, y, i, j, numcolors, bits;
+
+	numcolors = databuffer_get_bits( commanddata, 2 ) + 1;
+
+	colors[0] = get_color( imagedata, layout, colormap );
+
+	for( j=1; j<PALETTE_MAXCOLORS; j++ )
+	{
+		if( j < numcolors )
+			colors[j] = get_color( imagedata, layout, colormap );
+		else
+			colors[j] = colors[0];
+	}
+
+	bits = numcolors > 2 ? 2 : 1;
+
+	for( y=y1; y<y2; y++ )
+	{
+		i = x1 + y*width;
+		for( x=x1; x<x2; x++ )
+			set_channels( &pixels[ i++ ], colors[ databuffer_get_bits( commanddata, bits ) ], mask );
+	}
+}
+
+/*******************************************************************************
+* Structure to hold the state of the quad tree decompressor for one slice      *
+*                                                                              *
+* input is the compressed input image                                          *
+* slice is the slice to decompress                                             *
+* commanddata, imagedata and indexdata are the buffers of the slice            *
+* tilecache is the tile cache of the slice                                     *
+* outpixels are the pixels of the output image                                 *
+* refpixels are the pixels of the reference image, NULL for keyframes          *
+* damage is an optional map that receives the written blocks, or NULL          *
+* mask is the channel mask of the current pass                                 *
+* layout is the packed layout of the current pass, bgra the pixel format       *
+* minsize, maxdepth, keyframe, motion, blockcopy, palette and colordiff are    *
+* taken from the input image                                                   *
+* colors is the color map of the input image in the pixel format of the output *
+* image, NULL if the colors are stored literally                               *
+*******************************************************************************/
+struct qtc_decoder
+{
+	struct qti *input;
+	struct qti_slice *slice;
+
+	struct databuffer *commanddata, *imagedata, *indexdata;
+	struct tilecache *tilecache;
+
+	struct pixel *outpixels;
+	unsigned int *refpixels;
+	struct damage *damage;
+	unsigned int mask;
+	int layout, bgra;
+	int minsize, maxdepth;
+	int keyframe, motion, blockcopy, palette, colordiff;
+	struct pixel *colors;
+};
+
+/*******************************************************************************
+* Function to mark a decompressed block in the damage map of a decoder         *
+*                                                                              *
+* decoder is the decoder state                                                 *
+* x1, y1, x2, y2 describe the block                                            *
+*******************************************************************************/
+static inline void qtc_decompress_damage( struct qtc_decoder *decoder, int x1, int y1, int x2, int y2 )
+{
+	if( decoder->damage != NULL )
+		damage_add_rect( decoder->damage, x1, y1, x2-x1, y2-y1 );
+}
+
+/*******************************************************************************
+* Function to recursively decompress an image area                             *
+*                                                                              *
+* decoder is the decoder state                                                 *
+* x1, y1, x2, y2 describe the area                                             *
+* depth is the current recursion depth                                         *
+*******************************************************************************/
+static void qtc_decompress_rec( struct qtc_decoder *decoder, int x1, int y1, int x2, int y2, int depth )
+{
+	int x, y, sx, sy, i;
+	struct pixel color;
+	unsigned char status;
+	int index, width;
+
+	width = decoder->input->width;
+
+	if( decoder->keyframe )
+		status = 1;
+	else
+		status = databuffer_get_bits( decoder->commanddata, 1 );
+
+	if( status != 0 )
 	{
-		if( bgra )
+		if( decoder->motion && databuffer_get_bits( decoder->commanddata, 1 ) )
+		{
+			get_motion_block( decoder->imagedata, (unsigned int *)decoder->outpixels, decoder->refpixels, x1, x2, y1, y2, width, decoder->input->height, decoder->mask );
+			qtc_decompress_damage( decoder, x1, y1, x2, y2 );
+			return;
+		}
+
+		status = databuffer_get_bits( decoder->commanddata, 1 );
+
+		if( ( status == 0 ) && ( decoder->blockcopy ) &&
+		    ( x2-x1 >= COPY_MINSIZE ) && ( y2-y1 >= COPY_MINSIZE ) &&
+		    ( databuffer_get_bits( decoder->commanddata, 1 ) ) )
+		{
+			get_copy_block( decoder->imagedata, (unsigned int *)decoder->outpixels, x1, x2, y1, y2, width, decoder->slice, decoder->mask );
+			qtc_decompress_damage( decoder, x1, y1, x2, y2 );
+			return;
+		}
+
+		if( ( status == 0 ) && ( decoder->palette ) &&
+		    ( x2-x1 <= PALETTE_MAXSIZE ) && ( y2-y1 <= PALETTE_MAXSIZE ) &&
+		    ( databuffer_get_bits( decoder->commanddata, 1 ) ) )
+		{
+			get_palette_block( decoder->commanddata, decoder->imagedata, decoder->outpixels, x1, x2, y1, y2, width, decoder->layout, decoder->mask, decoder->colors );
+			qtc_decompress_damage( decoder, x1, y1, x2, y2 );
+			return;
+		}
+
+		if( status == 0 )
 		{
-			for( y=y1; y<y2; y++ )
+			if( depth < decoder->maxdepth )
 			{
-				i = x1 + y*width;
-				for( x=x1; x<x2; x++ )
+				if( ( x2-x1 > decoder->minsize ) && ( y2-y1 > decoder->minsize ) )
+				{
+					sx = x1 + (x2-x1)/2;
+					sy = y1 + (y2-y1)/2;
+
+					qtc_decompress_rec( decoder, x1, y1, sx, sy, depth+1 );
+					qtc_decompress_rec( decoder, x1, sy, sx, y2, depth+1 );
+					qtc_decompress_rec( decoder, sx, y1, x2, sy, depth+1 );
+					qtc_decompress_rec( decoder, sx, sy, x2, y2, depth+1 );
+				}
+				else
 				{
-					pixels[i].z = databuffer_get_byte( imagedata );
-					pixels[i].y = databuffer_get_byte( imagedata );
-					pixels[i].x = databuffer_get_byte( imagedata );
-					i++;
+					if( x2-x1 > decoder->minsize )
+					{
+						sx = x1 + (x2-x1)/2;
+
+						qtc_decompress_rec( decoder, x1, y1, sx, y2, depth+1 );
+						qtc_decompress_rec( decoder, sx, y1, x2, y2, depth+1 );
+					}
+					else if ( y2-y1 > decoder->minsize )
+					{
+						sy = y1 + (y2-y1)/2;
+
+						qtc_decompress_rec( decoder, x1, y1, x2, sy, depth+1 );
+						qtc_decompress_rec( decoder, x1, sy, x2, y2, depth+1 );
+					}
+					else
+					{
+						if( decoder->input->has_tilecache )
+						{
+							if( databuffer_get_bits( decoder->commanddata, 1 ) )
+							{
+								get_pixels( decoder->imagedata, decoder->outpixels, x1, x2, y1, y2, width, decoder->layout, decoder->colors );
+								tilecache_add( decoder->tilecache, (unsigned int *)decoder->outpixels, x1, x2, y1, y2, width, decoder->mask );
+							}
+							else
+							{
+								index = databuffer_get_bits( decoder->indexdata, decoder->tilecache->indexbits );
+								tilecache_read( decoder->tilecache, (unsigned int *)decoder->outpixels, index, x1, x2, y1, y2, width, decoder->mask );
+							}
+						}
+						else
+						{
+							get_pixels( decoder->imagedata, decoder->outpixels, x1, x2, y1, y2, width, decoder->layout, decoder->colors );
+						}
+
+						qtc_decompress_damage( decoder, x1, y1, x2, y2 );
+					}
 				}
 			}
+			else
+			{
+				get_pixels( decoder->imagedata, decoder->outpixels, x1, x2, y1, y2, width, decoder->layout, decoder->colors );
+				qtc_decompress_damage( decoder, x1, y1, x2, y2 );
+			}
 		}
 		else
 		{
+			color = get_color( decoder->imagedata, decoder->layout, decoder->colors );
+
 			for( y=y1; y<y2; y++ )
 			{
 				i = x1 + y*width;
 				for( x=x1; x<x2; x++ )
-				{
-					pixels[i].x = databuffer_get_byte( imagedata );
-					pixels[i].y = databuffer_get_byte( imagedata );
-					pixels[i].z = databuffer_get_byte( imagedata );
-					i++;
-				}
+					set_channels( &decoder->outpixels[ i++ ], color, decoder->mask );
 			}
+
+			qtc_decompress_damage( decoder, x1, y1, x2, y2 );
 		}
 	}
+}
+
+/*******************************************************************************
+* Function to decompress one slice, called by the thread pool                  *
+* Decompresses all passes, or only the pass of its plane with separate planes  *
+*                                                                              *
+* task is the decoder state of the slice                                       *
+*******************************************************************************/
+static void qtc_decompress_task( void *task )
+{
+	struct qtc_decoder *decoder;
+	struct qti_slice *slice;
+	int width, i;
+
+	decoder = task;
+	slice = decoder->slice;
+	width = decoder->input->width;
+
+	if( ! decoder->colordiff )
+	{
+		decoder->layout = plane_channels( 1, 0, decoder->bgra, &decoder->mask );
+		qtc_decompress_rec( decoder, 0, slice->y1, width, slice->y2, 0 );
+	}
+	else if( decoder->input->numplanes > 1 )
+	{
+		decoder->layout = plane_channels( decoder->input->numplanes, slice->plane, decoder->bgra, &decoder->mask );
+		qtc_decompress_rec( decoder, 0, slice->y1, width, slice->y2, 0 );
+	}
 	else
 	{
-		if( luma )
-		{
-			for( y=y1; y<y2; y++ )
-			{
-				i = x1 + y*width;
-				for( x=x1; x<x2; x++ )
-				{
-					pixels[i++].y = databuffer_get_byte( imagedata );
-				}
-			}
-		}
-		else
+		for( i=0; i<2; i++ )
 		{
-			if( ! bgra )
-			{
-				for( y=y1; y<y2; y++ )
-				{
-					i = x1 + y*width;
-					for( x=x1; x<x2; x++ )
-					{
-						pixels[i].x = databuffer_get_byte( imagedata );
-						pixels[i].z = databuffer_get_byte( imagedata );
-						i++;
-					}
-				}
-			}
-			else
-			{
-				for( y=y1; y<y2; y++ )
-				{
-					i = x1 + y*width;
-					for( x=x1; x<x2; x++ )
-					{
-						pixels[i].z = databuffer_get_byte( imagedata );
-						pixels[i].x = databuffer_get_byte( imagedata );
-						i++;
-					}
-				}
-			}
+			decoder->layout = plane_channels( 2, i, decoder->bgra, &decoder->mask );
+			qtc_decompress_rec( decoder, 0, slice->y1, width, slice->y2, 0 );
 		}
 	}
 }
 
+/*******************************************************************************
+* Function to free the per decoder damage maps of the decompressor             *
+*                                                                              *
+* damages is the array of damage maps                                          *
+* numdecoders is the number of entries in damages                              *
+* damage is the damage map of the caller, it is not freed                      *
+*******************************************************************************/
+static void qtc_decompress_free_damages( struct damage **damages, int numdecoders, struct damage *damage )
+{
+	int i;
+
+	for( i=0; i<numdecoders; i++ )
+	{
+		if( ( damages[i] != NULL ) && ( damages[i] != damage ) )
+			damage_free( damages[i] );
+	}
+
+	free( damages );
+}
+
 /*******************************************************************************
 * Function to decompress an image compressed using quad tree compression       *
 *                                                                              *
 * input is the compressed input image                                          *
 * refimage is the reference image, set to NULL for keyframes                   *
 * output is the uncompressed image                                             *
+* damage is an optional map that receives the changed areas, or NULL           *
+* pool is an optional thread pool to decompress the slices with, or NULL       *
+*                                                                              *
+* The damage map is not cleared, the changed blocks are added to it. Keyframes *
+* damage the whole map.                                                        *
+* If output is the reference image the frame is decoded in place, only the     *
+* changed blocks are written and unchanged blocks are not touched at all.      *
+* Frames with motion compensation read moved blocks from the reference image   *
+* and can not be decoded in place. A scrolled region is shifted before the     *
+* quad tree is applied and added to the damage map.                            *
 *                                                                              *
 * Returns 0 on failure, 1 on success                                           *
 *******************************************************************************/
-int qtc_decompress( struct qti *input, struct image *refimage, struct image *output )
+int qtc_decompress( struct qti *input, struct image *refimage, struct image *output, struct damage *damage, struct threadpool *pool )
 {
-	struct databuffer *commanddata, *imagedata, *indexdata;
-	int minsize, maxdepth;
-	int keyframe;
-	struct pixel *outpixels;
-	unsigned int mask;
-	int luma, bgra, colordiff;
+	struct qtc_decoder *decoders;
+	struct damage **damages;
+	void **tasks;
+	struct pixel colors[ QTI_MAXCOLORS ];
+	int i, numdecoders;
 
-	void qtc_decompress_rec( int x1, int y1, int x2, int y2, int depth )
+	if( ( damage != NULL ) && ( ( damage->width != input->width ) || ( damage->height != input->height ) ) )
 	{
-		int x, y, sx, sy, i;
-		struct pixel color;
-		unsigned char status;
-		int index;
+		fputs( "qtc_decompress: damage map size mismatch\n", stderr );
+		return 0;
+	}
 
-		if( keyframe )
-			status = 1;
-		else
-			status = databuffer_get_bits( commanddata, 1 );
+	if( ( input->motion ) && ( ( refimage == NULL ) || ( refimage == output ) ) )
+	{
+		fputs( "qtc_decompress: motion compensation needs a separate reference image\n", stderr );
+		return 0;
+	}
 
-		if( status != 0 )
-		{
-			status = databuffer_get_bits( commanddata, 1 );
-			if( status == 0 )
-			{
-				if( depth < maxdepth )
-				{
-					if( ( x2-x1 > minsize ) && ( y2-y1 > minsize ) )
-					{
-						sx = x1 + (x2-x1)/2;
-						sy = y1 + (y2-y1)/2;
+	if( ( input->scroll ) && ( refimage == NULL ) )
+	{
+		fputs( "qtc_decompress: scrolling needs a reference image\n", stderr );
+		return 0;
+	}
 
-						qtc_decompress_rec( x1, y1, sx, sy, depth+1 );
-						qtc_decompress_rec( x1, sy, sx, y2, depth+1 );
-						qtc_decompress_rec( sx, y1, x2, sy, depth+1 );
-						qtc_decompress_rec( sx, sy, x2, y2, depth+1 );
-					}
-					else
-					{
-						if( x2-x1 > minsize )
-						{
-							sx = x1 + (x2-x1)/2;
+	numdecoders = input->numslices*input->numplanes;
 
-							qtc_decompress_rec( x1, y1, sx, y2, depth+1 );
-							qtc_decompress_rec( sx, y1, x2, y2, depth+1 );
-						}
-						else if ( y2-y1 > minsize )
-						{
-							sy = y1 + (y2-y1)/2;
-	
-							qtc_decompress_rec( x1, y1, x2, sy, depth+1 );
-							qtc_decompress_rec( x1, sy, x2, y2, depth+1 );
-						}
-						else
-						{
-							if( input->has_tilecache )
-							{
-								if( databuffer_get_bits( commanddata, 1 ) )
-								{
-									get_pixels( imagedata, outpixels, x1, x2, y1, y2, input->width, bgra, colordiff, luma );
-									tilecache_add( input->tilecache, (unsigned int *)outpixels, x1, x2, y1, y2, input->width, mask );
-								}
-								else
-								{
-									index = databuffer_get_bits( indexdata, input->tilecache->indexbits );
-									tilecache_read( input->tilecache, (unsigned int *)outpixels, index, x1, x2, y1, y2, input->width, mask );
-								}
-							}
-							else
-							{
-								get_pixels( imagedata, outpixels, x1, x2, y1, y2, input->width, bgra, colordiff, luma );
-							}
-						}
-					}
-				}
-				else
-				{
-					get_pixels( imagedata, outpixels, x1, x2, y1, y2, input->width, bgra, colordiff, luma );
-				}
-			}
-			else
+	decoders = malloc( sizeof( *decoders ) * numdecoders );
+	damages = calloc( numdecoders, sizeof( *damages ) );
+	tasks = malloc( sizeof( *tasks ) * numdecoders );
+	if( ( decoders == NULL ) || ( damages == NULL ) || ( tasks == NULL ) )
+	{
+		perror( "qtc_decompress: malloc" );
+		free( decoders );
+		free( damages );
+		free( tasks );
+		return 0;
+	}
+
+	if( damage != NULL )
+	{
+		if( input->keyframe )		// Keyframes replace the whole image
+		{
+			damage_add_all( damage );
+		}
+		else if( numdecoders == 1 )
+		{
+			damages[0] = damage;
+		}
+		else		// Every decoder gets its own map, slices may share tiles
+		{
+			for( i=0; i<numdecoders; i++ )
 			{
-				if( ! colordiff )
+				damages[i] = damage_create( damage->width, damage->height, damage->tilesize );
+				if( damages[i] == NULL )
 				{
-					if( bgra )
-					{
-						color.z = databuffer_get_byte( imagedata );
-						color.y = databuffer_get_byte( imagedata );
-						color.x = databuffer_get_byte( imagedata );
-						color.a = 0;
-					}
-					else
-					{
-						color.x = databuffer_get_byte( imagedata );
-						color.y = databuffer_get_byte( imagedata );
-						color.z = databuffer_get_byte( imagedata );
-						color.a = 0;
-					}
-
-					for( y=y1; y<y2; y++ )
-					{
-						i = x1 + y*input->width;
-						for( x=x1; x<x2; x++ )
-						{
-							outpixels[ i++ ] = color;
-						}
-					}
+					qtc_decompress_free_damages( damages, numdecoders, damage );
+					free( decoders );
+					free( tasks );
+					return 0;
 				}
-				else
-				{
-					if( luma )
-					{
-						color.y = databuffer_get_byte( imagedata );
-
-						for( y=y1; y<y2; y++ )
-						{
-							i = x1 + y*input->width;
-							for( x=x1; x<x2; x++ )
-							{
-								outpixels[ i++ ].y = color.y;
-							}
-						}
-					}
-					else
-					{
-						if( bgra )
-						{
-							color.z = databuffer_get_byte( imagedata );
-							color.x = databuffer_get_byte( imagedata );
-						}
-						else
-						{
-							color.x = databuffer_get_byte( imagedata );
-							color.z = databuffer_get_byte( imagedata );
-						}
 
-						for( y=y1; y<y2; y++ )
-						{
-							i = x1 + y*input->width;
-							for( x=x1; x<x2; x++ )
-							{
-								outpixels[ i ].x = color.x;
-								outpixels[ i ].z = color.z;
-								i++;
-							}
-						}
-					}
-				}
+				damage_clear( damages[i] );
 			}
 		}
 	}
-	
-	commanddata = input->commanddata;
-	imagedata = input->imagedata;
-	indexdata = input->indexdata;
-	minsize = input->minsize;
-	maxdepth = input->maxdepth;
-	colordiff = input->colordiff == 2;
-	keyframe = input->keyframe;
-
-	bgra = output->bgra;
 
 	output->transform = input->transform;
 
-	if( input->colordiff >= 1 )
-		output->colordiff = 1;
+	output->colordiff = input->colordiff >= 1;
 
-	outpixels = output->pixels;
+	if( ( !input->keyframe ) && ( refimage != NULL ) && ( refimage != output ) )
+		memcpy( output->pixels, refimage->pixels, input->width * input->height * 4 );
 
-	if( ( !keyframe ) && ( refimage != NULL ) )
-		memcpy( outpixels, refimage->pixels, input->width * input->height * 4 );
+	if( input->scroll )
+	{
+		scroll_apply( (unsigned int *)output->pixels, input->width, input->scrollx1, input->scrolly1, input->scrollx2, input->scrolly2, input->scrolldx, input->scrolldy );
 
-	if( ! colordiff )
+		if( damage != NULL )
+			damage_add_rect( damage, input->scrollx1, input->scrolly1, input->scrollx2-input->scrollx1, input->scrolly2-input->scrolly1 );
+	}
+
+	for( i=0; i<QTI_MAXCOLORS; i++ )		// Convert the color map to the pixel format of the output image
+	{
+		if( i < input->numcolors )
+		{
+			colors[i].x = output->bgra ? input->colors[i][2] : input->colors[i][0];
+			colors[i].y = input->colors[i][1];
+			colors[i].z = output->bgra ? input->colors[i][0] : input->colors[i][2];
+		}
+		else
+		{
+			colors[i].x = colors[i].y = colors[i].z = 0;
+		}
+
+		colors[i].a = 0;
+	}
+
+	for( i=0; i<numdecoders; i++ )
+	{
+		decoders[i].input = input;
+		decoders[i].slice = &input->slices[i];
+		decoders[i].commanddata = input->slices[i].commanddata;
+		decoders[i].imagedata = input->slices[i].imagedata;
+		decoders[i].indexdata = input->slices[i].indexdata;
+		decoders[i].tilecache = input->slices[i].tilecache;
+		decoders[i].outpixels = output->pixels;
+		decoders[i].refpixels = refimage != NULL ? (unsigned int *)refimage->pixels : NULL;
+		decoders[i].damage = damages[i];
+		decoders[i].bgra = output->bgra;
+		decoders[i].minsize = input->minsize;
+		decoders[i].maxdepth = input->maxdepth;
+		decoders[i].keyframe = input->keyframe;
+		decoders[i].motion = input->motion;
+		decoders[i].blockcopy = input->blockcopy;
+		decoders[i].palette = input->palette;
+		decoders[i].colordiff = input->colordiff == 2;
+		decoders[i].colors = input->numcolors > 0 ? colors : NULL;
+
+		tasks[i] = &decoders[i];
+	}
+
+	if( ( pool != NULL ) && ( numdecoders > 1 ) )
 	{
-		mask = 0x00FFFFFF;
-		luma = 0;
-		qtc_decompress_rec( 0, 0, input->width, input->height, 0 );
+		threadpool_run( pool, qtc_decompress_task, tasks, numdecoders );
 	}
 	else
 	{
-		mask = 0x0000FF00;
-		luma = 1;
-		qtc_decompress_rec( 0, 0, input->width, input->height, 0 );
+		for( i=0; i<numdecoders; i++ )
+			qtc_decompress_task( tasks[i] );
+	}
 
-		mask = 0x00FF00FF;
-		luma = 0;
-		qtc_decompress_rec( 0, 0, input->width, input->height, 0 );
+	if( ( damage != NULL ) && ( damages[0] != damage ) )
+	{
+		for( i=0; i<numdecoders; i++ )
+		{
+			if( damages[i] != NULL )
+				damage_merge( damage, damages[i] );
+		}
 	}
 
+	qtc_decompress_free_damages( damages, numdecoders, damage );
+	free( decoders );
+	free( tasks );
+
 	return 1;
 }
 
+/*******************************************************************************
+* Function to skip the command data of a palette block                         *
+*                                                                              *
+* commanddata is the databuffer to read from                                   *
+* x1, y1, x2, y2 describe the block                                            *
+*******************************************************************************/
+static inline void qtc_decompress_ccode_skip_palette( struct databuffer *commanddata, int x1, int y1, int x2, int y2 )
+{
+	int i, bits;
+
+	bits = databuffer_get_bits( commanddata, 2 ) > 1 ? 2 : 1;
+
+	for( i=0; i<(x2-x1)*(y2-y1); i++ )
+		databuffer_get_bits( commanddata, bits );
+}
 
 /*******************************************************************************
 * Function to draw a transparent box with outlines into an image               *
@@ -762,6 +2261,7 @@ int qtc_decompress_ccode( struct qti *input, struct image *output, int channel )
 	int keyframe;
 	struct pixel *outpixels;
 	int bgra, colordiff;
+	int s, y1, y2;
 
 	void qtc_decompress_ccode_rec( int x1, int y1, int x2, int y2, int depth )
 	{
@@ -795,10 +2295,34 @@ int qtc_decompress_ccode( struct qti *input, struct image *output, int channel )
 			else
 				put_ccode_box( (unsigned int *)outpixels, x1, x2, y1, y2, input->width, 0x007F0000, 0x00FF0000 );
 		}
+		else if( input->motion && databuffer_get_bits( commanddata, 1 ) )
+		{
+			put_ccode_box( (unsigned int *)outpixels, x1, x2, y1, y2, input->width, 0x007F007F, 0x00FF00FF );
+		}
 		else
 		{
 			status = databuffer_get_bits( commanddata, 1 );
-			if( status == 0 )
+			if( ( status == 0 ) && ( input->blockcopy ) &&
+			    ( x2-x1 >= COPY_MINSIZE ) && ( y2-y1 >= COPY_MINSIZE ) &&
+			    ( databuffer_get_bits( commanddata, 1 ) ) )
+			{
+				if( bgra )
+					put_ccode_box( (unsigned int *)outpixels, x1, x2, y1, y2, input->width, 0x007F7F00, 0x00FFFF00 );
+				else
+					put_ccode_box( (unsigned int *)outpixels, x1, x2, y1, y2, input->width, 0x00007F7F, 0x0000FFFF );
+			}
+			else if( ( status == 0 ) && ( input->palette ) &&
+			         ( x2-x1 <= PALETTE_MAXSIZE ) && ( y2-y1 <= PALETTE_MAXSIZE ) &&
+			         ( databuffer_get_bits( commanddata, 1 ) ) )
+			{
+				qtc_decompress_ccode_skip_palette( commanddata, x1, y1, x2, y2 );
+
+				if( bgra )
+					put_ccode_box( (unsigned int *)outpixels, x1, x2, y1, y2, input->width, 0x00007F7F, 0x0000FFFF );
+				else
+					put_ccode_box( (unsigned int *)outpixels, x1, x2, y1, y2, input->width, 0x007F7F00, 0x00FFFF00 );
+			}
+			else if( status == 0 )
 			{
 				if( depth < maxdepth )
 				{
@@ -882,9 +2406,25 @@ int qtc_decompress_ccode( struct qti *input, struct image *output, int channel )
 		else
 			status = databuffer_get_bits( commanddata, 1 );
 
+		if( ( status != 0 ) && ( input->motion ) )
+			status = ! databuffer_get_bits( commanddata, 1 );
+
 		if( status != 0 )
 		{
 			status = databuffer_get_bits( commanddata, 1 );
+
+			if( ( status == 0 ) && ( input->blockcopy ) &&
+			    ( x2-x1 >= COPY_MINSIZE ) && ( y2-y1 >= COPY_MINSIZE ) )
+				status = databuffer_get_bits( commanddata, 1 );
+
+			if( ( status == 0 ) && ( input->palette ) &&
+			    ( x2-x1 <= PALETTE_MAXSIZE ) && ( y2-y1 <= PALETTE_MAXSIZE ) &&
+			    ( databuffer_get_bits( commanddata, 1 ) ) )
+			{
+				qtc_decompress_ccode_skip_palette( commanddata, x1, y1, x2, y2 );
+				status = 1;
+			}
+
 			if( status == 0 )
 			{
 				if( depth < maxdepth )
@@ -926,7 +2466,6 @@ int qtc_decompress_ccode( struct qti *input, struct image *output, int channel )
 		}
 	}
 	
-	commanddata = input->commanddata;
 	minsize = input->minsize;
 	maxdepth = input->maxdepth;
 	colordiff = input->colordiff == 2;
@@ -941,20 +2480,32 @@ int qtc_decompress_ccode( struct qti *input, struct image *output, int channel )
 	
 	memset( outpixels, 0, input->width*input->height*4 );
 
-	if( ! colordiff )
-	{
-		qtc_decompress_ccode_rec( 0, 0, input->width, input->height, 0 );
-	}
-	else
+	for( s=0; s<input->numslices*input->numplanes; s++ )
 	{
-		if( channel == 0 )
+		commanddata = input->slices[s].commanddata;
+		y1 = input->slices[s].y1;
+		y2 = input->slices[s].y2;
+
+		if( ! colordiff )
+		{
+			qtc_decompress_ccode_rec( 0, y1, input->width, y2, 0 );
+		}
+		else if( input->numplanes > 1 )
 		{
-			qtc_decompress_ccode_rec( 0, 0, input->width, input->height, 0 );
+			if( input->slices[s].plane == channel )
+				qtc_decompress_ccode_rec( 0, y1, input->width, y2, 0 );
 		}
 		else
 		{
-			qtc_decompress_ccode_dummy_rec( 0, 0, input->width, input->height, 0 );
-			qtc_decompress_ccode_rec( 0, 0, input->width, input->height, 0 );
+			if( channel == 0 )
+			{
+				qtc_decompress_ccode_rec( 0, y1, input->width, y2, 0 );
+			}
+			else
+			{
+				qtc_decompress_ccode_dummy_rec( 0, y1, input->width, y2, 0 );
+				qtc_decompress_ccode_rec( 0, y1, input->width, y2, 0 );
+			}
 		}
 	}
 
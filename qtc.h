@@ -20,8 +20,34 @@
 #ifndef QTC_H
 #define QTC_H
 
-extern int qtc_compress( struct image *input, struct image *refimage, struct qti *output, int lazyness, int colordiff );
-extern int qtc_decompress( struct qti *input, struct image *refimage, struct image *output );
+/*******************************************************************************
+* Structure to hold the optional settings of the quad tree compressor          *
+*                                                                              *
+* blockmap is an optional block map used to avoid rescanning blocks, or NULL   *
+* damage is an optional map of the areas that changed since refimage, or NULL  *
+* motion is an optional motion search to find moved blocks with, or NULL       *
+* scroll is an optional scroll detection to find a shifted region, or NULL     *
+* colormap is an optional color map to store the colors of the image in, or    *
+* NULL, it is only used without split channels and if the image has few colors *
+* blockcopy enables copies of repeated blocks within the image                 *
+* palette enables palette blocks for blocks of up to four colors               *
+* pool is an optional thread pool to compress with, or NULL                    *
+* splitdepth is the depth at which the quad tree is split up between threads   *
+*******************************************************************************/
+struct qtc_options
+{
+	struct blockmap *blockmap;
+	struct damage *damage;
+	struct motion *motion;
+	struct scroll *scroll;
+	struct colormap *colormap;
+	int blockcopy, palette;
+	struct threadpool *pool;
+	int splitdepth;
+};
+
+extern int qtc_compress( struct image *input, struct image *refimage, struct qti *output, int lazyness, int colordiff, struct qtc_options *options );
+extern int qtc_decompress( struct qti *input, struct image *refimage, struct image *output, struct damage *damage, struct threadpool *pool );
 extern int qtc_decompress_ccode( struct qti *input, struct image *output, int channel );
 
 #endif
@@ -23,12 +23,25 @@
 
 #include "databuffer.h"
 #include "rangecode.h"
+#include "rans.h"
 #include "tilecache.h"
+#include "bufferpool.h"
 
 #include "qti.h"
 
 #define FILEVERSION "QTI1"
 #define VERSION 5
+#define EXTVERSION 6
+
+#define FEATURE_SLICES 0x01
+#define FEATURE_PLANES 0x02
+#define FEATURE_COPY 0x04
+#define FEATURE_PALETTE 0x08
+#define FEATURE_COLORMAP 0x10
+#define FEATURE_BINARY 0x20
+#define FEATURE_RANS 0x40
+#define FEATURE_TREE 0x80
+#define FEATURE_CHANNELS 0x100
 
 /*******************************************************************************
 * Function to load and decompress a qti file                                   *
@@ -43,12 +56,13 @@ int qti_read( struct qti *image, char filename[] )
 	FILE * qti;
 	struct databuffer *compdata;
 	struct rangecoder *coder;
+	struct qti_slice *slice;
 	char header[4];
 	int width, height;
 	int minsize, maxdepth, cachesize, tilesize;
-	int compress;
+	int compress, cmdmodel, datamodel, rans, numslices, numplanes, i;
 	unsigned char flags, version;
-	unsigned int size;
+	unsigned int size, features;
 
 	if( filename == NULL )
 	{
@@ -97,7 +111,7 @@ int qti_read( struct qti *image, char filename[] )
 			return 0;
 		}
 
-		if( version != VERSION )
+		if( version != ( ( flags & (0x01<<6) ) ? EXTVERSION : VERSION ) )
 		{
 			fputs( "qti_read: Wrong version\n", stderr );
 			if( qti != stdin )
@@ -105,123 +119,136 @@ int qti_read( struct qti *image, char filename[] )
 			return 0;
 		}
 
-		image->width = width;
-		image->height = height;
-		image->minsize = minsize;
-		image->maxdepth = maxdepth;
-		image->transform = flags&0x03;
-		compress = ( flags & (0x01<<2) ) != 0;
-		image->colordiff = ( ( flags & (0x03<<3) ) >> 3 ) & 0x03;
-		image->has_tilecache = ( flags & (0x01<<5) ) != 0;
-		image->keyframe = 1;
+		features = 0;
+		numslices = 1;
+		numplanes = 1;
 
-		if( image->has_tilecache )
+		if( flags & (0x01<<6) )
 		{
-			if( ( fread( &cachesize, sizeof( cachesize ), 1, qti ) != 1 ) ||
-			    ( fread( &tilesize, sizeof( tilesize ), 1, qti ) != 1 ) )
+			if( fread( &features, sizeof( features ), 1, qti ) != 1 )
 			{
-				fputs( "qti_read: Short read on cache info\n", stderr );
+				fputs( "qti_read: Short read on feature flags\n", stderr );
 				if( qti != stdin )
 					fclose( qti );
 				return 0;
 			}
 
-			image->tilecache = tilecache_create( cachesize, tilesize );
-			if( image->tilecache == NULL )
-				return 0;
-		}
-
-		if( compress )
-		{
-			if( fread( &size, sizeof( size ), 1, qti ) != 1 )
+			if( features & ~( FEATURE_SLICES | FEATURE_PLANES | FEATURE_COPY | FEATURE_PALETTE | FEATURE_COLORMAP | FEATURE_BINARY | FEATURE_RANS | FEATURE_TREE | FEATURE_CHANNELS ) )
 			{
-				fputs( "qti_read: Short read on compressed command data size\n", stderr );
+				fputs( "qti_read: Unsupported features\n", stderr );
 				if( qti != stdin )
 					fclose( qti );
 				return 0;
 			}
 
-			compdata = databuffer_create( size );
-			if( compdata == NULL )
-				return 0;
+			if( features & FEATURE_SLICES )
+			{
+				if( fread( &numslices, sizeof( numslices ), 1, qti ) != 1 )
+				{
+					fputs( "qti_read: Short read on slice info\n", stderr );
+					if( qti != stdin )
+						fclose( qti );
+					return 0;
+				}
 
-			compdata->size = size;
+				if( ( numslices < 1 ) || ( numslices > height ) )
+				{
+					fputs( "qti_read: Invalid number of slices\n", stderr );
+					if( qti != stdin )
+						fclose( qti );
+					return 0;
+				}
+			}
 
-			if( fread( &size, sizeof( size ), 1, qti ) != 1 )
+			if( features & FEATURE_PLANES )
 			{
-				fputs( "qti_read: Short read on uncompressed command data size\n", stderr );
-				if( qti != stdin )
-					fclose( qti );
-				return 0;
+				if( ( ( flags & (0x03<<3) ) >> 3 ) != 2 )
+				{
+					fputs( "qti_read: Planes without separate color channels\n", stderr );
+					if( qti != stdin )
+						fclose( qti );
+					return 0;
+				}
+
+				numplanes = ( features & FEATURE_CHANNELS ) ? 3 : 2;
 			}
+		}
 
-			if( fread( compdata->data, 1, compdata->size, qti ) != compdata->size )
+		image->width = width;
+		image->height = height;
+		image->minsize = minsize;
+		image->maxdepth = maxdepth;
+		image->transform = flags&0x03;
+		compress = ( flags & (0x01<<2) ) != 0;
+		cmdmodel = ( features & FEATURE_BINARY ) ? RANGECODER_BINARY : RANGECODER_LINEAR;
+		datamodel = ( features & FEATURE_TREE ) ? RANGECODER_TREE : RANGECODER_GROUPED;
+		rans = ( features & FEATURE_RANS ) != 0;
+		image->colordiff = ( ( flags & (0x03<<3) ) >> 3 ) & 0x03;
+		image->has_tilecache = ( flags & (0x01<<5) ) != 0;
+		image->keyframe = 1;
+		image->motion = 0;
+		image->scroll = 0;
+		image->blockcopy = ( features & FEATURE_COPY ) != 0;
+		image->palette = ( features & FEATURE_PALETTE ) != 0;
+		image->numcolors = 0;
+		image->firstcolor = 0;
+		image->bufferpool = NULL;
+
+		if( features & FEATURE_COLORMAP )
+		{
+			if( fread( &(image->numcolors), sizeof( image->numcolors ), 1, qti ) != 1 )
 			{
-				fputs( "qti_read: Short read on compressed command data\n", stderr );
+				fputs( "qti_read: Short read on color map size\n", stderr );
 				if( qti != stdin )
 					fclose( qti );
 				return 0;
 			}
-			
-			image->commanddata = databuffer_create( size );
-			if( image->commanddata == NULL )
-				return 0;
-
-			coder = rangecoder_create( 8, 1 );
 
-			rangecode_decompress( coder, compdata, image->commanddata, size );
-			
-			rangecoder_free( coder );
-			databuffer_free( compdata );
-
-
-			if( fread( &size, sizeof( size ), 1, qti ) != 1 )
+			if( ( image->numcolors < 1 ) || ( image->numcolors > QTI_MAXCOLORS ) || ( image->colordiff == 2 ) )
 			{
-				fputs( "qti_read: Short read on compressed image data size\n", stderr );
+				fputs( "qti_read: Invalid color map\n", stderr );
 				if( qti != stdin )
 					fclose( qti );
 				return 0;
 			}
 
-			compdata = databuffer_create( size );
-			if( compdata == NULL )
-				return 0;
-
-			compdata->size = size;
-
-			if( fread( &size, sizeof( size ), 1, qti ) != 1 )
+			if( fread( image->colors, 3, image->numcolors, qti ) != (size_t)image->numcolors )
 			{
-				fputs( "qti_read: Short read on uncompressed image data size\n", stderr );
+				fputs( "qti_read: Short read on color map\n", stderr );
 				if( qti != stdin )
 					fclose( qti );
 				return 0;
 			}
+		}
 
-			if( fread( compdata->data, 1, compdata->size, qti ) != compdata->size )
+		if( image->has_tilecache )
+		{
+			if( ( fread( &cachesize, sizeof( cachesize ), 1, qti ) != 1 ) ||
+			    ( fread( &tilesize, sizeof( tilesize ), 1, qti ) != 1 ) )
 			{
-				fputs( "qti_read: Short read on compressed image data\n", stderr );
+				fputs( "qti_read: Short read on cache info\n", stderr );
 				if( qti != stdin )
 					fclose( qti );
 				return 0;
 			}
-			
-			image->imagedata = databuffer_create( size );
-			if( image->imagedata == NULL )
-				return 0;
 
-			coder = rangecoder_create( 2, 8 );
+			image->tilecache = tilecache_create( cachesize, tilesize );
+			if( image->tilecache == NULL )
+				return 0;
+		}
 
-			rangecode_decompress( coder, compdata, image->imagedata, size );
-			
-			rangecoder_free( coder );
-			databuffer_free( compdata );
+		if( ! qti_create_slices( image, numslices, numplanes ) )
+			return 0;
 
+		for( i=0; i<image->numslices*image->numplanes; i++ )
+		{
+			slice = &image->slices[i];
 
-			if( image->has_tilecache )
+			if( compress )
 			{
 				if( fread( &size, sizeof( size ), 1, qti ) != 1 )
 				{
-					fputs( "qti_read: Short read on compressed index data size\n", stderr );
+					fputs( "qti_read: Short read on compressed command data size\n", stderr );
 					if( qti != stdin )
 						fclose( qti );
 					return 0;
@@ -235,7 +262,7 @@ int qti_read( struct qti *image, char filename[] )
 
 				if( fread( &size, sizeof( size ), 1, qti ) != 1 )
 				{
-					fputs( "qti_read: Short read on uncompressed index data size\n", stderr );
+					fputs( "qti_read: Short read on uncompressed command data size\n", stderr );
 					if( qti != stdin )
 						fclose( qti );
 					return 0;
@@ -243,95 +270,198 @@ int qti_read( struct qti *image, char filename[] )
 
 				if( fread( compdata->data, 1, compdata->size, qti ) != compdata->size )
 				{
-					fputs( "qti_read: Short read on compressed index data\n", stderr );
+					fputs( "qti_read: Short read on compressed command data\n", stderr );
 					if( qti != stdin )
 						fclose( qti );
 					return 0;
 				}
 			
-				image->indexdata = databuffer_create( size );
-				if( image->indexdata == NULL )
+				slice->commanddata = databuffer_create( size );
+				if( slice->commanddata == NULL )
 					return 0;
 
-				coder = rangecoder_create( 2, 8 );
+				coder = rangecoder_create( 8, 1, cmdmodel, 0 );
 
-				rangecode_decompress( coder, compdata, image->indexdata, size );
+				rangecode_decompress( coder, compdata, slice->commanddata, size );
 			
 				rangecoder_free( coder );
 				databuffer_free( compdata );
-			}
-		}
-		else
-		{
-			if( fread( &size, sizeof( size ), 1, qti ) != 1 )
-			{
-				fputs( "qti_read: Short read on command data size\n", stderr );
-				if( qti != stdin )
-					fclose( qti );
-				return 0;
-			}
 
-			image->commanddata = databuffer_create( size );
-			if( image->commanddata == NULL )
-				return 0;
 
-			image->commanddata->size = size;
-			if( fread( image->commanddata->data, 1, image->commanddata->size, qti ) != image->commanddata->size )
-			{
-				fputs( "qti_read: Short read on command data\n", stderr );
-				if( qti != stdin )
-					fclose( qti );
-				return 0;
-			}
+				if( fread( &size, sizeof( size ), 1, qti ) != 1 )
+				{
+					fputs( "qti_read: Short read on compressed image data size\n", stderr );
+					if( qti != stdin )
+						fclose( qti );
+					return 0;
+				}
 
+				compdata = databuffer_create( size );
+				if( compdata == NULL )
+					return 0;
 
-			if( fread( &size, sizeof( size ), 1, qti ) != 1 )
-			{
-				fputs( "qti_read: Short read on image data size\n", stderr );
-				if( qti != stdin )
-					fclose( qti );
-				return 0;
-			}
+				compdata->size = size;
 
-			image->imagedata = databuffer_create( size );
-			if( image->imagedata == NULL )
-				return 0;
+				if( fread( &size, sizeof( size ), 1, qti ) != 1 )
+				{
+					fputs( "qti_read: Short read on uncompressed image data size\n", stderr );
+					if( qti != stdin )
+						fclose( qti );
+					return 0;
+				}
 
-			image->imagedata->size = size;
-			if( fread( image->imagedata->data, 1, image->imagedata->size, qti ) != image->imagedata->size )
-			{
-				fputs( "qti_read: Short read on image data\n", stderr );
-				if( qti != stdin )
-					fclose( qti );
-				return 0;
-			}
+				if( fread( compdata->data, 1, compdata->size, qti ) != compdata->size )
+				{
+					fputs( "qti_read: Short read on compressed image data\n", stderr );
+					if( qti != stdin )
+						fclose( qti );
+					return 0;
+				}
+			
+				slice->imagedata = databuffer_create( size );
+				if( slice->imagedata == NULL )
+					return 0;
+
+				if( rans )
+				{
+					if( ! rans_decompress( compdata, slice->imagedata, size ) )
+						return 0;
+				}
+				else
+				{
+					coder = rangecoder_create( 2, 8, datamodel, 0 );
 
+					rangecode_decompress( coder, compdata, slice->imagedata, size );
 
-			if( image->has_tilecache )
+					rangecoder_free( coder );
+				}
+				databuffer_free( compdata );
+
+
+				if( image->has_tilecache )
+				{
+					if( fread( &size, sizeof( size ), 1, qti ) != 1 )
+					{
+						fputs( "qti_read: Short read on compressed index data size\n", stderr );
+						if( qti != stdin )
+							fclose( qti );
+						return 0;
+					}
+
+					compdata = databuffer_create( size );
+					if( compdata == NULL )
+						return 0;
+
+					compdata->size = size;
+
+					if( fread( &size, sizeof( size ), 1, qti ) != 1 )
+					{
+						fputs( "qti_read: Short read on uncompressed index data size\n", stderr );
+						if( qti != stdin )
+							fclose( qti );
+						return 0;
+					}
+
+					if( fread( compdata->data, 1, compdata->size, qti ) != compdata->size )
+					{
+						fputs( "qti_read: Short read on compressed index data\n", stderr );
+						if( qti != stdin )
+							fclose( qti );
+						return 0;
+					}
+			
+					slice->indexdata = databuffer_create( size );
+					if( slice->indexdata == NULL )
+						return 0;
+
+					if( rans )
+					{
+						if( ! rans_decompress( compdata, slice->indexdata, size ) )
+							return 0;
+					}
+					else
+					{
+						coder = rangecoder_create( 2, 8, datamodel, 0 );
+
+						rangecode_decompress( coder, compdata, slice->indexdata, size );
+
+						rangecoder_free( coder );
+					}
+					databuffer_free( compdata );
+				}
+			}
+			else
 			{
 				if( fread( &size, sizeof( size ), 1, qti ) != 1 )
 				{
-					fputs( "qti_read: Short read on index data size\n", stderr );
+					fputs( "qti_read: Short read on command data size\n", stderr );
+					if( qti != stdin )
+						fclose( qti );
+					return 0;
+				}
+
+				slice->commanddata = databuffer_create( size );
+				if( slice->commanddata == NULL )
+					return 0;
+
+				slice->commanddata->size = size;
+				if( fread( slice->commanddata->data, 1, slice->commanddata->size, qti ) != slice->commanddata->size )
+				{
+					fputs( "qti_read: Short read on command data\n", stderr );
+					if( qti != stdin )
+						fclose( qti );
+					return 0;
+				}
+
+
+				if( fread( &size, sizeof( size ), 1, qti ) != 1 )
+				{
+					fputs( "qti_read: Short read on image data size\n", stderr );
 					if( qti != stdin )
 						fclose( qti );
 					return 0;
 				}
 
-				image->indexdata = databuffer_create( size );
-				if( image->indexdata == NULL )
+				slice->imagedata = databuffer_create( size );
+				if( slice->imagedata == NULL )
 					return 0;
 
-				image->indexdata->size = size;
-				if( fread( image->indexdata->data, 1, image->indexdata->size, qti ) != image->indexdata->size )
+				slice->imagedata->size = size;
+				if( fread( slice->imagedata->data, 1, slice->imagedata->size, qti ) != slice->imagedata->size )
 				{
-					fputs( "qti_read: Short read on index data\n", stderr );
+					fputs( "qti_read: Short read on image data\n", stderr );
 					if( qti != stdin )
 						fclose( qti );
 					return 0;
 				}
+
+
+				if( image->has_tilecache )
+				{
+					if( fread( &size, sizeof( size ), 1, qti ) != 1 )
+					{
+						fputs( "qti_read: Short read on index data size\n", stderr );
+						if( qti != stdin )
+							fclose( qti );
+						return 0;
+					}
+
+					slice->indexdata = databuffer_create( size );
+					if( slice->indexdata == NULL )
+						return 0;
+
+					slice->indexdata->size = size;
+					if( fread( slice->indexdata->data, 1, slice->indexdata->size, qti ) != slice->indexdata->size )
+					{
+						fputs( "qti_read: Short read on index data\n", stderr );
+						if( qti != stdin )
+							fclose( qti );
+						return 0;
+					}
+				}
 			}
 		}
-		
+
 		if( qti != stdin )
 			fclose( qti );
 		
@@ -348,6 +478,9 @@ int qti_read( struct qti *image, char filename[] )
 * Function to compress a qti and write it to a file                            *
 *                                                                              *
 * image is the image to be written                                             *
+* compress is 0 to store the data as it is or QTI_COMPRESS, optionally with    *
+* QTI_COMPRESS_BINARY for the command data and QTI_COMPRESS_RANS for the image *
+* and index data or QTI_COMPRESS_TREE to range code them bit by bit            *
 * filename is the file name of the new qti file                                *
 *                                                                              *
 * Returns 0 on failure, 1 on success                                           *
@@ -357,8 +490,10 @@ int qti_write( struct qti *image, int compress, char filename[] )
 	FILE * qti;
 	struct databuffer *compdata;
 	struct rangecoder *coder;
+	struct qti_slice *slice;
 	unsigned char flags, version;
-	unsigned int size;
+	unsigned int size, features;
+	int i;
 
 	if( filename == NULL )
 	{
@@ -382,10 +517,36 @@ int qti_write( struct qti *image, int compress, char filename[] )
 		
 		flags = 0;
 		flags |= image->transform & 0x03;
-		flags |= ( compress & 0x01 ) << 2;
+		flags |= ( compress != 0 ) << 2;
 		flags |= ( image->colordiff & 0x03 ) << 3;
 		flags |= ( image->has_tilecache & 0x01 ) << 5;
 		version = VERSION;
+
+		features = 0;
+		if( image->numslices > 1 )
+			features |= FEATURE_SLICES;
+		if( image->numplanes > 1 )
+			features |= FEATURE_PLANES;
+		if( image->numplanes > 2 )
+			features |= FEATURE_CHANNELS;
+		if( image->blockcopy )
+			features |= FEATURE_COPY;
+		if( image->palette )
+			features |= FEATURE_PALETTE;
+		if( image->numcolors > 0 )
+			features |= FEATURE_COLORMAP;
+		if( compress & QTI_COMPRESS_BINARY )
+			features |= FEATURE_BINARY;
+		if( compress & QTI_COMPRESS_RANS )
+			features |= FEATURE_RANS;
+		if( compress & QTI_COMPRESS_TREE )
+			features |= FEATURE_TREE;
+
+		if( features )
+		{
+			flags |= 0x01 << 6;
+			version = EXTVERSION;
+		}
 		
 		fwrite( &(version), sizeof( version ), 1, qti );
 		fwrite( &(image->width), sizeof( image->width ), 1, qti );
@@ -393,6 +554,20 @@ int qti_write( struct qti *image, int compress, char filename[] )
 		fwrite( &(flags), sizeof( flags ), 1, qti );
 		fwrite( &(image->minsize), sizeof( image->minsize ), 1, qti );
 		fwrite( &(image->maxdepth), sizeof( image->maxdepth ), 1, qti );
+
+		if( features )
+		{
+			fwrite( &features, sizeof( features ), 1, qti );
+
+			if( features & FEATURE_SLICES )
+				fwrite( &(image->numslices), sizeof( image->numslices ), 1, qti );
+
+			if( features & FEATURE_COLORMAP )
+			{
+				fwrite( &(image->numcolors), sizeof( image->numcolors ), 1, qti );
+				fwrite( image->colors, 3, image->numcolors, qti );
+			}
+		}
 		
 		if( image->has_tilecache )
 		{
@@ -400,99 +575,122 @@ int qti_write( struct qti *image, int compress, char filename[] )
 			fwrite( &(image->tilecache->blocksize), sizeof( image->tilecache->blocksize ), 1, qti );
 		}
 
-		databuffer_pad( image->commanddata );
-		databuffer_pad( image->imagedata );
-
-		if( image->has_tilecache )
-			databuffer_pad( image->indexdata );
-		
 		size = 0;
 
-		if( compress )
+		for( i=0; i<image->numslices*image->numplanes; i++ )
 		{
-			compdata = databuffer_create( image->commanddata->size );
-			if( compdata == NULL )
-				return 0;
+			slice = &image->slices[i];
 
-			coder = rangecoder_create( 8, 1 );
-			if( coder == NULL )
-				return 0;
+			databuffer_pad( slice->commanddata );
+			databuffer_pad( slice->imagedata );
 
-			rangecode_compress( coder, image->commanddata, compdata );
-			databuffer_pad( compdata );
-
-			fwrite( &(compdata->size), sizeof( compdata->size ), 1, qti );
-			fwrite( &(image->commanddata->size), sizeof( image->commanddata->size ), 1, qti );
-			fwrite( compdata->data, 1, compdata->size, qti );
-
-			size += sizeof( compdata->size ) + sizeof( image->commanddata->size ) + compdata->size;
-
-			rangecoder_free( coder );
-			databuffer_free( compdata );
+			if( image->has_tilecache )
+				databuffer_pad( slice->indexdata );
 
+			if( compress )
+			{
+				compdata = databuffer_create( slice->commanddata->size );
+				if( compdata == NULL )
+					return 0;
 
-			compdata = databuffer_create( image->imagedata->size / 2 + 1 );
-			if( compdata == NULL )
-				return 0;
+				coder = rangecoder_create( 8, 1, ( compress & QTI_COMPRESS_BINARY ) ? RANGECODER_BINARY : RANGECODER_LINEAR, 0 );
+				if( coder == NULL )
+					return 0;
 
-			coder = rangecoder_create( 2, 8 );
-			if( coder == NULL )
-				return 0;
+				rangecode_compress( coder, slice->commanddata, compdata );
+				databuffer_pad( compdata );
 
-			rangecode_compress( coder, image->imagedata, compdata );
-			databuffer_pad( compdata );
+				fwrite( &(compdata->size), sizeof( compdata->size ), 1, qti );
+				fwrite( &(slice->commanddata->size), sizeof( slice->commanddata->size ), 1, qti );
+				fwrite( compdata->data, 1, compdata->size, qti );
 
-			fwrite( &(compdata->size), sizeof( compdata->size ), 1, qti );
-			fwrite( &(image->imagedata->size), sizeof( image->imagedata->size ), 1, qti );
-			fwrite( compdata->data, 1, compdata->size, qti );
+				size += sizeof( compdata->size ) + sizeof( slice->commanddata->size ) + compdata->size;
 
-			size += sizeof( compdata->size ) + sizeof( image->imagedata->size ) + compdata->size;
+				rangecoder_free( coder );
+				databuffer_free( compdata );
 
-			rangecoder_free( coder );
-			databuffer_free( compdata );
 
-			if( image->has_tilecache )
-			{
-				compdata = databuffer_create( image->indexdata->size / 2 + 1 );
+				compdata = databuffer_create( slice->imagedata->size / 2 + 1 );
 				if( compdata == NULL )
 					return 0;
 
-				coder = rangecoder_create( 2, 8 );
-				if( coder == NULL )
-					return 0;
+				if( compress & QTI_COMPRESS_RANS )
+				{
+					if( ! rans_compress( slice->imagedata, compdata ) )
+						return 0;
+				}
+				else
+				{
+					coder = rangecoder_create( 2, 8, ( compress & QTI_COMPRESS_TREE ) ? RANGECODER_TREE : RANGECODER_GROUPED, 0 );
+					if( coder == NULL )
+						return 0;
 
-				rangecode_compress( coder, image->indexdata, compdata );
-				databuffer_pad( compdata );
+					rangecode_compress( coder, slice->imagedata, compdata );
+					databuffer_pad( compdata );
+
+					rangecoder_free( coder );
+				}
 
 				fwrite( &(compdata->size), sizeof( compdata->size ), 1, qti );
-				fwrite( &(image->indexdata->size), sizeof( image->indexdata->size ), 1, qti );
+				fwrite( &(slice->imagedata->size), sizeof( slice->imagedata->size ), 1, qti );
 				fwrite( compdata->data, 1, compdata->size, qti );
 
-				size += sizeof( compdata->size ) + sizeof( image->indexdata->size ) + compdata->size;
+				size += sizeof( compdata->size ) + sizeof( slice->imagedata->size ) + compdata->size;
 
-				rangecoder_free( coder );
 				databuffer_free( compdata );
+
+				if( image->has_tilecache )
+				{
+					compdata = databuffer_create( slice->indexdata->size / 2 + 1 );
+					if( compdata == NULL )
+						return 0;
+
+					if( compress & QTI_COMPRESS_RANS )
+					{
+						if( ! rans_compress( slice->indexdata, compdata ) )
+							return 0;
+					}
+					else
+					{
+						coder = rangecoder_create( 2, 8, ( compress & QTI_COMPRESS_TREE ) ? RANGECODER_TREE : RANGECODER_GROUPED, 0 );
+						if( coder == NULL )
+							return 0;
+
+						rangecode_compress( coder, slice->indexdata, compdata );
+						databuffer_pad( compdata );
+
+						rangecoder_free( coder );
+					}
+
+					fwrite( &(compdata->size), sizeof( compdata->size ), 1, qti );
+					fwrite( &(slice->indexdata->size), sizeof( slice->indexdata->size ), 1, qti );
+					fwrite( compdata->data, 1, compdata->size, qti );
+
+					size += sizeof( compdata->size ) + sizeof( slice->indexdata->size ) + compdata->size;
+
+					databuffer_free( compdata );
+				}
 			}
-		}
-		else
-		{
-			fwrite( &(image->commanddata->size), sizeof( image->commanddata->size ), 1, qti );
-			fwrite( image->commanddata->data, 1, image->commanddata->size, qti );
+			else
+			{
+				fwrite( &(slice->commanddata->size), sizeof( slice->commanddata->size ), 1, qti );
+				fwrite( slice->commanddata->data, 1, slice->commanddata->size, qti );
 			
-			size += sizeof( image->commanddata->size ) + image->commanddata->size;
+				size += sizeof( slice->commanddata->size ) + slice->commanddata->size;
 
 
-			fwrite( &(image->imagedata->size), sizeof( image->imagedata->size ), 1, qti );
-			fwrite( image->imagedata->data, 1, image->imagedata->size, qti );
+				fwrite( &(slice->imagedata->size), sizeof( slice->imagedata->size ), 1, qti );
+				fwrite( slice->imagedata->data, 1, slice->imagedata->size, qti );
 			
-			size += sizeof( image->imagedata->size ) + image->imagedata->size;
+				size += sizeof( slice->imagedata->size ) + slice->imagedata->size;
 
-			if( image->has_tilecache )
-			{
-				fwrite( &(image->indexdata->size), sizeof( image->indexdata->size ), 1, qti );
-				fwrite( image->indexdata->data, 1, image->indexdata->size, qti );
+				if( image->has_tilecache )
+				{
+					fwrite( &(slice->indexdata->size), sizeof( slice->indexdata->size ), 1, qti );
+					fwrite( slice->indexdata->data, 1, slice->indexdata->size, qti );
 			
-				size += sizeof( image->indexdata->size ) + image->indexdata->size;
+					size += sizeof( slice->indexdata->size ) + slice->indexdata->size;
+				}
 			}
 		}
 
@@ -517,13 +715,20 @@ int qti_write( struct qti *image, int compress, char filename[] )
 * minsize is the minimal block size used during compression                    *
 * maxdepth is the maximum recursion depth used during compression              *
 * tilecache is the tile cache to associate with this image                     *
+* numslices is the number of horizontal slices to split the image into         *
+* numplanes is 2 to code luma and chroma as separate planes, 3 to code every   *
+* channel as a plane of its own, 1 otherwise                                   *
+* pool is the buffer pool to take the data buffers from, or NULL               *
 *                                                                              *
 * Modifies the qti structure                                                   *
 *                                                                              *
 * Returns 0 on failure, 1 on success                                           *
 *******************************************************************************/
-int qti_create( struct qti *image, int width, int height, int minsize, int maxdepth, struct tilecache *cache )
+int qti_create( struct qti *image, int width, int height, int minsize, int maxdepth, struct tilecache *cache, int numslices, int numplanes, struct bufferpool *pool )
 {
+	struct qti_slice *slice;
+	int i;
+
 	image->width = width;
 	image->height = height;
 	image->minsize = minsize;
@@ -531,34 +736,118 @@ int qti_create( struct qti *image, int width, int height, int minsize, int maxde
 	image->transform = 0;
 	image->colordiff = 0;
 	image->keyframe = 0;
+	image->motion = 0;
+	image->scroll = 0;
+	image->blockcopy = 0;
+	image->palette = 0;
+	image->numcolors = 0;
+	image->firstcolor = 0;
+	image->bufferpool = pool;
 
 	if( cache != NULL )
 	{
 		image->has_tilecache = 1;
 		image->tilecache = cache;
-
-		image->indexdata = databuffer_create( 1024*64 );
-		if( image->indexdata == NULL )
-			return 0;
 	}
 	else
 	{
 		image->has_tilecache = 0;
 	}
 
-	image->imagedata = databuffer_create( 1024*512 );
-	if( image->imagedata == NULL )
+	if( ! qti_create_slices( image, numslices, numplanes ) )
 		return 0;
 
-	image->commanddata = databuffer_create( 1204 );
-	if( image->commanddata == NULL )
+	for( i=0; i<image->numslices*image->numplanes; i++ )
+	{
+		slice = &image->slices[i];
+
+		if( image->has_tilecache )
+		{
+			slice->indexdata = bufferpool_get( pool, 1024*64 );
+			if( slice->indexdata == NULL )
+				return 0;
+		}
+
+		slice->imagedata = bufferpool_get( pool, 1024*512 );
+		if( slice->imagedata == NULL )
+			return 0;
+
+		slice->commanddata = bufferpool_get( pool, 1204 );
+		if( slice->commanddata == NULL )
+			return 0;
+	}
+
+	return 1;
+}
+
+/*******************************************************************************
+* Function to split a qti into horizontal slices                               *
+* The slices get their rows, planes and tile caches assigned, their data       *
+* buffers are left empty. With planes every slice is stored once per plane,    *
+* the luma plane followed by the chroma plane or the two chroma channels.      *
+*                                                                              *
+* image is the qti to split, its height and tile cache have to be set          *
+* numslices is the number of slices, it is clamped to the image height         *
+* numplanes is the number of planes, 1 to 3                                    *
+*                                                                              *
+* Modifies the qti structure                                                   *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+int qti_create_slices( struct qti *image, int numslices, int numplanes )
+{
+	struct qti_slice *slice;
+	int i, j;
+
+	if( numslices > image->height )
+		numslices = image->height;
+
+	if( numslices < 1 )
+		numslices = 1;
+
+	if( ( numplanes < 1 ) || ( numplanes > 3 ) )
+		numplanes = 1;
+
+	image->slices = malloc( sizeof( *image->slices ) * numslices * numplanes );
+	if( image->slices == NULL )
+	{
+		perror( "qti_create_slices: malloc" );
 		return 0;
+	}
+
+	image->numslices = numslices;
+	image->numplanes = numplanes;
+
+	for( i=0; i<numslices; i++ )
+	{
+		for( j=0; j<numplanes; j++ )
+		{
+			slice = &image->slices[i*numplanes+j];
+
+			slice->y1 = i*image->height/numslices;
+			slice->y2 = (i+1)*image->height/numslices;
+			slice->plane = j;
+
+			slice->imagedata = NULL;
+			slice->commanddata = NULL;
+			slice->indexdata = NULL;
+			slice->tilecache = NULL;
+
+			if( image->has_tilecache )
+			{
+				slice->tilecache = tilecache_get_sibling( image->tilecache, i*numplanes+j );
+				if( slice->tilecache == NULL )
+					return 0;
+			}
+		}
+	}
 
 	return 1;
 }
 
 /*******************************************************************************
 * Function to free the internal structures of a qti                            *
+* The data buffers are given back to the buffer pool of the qti, if any        *
 *                                                                              *
 * image is the qti to free                                                     *
 *                                                                              *
@@ -566,16 +855,22 @@ int qti_create( struct qti *image, int width, int height, int minsize, int maxde
 *******************************************************************************/
 void qti_free( struct qti *image )
 {
-	databuffer_free( image->imagedata );
-	image->imagedata = NULL;
-	databuffer_free( image->commanddata );
-	image->commanddata = NULL;
+	int i;
 
-	if( image->has_tilecache )
+	for( i=0; i<image->numslices*image->numplanes; i++ )
 	{
-		databuffer_free( image->indexdata );
-		image->indexdata = NULL;
+		if( image->slices[i].imagedata != NULL )
+			bufferpool_put( image->bufferpool, image->slices[i].imagedata );
+		if( image->slices[i].commanddata != NULL )
+			bufferpool_put( image->bufferpool, image->slices[i].commanddata );
+		if( image->slices[i].indexdata != NULL )
+			bufferpool_put( image->bufferpool, image->slices[i].indexdata );
 	}
+
+	free( image->slices );
+	image->slices = NULL;
+	image->numslices = 0;
+	image->numplanes = 0;
 }
 
 /*******************************************************************************
@@ -585,14 +880,22 @@ void qti_free( struct qti *image )
 *******************************************************************************/
 unsigned int qti_getsize( struct qti *image )
 {
+	struct qti_slice *slice;
 	unsigned int size=0;
+	int i;
+
+	size += ( image->numcolors - image->firstcolor ) * 3 * 8;
 	
-	size += image->imagedata->size*8+image->imagedata->bits;
-	size += image->commanddata->size*8+image->commanddata->bits;
+	for( i=0; i<image->numslices*image->numplanes; i++ )
+	{
+		slice = &image->slices[i];
+
+		size += slice->imagedata->size*8+slice->imagedata->bits;
+		size += slice->commanddata->size*8+slice->commanddata->bits;
 	
-	if( image->has_tilecache )
-		size += image->indexdata->size*8+image->indexdata->bits;
+		if( image->has_tilecache )
+			size += slice->indexdata->size*8+slice->indexdata->bits;
+	}
 	
 	return size;
 }
-
@@ -21,6 +21,39 @@
 #ifndef QTI_H
 #define QTI_H
 
+#define QTI_MAXCOLORS 256
+
+#define QTI_COMPRESS 0x01
+#define QTI_COMPRESS_BINARY 0x02
+#define QTI_COMPRESS_RANS 0x04
+#define QTI_COMPRESS_TREE 0x08
+
+/*******************************************************************************
+* Structure to hold the compressed data of one slice of a qti                  *
+*                                                                              *
+* Every slice is a horizontal band of the image with a quad tree, data streams *
+* and tile cache of its own, so slices can be en- and decoded independently.   *
+*                                                                              *
+* y1 and y2 are the first and one past the last row of the slice               *
+* plane is the plane of the slice, 0 for luma or all channels, 1 for chroma or *
+* the first chroma channel, 2 for the second chroma channel                    *
+* imagedata contains the compressed color data of the slice                    *
+* commanddata contains the data nessecary for reconstructing the quad tree     *
+* tilecache is the tile cache used by the slice                                *
+* indexdata contains the tile cache indices of the slice                       *
+*******************************************************************************/
+struct qti_slice
+{
+	int y1, y2;
+	int plane;
+
+	struct databuffer *imagedata;
+	struct databuffer *commanddata;
+
+	struct tilecache *tilecache;
+	struct databuffer *indexdata;
+};
+
 /*******************************************************************************
 * Structure to hold all the data associated with a qti                         *
 *                                                                              *
@@ -36,8 +69,28 @@
 * minsize is the minimal block size used during compression                    *
 * maxdepth is the maximum recursion depth used during compression              *
 * keyframes indicates wether the image makes use of a reference image or not   *
-* imagedata contains the compressed color data of the image                    *
-* commanddata contains the data nessecary for reconstructing the quad tree     *
+* motion indicates wether changed blocks may be copied from moved positions of *
+* the reference image, only possible in non keyframes of videos                *
+* scroll indicates wether a region of the reference image is shifted before    *
+* the quad tree is applied, only possible in non keyframes of videos           *
+* scrollx1, scrolly1, scrollx2 and scrolly2 describe the shifted region        *
+* scrolldx and scrolldy are the distance to the source of the region           *
+* blockcopy indicates wether blocks may be copied from already decompressed    *
+* blocks of the same slice                                                     *
+* palette indicates wether small blocks may be coded as palette and index map  *
+* numcolors is the number of colors of the color map, 0 if colors are stored   *
+* literally, a color map replaces every stored color by a one byte index       *
+* firstcolor is the first color that was not in the map of the previous frame, *
+* always 0 for images and key frames                                           *
+* colors are the red, green and blue channels of the colors of the map         *
+* has_tilecache indicates wether the image uses a tile cache                   *
+* tilecache is the tile cache used by the first slice                          *
+* numslices is the number of horizontal slices the image is split into         *
+* numplanes is 2 if luma and chroma are coded as separate planes, 3 if every   *
+* channel is a plane of its own, 1 otherwise                                   *
+* slices contains the compressed data of the slices, numslices*numplanes       *
+* bufferpool is the buffer pool the data buffers of the slices are taken from  *
+* and given back to, or NULL                                                   *
 *******************************************************************************/
 struct qti
 {
@@ -45,16 +98,29 @@ struct qti
 	int transform, colordiff;
 	int minsize, maxdepth;
 	int keyframe;
+	int motion;
 
-	struct databuffer *imagedata;
-	struct databuffer *commanddata;
+	int scroll;
+	int scrollx1, scrolly1, scrollx2, scrolly2;
+	int scrolldx, scrolldy;
+
+	int blockcopy;
+	int palette;
+
+	int numcolors, firstcolor;
+	unsigned char colors[ QTI_MAXCOLORS ][3];
 
 	int has_tilecache;
 	struct tilecache *tilecache;
-	struct databuffer *indexdata;
+
+	int numslices, numplanes;
+	struct qti_slice *slices;
+
+	struct bufferpool *bufferpool;
 };
 
-extern int qti_create( struct qti *image, int width, int height, int minsize, int maxdepth, struct tilecache *cache );
+extern int qti_create( struct qti *image, int width, int height, int minsize, int maxdepth, struct tilecache *cache, int numslices, int numplanes, struct bufferpool *pool );
+extern int qti_create_slices( struct qti *image, int numslices, int numplanes );
 extern int qti_read( struct qti *image, char filename[] );
 extern int qti_write( struct qti *image, int compress, char filename[] );
 extern void qti_free( struct qti *image );
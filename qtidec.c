@@ -24,6 +24,12 @@
 
 #include "image.h"
 #include "qti.h"
+#include "blockmap.h"
+#include "damage.h"
+#include "motion.h"
+#include "scroll.h"
+#include "colormap.h"
+#include "threadpool.h"
 #include "qtc.h"
 #include "ppm.h"
 
@@ -40,6 +46,7 @@ void print_help( void )
 	puts( "\t-h\t\t-\tPrint help" );
 	puts( "\t-v\t\t-\tBe verbose" );
 	puts( "\t-a [0..2]\t-\tAnalysis mode" );
+	puts( "\t-j [1..]\t-\tNumber of threads (1)" );
 	puts( "\t-i filename\t-\tInput file (-)" );
 	puts( "\t-o filename\t-\tOutput file (-)" );
 }
@@ -48,16 +55,18 @@ int main( int argc, char *argv[] )
 {
 	struct image image;
 	struct qti compimage;
+	struct threadpool *pool;
 
-	int opt, verbose, analyze;
+	int opt, verbose, analyze, threads;
 	char *infile, *outfile;
 
 	verbose = 0;
 	analyze = 0;
+	threads = 1;
 	infile = NULL;
 	outfile = NULL;
 
-	while( ( opt = getopt( argc, argv, "hva:i:o:" ) ) != -1 )
+	while( ( opt = getopt( argc, argv, "hva:j:i:o:" ) ) != -1 )
 	{
 		switch( opt )
 		{
@@ -75,6 +84,11 @@ int main( int argc, char *argv[] )
 					fputs( "main: Can not parse command line: -a\n", stderr );
 			break;
 
+			case 'j':
+				if( sscanf( optarg, "%i", &threads ) != 1 )
+					fputs( "main: Can not parse command line: -j\n", stderr );
+			break;
+
 			case 'i':
 				infile = strdup( optarg );
 			break;
@@ -97,6 +111,23 @@ int main( int argc, char *argv[] )
 		return 1;
 	}
 
+	if( threads < 1 )
+	{
+		fputs( "main: Number of threads out of range\n", stderr );
+		return 1;
+	}
+
+	if( threads > 1 )
+	{
+		pool = threadpool_create( threads-1 );		// Create worker threads
+		if( pool == NULL )
+			return 2;
+	}
+	else
+	{
+		pool = NULL;
+	}
+
 	if( ! qti_read( &compimage, infile ) )		// Read compressed image from file
 		return 2;
 
@@ -105,7 +136,7 @@ int main( int argc, char *argv[] )
 
 	if( analyze == 0 )
 	{
-		if( ! qtc_decompress( &compimage, NULL, &image ) )		// Decompress image
+		if( ! qtc_decompress( &compimage, NULL, &image, NULL, pool ) )		// Decompress image
 			return 2;
 
 		if( image.transform == 1 )		// Apply reverse image transforms
@@ -132,6 +163,9 @@ int main( int argc, char *argv[] )
 	image_free( &image );
 	qti_free( &compimage );
 
+	if( pool != NULL )
+		threadpool_free( pool );
+
 	free( infile );
 	free( outfile );
 
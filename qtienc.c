@@ -24,6 +24,12 @@
 
 #include "image.h"
 #include "qti.h"
+#include "blockmap.h"
+#include "damage.h"
+#include "motion.h"
+#include "scroll.h"
+#include "colormap.h"
+#include "threadpool.h"
 #include "qtc.h"
 #include "ppm.h"
 #include "tilecache.h"
@@ -41,12 +47,22 @@ void print_help( void )
 	puts( "\t-h\t\t-\tPrint help" );
 	puts( "\t-t [0..2]\t-\tUse image transforms (0)" );
 	puts( "\t-e\t\t-\tCompress output data" );
-	puts( "\t-y [0..2]\t-\tUse fakeyuv transform (0)" );
+	puts( "\t-y [0..4]\t-\tUse fakeyuv transform (0)" );
 	puts( "\t-v\t\t-\tBe verbose" );
 	puts( "\t-s [1..]\t-\tMinimal block size (2)" );
 	puts( "\t-d [0..]\t-\tMaximum recursion depth (16)" );
 	puts( "\t-c [0..]\t-\tCache size in kilo tiles (0)" );
 	puts( "\t-l [0..]\t-\tLaziness" );
+	puts( "\t-p\t\t-\tUse block map (faster, needs more memory)" );
+	puts( "\t-C\t\t-\tCopy repeated blocks within a frame" );
+	puts( "\t-P\t\t-\tCode blocks of few colors as palette blocks" );
+	puts( "\t-G\t\t-\tStore colors of frames with few colors in a color map" );
+	puts( "\t-B\t\t-\tCode the command data with a binary coder (with -e)" );
+	puts( "\t-R\t\t-\tCode the image data with a static rANS coder (with -e)" );
+	puts( "\t-T\t\t-\tCode the image data bit by bit with a binary tree (with -e)" );
+	puts( "\t-j [1..]\t-\tNumber of threads (1)" );
+	puts( "\t-q [0..]\t-\tQuad tree split depth for threads (4)" );
+	puts( "\t-z [1..]\t-\tNumber of slices (1)" );
 	puts( "\t-i filename\t-\tInput file (-)" );
 	puts( "\t-o filename\t-\tOutput file (-)" );
 }
@@ -56,6 +72,10 @@ int main( int argc, char *argv[] )
 	struct image image;
 	struct qti compimage;
 	struct tilecache *cache;
+	struct blockmap *blockmap;
+	struct colormap *colormap;
+	struct qtc_options options;
+	struct threadpool *pool;
 
 	int opt, verbose;
 	unsigned long int insize, bsize, outsize;
@@ -65,6 +85,8 @@ int main( int argc, char *argv[] )
 	int minsize;
 	int maxdepth;
 	int lazyness;
+	int useblockmap, usecopy, usepalette, usecolormap, usebinary, usetree, userans;
+	int threads, splitdepth, slices;
 	int cachesize;
 	char *infile, *outfile;
 
@@ -76,10 +98,20 @@ int main( int argc, char *argv[] )
 	maxdepth = 16;
 	cachesize = 0;
 	lazyness = 0;
+	useblockmap = 0;
+	usecopy = 0;
+	usepalette = 0;
+	usecolormap = 0;
+	usebinary = 0;
+	usetree = 0;
+	userans = 0;
+	threads = 1;
+	splitdepth = 4;
+	slices = 1;
 	infile = NULL;
 	outfile = NULL;
 
-	while( ( opt = getopt( argc, argv, "hevy:t:s:d:c:l:i:o:" ) ) != -1 )
+	while( ( opt = getopt( argc, argv, "hevpCPGBTRj:q:z:y:t:s:d:c:l:i:o:" ) ) != -1 )
 	{
 		switch( opt )
 		{
@@ -126,6 +158,49 @@ int main( int argc, char *argv[] )
 					fputs( "main: Can not parse command line: -l\n", stderr );
 			break;
 
+			case 'p':
+				useblockmap = 1;
+			break;
+
+			case 'C':
+				usecopy = 1;
+			break;
+
+			case 'P':
+				usepalette = 1;
+			break;
+
+			case 'G':
+				usecolormap = 1;
+			break;
+
+			case 'B':
+				usebinary = 1;
+			break;
+
+			case 'R':
+				userans = 1;
+			break;
+
+			case 'T':
+				usetree = 1;
+			break;
+
+			case 'j':
+				if( sscanf( optarg, "%i", &threads ) != 1 )
+					fputs( "main: Can not parse command line: -j\n", stderr );
+			break;
+
+			case 'q':
+				if( sscanf( optarg, "%i", &splitdepth ) != 1 )
+					fputs( "main: Can not parse command line: -q\n", stderr );
+			break;
+
+			case 'z':
+				if( sscanf( optarg, "%i", &slices ) != 1 )
+					fputs( "main: Can not parse command line: -z\n", stderr );
+			break;
+
 			case 'i':
 				infile = strdup( optarg );
 			break;
@@ -148,7 +223,7 @@ int main( int argc, char *argv[] )
 		return 1;
 	}
 
-	if( ( colordiff < 0 ) || ( colordiff > 2 ) )
+	if( ( colordiff < 0 ) || ( colordiff > 4 ) )
 	{
 		fputs( "main: Fakeyuv mode out of range\n", stderr );
 		return 1;
@@ -178,6 +253,26 @@ int main( int argc, char *argv[] )
 		return 1;
 	}
 
+	if( threads < 1 )
+	{
+		fputs( "main: Number of threads out of range\n", stderr );
+		return 1;
+	}
+
+	if( splitdepth < 0 )
+	{
+		fputs( "main: Split depth out of range\n", stderr );
+		return 1;
+	}
+
+	if( slices < 1 )
+	{
+		fputs( "main: Number of slices out of range\n", stderr );
+		return 1;
+	}
+
+	image.pixels = NULL;
+
 	if( ! ppm_read( &image, infile ) )		// Read the input image
 		return 2;
 
@@ -196,24 +291,75 @@ int main( int argc, char *argv[] )
 	else
 		cache = NULL;
 
-	if( ! qti_create( &compimage, image.width, image.height, minsize, maxdepth, cache ) )
+	if( useblockmap )
+	{
+		blockmap = blockmap_create( image.width, image.height );		// Create block map
+		if( blockmap == NULL )
+			return 2;
+	}
+	else
+	{
+		blockmap = NULL;
+	}
+
+	if( usecolormap )
+	{
+		colormap = colormap_create();		// Create color map
+		if( colormap == NULL )
+			return 2;
+	}
+	else
+	{
+		colormap = NULL;
+	}
+
+	if( threads > 1 )
+	{
+		pool = threadpool_create( threads-1 );		// Create worker threads
+		if( pool == NULL )
+			return 2;
+	}
+	else
+	{
+		pool = NULL;
+	}
+
+	if( ! qti_create( &compimage, image.width, image.height, minsize, maxdepth, cache, slices, colordiff >= 3 ? colordiff-1 : 1, NULL ) )
 		return 2;
 
-	if( ! qtc_compress( &image, NULL, &compimage, lazyness, colordiff >= 2 ) )		// Compress the image
+	options.blockmap = blockmap;
+	options.damage = NULL;
+	options.motion = NULL;
+	options.scroll = NULL;
+	options.colormap = colormap;
+	options.blockcopy = usecopy;
+	options.palette = usepalette;
+	options.pool = pool;
+	options.splitdepth = splitdepth;
+
+	if( ! qtc_compress( &image, NULL, &compimage, lazyness, colordiff >= 2, &options ) )		// Compress the image
 		return 2;
 
 	bsize = qti_getsize( &compimage );
 
-	if( ! ( outsize = qti_write( &compimage, rangecomp, outfile ) ) )		// Write image to file
+	if( ! ( outsize = qti_write( &compimage, rangecomp ? QTI_COMPRESS | ( usebinary ? QTI_COMPRESS_BINARY : 0 ) | ( usetree ? QTI_COMPRESS_TREE : 0 ) | ( userans ? QTI_COMPRESS_RANS : 0 ) : 0, outfile ) ) )		// Write image to file
 		return 2;
 	
 	image_free( &image );
 	qti_free( &compimage );
+
+	if( blockmap != NULL )
+		blockmap_free( blockmap );
+
+	if( colormap != NULL )
+		colormap_free( colormap );
+
+	if( pool != NULL )
+		threadpool_free( pool );
 	
 	if( cache != NULL )
 	{
-		cacheblocks = cache->numblocks;
-		cachehits = cache->hits;
+		tilecache_get_stats( cache, &cacheblocks, &cachehits );
 		tilecache_free( cache );
 	}
 	else
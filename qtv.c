@@ -23,14 +23,363 @@
 
 #include "databuffer.h"
 #include "rangecode.h"
+#include "rans.h"
 #include "tilecache.h"
+#include "bufferpool.h"
+#include "threadpool.h"
 #include "qti.h"
 
 #include "qtv.h"
 
 #define QTV_MAGIC "QTV1"
 #define QTW_MAGIC "QTW1"
+#define PRIORS_MAGIC "QTP1"
 #define VERSION 7
+#define EXTVERSION 8
+
+#define FEATURE_SLICES 0x01
+#define FEATURE_PLANES 0x02
+#define FEATURE_MOTION 0x04
+#define FEATURE_SCROLL 0x08
+#define FEATURE_COPY 0x10
+#define FEATURE_PALETTE 0x20
+#define FEATURE_COLORMAP 0x40
+#define FEATURE_CONTEXTS 0x80
+#define FEATURE_BINARY 0x100
+#define FEATURE_RANS 0x200
+#define FEATURE_CHUNKS 0x400
+#define FEATURE_TREE 0x800
+#define FEATURE_PRIORS 0x1000
+#define FEATURE_CHANNELS 0x2000
+
+#define CHUNKSIZE (1<<18)
+
+/*******************************************************************************
+* Function to create the range coders and the buffer pool of a qtv             *
+* Every slice and plane gets a command, image and, with a tile cache, an index *
+* coder.                                                                       *
+*                                                                              *
+* video is the qtv to create the coders for, has_tilecache, contexts, binary,  *
+* tree and chunks have to be set                                               *
+* numslices is the number of slices of the video                               *
+* numplanes is the number of planes of the video                               *
+*                                                                              *
+* Modifies video                                                               *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int qtv_create_coders( struct qtv *video, int numslices, int numplanes )
+{
+	int datamodel, i, j;
+
+	video->numslices = numslices;
+	video->numplanes = numplanes;
+	video->numcoders = 0;
+
+	video->bufferpool = bufferpool_create();
+	if( video->bufferpool == NULL )
+		return 0;
+
+	video->cmdcoders = calloc( numslices*numplanes, sizeof( *video->cmdcoders ) );
+	video->imgcoders = calloc( numslices*numplanes, sizeof( *video->imgcoders ) );
+	video->idxcoders = calloc( numslices*numplanes, sizeof( *video->idxcoders ) );
+	video->chunkcoders = calloc( numslices*numplanes*video->chunks, sizeof( *video->chunkcoders ) );
+	if( ( video->cmdcoders == NULL ) || ( video->imgcoders == NULL ) || ( video->idxcoders == NULL ) || ( video->chunkcoders == NULL ) )
+	{
+		perror( "qtv_create_coders: calloc" );
+		return 0;
+	}
+
+	video->streams = malloc( sizeof( *video->streams ) * numslices*numplanes * ( video->chunks+2 ) );
+	video->tasks = malloc( sizeof( *video->tasks ) * numslices*numplanes * ( video->chunks+2 ) );
+	if( ( video->streams == NULL ) || ( video->tasks == NULL ) )
+	{
+		perror( "qtv_create_coders: malloc" );
+		return 0;
+	}
+
+	datamodel = video->tree ? RANGECODER_TREE : RANGECODER_GROUPED;
+
+	for( i=0; i<numslices*numplanes; i++ )
+	{
+		if( video->has_tilecache )
+		{
+			video->idxcoders[i] = rangecoder_create( 2, 8, datamodel, video->contexts );
+			if( video->idxcoders[i] == NULL )
+				return 0;
+		}
+
+		video->cmdcoders[i] = rangecoder_create( 8, 1, video->binary ? RANGECODER_BINARY : RANGECODER_LINEAR, 0 );
+		if( video->cmdcoders[i] == NULL )
+			return 0;
+
+		video->imgcoders[i] = rangecoder_create( 2, 8, datamodel, video->contexts );
+		if( video->imgcoders[i] == NULL )
+			return 0;
+
+		for( j=0; j<video->chunks-1; j++ )
+		{
+			video->chunkcoders[i*(video->chunks-1)+j] = rangecoder_create( 2, 8, datamodel, video->contexts );
+			if( video->chunkcoders[i*(video->chunks-1)+j] == NULL )
+				return 0;
+		}
+
+		video->numcoders++;
+	}
+
+	return 1;
+}
+
+/*******************************************************************************
+* Function to make the image and index coders of a qtv start from its priors   *
+* The image coders of the first plane get the first table, those of the other  *
+* planes share the second one.                                                 *
+*                                                                              *
+* video is the qtv whose coders and priors are set up                          *
+*                                                                              *
+* Modifies video                                                               *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int qtv_apply_priors( struct qtv *video )
+{
+	unsigned char *priors;
+	int i, j, plane;
+
+	for( i=0; i<video->numcoders; i++ )
+	{
+		plane = i % video->numplanes;
+		priors = video->priors + ( plane > 1 ? 1 : plane ) * RANGECODER_PRIORS;
+
+		if( ! rangecoder_set_priors( video->imgcoders[i], priors ) )
+			return 0;
+
+		for( j=0; j<video->chunks-1; j++ )
+		{
+			if( ! rangecoder_set_priors( video->chunkcoders[i*(video->chunks-1)+j], priors ) )
+				return 0;
+		}
+
+		if( video->has_tilecache )
+		{
+			if( ! rangecoder_set_priors( video->idxcoders[i], video->priors + 2*RANGECODER_PRIORS ) )
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*******************************************************************************
+* Function to free the buffers and coder used to store the priors of a qtv     *
+*                                                                              *
+* data is the buffer holding the plain priors, or NULL                         *
+* compdata is the buffer holding the coded priors, or NULL                     *
+* coder is the range coder used on the priors, or NULL                         *
+*******************************************************************************/
+static void qtv_free_priors_coding( struct databuffer *data, struct databuffer *compdata, struct rangecoder *coder )
+{
+	if( coder != NULL )
+		rangecoder_free( coder );
+	if( compdata != NULL )
+		databuffer_free( compdata );
+	if( data != NULL )
+		databuffer_free( data );
+}
+
+/*******************************************************************************
+* Function to write the priors of a qtv into its header                        *
+* The priors are stored range coded, preceded by their compressed size.        *
+*                                                                              *
+* video is the qtv whose priors are written                                    *
+* qtv is the file to write to                                                  *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int qtv_write_priors( struct qtv *video, FILE *qtv )
+{
+	struct databuffer *data, *compdata;
+	struct rangecoder *coder;
+	unsigned char *span;
+	unsigned int size;
+
+	data = databuffer_create( QTV_PRIORS*RANGECODER_PRIORS );
+	compdata = databuffer_create( QTV_PRIORS*RANGECODER_PRIORS / 4 );
+	coder = rangecoder_create( 1, 8, RANGECODER_GROUPED, 0 );
+	if( ( data == NULL ) || ( compdata == NULL ) || ( coder == NULL ) )
+	{
+		fputs( "qtv_write_priors: Could not create the priors coder\n", stderr );
+		qtv_free_priors_coding( data, compdata, coder );
+		return 0;
+	}
+
+	span = databuffer_add_span( data, QTV_PRIORS*RANGECODER_PRIORS );
+	if( span == NULL )
+	{
+		qtv_free_priors_coding( data, compdata, coder );
+		return 0;
+	}
+
+	memcpy( span, video->priors, QTV_PRIORS*RANGECODER_PRIORS );
+
+	if( ! rangecode_compress( coder, data, compdata ) )
+	{
+		fputs( "qtv_write_priors: Could not compress priors\n", stderr );
+		qtv_free_priors_coding( data, compdata, coder );
+		return 0;
+	}
+
+	size = compdata->size;
+	fwrite( &size, sizeof( size ), 1, qtv );
+	fwrite( compdata->data, 1, size, qtv );
+
+	qtv_free_priors_coding( data, compdata, coder );
+
+	return 1;
+}
+
+/*******************************************************************************
+* Function to read the priors stored in the header of a qtv                    *
+*                                                                              *
+* qtv is the file to read from                                                 *
+*                                                                              *
+* Returns the priors or NULL on failure                                        *
+*******************************************************************************/
+static unsigned char *qtv_read_priors( FILE *qtv )
+{
+	struct databuffer *data, *compdata;
+	struct rangecoder *coder;
+	unsigned char *priors;
+	unsigned int size;
+
+	if( fread( &size, sizeof( size ), 1, qtv ) != 1 )
+	{
+		fputs( "qtv_read_priors: Short read on priors size\n", stderr );
+		return NULL;
+	}
+
+	if( ( size == 0 ) || ( size > 2*QTV_PRIORS*RANGECODER_PRIORS ) )
+	{
+		fputs( "qtv_read_priors: Invalid priors size\n", stderr );
+		return NULL;
+	}
+
+	compdata = databuffer_create( size );
+	data = databuffer_create( QTV_PRIORS*RANGECODER_PRIORS );
+	coder = rangecoder_create( 1, 8, RANGECODER_GROUPED, 0 );
+	if( ( compdata == NULL ) || ( data == NULL ) || ( coder == NULL ) )
+	{
+		fputs( "qtv_read_priors: Could not create the priors coder\n", stderr );
+		qtv_free_priors_coding( data, compdata, coder );
+		return NULL;
+	}
+
+	priors = malloc( QTV_PRIORS*RANGECODER_PRIORS );
+	if( priors == NULL )
+	{
+		perror( "qtv_read_priors: malloc" );
+		qtv_free_priors_coding( data, compdata, coder );
+		return NULL;
+	}
+
+	compdata->size = size;
+
+	if( fread( compdata->data, 1, size, qtv ) != size )
+	{
+		fputs( "qtv_read_priors: Short read on priors\n", stderr );
+		qtv_free_priors_coding( data, compdata, coder );
+		free( priors );
+		return NULL;
+	}
+
+	if( ! rangecode_decompress( coder, compdata, data, QTV_PRIORS*RANGECODER_PRIORS ) )
+	{
+		fputs( "qtv_read_priors: Could not decompress priors\n", stderr );
+		qtv_free_priors_coding( data, compdata, coder );
+		free( priors );
+		return NULL;
+	}
+
+	memcpy( priors, data->data, QTV_PRIORS*RANGECODER_PRIORS );
+
+	qtv_free_priors_coding( data, compdata, coder );
+
+	return priors;
+}
+
+/*******************************************************************************
+* Function to entropy code one stream of a frame, called by the thread pool    *
+*                                                                              *
+* task is the stream to be coded                                               *
+*******************************************************************************/
+static void qtv_compress_task( void *task )
+{
+	struct qtv_stream *stream;
+
+	stream = task;
+
+	if( stream->coder != NULL )
+		stream->result = rangecode_compress( stream->coder, stream->input, stream->output ) && databuffer_pad( stream->output );
+	else
+		stream->result = rans_compress( stream->input, stream->output );
+}
+
+/*******************************************************************************
+* Function to entropy decode one stream of a frame, called by the thread pool  *
+*                                                                              *
+* task is the stream to be decoded                                             *
+*******************************************************************************/
+static void qtv_decompress_task( void *task )
+{
+	struct qtv_stream *stream;
+
+	stream = task;
+
+	if( stream->coder != NULL )
+		stream->result = rangecode_decompress( stream->coder, stream->input, stream->output, stream->size );
+	else
+		stream->result = rans_decompress( stream->input, stream->output, stream->size );
+}
+
+/*******************************************************************************
+* Function to entropy code the streams of a frame in parallel                  *
+* Every stream has a coder of its own, so they do not depend on each other.    *
+*                                                                              *
+* video is the qtv the streams belong to                                       *
+* function is qtv_compress_task or qtv_decompress_task                         *
+* numstreams is the number of streams to code                                  *
+* pool is the thread pool to use or NULL to code serially                      *
+*                                                                              *
+* Modifies the streams of video                                                *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int qtv_code_streams( struct qtv *video, void (*function)( void *task ), int numstreams, struct threadpool *pool )
+{
+	int i, result;
+
+	for( i=0; i<numstreams; i++ )
+	{
+		video->streams[i].result = 0;
+		video->tasks[i] = &video->streams[i];
+	}
+
+	if( ( pool != NULL ) && ( numstreams > 1 ) )
+	{
+		threadpool_run( pool, function, video->tasks, numstreams );
+	}
+	else
+	{
+		for( i=0; i<numstreams; i++ )
+			function( video->tasks[i] );
+	}
+
+	result = 1;
+	for( i=0; i<numstreams; i++ )
+		result = result && video->streams[i].result;
+
+	return result;
+}
 
 /*******************************************************************************
 * Function to read a qtv file header and initialize a qtv struct from it       *
@@ -51,6 +400,8 @@ int qtv_read_header( struct qtv *video, int is_qtw, char filename[] )
 	int width, height, framerate;
 	int cachesize, tilesize;
 	unsigned char version, flags;
+	unsigned int features;
+	int numslices, numplanes, contexts, chunks;
 	int numframes, idx_size, numblocks, frame, blocknum;
 	long int orig_offset, offset, idx_offset;
 	char blockname[256];
@@ -124,7 +475,7 @@ int qtv_read_header( struct qtv *video, int is_qtw, char filename[] )
 			return 0;
 		}
 
-		if( version != VERSION )
+		if( version != ( ( flags & (0x01<<2) ) ? EXTVERSION : VERSION ) )
 		{
 			fputs( "qtv_read_header: Wrong version\n", stderr );
 			if( qtv != stdin )
@@ -132,6 +483,91 @@ int qtv_read_header( struct qtv *video, int is_qtw, char filename[] )
 			return 0;
 		}
 
+		features = 0;
+		numslices = 1;
+		numplanes = 1;
+		contexts = 0;
+		chunks = 1;
+
+		if( flags & (0x01<<2) )
+		{
+			if( fread( &features, sizeof( features ), 1, qtv ) != 1 )
+			{
+				fputs( "qtv_read_header: Short read on feature flags\n", stderr );
+				if( qtv != stdin )
+					fclose( qtv );
+				return 0;
+			}
+
+			if( features & ~( FEATURE_SLICES | FEATURE_PLANES | FEATURE_MOTION | FEATURE_SCROLL | FEATURE_COPY | FEATURE_PALETTE | FEATURE_COLORMAP | FEATURE_CONTEXTS | FEATURE_BINARY | FEATURE_RANS | FEATURE_CHUNKS | FEATURE_TREE | FEATURE_PRIORS | FEATURE_CHANNELS ) )
+			{
+				fputs( "qtv_read_header: Unsupported features\n", stderr );
+				if( qtv != stdin )
+					fclose( qtv );
+				return 0;
+			}
+
+			if( features & FEATURE_SLICES )
+			{
+				if( fread( &numslices, sizeof( numslices ), 1, qtv ) != 1 )
+				{
+					fputs( "qtv_read_header: Short read on slice info\n", stderr );
+					if( qtv != stdin )
+						fclose( qtv );
+					return 0;
+				}
+
+				if( ( numslices < 1 ) || ( numslices > height ) )
+				{
+					fputs( "qtv_read_header: Invalid number of slices\n", stderr );
+					if( qtv != stdin )
+						fclose( qtv );
+					return 0;
+				}
+			}
+
+			if( features & FEATURE_PLANES )
+				numplanes = ( features & FEATURE_CHANNELS ) ? 3 : 2;
+
+			if( features & FEATURE_CONTEXTS )
+			{
+				if( fread( &contexts, sizeof( contexts ), 1, qtv ) != 1 )
+				{
+					fputs( "qtv_read_header: Short read on context limit\n", stderr );
+					if( qtv != stdin )
+						fclose( qtv );
+					return 0;
+				}
+
+				if( contexts < 1 )
+				{
+					fputs( "qtv_read_header: Invalid context limit\n", stderr );
+					if( qtv != stdin )
+						fclose( qtv );
+					return 0;
+				}
+			}
+
+			if( features & FEATURE_CHUNKS )
+			{
+				if( fread( &chunks, sizeof( chunks ), 1, qtv ) != 1 )
+				{
+					fputs( "qtv_read_header: Short read on chunk info\n", stderr );
+					if( qtv != stdin )
+						fclose( qtv );
+					return 0;
+				}
+
+				if( ( chunks < 2 ) || ( chunks > QTV_MAXCHUNKS ) )
+				{
+					fputs( "qtv_read_header: Invalid number of chunks\n", stderr );
+					if( qtv != stdin )
+						fclose( qtv );
+					return 0;
+				}
+			}
+		}
+
 		video->framenum = 0;
 		video->numframes = 0;
 		video->blocknum = 0;
@@ -142,6 +578,18 @@ int qtv_read_header( struct qtv *video, int is_qtw, char filename[] )
 		video->is_qtw = is_qtw;
 		video->has_index = ( flags & 0x01 ) != 0;
 		video->has_tilecache = ( flags & (0x01<<1) ) != 0;
+		video->motion = ( features & FEATURE_MOTION ) != 0;
+		video->scroll = ( features & FEATURE_SCROLL ) != 0;
+		video->blockcopy = ( features & FEATURE_COPY ) != 0;
+		video->palette = ( features & FEATURE_PALETTE ) != 0;
+		video->colormap = ( features & FEATURE_COLORMAP ) != 0;
+		video->numcolors = 0;
+		video->contexts = contexts;
+		video->binary = ( features & FEATURE_BINARY ) != 0;
+		video->tree = ( features & FEATURE_TREE ) != 0;
+		video->rans = ( features & FEATURE_RANS ) != 0;
+		video->chunks = chunks;
+		video->priors = NULL;
 
 		if( video->has_tilecache )
 		{
@@ -155,6 +603,17 @@ int qtv_read_header( struct qtv *video, int is_qtw, char filename[] )
 			}
 		}
 
+		if( features & FEATURE_PRIORS )
+		{
+			video->priors = qtv_read_priors( qtv );
+			if( video->priors == NULL )
+			{
+				if( qtv != stdin )
+					fclose( qtv );
+				return 0;
+			}
+		}
+
 		if( qtv == stdin )
 			video->has_index = 0;
 
@@ -276,20 +735,16 @@ int qtv_read_header( struct qtv *video, int is_qtw, char filename[] )
 			video->tilecache = tilecache_create( cachesize, tilesize );
 			if( video->tilecache == NULL )
 				return 0;
-
-			video->idxcoder = rangecoder_create( 2, 8 );
-			if( video->idxcoder == NULL )
-				return 0;
 		}
 
-		video->cmdcoder = rangecoder_create( 8, 1 );
-		if( video->cmdcoder == NULL )
-			return 0;
-
-		video->imgcoder = rangecoder_create( 2, 8 );
-		if( video->imgcoder == NULL )
+		if( ! qtv_create_coders( video, numslices, numplanes ) )
 			return 0;
 
+		if( video->priors != NULL )
+		{
+			if( ! qtv_apply_priors( video ) )
+				return 0;
+		}
 
 		if( filename )
 			video->filename = strdup( filename );
@@ -328,21 +783,25 @@ int qtv_read_header( struct qtv *video, int is_qtw, char filename[] )
 *                                                                              *
 * video is a qtv structure as returned from qtv_read_header                    *
 * image is a pointer to a qti image where the frame will be stored             *
+* pool is the thread pool to decode the streams with or NULL                   *
 *                                                                              *
 * Modifies video                                                               *
 *                                                                              *
 * Returns 0 on failure, 1 on success                                           *
 *******************************************************************************/
-int qtv_read_frame( struct qtv *video, struct qti *image )
+int qtv_read_frame( struct qtv *video, struct qti *image, struct threadpool *pool )
 {
 	FILE *qtv;
 	struct databuffer *compdata;
-	struct rangecoder *coder;
+	struct qtv_stream *stream;
+	struct qti_slice *slice;
 	int minsize, maxdepth;
-	int compress;
-	int tmp;
-	unsigned char flags;
-	unsigned int size;
+	int compress, rans;
+	int numstreams, result;
+	int tmp, i, j;
+	unsigned char flags, coders, numchunks;
+	unsigned int size, compsize, length;
+	unsigned int chunksizes[ QTV_MAXCHUNKS ];
 	char blockname[256];
 
 	if( video->is_qtw )
@@ -388,6 +847,21 @@ int qtv_read_frame( struct qtv *video, struct qti *image )
 			return 0;
 		}
 
+		coders = 0;
+
+		if( video->rans )		// Which entropy coder the frame uses
+		{
+			if( fread( &coders, sizeof( coders ), 1, qtv ) != 1 )
+			{
+				fputs( "qtv_read_frame: Short read on coder flags\n", stderr );
+				if( qtv != stdin )
+					fclose( qtv );
+				return 0;
+			}
+		}
+
+		rans = ( coders & 0x01 ) != 0;
+
 		image->width = video->width;
 		image->height = video->height;
 		image->minsize = minsize;
@@ -397,224 +871,411 @@ int qtv_read_frame( struct qtv *video, struct qti *image )
 		image->colordiff = ( ( flags & (0x03<<3) ) >> 3 ) & 0x03;
 		image->has_tilecache = ( flags & (0x01<<5) ) != 0;
 		image->keyframe = ( flags & (0x01<<7) ) != 0;
+		image->motion = video->motion && ! image->keyframe;
+		image->scroll = ( flags & (0x01<<6) ) != 0;
+		image->blockcopy = video->blockcopy;
+		image->palette = video->palette;
+		image->bufferpool = video->bufferpool;
 
-		if( ( image->has_tilecache ) && ( video->has_tilecache ) )
+		if( image->scroll )
 		{
-			image->tilecache = video->tilecache;
-		}
-		else
-		{
-			image->has_tilecache = 0;
-		}
-
-		if( image->keyframe )
-		{
-			rangecoder_reset( video->cmdcoder );
-			rangecoder_reset( video->imgcoder );
-			
-			if( image->has_tilecache )
+			if( image->keyframe || ! video->scroll )
 			{
-				rangecoder_reset( video->idxcoder );
-				tilecache_reset( video->tilecache );
+				fputs( "qtv_read_frame: Unexpected scroll info\n", stderr );
+				if( qtv != stdin )
+					fclose( qtv );
+				return 0;
 			}
-		}
 
-		if( compress )
-		{
-			if( fread( &size, sizeof( size ), 1, qtv ) != 1 )
+			if( ( fread( &(image->scrollx1), sizeof( image->scrollx1 ), 1, qtv ) != 1 ) ||
+			    ( fread( &(image->scrolly1), sizeof( image->scrolly1 ), 1, qtv ) != 1 ) ||
+			    ( fread( &(image->scrollx2), sizeof( image->scrollx2 ), 1, qtv ) != 1 ) ||
+			    ( fread( &(image->scrolly2), sizeof( image->scrolly2 ), 1, qtv ) != 1 ) ||
+			    ( fread( &(image->scrolldx), sizeof( image->scrolldx ), 1, qtv ) != 1 ) ||
+			    ( fread( &(image->scrolldy), sizeof( image->scrolldy ), 1, qtv ) != 1 ) )
 			{
-				fputs( "qtv_read_frame: Short read on compressed command data size\n", stderr );
+				fputs( "qtv_read_frame: Short read on scroll info\n", stderr );
 				if( qtv != stdin )
 					fclose( qtv );
 				return 0;
 			}
 
-			compdata = databuffer_create( size );
-			if( compdata == NULL )
+			if( ( image->scrollx1 < 0 ) || ( image->scrolly1 < 0 ) ||
+			    ( image->scrollx1 >= image->scrollx2 ) || ( image->scrolly1 >= image->scrolly2 ) ||
+			    ( image->scrollx2 > image->width ) || ( image->scrolly2 > image->height ) ||
+			    ( image->scrollx1+image->scrolldx < 0 ) || ( image->scrolly1+image->scrolldy < 0 ) ||
+			    ( image->scrollx2+image->scrolldx > image->width ) || ( image->scrolly2+image->scrolldy > image->height ) )
+			{
+				fputs( "qtv_read_frame: Invalid scroll region\n", stderr );
+				if( qtv != stdin )
+					fclose( qtv );
 				return 0;
+			}
+		}
 
-			compdata->size = size;
+		image->numcolors = 0;
+		image->firstcolor = 0;
 
-			if( fread( &size, sizeof( size ), 1, qtv ) != 1 )
+		if( video->colormap )
+		{
+			if( ( fread( &(image->numcolors), sizeof( image->numcolors ), 1, qtv ) != 1 ) ||
+			    ( fread( &(image->firstcolor), sizeof( image->firstcolor ), 1, qtv ) != 1 ) )
 			{
-				fputs( "qtv_read_frame: Short read on uncompressed command data size\n", stderr );
+				fputs( "qtv_read_frame: Short read on color map info\n", stderr );
 				if( qtv != stdin )
 					fclose( qtv );
 				return 0;
 			}
 
-			if( fread( compdata->data, 1, compdata->size, qtv ) != compdata->size )
+			if( ( image->numcolors < 0 ) || ( image->numcolors > QTI_MAXCOLORS ) ||
+			    ( ( image->numcolors > 0 ) && ( ( image->colordiff == 2 ) ||
+			      ( image->firstcolor < 0 ) || ( image->firstcolor > image->numcolors ) || ( image->firstcolor > video->numcolors ) ) ) )
 			{
-				fputs( "qtv_read_frame: Short read on compressed command data\n", stderr );
+				fputs( "qtv_read_frame: Invalid color map\n", stderr );
 				if( qtv != stdin )
 					fclose( qtv );
 				return 0;
 			}
-			
-			image->commanddata = databuffer_create( size );
-			if( image->commanddata == NULL )
-				return 0;
 
-			coder = video->cmdcoder;
+			if( image->numcolors > 0 )		// The frame extends the color map of the previous frames
+			{
+				if( fread( video->colors[ image->firstcolor ], 3, image->numcolors - image->firstcolor, qtv ) != (size_t)( image->numcolors - image->firstcolor ) )
+				{
+					fputs( "qtv_read_frame: Short read on color map\n", stderr );
+					if( qtv != stdin )
+						fclose( qtv );
+					return 0;
+				}
 
-			rangecode_decompress( coder, compdata, image->commanddata, size );
-			
-			databuffer_free( compdata );
+				video->numcolors = image->numcolors;
+				memcpy( image->colors, video->colors, image->numcolors * 3 );
+			}
+		}
 
+		if( ( image->has_tilecache ) && ( video->has_tilecache ) )
+		{
+			image->tilecache = video->tilecache;
+		}
+		else
+		{
+			image->has_tilecache = 0;
+		}
+
+		if( ! qti_create_slices( image, video->numslices, image->colordiff == 2 ? video->numplanes : 1 ) )
+			return 0;
 
-			if( fread( &size, sizeof( size ), 1, qtv ) != 1 )
+		if( image->keyframe )
+		{
+			for( i=0; i<video->numcoders; i++ )
 			{
-				fputs( "qtv_read_frame: Short read on compressed image data size\n", stderr );
-				if( qtv != stdin )
-					fclose( qtv );
-				return 0;
+				rangecoder_reset( video->cmdcoders[i] );
+				rangecoder_reset( video->imgcoders[i] );
+			
+				if( image->has_tilecache )
+					rangecoder_reset( video->idxcoders[i] );
+
+				for( j=0; j<video->chunks-1; j++ )
+					rangecoder_reset( video->chunkcoders[i*(video->chunks-1)+j] );
 			}
+			
+			if( image->has_tilecache )
+				tilecache_reset( video->tilecache );
+		}
 
-			compdata = databuffer_create( size );
-			if( compdata == NULL )
-				return 0;
+		numstreams = 0;
 
-			compdata->size = size;
+		for( i=0; i<image->numslices*image->numplanes; i++ )		// Read all streams first, then decode them together
+		{
+			slice = &image->slices[i];
 
-			if( fread( &size, sizeof( size ), 1, qtv ) != 1 )
+			if( compress )
 			{
-				fputs( "qtv_read_frame: Short read on uncompressed image data size\n", stderr );
-				if( qtv != stdin )
-					fclose( qtv );
-				return 0;
-			}
+				if( fread( &size, sizeof( size ), 1, qtv ) != 1 )
+				{
+					fputs( "qtv_read_frame: Short read on compressed command data size\n", stderr );
+					if( qtv != stdin )
+						fclose( qtv );
+					return 0;
+				}
 
-			if( fread( compdata->data, 1, compdata->size, qtv ) != compdata->size )
-			{
-				fputs( "qtv_read_frame: Short read on compressed image data\n", stderr );
-				if( qtv != stdin )
-					fclose( qtv );
-				return 0;
-			}
+				compdata = bufferpool_get( video->bufferpool, size );
+				if( compdata == NULL )
+					return 0;
+
+				compdata->size = size;
+
+				if( fread( &size, sizeof( size ), 1, qtv ) != 1 )
+				{
+					fputs( "qtv_read_frame: Short read on uncompressed command data size\n", stderr );
+					if( qtv != stdin )
+						fclose( qtv );
+					return 0;
+				}
+
+				if( fread( compdata->data, 1, compdata->size, qtv ) != compdata->size )
+				{
+					fputs( "qtv_read_frame: Short read on compressed command data\n", stderr );
+					if( qtv != stdin )
+						fclose( qtv );
+					return 0;
+				}
 			
-			image->imagedata = databuffer_create( size );
-			if( image->imagedata == NULL )
-				return 0;
+				slice->commanddata = bufferpool_get( video->bufferpool, size );
+				if( slice->commanddata == NULL )
+					return 0;
+
+				stream = &video->streams[numstreams++];
+				stream->coder = video->cmdcoders[i];
+				stream->input = compdata;
+				stream->output = slice->commanddata;
+				stream->target = NULL;
+				stream->size = size;
+				stream->chunks = 0;
+
+
+				if( ( fread( &compsize, sizeof( compsize ), 1, qtv ) != 1 ) ||
+				    ( fread( &size, sizeof( size ), 1, qtv ) != 1 ) )
+				{
+					fputs( "qtv_read_frame: Short read on compressed image data size\n", stderr );
+					if( qtv != stdin )
+						fclose( qtv );
+					return 0;
+				}
+
+				numchunks = 1;
+
+				if( video->chunks > 1 )		// Large image data is split into chunks with a table of their sizes
+				{
+					if( fread( &numchunks, sizeof( numchunks ), 1, qtv ) != 1 )
+					{
+						fputs( "qtv_read_frame: Short read on chunk info\n", stderr );
+						if( qtv != stdin )
+							fclose( qtv );
+						return 0;
+					}
+
+					if( ( numchunks < 1 ) || ( numchunks > video->chunks ) || ( numchunks > size ) )
+					{
+						fputs( "qtv_read_frame: Invalid number of chunks\n", stderr );
+						if( qtv != stdin )
+							fclose( qtv );
+						return 0;
+					}
+				}
+
+				if( numchunks > 1 )
+				{
+					if( fread( chunksizes, sizeof( *chunksizes ), numchunks, qtv ) != numchunks )
+					{
+						fputs( "qtv_read_frame: Short read on chunk table\n", stderr );
+						if( qtv != stdin )
+							fclose( qtv );
+						return 0;
+					}
+
+					length = 0;
+					for( j=0; j<numchunks; j++ )
+						length += chunksizes[j];
+
+					if( length != compsize )
+					{
+						fputs( "qtv_read_frame: Invalid chunk table\n", stderr );
+						if( qtv != stdin )
+							fclose( qtv );
+						return 0;
+					}
+				}
+				else
+				{
+					chunksizes[0] = compsize;
+				}
+
+				slice->imagedata = bufferpool_get( video->bufferpool, size );
+				if( slice->imagedata == NULL )
+					return 0;
+
+				for( j=0; j<numchunks; j++ )
+				{
+					compdata = bufferpool_get( video->bufferpool, chunksizes[j] );
+					if( compdata == NULL )
+						return 0;
 
-			coder = video->imgcoder;
+					compdata->size = chunksizes[j];
 
-			rangecode_decompress( coder, compdata, image->imagedata, size );
+					if( fread( compdata->data, 1, compdata->size, qtv ) != compdata->size )
+					{
+						fputs( "qtv_read_frame: Short read on compressed image data\n", stderr );
+						if( qtv != stdin )
+							fclose( qtv );
+						return 0;
+					}
+
+					stream = &video->streams[numstreams++];
+					stream->input = compdata;
+					stream->chunks = j == 0 ? numchunks : 0;
+
+					if( rans )
+						stream->coder = NULL;
+					else if( j == 0 )
+						stream->coder = video->imgcoders[i];
+					else
+						stream->coder = video->chunkcoders[i*(video->chunks-1)+j-1];
+
+					if( numchunks > 1 )
+					{
+						length = size / numchunks;
+
+						stream->size = j < numchunks-1 ? length : size - length*(numchunks-1);
+						stream->target = slice->imagedata;
+						stream->output = bufferpool_get( video->bufferpool, stream->size );
+						if( stream->output == NULL )
+							return 0;
+					}
+					else
+					{
+						stream->size = size;
+						stream->target = NULL;
+						stream->output = slice->imagedata;
+					}
+				}
 			
-			databuffer_free( compdata );
 			
+				if( image->has_tilecache )
+				{
+					if( fread( &size, sizeof( size ), 1, qtv ) != 1 )
+					{
+						fputs( "qtv_read_frame: Short read on compressed index data size\n", stderr );
+						if( qtv != stdin )
+							fclose( qtv );
+						return 0;
+					}
+
+					compdata = bufferpool_get( video->bufferpool, size );
+					if( compdata == NULL )
+						return 0;
+
+					compdata->size = size;
+
+					if( fread( &size, sizeof( size ), 1, qtv ) != 1 )
+					{
+						fputs( "qtv_read_frame: Short read on uncompressed index data size\n", stderr );
+						if( qtv != stdin )
+							fclose( qtv );
+						return 0;
+					}
+
+					if( fread( compdata->data, 1, compdata->size, qtv ) != compdata->size )
+					{
+						fputs( "qtv_read_frame: Short read on compressed index data\n", stderr );
+						if( qtv != stdin )
+							fclose( qtv );
+						return 0;
+					}
 			
-			if( image->has_tilecache )
+					slice->indexdata = bufferpool_get( video->bufferpool, size );
+					if( slice->indexdata == NULL )
+						return 0;
+
+					stream = &video->streams[numstreams++];
+					stream->coder = rans ? NULL : video->idxcoders[i];
+					stream->input = compdata;
+					stream->output = slice->indexdata;
+					stream->target = NULL;
+					stream->size = size;
+					stream->chunks = 0;
+				}
+			}
+			else
 			{
 				if( fread( &size, sizeof( size ), 1, qtv ) != 1 )
 				{
-					fputs( "qtv_read_frame: Short read on compressed index data size\n", stderr );
+					fputs( "qtv_read_frame: Short read on command data size\n", stderr );
 					if( qtv != stdin )
 						fclose( qtv );
 					return 0;
 				}
 
-				compdata = databuffer_create( size );
-				if( compdata == NULL )
+				slice->commanddata = bufferpool_get( video->bufferpool, size );
+				if( slice->commanddata == NULL )
 					return 0;
 
-				compdata->size = size;
+				slice->commanddata->size = size;
+				if( fread( slice->commanddata->data, 1, slice->commanddata->size, qtv ) != slice->commanddata->size )
+				{
+					fputs( "qtv_read_frame: Short read on command data\n", stderr );
+					if( qtv != stdin )
+						fclose( qtv );
+					return 0;
+				}
+
 
 				if( fread( &size, sizeof( size ), 1, qtv ) != 1 )
 				{
-					fputs( "qtv_read_frame: Short read on uncompressed index data size\n", stderr );
+					fputs( "qtv_read_frame: Short read on image data size\n", stderr );
 					if( qtv != stdin )
 						fclose( qtv );
 					return 0;
 				}
 
-				if( fread( compdata->data, 1, compdata->size, qtv ) != compdata->size )
+				slice->imagedata = bufferpool_get( video->bufferpool, size );
+				if( slice->imagedata == NULL )
+					return 0;
+
+				slice->imagedata->size = size;
+				if( fread( slice->imagedata->data, 1, slice->imagedata->size, qtv ) != slice->imagedata->size )
 				{
-					fputs( "qtv_read_frame: Short read on compressed index data\n", stderr );
+					fputs( "qtv_read_frame: Short read on image data\n", stderr );
 					if( qtv != stdin )
 						fclose( qtv );
 					return 0;
 				}
 			
-				image->indexdata = databuffer_create( size );
-				if( image->indexdata == NULL )
-					return 0;
-
-				coder = video->idxcoder;
-
-				rangecode_decompress( coder, compdata, image->indexdata, size );
 			
-				databuffer_free( compdata );
-			}
-		}
-		else
-		{
-			if( fread( &size, sizeof( size ), 1, qtv ) != 1 )
-			{
-				fputs( "qtv_read_frame: Short read on command data size\n", stderr );
-				if( qtv != stdin )
-					fclose( qtv );
-				return 0;
-			}
+				if( image->has_tilecache )
+				{
+					if( fread( &size, sizeof( size ), 1, qtv ) != 1 )
+					{
+						fputs( "qtv_read_frame: Short read on index data size\n", stderr );
+						if( qtv != stdin )
+							fclose( qtv );
+						return 0;
+					}
 
-			image->commanddata = databuffer_create( size );
-			if( image->commanddata == NULL )
-				return 0;
+					slice->indexdata = bufferpool_get( video->bufferpool, size );
+					if( slice->indexdata == NULL )
+						return 0;
 
-			image->commanddata->size = size;
-			if( fread( image->commanddata->data, 1, image->commanddata->size, qtv ) != image->commanddata->size )
-			{
-				fputs( "qtv_read_frame: Short read on command data\n", stderr );
-				if( qtv != stdin )
-					fclose( qtv );
-				return 0;
+					slice->indexdata->size = size;
+					if( fread( slice->indexdata->data, 1, slice->indexdata->size, qtv ) != slice->indexdata->size )
+					{
+						fputs( "qtv_read_frame: Short read on index data\n", stderr );
+						if( qtv != stdin )
+							fclose( qtv );
+						return 0;
+					}
+				}
 			}
+		}
 
+		if( numstreams > 0 )
+		{
+			result = qtv_code_streams( video, qtv_decompress_task, numstreams, pool );
 
-			if( fread( &size, sizeof( size ), 1, qtv ) != 1 )
+			for( i=0; i<numstreams; i++ )
 			{
-				fputs( "qtv_read_frame: Short read on image data size\n", stderr );
-				if( qtv != stdin )
-					fclose( qtv );
-				return 0;
-			}
-
-			image->imagedata = databuffer_create( size );
-			if( image->imagedata == NULL )
-				return 0;
+				stream = &video->streams[i];
 
-			image->imagedata->size = size;
-			if( fread( image->imagedata->data, 1, image->imagedata->size, qtv ) != image->imagedata->size )
-			{
-				fputs( "qtv_read_frame: Short read on image data\n", stderr );
-				if( qtv != stdin )
-					fclose( qtv );
-				return 0;
-			}
-			
-			
-			if( image->has_tilecache )
-			{
-				if( fread( &size, sizeof( size ), 1, qtv ) != 1 )
+				if( stream->target != NULL )		// Join the chunks of split image data
 				{
-					fputs( "qtv_read_frame: Short read on index data size\n", stderr );
-					if( qtv != stdin )
-						fclose( qtv );
-					return 0;
+					result = result && databuffer_add_buffer( stream->target, stream->output );
+					bufferpool_put( video->bufferpool, stream->output );
 				}
 
-				image->indexdata = databuffer_create( size );
-				if( image->indexdata == NULL )
-					return 0;
-
-				image->indexdata->size = size;
-				if( fread( image->indexdata->data, 1, image->indexdata->size, qtv ) != image->indexdata->size )
-				{
-					fputs( "qtv_read_frame: Short read on index data\n", stderr );
-					if( qtv != stdin )
-						fclose( qtv );
-					return 0;
-				}
+				bufferpool_put( video->bufferpool, stream->input );
 			}
+
+			if( ! result )
+				return 0;
 		}
 
 		video->framenum++;
@@ -669,6 +1330,7 @@ int qtv_write_header( struct qtv *video, char filename[] )
 {
 	FILE *qtv, *block;
 	unsigned char version, flags;
+	unsigned int features;
 	char blockname[256];
 
 	if( filename == NULL )
@@ -717,6 +1379,42 @@ int qtv_write_header( struct qtv *video, char filename[] )
 		flags = 0;
 		flags |= video->has_index & 0x01;
 		flags |= ( video->has_tilecache & 0x01 ) << 1;
+
+		features = 0;
+		if( video->numslices > 1 )
+			features |= FEATURE_SLICES;
+		if( video->numplanes > 1 )
+			features |= FEATURE_PLANES;
+		if( video->numplanes > 2 )
+			features |= FEATURE_CHANNELS;
+		if( video->motion )
+			features |= FEATURE_MOTION;
+		if( video->scroll )
+			features |= FEATURE_SCROLL;
+		if( video->blockcopy )
+			features |= FEATURE_COPY;
+		if( video->palette )
+			features |= FEATURE_PALETTE;
+		if( video->colormap )
+			features |= FEATURE_COLORMAP;
+		if( video->contexts )
+			features |= FEATURE_CONTEXTS;
+		if( video->binary )
+			features |= FEATURE_BINARY;
+		if( video->rans )
+			features |= FEATURE_RANS;
+		if( video->chunks > 1 )
+			features |= FEATURE_CHUNKS;
+		if( video->tree )
+			features |= FEATURE_TREE;
+		if( video->priors != NULL )
+			features |= FEATURE_PRIORS;
+
+		if( features )
+		{
+			flags |= 0x01 << 2;
+			version = EXTVERSION;
+		}
 		
 		fwrite( &(version), sizeof( version ), 1, qtv );
 		fwrite( &(video->width), sizeof( video->width ), 1, qtv );
@@ -724,12 +1422,32 @@ int qtv_write_header( struct qtv *video, char filename[] )
 		fwrite( &(video->framerate), sizeof( video->framerate ), 1, qtv );
 		fwrite( &flags, sizeof( flags ), 1, qtv );
 
+		if( features )
+		{
+			fwrite( &features, sizeof( features ), 1, qtv );
+
+			if( features & FEATURE_SLICES )
+				fwrite( &(video->numslices), sizeof( video->numslices ), 1, qtv );
+
+			if( features & FEATURE_CONTEXTS )
+				fwrite( &(video->contexts), sizeof( video->contexts ), 1, qtv );
+
+			if( features & FEATURE_CHUNKS )
+				fwrite( &(video->chunks), sizeof( video->chunks ), 1, qtv );
+		}
+
 		if( video->has_tilecache )
 		{
 			fwrite( &(video->tilecache->size), sizeof( video->tilecache->size ), 1, qtv );
 			fwrite( &(video->tilecache->blocksize), sizeof( video->tilecache->blocksize ), 1, qtv );
 		}
 
+		if( features & FEATURE_PRIORS )
+		{
+			if( ! qtv_write_priors( video, qtv ) )
+				return 0;
+		}
+
 		if( filename )
 			video->filename = strdup( filename );
 		else
@@ -767,19 +1485,24 @@ int qtv_write_header( struct qtv *video, char filename[] )
 *                                                                              *
 * video is a qtv structure as returned from qtv_create                         *
 * image is the frame to be written                                             *
-* compress indicates wether the frame data should be compressed                *
+* compress is 0 to store the frame data as it is or QTI_COMPRESS, optionally   *
+* with QTI_COMPRESS_RANS to code the image and index data with rANS            *
+* pool is the thread pool to code the streams with or NULL                     *
 *                                                                              *
 * Modifies video                                                               *
 *                                                                              *
 * Returns 0 on failure, 1 on success                                           *
 *******************************************************************************/
-int qtv_write_frame( struct qtv *video, struct qti *image, int compress )
+int qtv_write_frame( struct qtv *video, struct qti *image, int compress, struct threadpool *pool )
 {
 	FILE * qtv;
-	struct databuffer *compdata;
-	struct rangecoder *coder;
-	unsigned char flags;
-	unsigned int size, offset;
+	struct qtv_stream *stream;
+	struct qti_slice *slice;
+	unsigned char *data;
+	unsigned char flags, coders, numchunks;
+	unsigned int size, offset, compsize, length;
+	int numstreams, result;
+	int i, j;
 
 	if( video->is_qtw )
 		qtv = video->streamfile;
@@ -792,6 +1515,48 @@ int qtv_write_frame( struct qtv *video, struct qti *image, int compress )
 		return 0;
 	}
 
+	if( ( image->numslices != video->numslices ) || ( image->numplanes > video->numplanes ) )
+	{
+		fputs( "write_qtv: frame slice mismatch\n", stderr );
+		return 0;
+	}
+
+	if( image->motion != ( video->motion && ! image->keyframe ) )
+	{
+		fputs( "write_qtv: frame motion mismatch\n", stderr );
+		return 0;
+	}
+
+	if( image->blockcopy != video->blockcopy )
+	{
+		fputs( "write_qtv: frame block copy mismatch\n", stderr );
+		return 0;
+	}
+
+	if( image->palette != video->palette )
+	{
+		fputs( "write_qtv: frame palette mismatch\n", stderr );
+		return 0;
+	}
+
+	if( ( image->numcolors > 0 ) && ( ! video->colormap ) )
+	{
+		fputs( "write_qtv: frame color map mismatch\n", stderr );
+		return 0;
+	}
+
+	if( image->scroll && ( image->keyframe || ! video->scroll ) )
+	{
+		fputs( "write_qtv: frame scroll mismatch\n", stderr );
+		return 0;
+	}
+
+	if( ( compress & QTI_COMPRESS_RANS ) && ( ! video->rans ) )
+	{
+		fputs( "write_qtv: frame coder mismatch\n", stderr );
+		return 0;
+	}
+
 	if( qtv != NULL )
 	{
 		offset = ftell( qtv );
@@ -801,100 +1566,220 @@ int qtv_write_frame( struct qtv *video, struct qti *image, int compress )
 		flags |= ( compress & 0x01 ) << 2;
 		flags |= ( image->colordiff & 0x03 ) << 3;
 		flags |= ( image->has_tilecache & 0x01 ) << 5;
+		flags |= ( image->scroll & 0x01 ) << 6;
 		flags |= ( image->keyframe & 0x01 ) << 7;
 		
 		fwrite( &(flags), sizeof( flags ), 1, qtv );
 		fwrite( &(image->minsize), sizeof( image->minsize ), 1, qtv );
 		fwrite( &(image->maxdepth), sizeof( image->maxdepth ), 1, qtv );
 
-		databuffer_pad( image->commanddata );
-		databuffer_pad( image->imagedata );
+		if( video->rans )
+		{
+			coders = ( compress & QTI_COMPRESS_RANS ) != 0;
+			fwrite( &coders, sizeof( coders ), 1, qtv );
+		}
+
+		if( image->scroll )
+		{
+			fwrite( &(image->scrollx1), sizeof( image->scrollx1 ), 1, qtv );
+			fwrite( &(image->scrolly1), sizeof( image->scrolly1 ), 1, qtv );
+			fwrite( &(image->scrollx2), sizeof( image->scrollx2 ), 1, qtv );
+			fwrite( &(image->scrolly2), sizeof( image->scrolly2 ), 1, qtv );
+			fwrite( &(image->scrolldx), sizeof( image->scrolldx ), 1, qtv );
+			fwrite( &(image->scrolldy), sizeof( image->scrolldy ), 1, qtv );
+		}
+
+		if( video->colormap )		// Only the colors added since the previous frame are stored
+		{
+			fwrite( &(image->numcolors), sizeof( image->numcolors ), 1, qtv );
+			fwrite( &(image->firstcolor), sizeof( image->firstcolor ), 1, qtv );
+
+			if( image->numcolors > 0 )
+				fwrite( image->colors[ image->firstcolor ], 3, image->numcolors - image->firstcolor, qtv );
+		}
 
 		size = 0;
 
+		for( i=0; i<image->numslices*image->numplanes; i++ )
+		{
+			databuffer_pad( image->slices[i].commanddata );
+			databuffer_pad( image->slices[i].imagedata );
+
+			if( image->has_tilecache )
+				databuffer_pad( image->slices[i].indexdata );
+		}
+
 		if( image->keyframe )
 		{
-			rangecoder_reset( video->cmdcoder );
-			rangecoder_reset( video->imgcoder );
+			for( i=0; i<video->numcoders; i++ )
+			{
+				rangecoder_reset( video->cmdcoders[i] );
+				rangecoder_reset( video->imgcoders[i] );
 			
-			if( image->has_tilecache )
-				rangecoder_reset( video->idxcoder );
+				if( image->has_tilecache )
+					rangecoder_reset( video->idxcoders[i] );
+
+				for( j=0; j<video->chunks-1; j++ )
+					rangecoder_reset( video->chunkcoders[i*(video->chunks-1)+j] );
+			}
 		}
 
-		if( compress )
+		numstreams = 0;
+
+		if( compress )		// Code all streams together, then write them in order
 		{
-			compdata = databuffer_create( image->commanddata->size );
-			if( compdata == NULL )
-				return 0;
+			for( i=0; i<image->numslices*image->numplanes; i++ )
+			{
+				slice = &image->slices[i];
+
+				stream = &video->streams[numstreams++];
+				stream->coder = video->cmdcoders[i];
+				stream->input = slice->commanddata;
+				stream->target = NULL;
+				stream->chunks = 0;
+				stream->output = bufferpool_get( video->bufferpool, slice->commanddata->size );
+				if( stream->output == NULL )
+					return 0;
 
-			coder = video->cmdcoder;
+				numchunks = 1;
 
-			rangecode_compress( coder, image->commanddata, compdata );
-			databuffer_pad( compdata );
+				if( video->chunks > 1 )		// Only image data large enough to give every chunk CHUNKSIZE bytes is split
+				{
+					if( slice->imagedata->size / CHUNKSIZE < (unsigned int)video->chunks )
+						numchunks = slice->imagedata->size / CHUNKSIZE;
+					else
+						numchunks = video->chunks;
+
+					if( numchunks < 1 )
+						numchunks = 1;
+				}
 
-			fwrite( &(compdata->size), sizeof( compdata->size ), 1, qtv );
-			fwrite( &(image->commanddata->size), sizeof( image->commanddata->size ), 1, qtv );
-			fwrite( compdata->data, 1, compdata->size, qtv );
+				length = slice->imagedata->size / numchunks;
 
-			size += sizeof( compdata->size ) + sizeof( image->commanddata->size ) + compdata->size;
-			
-			databuffer_free( compdata );
+				for( j=0; j<numchunks; j++ )
+				{
+					stream = &video->streams[numstreams++];
+					stream->chunks = ( ( video->chunks > 1 ) && ( j == 0 ) ) ? numchunks : 0;
 
+					if( compress & QTI_COMPRESS_RANS )
+						stream->coder = NULL;
+					else if( j == 0 )
+						stream->coder = video->imgcoders[i];
+					else
+						stream->coder = video->chunkcoders[i*(video->chunks-1)+j-1];
 
-			compdata = databuffer_create( image->imagedata->size / 2 + 1 );
-			if( compdata == NULL )
-				return 0;
+					if( numchunks > 1 )
+					{
+						stream->size = j < numchunks-1 ? length : slice->imagedata->size - length*(numchunks-1);
+						stream->target = slice->imagedata;
+						stream->input = bufferpool_get( video->bufferpool, stream->size );
+						if( stream->input == NULL )
+							return 0;
 
-			coder = video->imgcoder;
-			rangecode_compress( coder, image->imagedata, compdata );
-			databuffer_pad( compdata );
+						data = databuffer_add_span( stream->input, stream->size );
+						if( data == NULL )
+							return 0;
 
-			fwrite( &(compdata->size), sizeof( compdata->size ), 1, qtv );
-			fwrite( &(image->imagedata->size), sizeof( image->imagedata->size ), 1, qtv );
-			fwrite( compdata->data, 1, compdata->size, qtv );
-			
-			size += sizeof( compdata->size ) + sizeof( image->imagedata->size ) + compdata->size;
-			
-			databuffer_free( compdata );
-			
-			if( image->has_tilecache )
+						memcpy( data, slice->imagedata->data + length*j, stream->size );
+					}
+					else
+					{
+						stream->target = NULL;
+						stream->input = slice->imagedata;
+					}
+
+					stream->output = bufferpool_get( video->bufferpool, stream->input->size / 2 + 1 );
+					if( stream->output == NULL )
+						return 0;
+				}
+
+				if( image->has_tilecache )
+				{
+					stream = &video->streams[numstreams++];
+					stream->coder = ( compress & QTI_COMPRESS_RANS ) ? NULL : video->idxcoders[i];
+					stream->input = slice->indexdata;
+					stream->target = NULL;
+					stream->chunks = 0;
+					stream->output = bufferpool_get( video->bufferpool, slice->indexdata->size / 2 + 1 );
+					if( stream->output == NULL )
+						return 0;
+				}
+			}
+
+			result = qtv_code_streams( video, qtv_compress_task, numstreams, pool );
+
+			for( i=0; i<numstreams; i+=numchunks )
 			{
-				compdata = databuffer_create( image->indexdata->size / 2 + 1 );
-				if( compdata == NULL )
-					return 0;
+				stream = &video->streams[i];
+				numchunks = stream->chunks > 1 ? stream->chunks : 1;
 
-				coder = video->idxcoder;
-				rangecode_compress( coder, image->indexdata, compdata );
-				databuffer_pad( compdata );
+				if( result )
+				{
+					compsize = 0;
+					for( j=0; j<numchunks; j++ )
+						compsize += stream[j].output->size;
 
-				fwrite( &(compdata->size), sizeof( compdata->size ), 1, qtv );
-				fwrite( &(image->indexdata->size), sizeof( image->indexdata->size ), 1, qtv );
-				fwrite( compdata->data, 1, compdata->size, qtv );
-			
-				size += sizeof( compdata->size ) + sizeof( image->indexdata->size ) + compdata->size;
-			
-				databuffer_free( compdata );
+					length = stream->target != NULL ? stream->target->size : stream->input->size;
+
+					fwrite( &compsize, sizeof( compsize ), 1, qtv );
+					fwrite( &length, sizeof( length ), 1, qtv );
+
+					size += sizeof( compsize ) + sizeof( length ) + compsize;
+
+					if( stream->chunks > 0 )		// Chunk table of image data
+					{
+						fwrite( &numchunks, sizeof( numchunks ), 1, qtv );
+						size += sizeof( numchunks );
+
+						if( numchunks > 1 )
+						{
+							for( j=0; j<numchunks; j++ )
+								fwrite( &(stream[j].output->size), sizeof( stream[j].output->size ), 1, qtv );
+
+							size += sizeof( stream->output->size ) * numchunks;
+						}
+					}
+
+					for( j=0; j<numchunks; j++ )
+						fwrite( stream[j].output->data, 1, stream[j].output->size, qtv );
+				}
+
+				for( j=0; j<numchunks; j++ )
+				{
+					bufferpool_put( video->bufferpool, stream[j].output );
+
+					if( stream[j].target != NULL )
+						bufferpool_put( video->bufferpool, stream[j].input );
+				}
 			}
+
+			if( ! result )
+				return 0;
 		}
 		else
 		{
-			fwrite( &(image->commanddata->size), sizeof( image->commanddata->size ), 1, qtv );
-			fwrite( image->commanddata->data, 1, image->commanddata->size, qtv );
+			for( i=0; i<image->numslices*image->numplanes; i++ )
+			{
+				slice = &image->slices[i];
+
+				fwrite( &(slice->commanddata->size), sizeof( slice->commanddata->size ), 1, qtv );
+				fwrite( slice->commanddata->data, 1, slice->commanddata->size, qtv );
 
-			size += sizeof( image->commanddata->size ) + image->commanddata->size;
+				size += sizeof( slice->commanddata->size ) + slice->commanddata->size;
 
 
-			fwrite( &(image->imagedata->size), sizeof( image->imagedata->size ), 1, qtv );
-			fwrite( image->imagedata->data, 1, image->imagedata->size, qtv );
+				fwrite( &(slice->imagedata->size), sizeof( slice->imagedata->size ), 1, qtv );
+				fwrite( slice->imagedata->data, 1, slice->imagedata->size, qtv );
 			
-			size += sizeof( image->imagedata->size ) + image->imagedata->size;
+				size += sizeof( slice->imagedata->size ) + slice->imagedata->size;
 			
-			if( image->has_tilecache )
-			{
-				fwrite( &(image->indexdata->size), sizeof( image->indexdata->size ), 1, qtv );
-				fwrite( image->indexdata->data, 1, image->indexdata->size, qtv );
+				if( image->has_tilecache )
+				{
+					fwrite( &(slice->indexdata->size), sizeof( slice->indexdata->size ), 1, qtv );
+					fwrite( slice->indexdata->data, 1, slice->indexdata->size, qtv );
 			
-				size += sizeof( image->indexdata->size ) + image->indexdata->size;
+					size += sizeof( slice->indexdata->size ) + slice->indexdata->size;
+				}
 			}
 		}
 
@@ -977,13 +1862,18 @@ int qtv_write_block( struct qtv *video )
 * tilecache is the tile cache to associate with this video                     *
 * index indicates wether the video should have and index (1) or not (0)        *
 * is_qtw indicates wether the video should be a qtw (1) or qtv(0) video        *
+* options are the coding settings of the video                                 *
 *                                                                              *
 * Modifies video                                                               *
 *                                                                              *
 * Returns 0 on failure, 1 on success                                           *
 *******************************************************************************/
-int qtv_create( struct qtv *video, int width, int height, int framerate, struct tilecache *cache, int index, int is_qtw )
+int qtv_create( struct qtv *video, int width, int height, int framerate, struct tilecache *cache, int index, int is_qtw, struct qtv_options *options )
 {
+	int numslices = options->numslices;
+	int numplanes = options->numplanes;
+	int chunks = options->chunks;
+
 	video->width = width;
 	video->height = height;
 	video->framerate = framerate;
@@ -996,6 +1886,25 @@ int qtv_create( struct qtv *video, int width, int height, int framerate, struct
 	video->framenum = 0;
 	video->numblocks = 0;
 	video->blocknum = 0;
+	video->motion = options->motion;
+	video->scroll = options->scroll;
+	video->blockcopy = options->blockcopy;
+	video->palette = options->palette;
+	video->colormap = options->colormap;
+	video->numcolors = 0;
+	video->contexts = options->contexts < 0 ? 0 : options->contexts;
+	video->binary = options->binary;
+	video->tree = options->tree;
+	video->rans = options->rans;
+
+	if( chunks < 1 )
+		chunks = 1;
+
+	if( chunks > QTV_MAXCHUNKS )
+		chunks = QTV_MAXCHUNKS;
+
+	video->chunks = chunks;
+	video->priors = NULL;
 
 	if( index )
 	{
@@ -1013,22 +1922,22 @@ int qtv_create( struct qtv *video, int width, int height, int framerate, struct
 	{
 		video->has_tilecache = 1;
 		video->tilecache = cache;
-		
-		video->idxcoder = rangecoder_create( 2, 8 );
-		if( video->idxcoder == NULL )
-			return 0;
 	}
 	else
 	{
 		video->has_tilecache = 0;
 	}
 
-	video->cmdcoder = rangecoder_create( 8, 1 );
-	if( video->cmdcoder == NULL )
-		return 0;
+	if( numslices > height )
+		numslices = height;
+
+	if( numslices < 1 )
+		numslices = 1;
+
+	if( ( numplanes < 1 ) || ( numplanes > 3 ) )
+		numplanes = 1;
 
-	video->imgcoder = rangecoder_create( 2, 8 );
-	if( video->imgcoder == NULL )
+	if( ! qtv_create_coders( video, numslices, numplanes ) )
 		return 0;
 
 	return 1;
@@ -1159,6 +2068,93 @@ int qtv_seek( struct qtv *video, int frame )
 	return 1;
 }
 
+/*******************************************************************************
+* Function to load trained priors from a file, they are stored in the header   *
+* so decoders do not need the file                                             *
+* The image and index coders start from the priors at every key frame.         *
+*                                                                              *
+* video is a qtv structure as returned from qtv_create, before the header is   *
+* written                                                                      *
+* filename is the file name of the priors file as written by qtv_save_priors   *
+*                                                                              *
+* Modifies video                                                               *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+int qtv_load_priors( struct qtv *video, char filename[] )
+{
+	FILE *file;
+	char header[4];
+
+	file = fopen( filename, "rb" );
+	if( file == NULL )
+	{
+		perror( "qtv_load_priors: fopen" );
+		return 0;
+	}
+
+	if( ( fread( header, 1, 4, file ) != 4 ) || ( strncmp( header, PRIORS_MAGIC, 4 ) != 0 ) )
+	{
+		fputs( "qtv_load_priors: Not a priors file\n", stderr );
+		fclose( file );
+		return 0;
+	}
+
+	free( video->priors );
+	video->priors = malloc( QTV_PRIORS*RANGECODER_PRIORS );
+	if( video->priors == NULL )
+	{
+		perror( "qtv_load_priors: malloc" );
+		fclose( file );
+		return 0;
+	}
+
+	if( fread( video->priors, 1, QTV_PRIORS*RANGECODER_PRIORS, file ) != QTV_PRIORS*RANGECODER_PRIORS )
+	{
+		fputs( "qtv_load_priors: Short read on priors\n", stderr );
+		fclose( file );
+		return 0;
+	}
+
+	fclose( file );
+
+	return qtv_apply_priors( video );
+}
+
+/*******************************************************************************
+* Function to save trained priors to a file                                    *
+*                                                                              *
+* priors are QTV_PRIORS tables of RANGECODER_PRIORS as made by                 *
+* rangecoder_make_priors                                                       *
+* filename is the file name of the new priors file                             *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+int qtv_save_priors( unsigned char *priors, char filename[] )
+{
+	FILE *file;
+
+	file = fopen( filename, "wb" );
+	if( file == NULL )
+	{
+		perror( "qtv_save_priors: fopen" );
+		return 0;
+	}
+
+	fwrite( PRIORS_MAGIC, 1, 4, file );
+
+	if( fwrite( priors, 1, QTV_PRIORS*RANGECODER_PRIORS, file ) != QTV_PRIORS*RANGECODER_PRIORS )
+	{
+		perror( "qtv_save_priors: fwrite" );
+		fclose( file );
+		return 0;
+	}
+
+	fclose( file );
+
+	return 1;
+}
+
 /*******************************************************************************
 * Function to free the internal structures of a qtv struct                     *
 *                                                                              *
@@ -1168,19 +2164,43 @@ int qtv_seek( struct qtv *video, int frame )
 *******************************************************************************/
 void qtv_free( struct qtv *video )
 {
-	rangecoder_free( video->cmdcoder );
-	video->cmdcoder = NULL;
-	rangecoder_free( video->imgcoder );
-	video->imgcoder = NULL;
-	
-	if( video->has_index )
-		free( video->index );
+	int i, j;
+
+	for( i=0; i<video->numcoders; i++ )
+	{
+		rangecoder_free( video->cmdcoders[i] );
+		rangecoder_free( video->imgcoders[i] );
+
+		if( video->has_tilecache )
+			rangecoder_free( video->idxcoders[i] );
+
+		for( j=0; j<video->chunks-1; j++ )
+			rangecoder_free( video->chunkcoders[i*(video->chunks-1)+j] );
+	}
 
-	if( video->has_tilecache )
+	free( video->cmdcoders );
+	video->cmdcoders = NULL;
+	free( video->imgcoders );
+	video->imgcoders = NULL;
+	free( video->idxcoders );
+	video->idxcoders = NULL;
+	free( video->chunkcoders );
+	video->chunkcoders = NULL;
+	free( video->streams );
+	video->streams = NULL;
+	free( video->tasks );
+	video->tasks = NULL;
+	free( video->priors );
+	video->priors = NULL;
+
+	if( video->bufferpool != NULL )
 	{
-		rangecoder_free( video->idxcoder );
-		video->idxcoder = NULL;
+		bufferpool_free( video->bufferpool );
+		video->bufferpool = NULL;
 	}
+	
+	if( video->has_index )
+		free( video->index );
 
 	if( ( video->file != NULL ) && ( video->file != stdout ) )
 	{
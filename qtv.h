@@ -20,6 +20,10 @@
 #ifndef QTV_H
 #define QTV_H
 
+#define QTV_MAXCHUNKS 64
+
+#define QTV_PRIORS 3
+
 /*******************************************************************************
 * Structure to hold all the data associated with a qtv index entry             *
 *                                                                              *
@@ -34,6 +38,29 @@ struct qtv_index
 	long int offset;
 };
 
+/*******************************************************************************
+* Structure to hold one entropy coded stream of a frame slice                  *
+*                                                                              *
+* coder is the range coder of the stream or NULL when it is coded with rANS    *
+* input is the data to be coded                                                *
+* output receives the coded data                                               *
+* size is the size of the decoded data (only when decoding)                    *
+* target is the image data a chunk was split off from or is joined into, NULL  *
+* for streams that are not split                                               *
+* chunks is the number of chunks the image data was split into, set on the     *
+* first chunk, 0 for streams that are never split                              *
+* result is set to 0 on failure, 1 on success                                  *
+*******************************************************************************/
+struct qtv_stream
+{
+	struct rangecoder *coder;
+	struct databuffer *input, *output;
+	struct databuffer *target;
+	unsigned int size;
+	int chunks;
+	int result;
+};
+
 /*******************************************************************************
 * Structure to hold all the data associated with a qtv                         *
 *                                                                              *
@@ -47,12 +74,40 @@ struct qtv_index
 * file is the file object to read/write                                        *
 * streamfile is the file object for the current block (only qtw)               *
 * filename is the file name of the video                                       *
-* cmdcoder is the range coder used to compress the command data                *
-* imgcoder is the range coder used to compress the image data                  *
+* numslices is the number of slices every frame is split into                  *
+* numplanes is the number of planes of frames with separate color channels     *
+* motion indicates wether non keyframes may copy moved blocks                  *
+* scroll indicates wether non keyframes may shift a region of the reference    *
+* blockcopy indicates wether frames may copy repeated blocks within themselves *
+* palette indicates wether frames may code small blocks as palette blocks      *
+* colormap indicates wether frames may store their colors in a color map       *
+* numcolors and colors are the color map of the last frame read                *
+* contexts limits the contexts kept by every order 2 coder, 0 for no limit     *
+* binary indicates wether the command data is coded with the binary coder      *
+* tree indicates wether the image and index data are range coded bit by bit    *
+* rans indicates wether frames may code their image and index data with rANS   *
+* chunks is the most chunks the image data of a slice is split into            *
+* numcoders is the number of range coders of each kind, numslices*numplanes    *
+* cmdcoders are the range coders used to compress the command data             *
+* imgcoders are the range coders used to compress the image data               *
+* chunkcoders are the range coders of the image data chunks after the first,   *
+* chunks-1 for every slice and plane                                           *
+* priors are the trained priors the image and index coders start from at key   *
+* frames, QTV_PRIORS tables of RANGECODER_PRIORS for the image data of the     *
+* first plane and of the other planes and the index data, or NULL for flat     *
+* counts                                                                       *
 * has_index indicates wether the video has an index or not                     *
 * index contains the video index                                               *
 * idx_size is the number of entries in the index                               *
 * idx_datasize is the amount of space allocated for the index entries          *
+* has_tilecache indicates wether the video uses a tile cache                   *
+* tilecache is the tile cache used by the video                                *
+* idxcoders are the range coders used to compress the tile cache indices       *
+* bufferpool keeps the data buffers of past frames for the next ones           *
+* streams are the streams of the current frame, chunks+2 for every coder       *
+* tasks point to the streams for the thread pool                               *
+*                                                                              *
+* Every slice and plane has range coders of its own.                           *
 *******************************************************************************/
 struct qtv
 {
@@ -66,8 +121,15 @@ struct qtv
 	FILE *file, *streamfile;
 	char *filename;
 
-	struct rangecoder *cmdcoder;
-	struct rangecoder *imgcoder;
+	int numslices, numplanes, numcoders;
+	int motion, scroll, blockcopy, palette, colormap;
+	int numcolors;
+	int contexts, binary, tree, rans, chunks;
+	unsigned char colors[ QTI_MAXCOLORS ][3];
+	struct rangecoder **cmdcoders;
+	struct rangecoder **imgcoders;
+	struct rangecoder **chunkcoders;
+	unsigned char *priors;
 	
 	int has_index;
 	struct qtv_index *index;
@@ -75,18 +137,50 @@ struct qtv
 
 	int has_tilecache;
 	struct tilecache *tilecache;
-	struct rangecoder *idxcoder;
+	struct rangecoder **idxcoders;
+
+	struct bufferpool *bufferpool;
+
+	struct qtv_stream *streams;
+	void **tasks;
+};
+
+/*******************************************************************************
+* Structure to hold the coding settings of a qtv that is written               *
+*                                                                              *
+* numslices is the number of slices every frame is split into                  *
+* numplanes is 2 to code luma and chroma of fakeyuv frames as separate planes, *
+* 3 to code every channel as a plane of its own                                *
+* motion indicates wether non keyframes may copy moved blocks                  *
+* scroll indicates wether non keyframes may shift a region of the reference    *
+* blockcopy indicates wether frames may copy repeated blocks within themselves *
+* palette indicates wether frames may code small blocks as palette blocks      *
+* colormap indicates wether frames may store their colors in a color map       *
+* contexts limits the contexts kept by every order 2 coder, 0 for no limit     *
+* binary indicates wether the command data is coded with the binary coder      *
+* tree indicates wether the image and index data are range coded bit by bit    *
+* rans indicates wether frames may code their image and index data with rANS   *
+* chunks is the most chunks large image data of a slice is split into, so they *
+* can be coded in parallel                                                     *
+*******************************************************************************/
+struct qtv_options
+{
+	int numslices, numplanes;
+	int motion, scroll, blockcopy, palette, colormap;
+	int contexts, binary, tree, rans, chunks;
 };
 
-extern int qtv_create( struct qtv *video, int width, int height, int framerate, struct tilecache *cache, int index, int is_qtw );
+extern int qtv_create( struct qtv *video, int width, int height, int framerate, struct tilecache *cache, int index, int is_qtw, struct qtv_options *options );
 extern int qtv_write_header( struct qtv *video, char filename[] );
-extern int qtv_write_frame( struct qtv *video, struct qti *image, int compress );
+extern int qtv_write_frame( struct qtv *video, struct qti *image, int compress, struct threadpool *pool );
 extern int qtv_write_block( struct qtv *video );
 extern int qtv_read_header( struct qtv *video, int is_qtw, char filename[] );
-extern int qtv_read_frame( struct qtv *video, struct qti *image );
+extern int qtv_read_frame( struct qtv *video, struct qti *image, struct threadpool *pool );
 extern int qtv_can_read_frame( struct qtv *video );
 extern int qtv_seek( struct qtv *video, int frame );
 extern int qtv_write_index( struct qtv *video );
+extern int qtv_load_priors( struct qtv *video, char filename[] );
+extern int qtv_save_priors( unsigned char *priors, char filename[] );
 extern void qtv_free( struct qtv *video );
 
 #endif
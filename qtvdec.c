@@ -26,6 +26,12 @@
 #include "utils.h"
 #include "image.h"
 #include "qti.h"
+#include "blockmap.h"
+#include "damage.h"
+#include "motion.h"
+#include "scroll.h"
+#include "colormap.h"
+#include "threadpool.h"
 #include "qtc.h"
 #include "qtv.h"
 #include "ppm.h"
@@ -54,17 +60,19 @@ void print_help( void )
 	puts( "\t-a [0..2]\t-\tAnalysis mode" );
 	puts( "\t-f [1..]\t-\tBegin decoding at specific frame (Needs index)" );
 	puts( "\t-n [1..]\t-\tLimit number of frames to decode" );
+	puts( "\t-j [1..]\t-\tNumber of threads (1)" );
 	puts( "\t-i filename\t-\tInput file (-)" );
 	puts( "\t-o filename\t-\tOutput file (-)" );
 }
 
 int main( int argc, char *argv[] )
 {
-	struct image image, refimage;
+	struct image image, refimage, *frame;
 	struct qti compimage;
 	struct qtv video;
+	struct threadpool *pool;
 
-	int opt, verbose, analyze, qtw;
+	int opt, verbose, analyze, qtw, threads;
 	int done, framenum, skipframes;
 	int startframe, numframes;
 	long int start, frame_start;
@@ -77,10 +85,11 @@ int main( int argc, char *argv[] )
 	skipframes = 0;
 	numframes = -1;
 	qtw = 0;
+	threads = 1;
 	infile = NULL;
 	outfile = NULL;
 
-	while( ( opt = getopt( argc, argv, "hva:wf:n:i:o:" ) ) != -1 )
+	while( ( opt = getopt( argc, argv, "hva:wf:n:j:i:o:" ) ) != -1 )
 	{
 		switch( opt )
 		{
@@ -112,6 +121,11 @@ int main( int argc, char *argv[] )
 					fputs( "main: Can not parse command line: -n\n", stderr );
 			break;
 
+			case 'j':
+				if( sscanf( optarg, "%i", &threads ) != 1 )
+					fputs( "main: Can not parse command line: -j\n", stderr );
+			break;
+
 			case 'i':
 				infile = strdup( optarg );
 			break;
@@ -146,11 +160,28 @@ int main( int argc, char *argv[] )
 		return 1;
 	}
 
+	if( threads < 1 )
+	{
+		fputs( "main: Number of threads out of range\n", stderr );
+		return 1;
+	}
+
 	interrupt = 0;
 
 	done = 0;
 	framenum = 0;
 
+	if( threads > 1 )
+	{
+		pool = threadpool_create( threads-1 );		// Create worker threads
+		if( pool == NULL )
+			return 2;
+	}
+	else
+	{
+		pool = NULL;
+	}
+
 	if( ! qtv_read_header( &video, qtw, infile ) )		// Read video header
 		return 2;
 
@@ -168,7 +199,11 @@ int main( int argc, char *argv[] )
 		skipframes = startframe - video.framenum;
 	}
 
-	image_create( &refimage, video.width, video.height, 0 );		// Create reference image
+	if( ! image_create( &refimage, video.width, video.height, 0 ) )		// Create reference image
+		return 2;
+
+	if( ! image_create( &image, video.width, video.height, 0 ) )		// Create output image
+		return 2;
 
 	fps = 0;
 	start = get_time();
@@ -177,22 +212,35 @@ int main( int argc, char *argv[] )
 	{
 		frame_start = get_time();
 
-		if( ! qtv_read_frame( &video, &compimage ) )		// Read frame from stream
+		if( ! qtv_read_frame( &video, &compimage, pool ) )		// Read frame from stream
 			return 2;
 
-		if( ! image_create( &image, compimage.width, compimage.height, 0 ) )
-			return 2;
+		frame = &image;
 
 		if( analyze == 0 )
 		{
-			if( ! qtc_decompress( &compimage, &refimage, &image ) )		// Decompress frame
-				return 2;
+			if( compimage.motion )		// Moved blocks are read from the reference, decode into the other buffer
+			{
+				if( ! qtc_decompress( &compimage, &refimage, &image, NULL, pool ) )
+					return 2;
 
-			image_copy( &image, &refimage );		// Copy frame to reference image
+				image_swap( &image, &refimage );
+			}
+			else
+			{
+				if( ! qtc_decompress( &compimage, &refimage, &refimage, NULL, pool ) )		// Decompress frame in place
+					return 2;
+			}
 
+			frame = &refimage;
 
-			if( skipframes <= 0 )
+			if( ( skipframes <= 0 ) && ( refimage.transform || refimage.colordiff ) )
 			{
+				image_copy( &refimage, &image );		// Transforms need a copy, the reference must stay untouched
+				image.transform = refimage.transform;
+				image.colordiff = refimage.colordiff;
+				frame = &image;
+
 				if( image.transform == 1 )		// Apply image transforms
 					image_transform_fast_rev( &image );
 				else if( image.transform == 2 )
@@ -201,7 +249,6 @@ int main( int argc, char *argv[] )
 				if( image.colordiff )		// Apply fakeyuv transform
 					image_color_diff_rev( &image );
 			}
-
 		}
 		else
 		{
@@ -214,7 +261,7 @@ int main( int argc, char *argv[] )
 
 		if( skipframes <= 0 )
 		{
-			if( ! ppm_write( &image, outfile ) )		// Write decompressed frame to file
+			if( ! ppm_write( frame, outfile ) )		// Write decompressed frame to file
 				return 2;
 
 			if( ( outfile != NULL ) && ( strcmp( outfile, "-" ) != 0 ) )
@@ -224,7 +271,6 @@ int main( int argc, char *argv[] )
 			}
 		}
 
-		image_free( &image );
 		qti_free( &compimage );
 
 		if( interrupt )
@@ -260,9 +306,13 @@ int main( int argc, char *argv[] )
 
 	fps = 1000000.0/((get_time()-start)/framenum);
 
+	image_free( &image );
 	image_free( &refimage );
 	qtv_free( &video );
 
+	if( pool != NULL )
+		threadpool_free( pool );
+
 	if( verbose )
 	{
 		fprintf( stderr, "FPS:%.2f\n", fps );
@@ -26,6 +26,12 @@
 #include "utils.h"
 #include "image.h"
 #include "qti.h"
+#include "blockmap.h"
+#include "motion.h"
+#include "scroll.h"
+#include "colormap.h"
+#include "damage.h"
+#include "threadpool.h"
 #include "qtc.h"
 #include "qtv.h"
 #include "ppm.h"
@@ -53,7 +59,7 @@ void print_help( void )
 	puts( "\t-t [0..2]\t-\tUse image transforms (0)" );
 	puts( "\t-e\t\t-\tCompress output data" );
 	puts( "\t-w\t\t-\tCreate QTW file" );
-	puts( "\t-y [0..2]\t-\tUse fakeyuv transform (0)" );
+	puts( "\t-y [0..4]\t-\tUse fakeyuv transform (0)" );
 	puts( "\t-v\t\t-\tBe verbose" );
 	puts( "\t-x\t\t-\tCreate index (Needs key frames)" );
 	puts( "\t-s [1..]\t-\tMinimal block size (2)" );
@@ -64,6 +70,21 @@ void print_help( void )
 	puts( "\t-d [0..]\t-\tMaximum recursion depth (16)" );
 	puts( "\t-c [0..]\t-\tCache size in kilo tiles (0)" );
 	puts( "\t-l [0..]\t-\tLaziness" );
+	puts( "\t-p\t\t-\tUse block map (faster, needs more memory)" );
+	puts( "\t-a\t\t-\tCopy moved blocks (motion compensation)" );
+	puts( "\t-S\t\t-\tShift scrolled regions of the reference frame" );
+	puts( "\t-C\t\t-\tCopy repeated blocks within a frame" );
+	puts( "\t-P\t\t-\tCode blocks of few colors as palette blocks" );
+	puts( "\t-G\t\t-\tStore colors of frames with few colors in a color map" );
+	puts( "\t-B\t\t-\tCode the command data with a binary coder (with -e)" );
+	puts( "\t-R\t\t-\tCode key frames with a static rANS coder (with -e)" );
+	puts( "\t-T\t\t-\tCode the image data bit by bit with a binary tree (with -e)" );
+	puts( "\t-M [0..]\t-\tContexts kept per order 2 coder, 0 for all (0)" );
+	puts( "\t-K [1..64]\t-\tChunks large image data is split into (1)" );
+	puts( "\t-L filename\t-\tStart the coders from trained priors (with -e)" );
+	puts( "\t-j [1..]\t-\tNumber of threads (1)" );
+	puts( "\t-q [0..]\t-\tQuad tree split depth for threads (4)" );
+	puts( "\t-z [1..]\t-\tNumber of slices (1)" );
 	puts( "\t-i filename\t-\tInput file (-)" );
 	puts( "\t-o filename\t-\tOutput file (-)" );
 }
@@ -74,6 +95,13 @@ int main( int argc, char *argv[] )
 	struct qti compimage;
 	struct qtv video;
 	struct tilecache *cache;
+	struct blockmap *blockmap;
+	struct motion *motion;
+	struct scroll *scroll;
+	struct colormap *colormap;
+	struct threadpool *pool;
+	struct qtc_options compopts;
+	struct qtv_options videoopts;
 
 	int opt, verbose, qtw;
 	unsigned long int insize, bsize, outsize, size;
@@ -84,13 +112,16 @@ int main( int argc, char *argv[] )
 	int minsize;
 	int maxdepth;
 	int lazyness;
+	int useblockmap, usemotion, usescroll, usecopy, usepalette, usecolormap, usebinary, usetree, userans;
+	int threads, splitdepth, slices;
+	int contexts, chunks;
 	int cachesize;
 	int index;
 	int framerate, keyrate, numframes;
 	int blockrate, numblocks, blocksize;
 	long int start, frame_start;
 	double fps;
-	char *infile, *outfile;
+	char *infile, *outfile, *priorfile;
 
 	verbose = 0;
 	transform = 0;
@@ -100,6 +131,20 @@ int main( int argc, char *argv[] )
 	maxdepth = 16;
 	cachesize = 0;
 	lazyness = 0;
+	useblockmap = 0;
+	usemotion = 0;
+	usescroll = 0;
+	usecopy = 0;
+	usepalette = 0;
+	usecolormap = 0;
+	usebinary = 0;
+	usetree = 0;
+	userans = 0;
+	contexts = 0;
+	chunks = 1;
+	threads = 1;
+	splitdepth = 4;
+	slices = 1;
 	framerate = 25;
 	keyrate = 0;
 	index = 0;
@@ -108,8 +153,9 @@ int main( int argc, char *argv[] )
 	qtw = 0;
 	infile = NULL;
 	outfile = NULL;
+	priorfile = NULL;
 
-	while( ( opt = getopt( argc, argv, "hevxwy:n:t:s:d:c:l:r:k:b:i:o:" ) ) != -1 )
+	while( ( opt = getopt( argc, argv, "hevxwpaSCPGBTRM:K:L:j:q:z:y:n:t:s:d:c:l:r:k:b:i:o:" ) ) != -1 )
 	{
 		switch( opt )
 		{
@@ -184,6 +230,67 @@ int main( int argc, char *argv[] )
 					fputs( "main: Can not parse command line: -l\n", stderr );
 			break;
 
+			case 'p':
+				useblockmap = 1;
+			break;
+
+			case 'a':
+				usemotion = 1;
+			break;
+
+			case 'S':
+				usescroll = 1;
+			break;
+
+			case 'C':
+				usecopy = 1;
+			break;
+
+			case 'P':
+				usepalette = 1;
+			break;
+
+			case 'G':
+				usecolormap = 1;
+			break;
+
+			case 'B':
+				usebinary = 1;
+			break;
+
+			case 'R':
+				userans = 1;
+			break;
+
+			case 'T':
+				usetree = 1;
+			break;
+
+			case 'M':
+				if( sscanf( optarg, "%i", &contexts ) != 1 )
+					fputs( "main: Can not parse command line: -M\n", stderr );
+			break;
+
+			case 'K':
+				if( sscanf( optarg, "%i", &chunks ) != 1 )
+					fputs( "main: Can not parse command line: -K\n", stderr );
+			break;
+
+			case 'j':
+				if( sscanf( optarg, "%i", &threads ) != 1 )
+					fputs( "main: Can not parse command line: -j\n", stderr );
+			break;
+
+			case 'q':
+				if( sscanf( optarg, "%i", &splitdepth ) != 1 )
+					fputs( "main: Can not parse command line: -q\n", stderr );
+			break;
+
+			case 'z':
+				if( sscanf( optarg, "%i", &slices ) != 1 )
+					fputs( "main: Can not parse command line: -z\n", stderr );
+			break;
+
 			case 'i':
 				infile = strdup( optarg );
 			break;
@@ -192,6 +299,10 @@ int main( int argc, char *argv[] )
 				outfile = strdup( optarg );
 			break;
 
+			case 'L':
+				priorfile = strdup( optarg );
+			break;
+
 			default:
 			case '?':
 				fputs( "main: Can not parse command line: unknown option\n", stderr );
@@ -206,7 +317,7 @@ int main( int argc, char *argv[] )
 		return 1;
 	}
 
-	if( ( colordiff < 0 ) || ( colordiff > 2 ) )
+	if( ( colordiff < 0 ) || ( colordiff > 4 ) )
 	{
 		fputs( "main: Fakeyuv mode out of range\n", stderr );
 		return 1;
@@ -236,6 +347,36 @@ int main( int argc, char *argv[] )
 		return 1;
 	}
 
+	if( threads < 1 )
+	{
+		fputs( "main: Number of threads out of range\n", stderr );
+		return 1;
+	}
+
+	if( splitdepth < 0 )
+	{
+		fputs( "main: Split depth out of range\n", stderr );
+		return 1;
+	}
+
+	if( slices < 1 )
+	{
+		fputs( "main: Number of slices out of range\n", stderr );
+		return 1;
+	}
+
+	if( contexts < 0 )
+	{
+		fputs( "main: Number of contexts out of range\n", stderr );
+		return 1;
+	}
+
+	if( ( chunks < 1 ) || ( chunks > QTV_MAXCHUNKS ) )
+	{
+		fputs( "main: Number of chunks out of range\n", stderr );
+		return 1;
+	}
+
 	if( numframes < -1 )
 	{
 		fputs( "main: Number of frames out of range\n", stderr );
@@ -272,6 +413,24 @@ int main( int argc, char *argv[] )
 	bsize = 0;
 	outsize = 0;
 
+	blockmap = NULL;
+	motion = NULL;
+	scroll = NULL;
+	colormap = NULL;
+
+	image.pixels = NULL;
+
+	if( threads > 1 )
+	{
+		pool = threadpool_create( threads-1 );
+		if( pool == NULL )
+			return 2;
+	}
+	else
+	{
+		pool = NULL;
+	}
+
 	if( cachesize > 0 )
 		cache = tilecache_create( cachesize*1024, minsize );		// Create tile cache
 	else
@@ -306,14 +465,71 @@ int main( int argc, char *argv[] )
 			signal( SIGINT, sig_exit );
 			signal( SIGTERM, sig_exit );
 
-			if( ! qtv_create( &video, image.width, image.height, framerate, cache, index, qtw ) )		// Initialize video
+			videoopts.numslices = slices;
+			videoopts.numplanes = colordiff >= 3 ? colordiff-1 : 1;
+			videoopts.motion = usemotion;
+			videoopts.scroll = usescroll;
+			videoopts.blockcopy = usecopy;
+			videoopts.palette = usepalette;
+			videoopts.colormap = usecolormap;
+			videoopts.contexts = contexts;
+			videoopts.binary = usebinary && rangecomp;
+			videoopts.tree = usetree && rangecomp;
+			videoopts.rans = userans && rangecomp;
+			videoopts.chunks = rangecomp ? chunks : 1;
+
+			if( ! qtv_create( &video, image.width, image.height, framerate, cache, index, qtw, &videoopts ) )		// Initialize video
 				return 2;
 
+			if( ( priorfile != NULL ) && rangecomp )		// Start the coders from trained priors
+			{
+				if( ! qtv_load_priors( &video, priorfile ) )
+					return 2;
+			}
+
 			if( ! qtv_write_header( &video, outfile ) )		// Write video header to file
 				return 2;
 
 			if( ! image_create( &refimage, image.width, image.height, 0 ) )		// Create reference image
 				return 2;
+
+			if( useblockmap )
+			{
+				blockmap = blockmap_create( image.width, image.height );		// Create block map
+				if( blockmap == NULL )
+					return 2;
+			}
+
+			if( usemotion )
+			{
+				motion = motion_create( image.width, image.height );		// Create motion search
+				if( motion == NULL )
+					return 2;
+			}
+
+			if( usescroll )
+			{
+				scroll = scroll_create( image.width, image.height );		// Create scroll detection
+				if( scroll == NULL )
+					return 2;
+			}
+
+			if( usecolormap )
+			{
+				colormap = colormap_create();		// Create color map
+				if( colormap == NULL )
+					return 2;
+			}
+
+			compopts.blockmap = blockmap;
+			compopts.damage = NULL;
+			compopts.motion = motion;
+			compopts.scroll = scroll;
+			compopts.colormap = colormap;
+			compopts.blockcopy = usecopy;
+			compopts.palette = usepalette;
+			compopts.pool = pool;
+			compopts.splitdepth = splitdepth;
 		}
 
 		if( ( image.width != video.width ) || ( image.height != video.height ) )
@@ -332,7 +548,7 @@ int main( int argc, char *argv[] )
 		else if( transform == 2 )
 			image_transform( &image );
 
-		if( ! qti_create( &compimage, image.width, image.height, minsize, maxdepth, cache ) )
+		if( ! qti_create( &compimage, image.width, image.height, minsize, maxdepth, cache, slices, colordiff >= 3 ? colordiff-1 : 1, video.bufferpool ) )
 			return 2;
 
 		if( keyframe )		// Compress frame
@@ -340,12 +556,12 @@ int main( int argc, char *argv[] )
 			if( cache != NULL )
 				tilecache_reset( cache );
 
-			if( ! qtc_compress( &image, NULL, &compimage, lazyness, colordiff == 2 ) )
+			if( ! qtc_compress( &image, NULL, &compimage, lazyness, colordiff >= 2, &compopts ) )
 				return 2;
 		}
 		else
 		{
-			if( ! qtc_compress( &image, &refimage, &compimage, lazyness, colordiff == 2 ) )
+			if( ! qtc_compress( &image, &refimage, &compimage, lazyness, colordiff >= 2, &compopts ) )
 				return 2;
 		}
 
@@ -354,17 +570,16 @@ int main( int argc, char *argv[] )
 		if( qti_getsize( &compimage ) <= 4 )		// Apply entropy coding only to big frames 
 			compress = 0;
 		else
-			compress = rangecomp;
+			compress = rangecomp && userans && keyframe ? QTI_COMPRESS | QTI_COMPRESS_RANS : rangecomp;
 
-		if( ! ( size = qtv_write_frame( &video, &compimage, compress ) ) )		// Write compressed frame to video stream
+		if( ! ( size = qtv_write_frame( &video, &compimage, compress, pool ) ) )		// Write compressed frame to video stream
 			return 2;
 
 		outsize += size;
 		blocksize += size;
 
-		image_copy( &image, &refimage );		// Copy current frame to reference image
+		image_swap( &image, &refimage );		// Current frame becomes the reference image, the old one is read into next
 
-		image_free( &image );
 		qti_free( &compimage );
 		
 		if( ( infile == NULL ) || ( strcmp( infile, "-" ) == 0 ) )
@@ -391,8 +606,7 @@ int main( int argc, char *argv[] )
 		{
 			if( cache != NULL )
 			{
-				cacheblocks = cache->numblocks;
-				cachehits = cache->hits;
+				tilecache_get_stats( cache, &cacheblocks, &cachehits );
 			}
 			else
 			{
@@ -431,13 +645,28 @@ int main( int argc, char *argv[] )
 	if( index )		// Write video index to file
 		outsize += qtv_write_index( &video );
 
+	image_free( &image );
 	image_free( &refimage );
 	qtv_free( &video );
 
+	if( blockmap != NULL )
+		blockmap_free( blockmap );
+
+	if( motion != NULL )
+		motion_free( motion );
+
+	if( scroll != NULL )
+		scroll_free( scroll );
+
+	if( colormap != NULL )
+		colormap_free( colormap );
+
+	if( pool != NULL )
+		threadpool_free( pool );
+
 	if( cache != NULL )
 	{
-		cacheblocks = cache->numblocks;
-		cachehits = cache->hits;
+		tilecache_get_stats( cache, &cacheblocks, &cachehits );
 		tilecache_free( cache );
 	}
 	else
@@ -458,6 +687,7 @@ int main( int argc, char *argv[] )
 
 	free( infile );
 	free( outfile );
+	free( priorfile );
 
 	return 0;
 }
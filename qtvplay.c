@@ -29,6 +29,12 @@
 #include "image.h"
 #include "databuffer.h"
 #include "qti.h"
+#include "blockmap.h"
+#include "damage.h"
+#include "motion.h"
+#include "scroll.h"
+#include "colormap.h"
+#include "threadpool.h"
 #include "qtc.h"
 #include "qtv.h"
 #include "ppm.h"
@@ -45,6 +51,7 @@ void print_help( void )
 	puts( "\t-v\t\t-\tBe verbose" );
 	puts( "\t-r [1..]\t-\tOverride frame rate" );
 	puts( "\t-w\t\t-\tRead QTW file" );
+	puts( "\t-j [1..]\t-\tNumber of threads (1)" );
 	puts( "\t-i filename\t-\tInput file (-)" );
 	puts( "Keys:" );
 	puts( "\t[space]\t\t-\tPlay/Pause" );
@@ -60,18 +67,74 @@ void print_help( void )
 
 }
 
+/*******************************************************************************
+* Function to show only the damaged parts of a decoded frame                   *
+* Runs of damaged tiles are copied to the screen, transformed and updated      *
+*                                                                              *
+* in is the decoded frame                                                      *
+* out is the image of the screen surface                                       *
+* screen is the screen surface                                                 *
+* damage is the damage map of the decoded frame                                *
+* colordiff enables the reverse fakeyuv transform                              *
+*******************************************************************************/
+void update_damage( struct image *in, struct image *out, SDL_Surface *screen, struct damage *damage, int colordiff )
+{
+	int tx1, tx2, ty, x1, y1, x2, y2;
+	unsigned char *tiles;
+
+	for( ty=0; ty<damage->tilesy; ty++ )
+	{
+		tiles = &damage->tiles[ ty*damage->tilesx ];
+
+		y1 = ty*damage->tilesize;
+		y2 = y1+damage->tilesize;
+		if( y2 > in->height )
+			y2 = in->height;
+
+		tx1 = 0;
+		while( tx1 < damage->tilesx )
+		{
+			if( ! tiles[tx1] )
+			{
+				tx1++;
+				continue;
+			}
+
+			tx2 = tx1+1;
+			while( ( tx2 < damage->tilesx ) && ( tiles[tx2] ) )
+				tx2++;
+
+			x1 = tx1*damage->tilesize;
+			x2 = tx2*damage->tilesize;
+			if( x2 > in->width )
+				x2 = in->width;
+
+			image_copy_rect( in, out, x1, y1, x2, y2 );
+
+			if( colordiff && in->colordiff )
+				image_color_diff_rev_rect( out, x1, y1, x2, y2 );
+
+			SDL_UpdateRect( screen, x1, y1, x2-x1, y2-y1 );
+
+			tx1 = tx2;
+		}
+	}
+}
+
 int main( int argc, char *argv[] )
 {
-	struct image image, ccimage, refimage;
+	struct image image, ccimage, refimage, nextimage;
 	struct qti compimage;
 	struct qtv video;
+	struct threadpool *pool;
+	struct damage *damage;
 
 	SDL_Surface *screen;
 	SDL_Event event;
 
 	int opt, analyze, overlay, transform, colordiff, printstats, qtw;
-	int done, framenum, playing, step;
-	int framerate;
+	int done, framenum, playing, step, redraw;
+	int framerate, threads;
 	long int delay, start, frame_start;
 	double fps, load;
 	char *infile;
@@ -86,9 +149,10 @@ int main( int argc, char *argv[] )
 	colordiff = 1;
 	printstats = 0;
 	qtw = 0;
+	threads = 1;
 	infile = NULL;
 
-	while( ( opt = getopt( argc, argv, "hvwi:r:" ) ) != -1 )
+	while( ( opt = getopt( argc, argv, "hvwj:i:r:" ) ) != -1 )
 	{
 		switch( opt )
 		{
@@ -110,6 +174,11 @@ int main( int argc, char *argv[] )
 				qtw = 1;
 			break;
 
+			case 'j':
+				if( sscanf( optarg, "%i", &threads ) != 1 )
+					fputs( "main: Can not parse command line: -j\n", stderr );
+			break;
+
 			case 'i':
 				infile = strdup( optarg );
 			break;
@@ -128,13 +197,31 @@ int main( int argc, char *argv[] )
 		return 1;
 	}
 
+	if( threads < 1 )
+	{
+		fputs( "main: Number of threads out of range\n", stderr );
+		return 1;
+	}
+
 	done = 0;
 	framenum = 0;
 	playing = 1;
 	step = 0;
+	redraw = 1;
 	fps = 0.0;
 	load = 0.0;
 
+	if( threads > 1 )
+	{
+		pool = threadpool_create( threads-1 );		// Create worker threads
+		if( pool == NULL )
+			return 0;
+	}
+	else
+	{
+		pool = NULL;
+	}
+
 	if( ! qtv_read_header( &video, qtw, infile ) )
 		return 0;
 
@@ -163,6 +250,17 @@ int main( int argc, char *argv[] )
 
 	image_create( &refimage, video.width, video.height, 1 );
 
+	nextimage.pixels = NULL;
+	if( video.motion )		// Frames with moved blocks can not be decoded in place
+	{
+		if( ! image_create( &nextimage, video.width, video.height, 1 ) )
+			return 2;
+	}
+
+	damage = damage_create( video.width, video.height, 16 );		// Create damage map for partial screen updates
+	if( damage == NULL )
+		return 2;
+
 	start = get_time();
 
 	do
@@ -171,74 +269,88 @@ int main( int argc, char *argv[] )
 
 		if( playing || step )
 		{
-			if( ! qtv_read_frame( &video, &compimage ) )
+			if( ! qtv_read_frame( &video, &compimage, pool ) )
 				return 2;
 
-			if( ! image_create( &image, compimage.width, compimage.height, 1 ) )
-				return 2;
+			damage_clear( damage );
 
-			if( ! qtc_decompress( &compimage, &refimage, &image ) )
-				return 2;
+			if( compimage.motion )
+			{
+				if( ! qtc_decompress( &compimage, &refimage, &nextimage, damage, pool ) )
+					return 2;
 
-			image_copy( &image, &refimage );
+				image_swap( &nextimage, &refimage );
+			}
+			else
+			{
+				if( ! qtc_decompress( &compimage, &refimage, &refimage, damage, pool ) )		// Decompress frame in place
+					return 2;
+			}
 
-			if( !analyze || overlay )
+			image = refimage;		// The output image is the screen surface
+			image.pixels = screen->pixels;
+
+			if( ( !analyze ) && ( !redraw ) && !( transform && image.transform ) )		// Only update the changed areas
 			{
-				if( transform )
+				update_damage( &refimage, &image, screen, damage, colordiff );
+			}
+			else
+			{
+				if( !analyze || overlay )
 				{
-					if( image.transform == 1 )
-						image_transform_fast_rev( &image );
-					else if( image.transform == 2 )
-						image_transform_rev( &image );
-				}
+					image_copy( &refimage, &image );
 
-				if( colordiff )
-				{
-					if( image.colordiff )
-						image_color_diff_rev( &image );
+					if( transform )
+					{
+						if( image.transform == 1 )
+							image_transform_fast_rev( &image );
+						else if( image.transform == 2 )
+							image_transform_rev( &image );
+					}
+
+					if( colordiff )
+					{
+						if( image.colordiff )
+							image_color_diff_rev( &image );
+					}
 				}
-			}
 			
-			if( analyze )
-			{
-				compimage.imagedata->pos = 0;
-				compimage.imagedata->bitpos = 8;
-				compimage.commanddata->pos = 0;
-				compimage.commanddata->bitpos = 8;
-				
-				if( overlay )
+				if( analyze )
 				{
-					if( ! image_create( &ccimage, compimage.width, compimage.height, 1 ) )
-						return 2;
+					for( i=0; i<compimage.numslices*compimage.numplanes; i++ )
+					{
+						databuffer_rewind( compimage.slices[i].imagedata );
+						databuffer_rewind( compimage.slices[i].commanddata );
+					}
+				
+					if( overlay )
+					{
+						if( ! image_create( &ccimage, compimage.width, compimage.height, 1 ) )
+							return 2;
 
-					if( ! qtc_decompress_ccode( &compimage, &ccimage, analyze-1 ) )
-						return 2;
+						if( ! qtc_decompress_ccode( &compimage, &ccimage, analyze-1 ) )
+							return 2;
 
-					pixels = (unsigned int *)image.pixels;
-					ccpixels = (unsigned int *)ccimage.pixels;
+						pixels = (unsigned int *)image.pixels;
+						ccpixels = (unsigned int *)ccimage.pixels;
 
-					for( i=0; i<image.width*image.height; i++ )
-						pixels[i] = ((pixels[i]&0xfefefefe)>>1)+((ccpixels[i]&0xfefefefe)>>1);
+						for( i=0; i<image.width*image.height; i++ )
+							pixels[i] = ((pixels[i]&0xfefefefe)>>1)+((ccpixels[i]&0xfefefefe)>>1);
 					
-					image_free( &ccimage );
+						image_free( &ccimage );
+					}
+					else
+					{
+						if( ! qtc_decompress_ccode( &compimage, &image, analyze-1 ) )
+							return 2;
+					}
 				}
-				else
-				{
-					image_free( &image );
 
-					if( ! image_create( &image, compimage.width, compimage.height, 1 ) )
-						return 2;
+				SDL_Flip( screen );
 
-					if( ! qtc_decompress_ccode( &compimage, &image, analyze-1 ) )
-						return 2;
-				}
+				redraw = 0;
 			}
 
-			memcpy( screen->pixels, image.pixels, video.width*video.height*4 );
-
-			SDL_Flip( screen );
-
-			image_free( &image );
 			qti_free( &compimage );
 
 			step = 0;
@@ -257,6 +369,8 @@ int main( int argc, char *argv[] )
 				break;
 
 				case SDL_KEYDOWN:
+					redraw = 1;
+
 					switch( event.key.keysym.sym )
 					{
 						case 'q':
@@ -437,9 +551,14 @@ int main( int argc, char *argv[] )
 
 	fps = 1000000.0/((get_time()-start)/framenum);
 
+	damage_free( damage );
+	image_free( &nextimage );
 	image_free( &refimage );
 	qtv_free( &video );
 
+	if( pool != NULL )
+		threadpool_free( pool );
+
 	if( printstats )
 	{
 		fprintf( stderr, "FPS:%.2f\n", fps );
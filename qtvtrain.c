@@ -0,0 +1,195 @@
+/*
+*    QTC: qtvtrain.c (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "databuffer.h"
+#include "rangecode.h"
+#include "threadpool.h"
+#include "qti.h"
+#include "qtv.h"
+
+/*******************************************************************************
+* This is the qtv prior trainer.                                               *
+*                                                                              *
+* It reads sample videos and writes the statistics of their image and index    *
+* data as priors for the range coders of qtvenc and qtvcap.                    *
+*******************************************************************************/
+
+void print_help( void )
+{
+	puts( "qtvtrain (c) 50m30n3 2011, 2012" );
+	puts( "USAGE: qtvtrain [options] -o outfile infile..." );
+	puts( "\t-h\t\t-\tPrint help" );
+	puts( "\t-v\t\t-\tBe verbose" );
+	puts( "\t-w\t\t-\tRead QTW files" );
+	puts( "\t-k\t\t-\tOnly count key frames" );
+	puts( "\t-j [1..]\t-\tNumber of threads (1)" );
+	puts( "\t-o filename\t-\tOutput file" );
+}
+
+int main( int argc, char *argv[] )
+{
+	struct qti compimage;
+	struct qtv video;
+	struct qti_slice *slice;
+	struct threadpool *pool;
+
+	unsigned int *counts;
+	unsigned char *priors;
+	int opt, verbose, qtw, keyonly, threads;
+	int numframes, i, j;
+	char *outfile;
+
+	verbose = 0;
+	qtw = 0;
+	keyonly = 0;
+	threads = 1;
+	outfile = NULL;
+
+	while( ( opt = getopt( argc, argv, "hvwkj:o:" ) ) != -1 )
+	{
+		switch( opt )
+		{
+			case 'h':
+				print_help();
+				return 0;
+			break;
+
+			case 'v':
+				verbose = 1;
+			break;
+
+			case 'w':
+				qtw = 1;
+			break;
+
+			case 'k':
+				keyonly = 1;
+			break;
+
+			case 'j':
+				if( sscanf( optarg, "%i", &threads ) != 1 )
+					fputs( "main: Can not parse command line: -j\n", stderr );
+			break;
+
+			case 'o':
+				outfile = strdup( optarg );
+			break;
+
+			default:
+			case '?':
+				fputs( "main: Can not parse command line: unknown option\n", stderr );
+				return 1;
+			break;
+		}
+	}
+
+	if( outfile == NULL )
+	{
+		fputs( "main: No output file given\n", stderr );
+		return 1;
+	}
+
+	if( optind >= argc )
+	{
+		fputs( "main: No input files given\n", stderr );
+		return 1;
+	}
+
+	if( threads < 1 )
+	{
+		fputs( "main: Number of threads out of range\n", stderr );
+		return 1;
+	}
+
+	if( threads > 1 )
+	{
+		pool = threadpool_create( threads-1 );		// Create worker threads
+		if( pool == NULL )
+			return 2;
+	}
+	else
+	{
+		pool = NULL;
+	}
+
+	counts = calloc( QTV_PRIORS*RANGECODER_PRIORS, sizeof( *counts ) );
+	priors = malloc( QTV_PRIORS*RANGECODER_PRIORS );
+	if( ( counts == NULL ) || ( priors == NULL ) )
+	{
+		perror( "main: malloc" );
+		return 2;
+	}
+
+	numframes = 0;
+
+	for( i=optind; i<argc; i++ )
+	{
+		if( ! qtv_read_header( &video, qtw, argv[i] ) )		// Read video header
+			return 2;
+
+		do
+		{
+			if( ! qtv_read_frame( &video, &compimage, pool ) )		// Read frame from stream
+				return 2;
+
+			if( compimage.keyframe || ( ! keyonly ) )
+			{
+				for( j=0; j<compimage.numslices*compimage.numplanes; j++ )		// Count the data of every plane into the table of its plane
+				{
+					slice = &compimage.slices[j];
+
+					rangecoder_count_priors( counts + ( slice->plane > 1 ? 1 : slice->plane )*RANGECODER_PRIORS, slice->imagedata );
+
+					if( slice->indexdata != NULL )
+						rangecoder_count_priors( counts + 2*RANGECODER_PRIORS, slice->indexdata );
+				}
+
+				numframes++;
+			}
+
+			qti_free( &compimage );
+		}
+		while( qtv_can_read_frame( &video ) );
+
+		if( verbose )
+			fprintf( stderr, "File:%s Frames:%i\n", argv[i], numframes );
+
+		qtv_free( &video );
+	}
+
+	for( i=0; i<QTV_PRIORS; i++ )
+		rangecoder_make_priors( counts + i*RANGECODER_PRIORS, priors + i*RANGECODER_PRIORS );
+
+	if( ! qtv_save_priors( priors, outfile ) )
+		return 2;
+
+	free( counts );
+	free( priors );
+	free( outfile );
+
+	if( pool != NULL )
+		threadpool_free( pool );
+
+	return 0;
+}
@@ -32,20 +32,38 @@ unsigned const int maxrange = 0xFFFFFFFF;
 unsigned const int top = 0x01<<24;
 unsigned const int bottom = 0x01<<16;
 
+#define PROBBITS 12
+#define PROBSHIFT 5
+
+#define TREEBITS 16
+#define TREESHIFT 4
+#define TREETOP ( 1ULL<<32 )
+
+#define PRIORWEIGHT 8
+
 
 /*******************************************************************************
 * This function creates a new range coder using a markov chain model           *
 *                                                                              *
 * order specifies the order of the markov chain model used for prediciton      *
 * bits specifies the number of bits per symbol                                 *
+* model is RANGECODER_LINEAR to scan the frequencies symbol by symbol,         *
+* RANGECODER_GROUPED to also keep running sums for groups of symbols,          *
+* RANGECODER_BINARY to code single bits with adaptive probabilities or         *
+* RANGECODER_TREE to code bytes as a tree of bits with adaptive probabilities  *
+* contexts limits the number of contexts a GROUPED model keeps apart, 0 means  *
+* all of them                                                                  *
+*                                                                              *
+* A GROUPED model keeps 16 bit counts in blocks that are only allocated once   *
+* their context is seen. Contexts beyond the limit share one spill block. A    *
+* TREE model keeps the probabilities of its contexts in the same way.          *
 *                                                                              *
 * Returns a new range coder struct                                             *
 *******************************************************************************/
-struct rangecoder *rangecoder_create( int order, int bits )
+struct rangecoder *rangecoder_create( int order, int bits, int model, int contexts )
 {
 	struct rangecoder *coder;
-	int i;
-	int symbols, fsize, tsize;
+	int fsize, tsize;
 
 	if( order < 0 )
 	{
@@ -62,36 +80,157 @@ struct rangecoder *rangecoder_create( int order, int bits )
 
 	coder->order = order;
 	coder->bits = bits;
+	coder->model = model;
+	coder->groupbits = bits/2;
 	
-	symbols = 1<<bits;
 	fsize = 1<<(bits*(order+1));
 	tsize = 1<<(bits*order);
 
-	coder->freqs = malloc( sizeof( *coder->freqs ) * fsize );
-	if( coder->freqs == NULL )
+	coder->freqs = NULL;
+	coder->totals = NULL;
+	coder->counts = NULL;
+	coder->slots = NULL;
+	coder->generations = NULL;
+	coder->probs = NULL;
+	coder->priors = NULL;
+
+	if( ( model == RANGECODER_BINARY ) && ( bits != 1 ) )
 	{
-		perror( "rangecoder_create: malloc" );
+		fputs( "rangecoder_create: binary model needs 1 bit symbols\n", stderr );
 		return NULL;
 	}
 
-	coder->totals = malloc( sizeof( *coder->freqs ) * tsize );
-	if( coder->freqs == NULL )
+	if( ( model == RANGECODER_TREE ) && ( bits != 8 ) )
 	{
-		perror( "rangecoder_create: malloc" );
+		fputs( "rangecoder_create: tree model needs 8 bit symbols\n", stderr );
 		return NULL;
 	}
 
-	for( i=0; i<fsize; i++ )
-		coder->freqs[i] = 1;
-	
-	for( i=0; i<tsize; i++ )
-		coder->totals[i] = symbols;
+	if( model == RANGECODER_BINARY )
+	{
+		coder->probs = malloc( sizeof( *coder->probs ) * tsize );
+		if( coder->probs == NULL )
+		{
+			perror( "rangecoder_create: malloc" );
+			return NULL;
+		}
+	}
+	else if( ( model == RANGECODER_GROUPED ) || ( model == RANGECODER_TREE ) )
+	{
+		if( ( contexts <= 0 ) || ( contexts > tsize ) )
+			contexts = tsize;
+
+		if( model == RANGECODER_TREE )
+		{
+			coder->freqoffset = 0;
+			coder->countsize = 1<<bits;		// Node 0 is not used
+		}
+		else
+		{
+			coder->freqoffset = ( ( (1<<(bits-coder->groupbits)) + 1 + 31 ) / 32 ) * 32;		// Groups and total, padded to a cache line
+			coder->countsize = coder->freqoffset + (1<<bits);
+		}
+
+		coder->maxcontexts = contexts;
+		coder->numcontexts = 0;
+		coder->allocated = contexts < 64 ? contexts + 1 : 64;
+		coder->generation = 1;
+
+		coder->counts = malloc( sizeof( *coder->counts ) * coder->countsize * coder->allocated );
+		coder->slots = malloc( sizeof( *coder->slots ) * tsize );
+		coder->generations = calloc( tsize, sizeof( *coder->generations ) );
+		if( ( coder->counts == NULL ) || ( coder->slots == NULL ) || ( coder->generations == NULL ) )
+		{
+			perror( "rangecoder_create: malloc" );
+			return NULL;
+		}
+	}
+	else
+	{
+		coder->freqs = malloc( sizeof( *coder->freqs ) * fsize );
+		if( coder->freqs == NULL )
+		{
+			perror( "rangecoder_create: malloc" );
+			return NULL;
+		}
+
+		coder->totals = malloc( sizeof( *coder->freqs ) * tsize );
+		if( coder->freqs == NULL )
+		{
+			perror( "rangecoder_create: malloc" );
+			return NULL;
+		}
+	}
+
+	rangecoder_reset( coder );
 
 	return coder;
 }
 
+/*******************************************************************************
+* This function sets the counts of one context of a GROUPED or TREE model to   *
+* the distribution every context starts out with, flat or from the priors      *
+* Every symbol weighs 1 plus PRIORWEIGHT times its prior. A TREE model gives   *
+* every node the share of the weight below it that falls on its zero side.     *
+*                                                                              *
+* coder is the range coder that holds the model                                *
+* counts is the block of counts to be initialized                              *
+* priors are the priors of the previous symbol or NULL for flat counts         *
+*                                                                              *
+* Modifies counts                                                              *
+*******************************************************************************/
+static void rangecoder_init_counts( struct rangecoder *coder, unsigned short *counts, unsigned char *priors )
+{
+	unsigned int sums[512];
+	unsigned short *freqs;
+	int i, prob;
+
+	if( coder->model == RANGECODER_TREE )
+	{
+		if( priors == NULL )
+		{
+			for( i=0; i<coder->countsize; i++ )
+				counts[i] = 1<<(TREEBITS-1);
+
+			return;
+		}
+
+		for( i=0; i<1<<coder->bits; i++ )
+			sums[(1<<coder->bits)+i] = 1 + priors[i]*PRIORWEIGHT;
+
+		for( i=(1<<coder->bits)-1; i>0; i-- )
+		{
+			sums[i] = sums[i<<1] + sums[(i<<1)|1];
+
+			prob = ( (unsigned long long)sums[i<<1] << TREEBITS ) / sums[i];
+			if( prob < 1<<TREESHIFT )
+				prob = 1<<TREESHIFT;
+			if( prob > (1<<TREEBITS)-(1<<TREESHIFT) )
+				prob = (1<<TREEBITS)-(1<<TREESHIFT);
+
+			counts[i] = prob;
+		}
+
+		return;
+	}
+
+	freqs = counts+coder->freqoffset;
+
+	for( i=0; i<=1<<(coder->bits-coder->groupbits); i++ )
+		counts[i] = 0;
+
+	for( i=0; i<1<<coder->bits; i++ )
+	{
+		freqs[i] = priors ? 1 + priors[i]*PRIORWEIGHT : 1;
+		counts[i>>coder->groupbits] += freqs[i];		// Group sum
+		counts[1<<(coder->bits-coder->groupbits)] += freqs[i];		// Total
+	}
+}
+
 /*******************************************************************************
 * This function resets the model of a range coder                              *
+* A GROUPED or TREE model only starts a new generation, its contexts are       *
+* initialized again when they are first used.                                  *
 *                                                                              *
 * coder is the range coder that contains the model to be reset                 *
 *                                                                              *
@@ -106,6 +245,30 @@ void rangecoder_reset( struct rangecoder *coder )
 	fsize = 1<<(coder->bits*(coder->order+1));
 	tsize = 1<<(coder->bits*coder->order);
 
+	if( ( coder->model == RANGECODER_GROUPED ) || ( coder->model == RANGECODER_TREE ) )
+	{
+		coder->generation++;
+		if( coder->generation == 0 )		// Wrapped around, old marks could match again
+		{
+			for( i=0; i<tsize; i++ )
+				coder->generations[i] = 0;
+			coder->generation = 1;
+		}
+
+		rangecoder_init_counts( coder, coder->counts, NULL );		// The spill block
+		coder->numcontexts = 0;
+
+		return;
+	}
+
+	if( coder->model == RANGECODER_BINARY )
+	{
+		for( i=0; i<tsize; i++ )
+			coder->probs[i] = 1<<(PROBBITS-1);
+
+		return;
+	}
+
 	for( i=0; i<fsize; i++ )
 		coder->freqs[i] = 1;
 	
@@ -124,9 +287,604 @@ void rangecoder_free( struct rangecoder *coder )
 {
 	free( coder->freqs );
 	free( coder->totals );
+	free( coder->counts );
+	free( coder->slots );
+	free( coder->generations );
+	free( coder->probs );
 	free( coder );
 }
 
+/*******************************************************************************
+* This function sets the priors new contexts of a range coder start from and   *
+* resets its model                                                             *
+* The priors stay owned by the caller and have to outlive the coder.           *
+*                                                                              *
+* coder is the range coder, a GROUPED or TREE model with 8 bit symbols         *
+* priors are RANGECODER_PRIORS weights as made by rangecoder_make_priors or    *
+* NULL for flat counts                                                         *
+*                                                                              *
+* Modifies coder                                                               *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+int rangecoder_set_priors( struct rangecoder *coder, unsigned char *priors )
+{
+	if( ( ( coder->model != RANGECODER_GROUPED ) && ( coder->model != RANGECODER_TREE ) ) || ( coder->bits != 8 ) || ( coder->order < 1 ) )
+	{
+		fputs( "rangecoder_set_priors: Model can not use priors\n", stderr );
+		return 0;
+	}
+
+	coder->priors = priors;
+	rangecoder_reset( coder );
+
+	return 1;
+}
+
+/*******************************************************************************
+* This function adds the order 1 statistics of a databuffer to the counts      *
+* priors are made from, the first byte counts as following a zero like it does *
+* for the range coder                                                          *
+*                                                                              *
+* counts are RANGECODER_PRIORS counts, one for every pair of bytes             *
+* data is the databuffer to be counted                                         *
+*                                                                              *
+* Modifies counts                                                              *
+*******************************************************************************/
+void rangecoder_count_priors( unsigned int *counts, struct databuffer *data )
+{
+	unsigned int i;
+	int previous;
+
+	previous = 0;
+
+	for( i=0; i<data->size; i++ )
+	{
+		counts[(previous<<8)|data->data[i]]++;
+		previous = data->data[i];
+	}
+}
+
+/*******************************************************************************
+* This function scales the counts of every previous byte to priors that sum    *
+* up to about 255                                                              *
+*                                                                              *
+* counts are RANGECODER_PRIORS counts as added up by rangecoder_count_priors   *
+* priors receives the RANGECODER_PRIORS priors                                 *
+*                                                                              *
+* Modifies priors                                                              *
+*******************************************************************************/
+void rangecoder_make_priors( unsigned int *counts, unsigned char *priors )
+{
+	unsigned long long total;
+	int i, j;
+
+	for( i=0; i<256; i++ )
+	{
+		total = 0;
+		for( j=0; j<256; j++ )
+			total += counts[(i<<8)|j];
+
+		for( j=0; j<256; j++ )
+			priors[(i<<8)|j] = total ? ( counts[(i<<8)|j] * 255ULL + total/2 ) / total : 0;
+	}
+}
+
+/*******************************************************************************
+* This function looks up the counts of a context of a GROUPED or TREE model    *
+* and allocates them if the context was not used since the last reset          *
+*                                                                              *
+* coder is the range coder that holds the model                                *
+* context is the number of the context                                         *
+*                                                                              *
+* Modifies coder                                                               *
+*                                                                              *
+* Returns the counts of the context or NULL if they could not be allocated     *
+*******************************************************************************/
+static inline unsigned short *rangecoder_counts( struct rangecoder *coder, int context )
+{
+	unsigned short *counts;
+	int slot;
+
+	if( coder->generations[context] != coder->generation )
+	{
+		if( coder->numcontexts >= coder->maxcontexts )
+		{
+			slot = 0;
+		}
+		else
+		{
+			slot = ++coder->numcontexts;
+			if( slot >= coder->allocated )
+			{
+				coder->allocated *= 2;
+				if( coder->allocated > coder->maxcontexts+1 )
+					coder->allocated = coder->maxcontexts+1;
+
+				counts = realloc( coder->counts, sizeof( *coder->counts ) * coder->countsize * coder->allocated );
+				if( counts == NULL )
+				{
+					perror( "rangecoder_counts: realloc" );
+					return NULL;
+				}
+				coder->counts = counts;
+			}
+
+			rangecoder_init_counts( coder, coder->counts+slot*coder->countsize, coder->priors ? coder->priors+((context&((1<<coder->bits)-1))<<coder->bits) : NULL );
+		}
+
+		coder->slots[context] = slot;
+		coder->generations[context] = coder->generation;
+	}
+
+	return coder->counts+coder->slots[context]*coder->countsize;
+}
+
+/*******************************************************************************
+* This function computes the cumulative frequency of all symbols below symbol  *
+* in a context of a GROUPED model                                              *
+*                                                                              *
+* coder is the range coder that holds the model                                *
+* counts are the counts of the current context                                 *
+* symbol is the symbol whose start is requested                                *
+*                                                                              *
+* Returns the start of the symbol in the current context                       *
+*******************************************************************************/
+static inline int rangecoder_start( struct rangecoder *coder, unsigned short *counts, int symbol )
+{
+	unsigned short *freqs;
+	int i, start;
+
+	freqs = counts+coder->freqoffset;
+	start = 0;
+
+	for( i=0; i<symbol>>coder->groupbits; i++ )
+		start += counts[i];
+
+	for( i<<=coder->groupbits; i<symbol; i++ )
+		start += freqs[i];
+
+	return start;
+}
+
+/*******************************************************************************
+* This function finds the symbol whose range contains value in a context of a  *
+* GROUPED model                                                                *
+*                                                                              *
+* coder is the range coder that holds the model                                *
+* counts are the counts of the current context                                 *
+* value is the cumulative frequency to be looked up                            *
+* start receives the start of the found symbol                                 *
+*                                                                              *
+* Returns the symbol or the number of symbols if value is out of range         *
+*******************************************************************************/
+static inline int rangecoder_find( struct rangecoder *coder, unsigned short *counts, unsigned int value, int *start )
+{
+	unsigned short *freqs;
+	int i, symbols;
+	unsigned int sum;
+
+	freqs = counts+coder->freqoffset;
+	symbols = 1<<coder->bits;
+	sum = 0;
+	i = 0;
+
+	while( ( i < symbols>>coder->groupbits ) && ( sum+counts[i] <= value ) )		// Skip whole groups first
+	{
+		sum += counts[i];
+		i++;
+	}
+
+	for( i<<=coder->groupbits; ( i < symbols ) && ( sum+freqs[i] <= value ); i++ )
+		sum += freqs[i];
+
+	*start = sum;
+
+	return i;
+}
+
+/*******************************************************************************
+* This function adds to the count of a symbol in a context of a GROUPED model  *
+* and rescales the context once its total grows too large                      *
+*                                                                              *
+* coder is the range coder that holds the model                                *
+* counts are the counts of the current context                                 *
+* symbol is the symbol that was coded                                          *
+*                                                                              *
+* Modifies counts                                                              *
+*******************************************************************************/
+static inline void rangecoder_update( struct rangecoder *coder, unsigned short *counts, int symbol )
+{
+	unsigned short *freqs, *total;
+	int i, freq, sum, groups;
+
+	freqs = counts+coder->freqoffset;
+	groups = 1<<(coder->bits-coder->groupbits);
+	total = counts+groups;
+
+	if( *total+32 < 0xFFFF )
+	{
+		freqs[symbol] += 32;
+		counts[symbol>>coder->groupbits] += 32;
+		*total += 32;
+		return;
+	}
+
+	for( i=0; i<groups; i++ )
+		counts[i] = 0;
+
+	sum = 0;
+	for( i=0; i<1<<coder->bits; i++ )
+	{
+		freq = freqs[i];
+		if( i == symbol )
+			freq += 32;
+
+		freq /= 2;
+		if( freq == 0 )
+			freq = 1;
+
+		freqs[i] = freq;
+		counts[i>>coder->groupbits] += freq;
+		sum += freq;
+	}
+
+	*total = sum;
+}
+
+/*******************************************************************************
+* This function compresses a databuffer bit by bit using a BINARY model        *
+* The probability of a zero bit is kept for every context of previous bits and *
+* moved towards the coded bit by a fixed fraction, so no divisions are needed. *
+*                                                                              *
+* coder is the range coder to be used during compression                       *
+* in contains the data to be compressed                                        *
+* out is the databuffer that the compressed data will be written to            *
+*                                                                              *
+* Modifies coder, in and out                                                   *
+*******************************************************************************/
+static int rangecode_compress_binary( struct rangecoder *coder, struct databuffer *in, struct databuffer *out )
+{
+	unsigned short *probs;
+	unsigned int count, length, word, bit, bound, mask;
+	int i, n, idx;
+
+	unsigned int low = 0x00;
+	unsigned int range = maxrange;
+
+	probs = coder->probs;
+	mask = ( 1u << coder->order ) - 1;
+	length = in->size*8;
+
+	idx = 0x00;
+
+	for( count=0; count<length; count+=n )
+	{
+		n = length-count < 32 ? length-count : 32;
+		word = databuffer_get_bits( in, n );
+
+		for( i=0; i<n; i++ )
+		{
+			bit = ( word >> i ) & 0x01;
+			bound = ( range >> PROBBITS ) * probs[idx];
+
+			if( bit )
+			{
+				low += bound;
+				range -= bound;
+				probs[idx] -= probs[idx] >> PROBSHIFT;
+			}
+			else
+			{
+				range = bound;
+				probs[idx] += ( (1<<PROBBITS) - probs[idx] ) >> PROBSHIFT;
+			}
+
+			while( ( (low^(low+range)) < top ) || ( range < bottom ) )
+			{
+				if( ( range < bottom ) && ( ( (low^(low+range)) >= top ) ) )
+					range = (-low)&(bottom-1);
+
+				databuffer_add_byte( ( low >> 24 ) & 0xFF, out );
+				low <<= 8;
+				range <<= 8;
+			}
+
+			idx = ((idx<<1)|bit)&mask;
+		}
+	}
+
+	for( i=0; i<4; i++ )
+	{
+		databuffer_add_byte( ( low >> 24 ) & 0xFF, out );
+		low <<= 8;
+	}
+
+	return 1;
+}
+
+/*******************************************************************************
+* This function decompresses a databuffer bit by bit using a BINARY model      *
+*                                                                              *
+* coder is the range coder to be used during compression                       *
+* in contains the data to be decompressed                                      *
+* out is the databuffer that the decompressed data will be written to          *
+* length is the uncompressed data length                                       *
+*                                                                              *
+* Modifies coder, in and out                                                   *
+*******************************************************************************/
+static int rangecode_decompress_binary( struct rangecoder *coder, struct databuffer *in, struct databuffer *out, unsigned int length )
+{
+	unsigned short *probs;
+	unsigned int count, word, bit, bound, mask;
+	int i, n, idx;
+
+	unsigned int low = 0x00;
+	unsigned int range = maxrange;
+	unsigned int code = 0x00;
+
+	probs = coder->probs;
+	mask = ( 1u << coder->order ) - 1;
+	length *= 8;
+
+	for( i=0; i<4; i++ )
+	{
+		code <<= 8;
+		code |= databuffer_get_byte( in ) & 0xFF;
+	}
+
+	idx = 0x00;
+
+	for( count=0; count<length; count+=n )
+	{
+		n = length-count < 32 ? length-count : 32;
+		word = 0;
+
+		for( i=0; i<n; i++ )
+		{
+			bound = ( range >> PROBBITS ) * probs[idx];
+
+			if( code - low >= bound )
+			{
+				bit = 1;
+				low += bound;
+				range -= bound;
+				probs[idx] -= probs[idx] >> PROBSHIFT;
+			}
+			else
+			{
+				bit = 0;
+				range = bound;
+				probs[idx] += ( (1<<PROBBITS) - probs[idx] ) >> PROBSHIFT;
+			}
+
+			while( ( (low^(low+range)) < top ) || ( range < bottom ) )
+			{
+				if( ( range < bottom ) && ( ( (low^(low+range)) >= top ) ) )
+					range = (-low)&(bottom-1);
+
+				code <<= 8;
+				code |= databuffer_get_byte( in ) & 0xFF;
+
+				low <<= 8;
+				range <<= 8;
+			}
+
+			word |= bit << i;
+			idx = ((idx<<1)|bit)&mask;
+		}
+
+		if( ! databuffer_add_bits( word, out, n ) )
+			return 0;
+	}
+
+	return databuffer_pad( out );
+}
+
+/*******************************************************************************
+* This function compresses a databuffer byte by byte using a TREE model        *
+* Every byte is coded as 8 bits from the top down, each with the probability   *
+* of its node in the tree of the bits above it. The probabilities are scaled   *
+* to 1<<TREEBITS, so the range is split with a shift and a multiplication      *
+* instead of a division. low and range have 64 bits and are renormalized 32    *
+* bits at a time straight into a span of out, which grows when it runs short.  *
+* Carries are added to the bytes already written.                              *
+*                                                                              *
+* coder is the range coder to be used during compression                       *
+* in contains the data to be compressed                                        *
+* out is the databuffer that the compressed data will be written to            *
+*                                                                              *
+* Modifies coder, in and out                                                   *
+*******************************************************************************/
+static int rangecode_compress_tree( struct rangecoder *coder, struct databuffer *in, struct databuffer *out )
+{
+	unsigned short *probs;
+	unsigned char *data, *span, *ptr, *carry;
+	unsigned long long low, range, bound;
+	unsigned int length, start, maxlength, used, pos;
+	int symbol, context, mask, node, bit, i;
+
+	length = in->size;
+	maxlength = length + length/2 + 64;
+
+	data = databuffer_get_span( in, length );
+	if( data == NULL )
+	{
+		fputs( "rangecode_compress: Data was already read\n", stderr );
+		return 0;
+	}
+
+	span = databuffer_add_span( out, maxlength );
+	if( span == NULL )
+		return 0;
+
+	start = span - out->data;
+
+	low = 0;
+	range = ~0ULL;
+	ptr = span;
+
+	mask = (1<<(coder->bits*coder->order))-1;
+	context = 0;
+
+	for( pos=0; pos<length; pos++ )
+	{
+		symbol = data[pos];
+
+		if( span + maxlength - ptr < 48 )		// One byte writes at most 32 bytes, keep room for the flush
+		{
+			used = ptr - span;
+
+			if( databuffer_add_span( out, maxlength ) == NULL )
+				return 0;
+
+			maxlength *= 2;
+			span = out->data + start;
+			ptr = span + used;
+		}
+
+		probs = rangecoder_counts( coder, context );
+		if( probs == NULL )
+			return 0;
+
+		node = 1;
+
+		for( i=coder->bits-1; i>=0; i-- )
+		{
+			bit = ( symbol >> i ) & 0x01;
+			bound = ( range >> TREEBITS ) * probs[node];
+
+			if( bit )
+			{
+				low += bound;
+				if( low < bound )
+				{
+					for( carry=ptr-1; ++(*carry) == 0; carry-- );
+				}
+
+				range -= bound;
+				probs[node] -= probs[node] >> TREESHIFT;
+			}
+			else
+			{
+				range = bound;
+				probs[node] += ( (1<<TREEBITS) - probs[node] ) >> TREESHIFT;
+			}
+
+			if( range < TREETOP )
+			{
+				ptr[0] = low >> 56;
+				ptr[1] = low >> 48;
+				ptr[2] = low >> 40;
+				ptr[3] = low >> 32;
+				ptr += 4;
+
+				low <<= 32;
+				range <<= 32;
+			}
+
+			node = ( node << 1 ) | bit;
+		}
+
+		context = ( ( context << coder->bits ) | symbol ) & mask;
+	}
+
+	for( i=0; i<8; i++ )
+		ptr[i] = low >> (56-i*8);
+
+	ptr += 8;
+
+	out->size -= span + maxlength - ptr;		// Give back the unused end of the span
+
+	return 1;
+}
+
+/*******************************************************************************
+* This function decompresses a databuffer byte by byte using a TREE model      *
+* Needs no division at all, every bit is found with one comparison.            *
+*                                                                              *
+* coder is the range coder to be used during compression                       *
+* in contains the data to be decompressed                                      *
+* out is the databuffer that the decompressed data will be written to          *
+* length is the uncompressed data length                                       *
+*                                                                              *
+* Modifies coder, in and out                                                   *
+*******************************************************************************/
+static int rangecode_decompress_tree( struct rangecoder *coder, struct databuffer *in, struct databuffer *out, unsigned int length )
+{
+	unsigned short *probs;
+	unsigned char *data, *end, *span;
+	unsigned long long code, range, bound;
+	unsigned int size, pos;
+	int context, mask, node, i;
+
+	size = in->size - in->pos;
+
+	data = databuffer_get_span( in, size );
+	span = databuffer_add_span( out, length );
+	if( ( data == NULL ) || ( span == NULL ) || ( size < 8 ) )
+	{
+		fputs( "rangecode_decompress: decompression error\n", stderr );
+		return 0;
+	}
+
+	end = data + size;
+
+	code = 0;
+	for( i=0; i<8; i++ )
+		code = ( code << 8 ) | *data++;
+
+	range = ~0ULL;
+
+	mask = (1<<(coder->bits*coder->order))-1;
+	context = 0;
+
+	for( pos=0; pos<length; pos++ )		// code holds the distance to the lower end of the range
+	{
+		probs = rangecoder_counts( coder, context );
+		if( probs == NULL )
+			return 0;
+
+		for( node=1; node<1<<coder->bits; )
+		{
+			bound = ( range >> TREEBITS ) * probs[node];
+
+			if( code < bound )
+			{
+				range = bound;
+				probs[node] += ( (1<<TREEBITS) - probs[node] ) >> TREESHIFT;
+				node = node << 1;
+			}
+			else
+			{
+				code -= bound;
+				range -= bound;
+				probs[node] -= probs[node] >> TREESHIFT;
+				node = ( node << 1 ) | 0x01;
+			}
+
+			if( range < TREETOP )
+			{
+				if( end - data < 4 )
+				{
+					fputs( "rangecode_decompress: decompression error\n", stderr );
+					return 0;
+				}
+
+				code = ( code << 32 ) | ( (unsigned long long)data[0] << 24 ) | ( data[1] << 16 ) | ( data[2] << 8 ) | data[3];
+				data += 4;
+				range <<= 32;
+			}
+		}
+
+		span[pos] = node & 0xFF;
+
+		context = ( ( context << coder->bits ) | span[pos] ) & mask;
+	}
+
+	return 1;
+}
+
 /*******************************************************************************
 * This function compresses a databuffer using a range coder                    *
 *                                                                              *
@@ -139,10 +897,11 @@ void rangecoder_free( struct rangecoder *coder )
 int rangecode_compress( struct rangecoder *coder, struct databuffer *in, struct databuffer *out )
 {
 	int *freqs, *totals;
+	unsigned short *counts = NULL;
 	unsigned int count;
 	int symbol;
 	int i;
-	int bits, symbols, idx, mask;
+	int bits, symbols, idx, mask, groups;
 	int start, size, total;
 
 	unsigned int low = 0x00;
@@ -152,6 +911,13 @@ int rangecode_compress( struct rangecoder *coder, struct databuffer *in, struct
 	totals = coder->totals;
 	bits = coder->bits;
 	symbols = 1<<bits;
+	groups = 1<<(bits-coder->groupbits);
+
+	if( coder->model == RANGECODER_BINARY )
+		return rangecode_compress_binary( coder, in, out );
+
+	if( coder->model == RANGECODER_TREE )
+		return rangecode_compress_tree( coder, in, out );
 
 	mask = ~((~0x00)<<(bits*(coder->order+1)));
 
@@ -164,12 +930,25 @@ int rangecode_compress( struct rangecoder *coder, struct databuffer *in, struct
 		else
 			symbol = databuffer_get_bits( in, bits );
 
-		start = 0;
-		for( i=0; i<symbol; i++ )
-			start += freqs[idx+i];
+		if( coder->model == RANGECODER_GROUPED )
+		{
+			counts = rangecoder_counts( coder, idx>>bits );
+			if( counts == NULL )
+				return 0;
+
+			start = rangecoder_start( coder, counts, symbol );
+			size = counts[coder->freqoffset+symbol];
+			total = counts[groups];
+		}
+		else
+		{
+			start = 0;
+			for( i=0; i<symbol; i++ )
+				start += freqs[idx+i];
 
-		size = freqs[idx+symbol];
-		total = totals[idx>>bits];
+			size = freqs[idx+symbol];
+			total = totals[idx>>bits];
+		}
 
 		range /= total;
 		low += start * range;
@@ -185,18 +964,25 @@ int rangecode_compress( struct rangecoder *coder, struct databuffer *in, struct
 			range <<= 8;
 		}
 
-		freqs[idx+symbol] += 32;
-		totals[idx>>bits] += 32;
-
-		if( totals[idx>>bits] >= 0xFFFF )
+		if( coder->model == RANGECODER_GROUPED )
+		{
+			rangecoder_update( coder, counts, symbol );
+		}
+		else
 		{
-			totals[idx>>bits] = 0;
-			for( i=0; i<symbols; i++ )
+			freqs[idx+symbol] += 32;
+			totals[idx>>bits] += 32;
+
+			if( totals[idx>>bits] >= 0xFFFF )
 			{
-				freqs[idx+i] /= 2;
-				if( freqs[idx+i] == 0 )
-					freqs[idx+i] = 1;
-				totals[idx>>bits] += freqs[idx+i];
+				totals[idx>>bits] = 0;
+				for( i=0; i<symbols; i++ )
+				{
+					freqs[idx+i] /= 2;
+					if( freqs[idx+i] == 0 )
+						freqs[idx+i] = 1;
+					totals[idx>>bits] += freqs[idx+i];
+				}
 			}
 		}
 
@@ -225,11 +1011,13 @@ int rangecode_compress( struct rangecoder *coder, struct databuffer *in, struct
 int rangecode_decompress( struct rangecoder *coder, struct databuffer *in, struct databuffer *out, unsigned int length )
 {
 	int *freqs, *totals;
+	unsigned short *counts = NULL;
 	unsigned int count;
 	int symbol;
 	int i;
-	int start, size, total, value;
-	int bits, symbols, idx, mask;
+	int start, size, total;
+	unsigned int value;
+	int bits, symbols, idx, mask, groups;
 
 	unsigned int low = 0x00;
 	unsigned int range = maxrange;
@@ -239,6 +1027,13 @@ int rangecode_decompress( struct rangecoder *coder, struct databuffer *in, struc
 	totals = coder->totals;
 	bits = coder->bits;
 	symbols = 1<<bits;
+	groups = 1<<(bits-coder->groupbits);
+
+	if( coder->model == RANGECODER_BINARY )
+		return rangecode_decompress_binary( coder, in, out, length );
+
+	if( coder->model == RANGECODER_TREE )
+		return rangecode_decompress_tree( coder, in, out, length );
 
 	for( i=0; i<4; i++ )
 	{
@@ -252,42 +1047,53 @@ int rangecode_decompress( struct rangecoder *coder, struct databuffer *in, struc
 
 	for( count=0; count<length*8; count+=bits )
 	{
-		total = totals[idx>>bits];
+		if( coder->model == RANGECODER_GROUPED )
+		{
+			counts = rangecoder_counts( coder, idx>>bits );
+			if( counts == NULL )
+				return 0;
+
+			total = counts[groups];
+		}
+		else
+		{
+			total = totals[idx>>bits];
+		}
 
 		range /= total;
 
 		value = ( code - low ) / range;
 
-		i = 0;
-		while( ( value >= 0 ) && ( i < symbols ) )
+		if( coder->model == RANGECODER_GROUPED )
+		{
+			symbol = rangecoder_find( coder, counts, value, &start );
+		}
+		else
 		{
-			value -= freqs[idx+i];
-			i++;
+			start = 0;
+			for( symbol=0; ( symbol < symbols ) && ( (unsigned int)( start+freqs[idx+symbol] ) <= value ); symbol++ )
+				start += freqs[idx+symbol];
 		}
 
-		if( value >= 0 )
+		if( symbol >= symbols )
 		{
 			fputs( "rangecode_decompress: decompression error\n", stderr );
 			return 0;
 		}
 
-		symbol = i-1;
-
 		if( bits == 8 )
 			databuffer_add_byte( symbol, out );
 		else
 			databuffer_add_bits( symbol, out, bits );
 
-		start = 0;
-		for( i=0; i<symbol; i++ )
-			start += freqs[idx+i];
-
-		size = freqs[idx+symbol];
+		if( coder->model == RANGECODER_GROUPED )
+			size = counts[coder->freqoffset+symbol];
+		else
+			size = freqs[idx+symbol];
 
 		low += start * range;
 		range *= size;
 
-
 		while( ( (low^(low+range)) < top ) || ( range < bottom ) )
 		{
 			if( ( range < bottom ) && ( ( (low^(low+range)) >= top ) ) )
@@ -300,24 +1106,31 @@ int rangecode_decompress( struct rangecoder *coder, struct databuffer *in, struc
 			range <<= 8;
 		}
 
-		freqs[idx+symbol] += 32;
-		totals[idx>>bits] += 32;
-
-		if( totals[idx>>bits] >= 0xFFFF )
+		if( coder->model == RANGECODER_GROUPED )
+		{
+			rangecoder_update( coder, counts, symbol );
+		}
+		else
 		{
-			totals[idx>>bits] = 0;
-			for( i=0; i<symbols; i++ )
+			freqs[idx+symbol] += 32;
+			totals[idx>>bits] += 32;
+
+			if( totals[idx>>bits] >= 0xFFFF )
 			{
-				freqs[idx+i] /= 2;
-				if( freqs[idx+i] == 0 )
-					freqs[idx+i] = 1;
-				totals[idx>>bits] += freqs[idx+i];
+				totals[idx>>bits] = 0;
+				for( i=0; i<symbols; i++ )
+				{
+					freqs[idx+i] /= 2;
+					if( freqs[idx+i] == 0 )
+						freqs[idx+i] = 1;
+					totals[idx>>bits] += freqs[idx+i];
+				}
 			}
 		}
 
 		idx = ((idx+symbol)<<bits)&mask;
 	}
 
-	return 1;
+	return databuffer_pad( out );
 }
 
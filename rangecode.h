@@ -20,24 +20,64 @@
 #ifndef RANGECODE_H
 #define RANGECODE_H
 
+#define RANGECODER_LINEAR 0
+#define RANGECODER_GROUPED 1
+#define RANGECODER_BINARY 2
+#define RANGECODER_TREE 3
+
+#define RANGECODER_PRIORS 65536
+
 /*******************************************************************************
 * Structure that holds all the data associated with a range coder              *
 *                                                                              *
 * order is the order of the markov chain used for prediction                   *
 * bits is the bits per symbol used by the range coder                          *
-* freqs and totals contain the model data                                      *
+* model is the way symbols are looked up, RANGECODER_LINEAR, GROUPED, BINARY   *
+* or TREE                                                                      *
+* groupbits is the log2 of the number of symbols summed up in one group        *
+* freqs and totals contain the model data of a LINEAR model                    *
+* counts contains the blocks of 16 bit counts of a GROUPED model, every block  *
+* holds the group sums, the total and from freqoffset on the frequencies       *
+* the blocks of a TREE model hold the probabilities of the binary tree nodes   *
+* countsize is the size of a block, allocated the number of blocks allocated   *
+* maxcontexts and numcontexts are the limit and the number of blocks in use,   *
+* block 0 is shared by all contexts beyond the limit                           *
+* slots holds the block of every context                                       *
+* generations holds the generation every context was last used in, contexts    *
+* of older generations are initialized again                                   *
+* generation is the current generation                                         *
+* probs holds the probability of a zero bit for every context of a BINARY      *
+* model, scaled to 12 bits                                                     *
+* priors are the trained symbol weights new contexts of a GROUPED or TREE      *
+* model start from, 256 for every previous symbol, or NULL for flat counts     *
 *******************************************************************************/
 struct rangecoder
 {
 	int order;
 	int bits;
+	int model;
+	int groupbits;
 	int *freqs;
 	int *totals;
+
+	unsigned short *counts;
+	int freqoffset, countsize, allocated;
+	int maxcontexts, numcontexts;
+	int *slots;
+	unsigned int *generations;
+	unsigned int generation;
+
+	unsigned short *probs;
+
+	unsigned char *priors;
 };
 
-extern struct rangecoder *rangecoder_create( int order, int bits );
+extern struct rangecoder *rangecoder_create( int order, int bits, int model, int contexts );
 extern void rangecoder_reset( struct rangecoder *coder );
 extern void rangecoder_free( struct rangecoder *coder );
+extern int rangecoder_set_priors( struct rangecoder *coder, unsigned char *priors );
+extern void rangecoder_count_priors( unsigned int *counts, struct databuffer *data );
+extern void rangecoder_make_priors( unsigned int *counts, unsigned char *priors );
 extern int rangecode_compress( struct rangecoder *coder, struct databuffer *in, struct databuffer *out );
 extern int rangecode_decompress( struct rangecoder *coder, struct databuffer *in, struct databuffer *out, unsigned int length );
 
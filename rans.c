@@ -0,0 +1,585 @@
+/*
+*    QTC: rans.c (c) 2011, 2012 50m30n3
+*
+*    The coder in this file is a range variant of the asymmetric numeral
+*    systems described by Jarek Duda, with the byte wise renormalization
+*    and interleaved states popularized by Fabian Giesen's rans_byte.h.
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "databuffer.h"
+
+#include "rans.h"
+
+#define LANES 4
+#define PROBBITS 12
+#define TOTAL (1<<PROBBITS)
+#define LOWER (1u<<23)
+
+/*******************************************************************************
+* Function to compute the base 2 logarithm of a number in 24.8 fixed point     *
+*                                                                              *
+* x is the number, has to be at least 1                                        *
+*                                                                              *
+* Returns the logarithm, the fraction is interpolated linearly                 *
+*******************************************************************************/
+static unsigned int rans_log2( unsigned int x )
+{
+	int bits;
+
+	for( bits=0; x>>(bits+1); bits++ );
+
+	if( bits >= 8 )
+		return ( bits << 8 ) | ( ( x >> ( bits - 8 ) ) & 0xFF );
+	else
+		return ( bits << 8 ) | ( ( x << ( 8 - bits ) ) & 0xFF );
+}
+
+/*******************************************************************************
+* Function to estimate the coded size of one context in bytes                  *
+* The table costs a 32 byte symbol map and two bytes for every symbol          *
+*                                                                              *
+* counts are the 256 symbol counts of the context                              *
+* sum is the sum of the counts                                                 *
+*                                                                              *
+* Returns the estimated size                                                   *
+*******************************************************************************/
+static unsigned long long rans_cost( unsigned int *counts, unsigned int sum )
+{
+	unsigned long long bits;
+	unsigned int logsum;
+	int i, symbols;
+
+	if( sum == 0 )
+		return 0;
+
+	logsum = rans_log2( sum );
+	bits = 0;
+	symbols = 0;
+
+	for( i=0; i<256; i++ )
+	{
+		if( counts[i] > 0 )
+		{
+			bits += (unsigned long long)counts[i] * ( logsum - rans_log2( counts[i] ) );
+			symbols++;
+		}
+	}
+
+	return bits / (8<<8) + 32 + symbols * 2;
+}
+
+/*******************************************************************************
+* Function to scale the symbol counts of a context to frequencies that add up  *
+* to TOTAL, every symbol that occurs keeps a frequency of at least 1           *
+*                                                                              *
+* counts are the 256 symbol counts of the context                              *
+* sum is the sum of the counts, has to be at least 1                           *
+* freqs receives the 256 frequencies                                           *
+*                                                                              *
+* Modifies freqs                                                               *
+*******************************************************************************/
+static void rans_normalize( unsigned int *counts, unsigned int sum, unsigned short *freqs )
+{
+	int i, max, total;
+
+	total = 0;
+	max = 0;
+
+	for( i=0; i<256; i++ )
+	{
+		freqs[i] = ( (unsigned long long)counts[i] * TOTAL ) / sum;
+		if( ( freqs[i] == 0 ) && ( counts[i] > 0 ) )
+			freqs[i] = 1;
+
+		total += freqs[i];
+
+		if( freqs[i] > freqs[max] )
+			max = i;
+	}
+
+	while( total != TOTAL )		// Take rounding errors from the largest frequencies
+	{
+		if( total < TOTAL )
+		{
+			freqs[max] += TOTAL - total;
+			total = TOTAL;
+		}
+		else
+		{
+			for( i=0; i<256; i++ )
+			{
+				if( freqs[i] > freqs[max] )
+					max = i;
+			}
+
+			if( freqs[max] - 1 < total - TOTAL )
+			{
+				total -= freqs[max] - 1;
+				freqs[max] = 1;
+			}
+			else
+			{
+				freqs[max] -= total - TOTAL;
+				total = TOTAL;
+			}
+		}
+	}
+}
+
+/*******************************************************************************
+* Function to write the frequency table of one context                         *
+* A 32 byte map of the symbols that occur is followed by their frequencies     *
+*                                                                              *
+* freqs are the 256 frequencies of the context                                 *
+* out is the databuffer to write to                                            *
+*                                                                              *
+* Modifies out                                                                 *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int rans_put_table( unsigned short *freqs, struct databuffer *out )
+{
+	unsigned char *data;
+	int i;
+
+	data = databuffer_add_span( out, 32 );
+	if( data == NULL )
+		return 0;
+
+	memset( data, 0, 32 );
+
+	for( i=0; i<256; i++ )
+	{
+		if( freqs[i] > 0 )
+			data[i/8] |= 1<<(i%8);
+	}
+
+	for( i=0; i<256; i++ )
+	{
+		if( freqs[i] > 0 )
+		{
+			if( ( ! databuffer_add_byte( freqs[i] & 0xFF, out ) ) ||
+			    ( ! databuffer_add_byte( freqs[i] >> 8, out ) ) )
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*******************************************************************************
+* Function to read the frequency table of one context and to build the tables  *
+* used for decoding                                                            *
+*                                                                              *
+* in is the databuffer to read from                                            *
+* freqs and starts receive the 256 frequencies and cumulative frequencies      *
+* lookup receives the symbol of every one of the TOTAL slots                   *
+*                                                                              *
+* Modifies in, freqs, starts and lookup                                        *
+*                                                                              *
+* Returns 0 if the table is invalid, 1 on success                              *
+*******************************************************************************/
+static int rans_get_table( struct databuffer *in, unsigned short *freqs, unsigned short *starts, unsigned char *lookup )
+{
+	unsigned char *map;
+	int i, total;
+
+	map = databuffer_get_span( in, 32 );
+	if( map == NULL )
+		return 0;
+
+	total = 0;
+
+	for( i=0; i<256; i++ )
+	{
+		freqs[i] = 0;
+
+		if( map[i/8] & (1<<(i%8)) )
+		{
+			freqs[i] = databuffer_get_byte( in );
+			freqs[i] |= databuffer_get_byte( in ) << 8;
+
+			if( ( freqs[i] == 0 ) || ( total + freqs[i] > TOTAL ) )
+				return 0;
+
+			memset( lookup + total, i, freqs[i] );
+		}
+
+		starts[i] = total;
+		total += freqs[i];
+	}
+
+	return total == TOTAL;
+}
+
+/*******************************************************************************
+* Function to code one symbol into a rANS state                                *
+* Whole bytes are moved out of the state first, so the new state stays below   *
+* 256 times LOWER                                                              *
+*                                                                              *
+* state is the state of the lane the symbol belongs to                         *
+* ptr points behind the bytes written so far, the bytes are written backwards  *
+* freq and start are the frequency and cumulative frequency of the symbol      *
+*                                                                              *
+* Modifies state and ptr                                                       *
+*******************************************************************************/
+static inline void rans_put_symbol( unsigned int *state, unsigned char **ptr, unsigned int freq, unsigned int start )
+{
+	unsigned int x;
+
+	x = *state;
+
+	while( x >= ( ( LOWER >> PROBBITS ) << 8 ) * freq )
+	{
+		*--(*ptr) = x & 0xFF;
+		x >>= 8;
+	}
+
+	*state = ( ( x / freq ) << PROBBITS ) + ( x % freq ) + start;
+}
+
+/*******************************************************************************
+* Function to decode one symbol from a rANS state                              *
+*                                                                              *
+* state is the state of the lane the symbol belongs to                         *
+* ptr points to the next byte to read, end to the end of the data              *
+* freqs, starts and lookup are the decoding tables of the context              *
+*                                                                              *
+* Modifies state and ptr                                                       *
+*                                                                              *
+* Returns the symbol                                                           *
+*******************************************************************************/
+static inline int rans_get_symbol( unsigned int *state, unsigned char **ptr, unsigned char *end, unsigned short *freqs, unsigned short *starts, unsigned char *lookup )
+{
+	unsigned int x, slot;
+	int symbol;
+
+	x = *state;
+
+	slot = x & (TOTAL-1);
+	symbol = lookup[slot];
+	x = freqs[symbol] * ( x >> PROBBITS ) + slot - starts[symbol];
+
+	while( ( x < LOWER ) && ( *ptr < end ) )
+		x = ( x << 8 ) | *(*ptr)++;
+
+	*state = x;
+
+	return symbol;
+}
+
+/*******************************************************************************
+* Function to write the order and frequency tables of a rANS stream            *
+*                                                                              *
+* order is the model order, 0 or 1                                             *
+* counts are the symbol counts of the 256 order 1 contexts and of order 0      *
+* sums are the sums of the counts of every context                             *
+* freqs and starts receive the frequencies and cumulative frequencies of the   *
+* used contexts                                                                *
+* out is the databuffer to write to                                            *
+*                                                                              *
+* Modifies freqs, starts and out                                               *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int rans_put_model( int order, unsigned int *counts, unsigned int *sums, unsigned short *freqs, unsigned short *starts, struct databuffer *out )
+{
+	unsigned char *map;
+	int i, j, contexts;
+
+	if( ! databuffer_add_byte( order, out ) )
+		return 0;
+
+	contexts = 1;
+
+	if( order )
+	{
+		contexts = 256;
+
+		map = databuffer_add_span( out, 32 );
+		if( map == NULL )
+			return 0;
+
+		memset( map, 0, 32 );
+
+		for( i=0; i<256; i++ )
+		{
+			if( sums[i] > 0 )
+				map[i/8] |= 1<<(i%8);
+		}
+	}
+	else
+	{
+		counts += 256*256;
+		sums += 256;
+	}
+
+	for( i=0; i<contexts; i++ )
+	{
+		if( sums[i] > 0 )
+			rans_normalize( counts+i*256, sums[i], freqs+i*256 );
+		else
+			memset( freqs+i*256, 0, sizeof( *freqs ) * 256 );
+
+		if( ( sums[i] > 0 ) || ( ! order ) )
+		{
+			if( ! rans_put_table( freqs+i*256, out ) )
+				return 0;
+		}
+
+		starts[i*256] = 0;
+		for( j=1; j<256; j++ )
+			starts[i*256+j] = starts[i*256+j-1] + freqs[i*256+j-1];
+	}
+
+	return 1;
+}
+
+/*******************************************************************************
+* Function to compress a databuffer with a static rANS model                   *
+* The frequencies of order 0 or, if that is estimated to be smaller, order 1   *
+* are stored in front of the data. The data is split into four lanes that are  *
+* coded with interleaved states, so their symbols can be decoded in parallel.  *
+* Every lane starts in context 0, the last lane also takes the remainder.      *
+*                                                                              *
+* in contains the data to be compressed                                        *
+* out is the databuffer that the compressed data will be written to            *
+*                                                                              *
+* Modifies in and out                                                          *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+int rans_compress( struct databuffer *in, struct databuffer *out )
+{
+	unsigned char *data, *buffer, *ptr, *span;
+	unsigned int *counts, *sums;
+	unsigned short *freqs, *starts;
+	unsigned int states[LANES];
+	unsigned int length, quarter, first, last, pos, i;
+	unsigned long long cost0, cost1;
+	int order, context, lane, k, success;
+
+	length = in->size;
+
+	data = databuffer_get_span( in, length );
+	if( data == NULL )
+	{
+		fputs( "rans_compress: Data was already read\n", stderr );
+		return 0;
+	}
+
+	counts = calloc( 256*257, sizeof( *counts ) );		// 256 order 1 contexts, then order 0
+	sums = calloc( 257, sizeof( *sums ) );
+	freqs = malloc( sizeof( *freqs ) * 256*256 );
+	starts = malloc( sizeof( *starts ) * 256*256 );
+	buffer = malloc( length*2 + 4*LANES );
+	if( ( counts == NULL ) || ( sums == NULL ) || ( freqs == NULL ) || ( starts == NULL ) || ( buffer == NULL ) )
+	{
+		perror( "rans_compress: malloc" );
+		free( counts );
+		free( sums );
+		free( freqs );
+		free( starts );
+		free( buffer );
+		return 0;
+	}
+
+	quarter = length / LANES;
+
+	for( lane=0; lane<LANES; lane++ )
+	{
+		first = lane*quarter;
+		last = lane == LANES-1 ? length : first+quarter;
+
+		for( pos=first; pos<last; pos++ )
+		{
+			context = pos == first ? 0 : data[pos-1];
+			counts[context*256+data[pos]]++;
+			counts[256*256+data[pos]]++;
+			sums[context]++;
+		}
+	}
+	sums[256] = length;
+
+	cost0 = rans_cost( counts+256*256, sums[256] );
+	cost1 = 32;
+	for( i=0; i<256; i++ )
+		cost1 += rans_cost( counts+i*256, sums[i] );
+
+	order = cost1 < cost0;
+
+	success = rans_put_model( order, counts, sums, freqs, starts, out );
+
+	for( lane=0; lane<LANES; lane++ )
+		states[lane] = LOWER;
+
+	ptr = buffer + length*2 + 4*LANES;		// rANS codes backwards, the last symbol first
+
+	for( pos=length; pos>LANES*quarter; )		// The tail of the last lane
+	{
+		pos--;
+		context = ( order && ( pos > (LANES-1)*quarter ) ) ? data[pos-1] : 0;
+		rans_put_symbol( &states[LANES-1], &ptr, freqs[context*256+data[pos]], starts[context*256+data[pos]] );
+	}
+
+	for( i=quarter; i>0; )
+	{
+		i--;
+		for( lane=LANES-1; lane>=0; lane-- )
+		{
+			pos = lane*quarter+i;
+			context = ( order && ( i > 0 ) ) ? data[pos-1] : 0;
+			rans_put_symbol( &states[lane], &ptr, freqs[context*256+data[pos]], starts[context*256+data[pos]] );
+		}
+	}
+
+	for( lane=LANES-1; lane>=0; lane-- )
+	{
+		for( k=3; k>=0; k-- )
+			*--ptr = ( states[lane] >> (k*8) ) & 0xFF;
+	}
+
+	if( success )
+	{
+		length = buffer + length*2 + 4*LANES - ptr;
+
+		span = databuffer_add_span( out, length );
+		if( span != NULL )
+			memcpy( span, ptr, length );
+		else
+			success = 0;
+	}
+
+	free( counts );
+	free( sums );
+	free( freqs );
+	free( starts );
+	free( buffer );
+
+	return success;
+}
+
+/*******************************************************************************
+* Function to decompress a databuffer that was compressed with rans_compress   *
+*                                                                              *
+* in contains the data to be decompressed                                      *
+* out is the databuffer that the decompressed data will be written to          *
+* length is the uncompressed data length                                       *
+*                                                                              *
+* Modifies in and out                                                          *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+int rans_decompress( struct databuffer *in, struct databuffer *out, unsigned int length )
+{
+	unsigned char *data, *ptr, *end, *map, *lookup;
+	unsigned short *freqs, *starts;
+	unsigned int states[LANES];
+	unsigned int quarter, pos, i;
+	int order, context, lane, k, valid;
+
+	order = databuffer_get_byte( in );
+	if( order > 1 )
+	{
+		fputs( "rans_decompress: Invalid model order\n", stderr );
+		return 0;
+	}
+
+	freqs = malloc( sizeof( *freqs ) * 256*256 );
+	starts = malloc( sizeof( *starts ) * 256*256 );
+	lookup = calloc( order ? 256*TOTAL : TOTAL, sizeof( *lookup ) );
+	if( ( freqs == NULL ) || ( starts == NULL ) || ( lookup == NULL ) )
+	{
+		perror( "rans_decompress: malloc" );
+		free( freqs );
+		free( starts );
+		free( lookup );
+		return 0;
+	}
+
+	valid = 1;
+
+	if( order )
+	{
+		map = databuffer_get_span( in, 32 );
+		if( map == NULL )
+			valid = 0;
+
+		for( i=0; valid && ( i<256 ); i++ )
+		{
+			memset( freqs+i*256, 0, sizeof( *freqs ) * 256 );
+			memset( starts+i*256, 0, sizeof( *starts ) * 256 );
+
+			if( map[i/8] & (1<<(i%8)) )
+				valid = rans_get_table( in, freqs+i*256, starts+i*256, lookup+i*TOTAL );
+		}
+	}
+	else
+	{
+		valid = rans_get_table( in, freqs, starts, lookup ) || ( length == 0 );
+	}
+
+	ptr = databuffer_get_span( in, 4*LANES );
+	data = databuffer_add_span( out, length );
+
+	if( ( ! valid ) || ( ptr == NULL ) || ( data == NULL ) )
+	{
+		fputs( "rans_decompress: Invalid frequency table\n", stderr );
+		free( freqs );
+		free( starts );
+		free( lookup );
+		return 0;
+	}
+
+	end = in->data + in->size;
+
+	for( lane=0; lane<LANES; lane++ )
+	{
+		states[lane] = 0;
+		for( k=0; k<4; k++ )
+			states[lane] |= (unsigned int)*ptr++ << (k*8);
+	}
+
+	quarter = length / LANES;
+
+	for( i=0; i<quarter; i++ )		// The lanes do not depend on each other
+	{
+		for( lane=0; lane<LANES; lane++ )
+		{
+			pos = lane*quarter+i;
+			context = ( order && ( i > 0 ) ) ? data[pos-1] : 0;
+			data[pos] = rans_get_symbol( &states[lane], &ptr, end, freqs+context*256, starts+context*256, lookup+context*TOTAL );
+		}
+	}
+
+	for( pos=LANES*quarter; pos<length; pos++ )		// The tail of the last lane
+	{
+		context = ( order && ( pos > (LANES-1)*quarter ) ) ? data[pos-1] : 0;
+		data[pos] = rans_get_symbol( &states[LANES-1], &ptr, end, freqs+context*256, starts+context*256, lookup+context*TOTAL );
+	}
+
+	free( freqs );
+	free( starts );
+	free( lookup );
+
+	return 1;
+}
@@ -0,0 +1,508 @@
+/*
+*    QTC: scroll.c (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pixelops.h"
+
+#include "scroll.h"
+
+#define SCROLL_BANDSIZE 32
+#define SCROLL_MINVOTES 16
+#define SCROLL_MAXMATCHES 8
+#define SCROLL_MINAREA ( 128*128 )
+
+#define SCROLL_STATIC 0
+#define SCROLL_CHANGED 1
+#define SCROLL_MATCHED 2
+
+#define SCROLL_HASH_INIT 2166136261u
+#define SCROLL_HASH_PRIME 16777619u
+
+/*******************************************************************************
+* Function to create a new scroll detection                                    *
+*                                                                              *
+* width and height are the dimension of the images to be searched              *
+*                                                                              *
+* Returns a new scroll detection or NULL on failure                            *
+*******************************************************************************/
+struct scroll *scroll_create( int width, int height )
+{
+	struct scroll *scroll;
+	int lines, bands;
+
+	scroll = calloc( 1, sizeof( *scroll ) );
+	if( scroll == NULL )
+	{
+		perror( "scroll_create: calloc" );
+		return NULL;
+	}
+
+	scroll->width = width;
+	scroll->height = height;
+	scroll->bandsize = SCROLL_BANDSIZE;
+	scroll->rowbands = ( width + SCROLL_BANDSIZE - 1 ) / SCROLL_BANDSIZE;
+	scroll->colbands = ( height + SCROLL_BANDSIZE - 1 ) / SCROLL_BANDSIZE;
+
+	lines = scroll->rowbands * height > scroll->colbands * width ? scroll->rowbands * height : scroll->colbands * width;
+	bands = scroll->rowbands > scroll->colbands ? scroll->rowbands : scroll->colbands;
+
+	scroll->hashes = malloc( sizeof( *scroll->hashes ) * lines );
+	scroll->refhashes = malloc( sizeof( *scroll->refhashes ) * lines );
+	scroll->lines = malloc( sizeof( *scroll->lines ) * ( width > height ? width : height ) );
+	scroll->matches = malloc( sizeof( *scroll->matches ) * lines );
+	scroll->heights = malloc( sizeof( *scroll->heights ) * bands );
+	scroll->stack = malloc( sizeof( *scroll->stack ) * ( bands + 1 ) );
+	scroll->pixels = malloc( sizeof( *scroll->pixels ) * width * height );
+
+	if( ( scroll->hashes == NULL ) || ( scroll->refhashes == NULL ) ||
+	    ( scroll->lines == NULL ) || ( scroll->matches == NULL ) ||
+	    ( scroll->heights == NULL ) || ( scroll->stack == NULL ) ||
+	    ( scroll->pixels == NULL ) )
+	{
+		perror( "scroll_create: malloc" );
+		scroll_free( scroll );
+		return NULL;
+	}
+
+	return scroll;
+}
+
+/*******************************************************************************
+* Function to free a scroll detection                                          *
+*                                                                              *
+* scroll is the scroll detection to free                                       *
+*                                                                              *
+* Modifies scroll                                                              *
+*******************************************************************************/
+void scroll_free( struct scroll *scroll )
+{
+	free( scroll->hashes );
+	free( scroll->refhashes );
+	free( scroll->lines );
+	free( scroll->matches );
+	free( scroll->heights );
+	free( scroll->stack );
+	free( scroll->pixels );
+	free( scroll );
+}
+
+/*******************************************************************************
+* Function to hash the lines of all bands of an image in one direction         *
+* Lines of a single color get the hash 0 and do not vote for an offset         *
+*                                                                              *
+* scroll is the scroll detection                                               *
+* pixels is the image data                                                     *
+* hashes receives the line hashes, band after band                             *
+* vertical selects the rows of column bands or the columns of row bands        *
+*******************************************************************************/
+static void scroll_hash( struct scroll *scroll, unsigned int *pixels, unsigned int *hashes, int vertical )
+{
+	int x, y, b, x1, x2, y1, y2, width, height;
+	unsigned int h;
+
+	width = scroll->width;
+	height = scroll->height;
+
+	if( vertical )
+	{
+		for( b=0; b<scroll->rowbands; b++ )
+		{
+			x1 = b*scroll->bandsize;
+			x2 = x1+scroll->bandsize < width ? x1+scroll->bandsize : width;
+
+			for( y=0; y<height; y++ )
+			{
+				if( pixelops_uniform( &pixels[ x1 + y*width ], x2-x1, pixels[ x1 + y*width ], 0x00FFFFFF ) )
+				{
+					hashes[ b*height + y ] = 0;
+					continue;
+				}
+
+				h = SCROLL_HASH_INIT;
+				for( x=x1; x<x2; x++ )
+					h = ( h ^ ( pixels[ x + y*width ] & 0x00FFFFFF ) ) * SCROLL_HASH_PRIME;
+
+				hashes[ b*height + y ] = h ? h : 1;
+			}
+		}
+	}
+	else
+	{
+		for( b=0; b<scroll->colbands; b++ )
+		{
+			y1 = b*scroll->bandsize;
+			y2 = y1+scroll->bandsize < height ? y1+scroll->bandsize : height;
+
+			for( x=0; x<width; x++ )
+				hashes[ b*width + x ] = SCROLL_HASH_INIT;
+
+			for( y=y1; y<y2; y++ )
+			{
+				for( x=0; x<width; x++ )
+					hashes[ b*width + x ] = ( hashes[ b*width + x ] ^ ( pixels[ x + y*width ] & 0x00FFFFFF ) ) * SCROLL_HASH_PRIME;
+			}
+
+			for( x=0; x<width; x++ )
+			{
+				for( y=y1+1; y<y2; y++ )
+				{
+					if( ( pixels[ x + y*width ] ^ pixels[ x + y1*width ] ) & 0x00FFFFFF )
+						break;
+				}
+
+				if( y == y2 )
+					hashes[ b*width + x ] = 0;
+				else if( hashes[ b*width + x ] == 0 )
+					hashes[ b*width + x ] = 1;
+			}
+		}
+	}
+}
+
+/*******************************************************************************
+* Function to compare two lines for sorting, by hash and then position         *
+*******************************************************************************/
+static int scroll_compare_lines( const void *a, const void *b )
+{
+	const struct scroll_line *la, *lb;
+
+	la = a;
+	lb = b;
+
+	if( la->hash != lb->hash )
+		return la->hash < lb->hash ? -1 : 1;
+
+	return la->pos - lb->pos;
+}
+
+/*******************************************************************************
+* Function to find the most common offset between changed lines of the image   *
+* and lines of the reference image with the same hash                          *
+*                                                                              *
+* scroll is the scroll detection                                               *
+* numbands is the number of bands                                              *
+* length is the number of lines per band                                       *
+*                                                                              *
+* Returns the offset, 0 if there is none                                       *
+*******************************************************************************/
+static int scroll_vote( struct scroll *scroll, int numbands, int length )
+{
+	int b, i, j, lo, hi, mid, numlines, matches, offset, best;
+	unsigned int h;
+	unsigned int *hashes, *refhashes;
+	struct scroll_line *lines;
+
+	lines = scroll->lines;
+
+	memset( scroll->votes, 0, sizeof( scroll->votes ) );
+
+	for( b=0; b<numbands; b++ )
+	{
+		hashes = &scroll->hashes[ b*length ];
+		refhashes = &scroll->refhashes[ b*length ];
+
+		numlines = 0;
+		for( i=0; i<length; i++ )
+		{
+			if( refhashes[i] != 0 )
+			{
+				lines[numlines].hash = refhashes[i];
+				lines[numlines].pos = i;
+				numlines++;
+			}
+		}
+
+		if( numlines == 0 )
+			continue;
+
+		qsort( lines, numlines, sizeof( *lines ), scroll_compare_lines );
+
+		for( i=0; i<length; i++ )
+		{
+			h = hashes[i];
+
+			if( ( h == 0 ) || ( h == refhashes[i] ) )
+				continue;
+
+			lo = 0;
+			hi = numlines;
+			while( lo < hi )
+			{
+				mid = ( lo + hi ) / 2;
+				if( lines[mid].hash < h )
+					lo = mid+1;
+				else
+					hi = mid;
+			}
+
+			matches = 0;
+			for( j=lo; ( j<numlines ) && ( lines[j].hash == h ) && ( matches < SCROLL_MAXMATCHES ); j++ )
+			{
+				offset = lines[j].pos - i;
+
+				if( ( offset >= -SCROLL_RANGE ) && ( offset <= SCROLL_RANGE ) && ( offset != 0 ) )
+				{
+					scroll->votes[ offset + SCROLL_RANGE ]++;
+					matches++;
+				}
+			}
+		}
+	}
+
+	best = SCROLL_RANGE;
+	for( i=0; i<2*SCROLL_RANGE+1; i++ )
+	{
+		if( scroll->votes[i] > scroll->votes[best] )
+			best = i;
+	}
+
+	if( scroll->votes[best] < SCROLL_MINVOTES )
+		return 0;
+
+	return best - SCROLL_RANGE;
+}
+
+/*******************************************************************************
+* Function to test wether a line of a band matches the shifted reference line  *
+*                                                                              *
+* scroll is the scroll detection                                               *
+* pixels and refpixels are the image data of the image and reference image     *
+* vertical selects the rows of column bands or the columns of row bands        *
+* b and i are the band and line to test                                        *
+* offset is the distance to the reference line                                 *
+*                                                                              *
+* Returns 1 if the lines are equal, 0 otherwise                                *
+*******************************************************************************/
+static int scroll_match_line( struct scroll *scroll, unsigned int *pixels, unsigned int *refpixels, int vertical, int b, int i, int offset )
+{
+	int x1, x2, y1, y2, y, width;
+
+	width = scroll->width;
+
+	if( vertical )
+	{
+		x1 = b*scroll->bandsize;
+		x2 = x1+scroll->bandsize < width ? x1+scroll->bandsize : width;
+
+		return ! pixelops_differ( &pixels[ x1 + i*width ], &refpixels[ x1 + ( i+offset )*width ], x2-x1, 0x00FFFFFF );
+	}
+	else
+	{
+		y1 = b*scroll->bandsize;
+		y2 = y1+scroll->bandsize < scroll->height ? y1+scroll->bandsize : scroll->height;
+
+		for( y=y1; y<y2; y++ )
+		{
+			if( ( pixels[ i + y*width ] ^ refpixels[ i + offset + y*width ] ) & 0x00FFFFFF )
+				return 0;
+		}
+
+		return 1;
+	}
+}
+
+/*******************************************************************************
+* Function to find the largest rectangle of bands and lines that can be taken  *
+* from the reference image shifted by an offset                                *
+* Lines that match the shifted reference or changed anyway are usable, lines   *
+* that only match the unshifted reference are not. The rectangle is only taken *
+* if at least half of its lines changed and match the shifted reference.       *
+*                                                                              *
+* scroll is the scroll detection                                               *
+* pixels and refpixels are the image data of the image and reference image     *
+* vertical selects the rows of column bands or the columns of row bands        *
+* offset is the distance to the reference lines                                *
+* b1, b2, l1 and l2 receive the band and line range of the rectangle           *
+*                                                                              *
+* Returns the area of the rectangle in pixels, 0 if there is none              *
+*******************************************************************************/
+static int scroll_rectangle( struct scroll *scroll, unsigned int *pixels, unsigned int *refpixels, int vertical, int offset, int *b1, int *b2, int *l1, int *l2 )
+{
+	int b, i, j, h, top, left, area, best, moved;
+	int numbands, length, size;
+	unsigned char *matches;
+	int *heights, *stack;
+
+	numbands = vertical ? scroll->rowbands : scroll->colbands;
+	length = vertical ? scroll->height : scroll->width;
+	size = vertical ? scroll->width : scroll->height;
+
+	matches = scroll->matches;
+	heights = scroll->heights;
+	stack = scroll->stack;
+
+	for( b=0; b<numbands; b++ )
+	{
+		for( i=0; i<length; i++ )
+		{
+			if( ( i+offset < 0 ) || ( i+offset >= length ) )
+				matches[ b*length + i ] = SCROLL_STATIC;
+			else if( ( scroll->hashes[ b*length + i ] == scroll->refhashes[ b*length + i+offset ] ) &&
+			         ( scroll_match_line( scroll, pixels, refpixels, vertical, b, i, offset ) ) )
+				matches[ b*length + i ] = SCROLL_MATCHED;
+			else if( scroll->hashes[ b*length + i ] != scroll->refhashes[ b*length + i ] )
+				matches[ b*length + i ] = SCROLL_CHANGED;
+			else
+				matches[ b*length + i ] = SCROLL_STATIC;
+		}
+
+		heights[b] = 0;
+	}
+
+	best = 0;
+
+	for( i=0; i<length; i++ )		// Largest rectangle under the histogram of usable lines ending in line i
+	{
+		for( b=0; b<numbands; b++ )
+			heights[b] = matches[ b*length + i ] != SCROLL_STATIC ? heights[b]+1 : 0;
+
+		top = 0;
+		for( b=0; b<=numbands; b++ )
+		{
+			h = b < numbands ? heights[b] : 0;
+
+			while( ( top > 0 ) && ( heights[ stack[top-1] ] >= h ) )
+			{
+				j = stack[--top];
+				left = top > 0 ? stack[top-1]+1 : 0;
+
+				area = ( ( b*scroll->bandsize < size ? b*scroll->bandsize : size ) - left*scroll->bandsize ) * heights[j];
+				if( area > best )
+				{
+					best = area;
+					*b1 = left;
+					*b2 = b;
+					*l1 = i-heights[j]+1;
+					*l2 = i+1;
+				}
+			}
+
+			stack[top++] = b;
+		}
+	}
+
+	if( best < SCROLL_MINAREA )
+		return 0;
+
+	moved = 0;
+	for( b=*b1; b<*b2; b++ )
+	{
+		for( i=*l1; i<*l2; i++ )
+		{
+			if( ( matches[ b*length + i ] == SCROLL_MATCHED ) &&
+			    ( scroll->hashes[ b*length + i ] != scroll->refhashes[ b*length + i ] ) )
+				moved++;
+		}
+	}
+
+	if( moved*2 < ( *b2-*b1 ) * ( *l2-*l1 ) )
+		return 0;
+
+	return best;
+}
+
+/*******************************************************************************
+* Function to find the largest region of an image that is a scrolled part of   *
+* the reference image                                                          *
+*                                                                              *
+* scroll is the scroll detection                                               *
+* pixels and refpixels are the image data of the image and reference image     *
+* x1, y1, x2 and y2 receive the region                                         *
+* dx and dy receive the distance to the source of the region in the reference  *
+*                                                                              *
+* Returns 1 if a scrolled region was found, 0 otherwise                        *
+*******************************************************************************/
+int scroll_find( struct scroll *scroll, unsigned int *pixels, unsigned int *refpixels, int *x1, int *y1, int *x2, int *y2, int *dx, int *dy )
+{
+	int offset, area, best, b1, b2, l1, l2;
+
+	best = 0;
+	b1 = b2 = l1 = l2 = 0;
+
+	scroll_hash( scroll, pixels, scroll->hashes, 1 );		// Vertical scrolling
+	scroll_hash( scroll, refpixels, scroll->refhashes, 1 );
+
+	offset = scroll_vote( scroll, scroll->rowbands, scroll->height );
+	if( offset != 0 )
+	{
+		area = scroll_rectangle( scroll, pixels, refpixels, 1, offset, &b1, &b2, &l1, &l2 );
+		if( area > best )
+		{
+			best = area;
+			*x1 = b1*scroll->bandsize;
+			*x2 = b2*scroll->bandsize < scroll->width ? b2*scroll->bandsize : scroll->width;
+			*y1 = l1;
+			*y2 = l2;
+			*dx = 0;
+			*dy = offset;
+		}
+	}
+
+	scroll_hash( scroll, pixels, scroll->hashes, 0 );		// Horizontal scrolling
+	scroll_hash( scroll, refpixels, scroll->refhashes, 0 );
+
+	offset = scroll_vote( scroll, scroll->colbands, scroll->width );
+	if( offset != 0 )
+	{
+		area = scroll_rectangle( scroll, pixels, refpixels, 0, offset, &b1, &b2, &l1, &l2 );
+		if( area > best )
+		{
+			best = area;
+			*x1 = l1;
+			*x2 = l2;
+			*y1 = b1*scroll->bandsize;
+			*y2 = b2*scroll->bandsize < scroll->height ? b2*scroll->bandsize : scroll->height;
+			*dx = offset;
+			*dy = 0;
+		}
+	}
+
+	return best > 0;
+}
+
+/*******************************************************************************
+* Function to shift a region of an image in place                              *
+* Every pixel of the region is replaced by the pixel at distance dx, dy, the   *
+* moved region has to lie within the image                                     *
+*                                                                              *
+* pixels is the image data                                                     *
+* width is the width of the image                                              *
+* x1, y1, x2 and y2 describe the region                                        *
+* dx and dy are the distance to the source pixels                              *
+*                                                                              *
+* Modifies pixels                                                              *
+*******************************************************************************/
+void scroll_apply( unsigned int *pixels, int width, int x1, int y1, int x2, int y2, int dx, int dy )
+{
+	int y;
+
+	if( dy > 0 )		// Rows are read before they get overwritten
+	{
+		for( y=y1; y<y2; y++ )
+			memmove( &pixels[ x1 + y*width ], &pixels[ x1+dx + ( y+dy )*width ], ( x2-x1 ) * sizeof( *pixels ) );
+	}
+	else
+	{
+		for( y=y2-1; y>=y1; y-- )
+			memmove( &pixels[ x1 + y*width ], &pixels[ x1+dx + ( y+dy )*width ], ( x2-x1 ) * sizeof( *pixels ) );
+	}
+}
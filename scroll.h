@@ -0,0 +1,75 @@
+/*
+*    QTC: scroll.h (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCROLL_H
+#define SCROLL_H
+
+#define SCROLL_RANGE 1024
+
+/*******************************************************************************
+* Structure to hold a line hash and its position, used for sorting             *
+*******************************************************************************/
+struct scroll_line
+{
+	unsigned int hash;
+	int pos;
+};
+
+/*******************************************************************************
+* Structure to hold all the data associated with a scroll detection            *
+*                                                                              *
+* The scroll detection looks for one large rectangle of an image that equals   *
+* the reference image shifted vertically or horizontally. The lines of narrow  *
+* bands of both images are hashed, the most common offset between matching     *
+* lines is the scroll candidate and the largest rectangle of bands and lines   *
+* that match under that offset is the scrolled region.                         *
+*                                                                              *
+* width and height are the dimension of the images                             *
+* bandsize is the width of a column band and the height of a row band          *
+* rowbands and colbands are the number of column and row bands                 *
+* hashes and refhashes are the line hashes of the image and reference image    *
+* lines is a scratch buffer to sort the lines of one band                      *
+* votes counts the matched lines per offset                                    *
+* matches classifies the lines under the candidate offset                      *
+* heights and stack are used to find the largest matching rectangle            *
+* pixels receives the shifted reference image                                  *
+*******************************************************************************/
+struct scroll
+{
+	int width, height;
+	int bandsize;
+	int rowbands, colbands;
+
+	unsigned int *hashes, *refhashes;
+
+	struct scroll_line *lines;
+	int votes[ 2*SCROLL_RANGE+1 ];
+
+	unsigned char *matches;
+	int *heights, *stack;
+
+	unsigned int *pixels;
+};
+
+extern struct scroll *scroll_create( int width, int height );
+extern void scroll_free( struct scroll *scroll );
+extern int scroll_find( struct scroll *scroll, unsigned int *pixels, unsigned int *refpixels, int *x1, int *y1, int *x2, int *y2, int *dx, int *dy );
+extern void scroll_apply( unsigned int *pixels, int width, int x1, int y1, int x2, int y2, int dx, int dy );
+
+#endif
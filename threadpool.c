@@ -0,0 +1,195 @@
+/*
+*    QTC: threadpool.c (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "threadpool.h"
+
+/*******************************************************************************
+* Function to work on the tasks of the current batch until none are left       *
+* Every thread takes the next free task from a shared counter, so threads that *
+* finish early keep taking work from the slower ones                           *
+*                                                                              *
+* pool is the thread pool to work for                                          *
+*******************************************************************************/
+static void threadpool_work( struct threadpool *pool )
+{
+	int i;
+
+	while( ( i = __sync_fetch_and_add( &pool->next, 1 ) ) < pool->numtasks )
+		pool->function( pool->tasks[i] );
+}
+
+/*******************************************************************************
+* Main function of a worker thread                                             *
+*                                                                              *
+* data is the thread pool the thread belongs to                                *
+*******************************************************************************/
+static void *threadpool_thread( void *data )
+{
+	struct threadpool *pool;
+	unsigned int generation;
+
+	pool = data;
+	generation = 0;
+
+	pthread_mutex_lock( &pool->mutex );
+
+	while( 1 )
+	{
+		while( ( pool->generation == generation ) && ( ! pool->quit ) )
+			pthread_cond_wait( &pool->start, &pool->mutex );
+
+		if( pool->quit )
+			break;
+
+		generation = pool->generation;
+
+		pthread_mutex_unlock( &pool->mutex );
+
+		threadpool_work( pool );
+
+		pthread_mutex_lock( &pool->mutex );
+
+		if( --pool->active == 0 )
+			pthread_cond_signal( &pool->finish );
+	}
+
+	pthread_mutex_unlock( &pool->mutex );
+
+	return NULL;
+}
+
+/*******************************************************************************
+* Function to create a new thread pool                                         *
+*                                                                              *
+* numthreads is the number of worker threads to start                          *
+*                                                                              *
+* Returns a new thread pool or NULL on failure                                 *
+*******************************************************************************/
+struct threadpool *threadpool_create( int numthreads )
+{
+	struct threadpool *pool;
+	int i;
+
+	pool = malloc( sizeof( *pool ) );
+	if( pool == NULL )
+	{
+		perror( "threadpool_create: malloc" );
+		return NULL;
+	}
+
+	pool->threads = malloc( sizeof( *pool->threads ) * ( numthreads > 0 ? numthreads : 1 ) );
+	if( pool->threads == NULL )
+	{
+		perror( "threadpool_create: malloc" );
+		free( pool );
+		return NULL;
+	}
+
+	pthread_mutex_init( &pool->mutex, NULL );
+	pthread_cond_init( &pool->start, NULL );
+	pthread_cond_init( &pool->finish, NULL );
+
+	pool->numthreads = 0;
+	pool->generation = 0;
+	pool->active = 0;
+	pool->quit = 0;
+	pool->function = NULL;
+	pool->tasks = NULL;
+	pool->numtasks = 0;
+	pool->next = 0;
+
+	for( i=0; i<numthreads; i++ )
+	{
+		if( pthread_create( &pool->threads[i], NULL, threadpool_thread, pool ) != 0 )
+		{
+			fputs( "threadpool_create: Cannot create thread\n", stderr );
+			threadpool_free( pool );
+			return NULL;
+		}
+
+		pool->numthreads++;
+	}
+
+	return pool;
+}
+
+/*******************************************************************************
+* Function to stop the workers and free a thread pool                          *
+*                                                                              *
+* pool is the thread pool to free                                              *
+*                                                                              *
+* Modifies pool                                                                *
+*******************************************************************************/
+void threadpool_free( struct threadpool *pool )
+{
+	int i;
+
+	pthread_mutex_lock( &pool->mutex );
+	pool->quit = 1;
+	pthread_cond_broadcast( &pool->start );
+	pthread_mutex_unlock( &pool->mutex );
+
+	for( i=0; i<pool->numthreads; i++ )
+		pthread_join( pool->threads[i], NULL );
+
+	pthread_cond_destroy( &pool->finish );
+	pthread_cond_destroy( &pool->start );
+	pthread_mutex_destroy( &pool->mutex );
+
+	free( pool->threads );
+	free( pool );
+}
+
+/*******************************************************************************
+* Function to run a batch of tasks on a thread pool                            *
+* The calling thread works on the tasks as well and returns once all tasks are *
+* done. Tasks may be finished in any order.                                    *
+*                                                                              *
+* pool is the thread pool to use                                               *
+* function is called once for every task                                       *
+* tasks is an array of task pointers passed to function                        *
+* numtasks is the number of tasks                                              *
+*******************************************************************************/
+void threadpool_run( struct threadpool *pool, void (*function)( void *task ), void **tasks, int numtasks )
+{
+	pthread_mutex_lock( &pool->mutex );
+
+	pool->function = function;
+	pool->tasks = tasks;
+	pool->numtasks = numtasks;
+	pool->next = 0;
+	pool->active = pool->numthreads;
+	pool->generation++;
+
+	pthread_cond_broadcast( &pool->start );
+	pthread_mutex_unlock( &pool->mutex );
+
+	threadpool_work( pool );
+
+	pthread_mutex_lock( &pool->mutex );
+
+	while( pool->active > 0 )
+		pthread_cond_wait( &pool->finish, &pool->mutex );
+
+	pthread_mutex_unlock( &pool->mutex );
+}
@@ -0,0 +1,64 @@
+/*
+*    QTC: threadpool.h (c) 2011, 2012 50m30n3
+*
+*    This file is part of QTC.
+*
+*    QTC is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    QTC is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with QTC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <pthread.h>
+
+/*******************************************************************************
+* Structure to hold all the data associated with a thread pool                 *
+*                                                                              *
+* numthreads is the number of worker threads, the caller of threadpool_run     *
+* works on the tasks as well                                                   *
+* threads are the worker threads                                               *
+* mutex protects the batch state and the condition variables                   *
+* start signals the workers that a new batch is ready                          *
+* finish signals the caller that all workers left the current batch            *
+* generation is increased for every new batch                                  *
+* active is the number of workers still working on the current batch           *
+* quit tells the workers to exit                                               *
+* function is the function to call for every task of the current batch         *
+* tasks is the array of tasks of the current batch                             *
+* numtasks is the number of tasks in the current batch                         *
+* next is the index of the next task to be taken                               *
+*******************************************************************************/
+struct threadpool
+{
+	int numthreads;
+	pthread_t *threads;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t start, finish;
+
+	unsigned int generation;
+	int active;
+	int quit;
+
+	void (*function)( void *task );
+	void **tasks;
+	int numtasks;
+	int next;
+};
+
+extern struct threadpool *threadpool_create( int numthreads );
+extern void threadpool_free( struct threadpool *pool );
+extern void threadpool_run( struct threadpool *pool, void (*function)( void *task ), void **tasks, int numtasks );
+
+#endif
@@ -49,6 +49,27 @@ static unsigned short int fletcher16( unsigned char *data, int length )
 	return (s2<<8)|s1;
 }
 
+/*******************************************************************************
+* Function to find the bytes of a pixel selected by a channel mask             *
+* Partial masks are applied byte by byte, so that the luma and chroma planes   *
+* of an image can be decoded into the same pixels at the same time.            *
+*                                                                              *
+* mask is the channel mask                                                     *
+* lanes is set to 1 for every byte of a pixel in memory that the mask selects  *
+*******************************************************************************/
+static void tilecache_get_lanes( unsigned int mask, int lanes[4] )
+{
+	unsigned int lane;
+	int b;
+
+	for( b=0; b<4; b++ )
+	{
+		lane = 0;
+		((unsigned char *)&lane)[b] = 0xFF;
+		lanes[b] = ( lane & mask ) != 0;
+	}
+}
+
 /*******************************************************************************
 * Function to create a new tile cache                                          *
 *                                                                              *
@@ -85,6 +106,9 @@ struct tilecache *tilecache_create( int size, int blocksize )
 	cache->numblocks = 0;
 	cache->hits = 0;
 
+	cache->siblings = NULL;
+	cache->numsiblings = 0;
+
 	cache->tiles = malloc( sizeof( *cache->tiles ) * size );
 	if( cache->tiles == NULL )
 	{
@@ -135,6 +159,12 @@ struct tilecache *tilecache_create( int size, int blocksize )
 *******************************************************************************/
 void tilecache_free( struct tilecache *cache )
 {
+	int i;
+
+	for( i=0; i<cache->numsiblings; i++ )
+		tilecache_free( cache->siblings[i] );
+
+	free( cache->siblings );
 	free( cache->tiles );
 	free( cache->tileindex );
 	free( cache->data );
@@ -163,6 +193,72 @@ void tilecache_reset( struct tilecache *cache )
 	
 	for( i=0; i<indexsize; i++ )
 		cache->tileindex[i] = -1;
+
+	for( i=0; i<cache->numsiblings; i++ )
+		tilecache_reset( cache->siblings[i] );
+}
+
+/*******************************************************************************
+* Function to get a sibling of a tile cache                                    *
+* Slices of an image are compressed independently and need a cache each. The   *
+* siblings have the same size as the cache and are created on first use.       *
+* Resetting or freeing a cache also resets or frees its siblings.              *
+*                                                                              *
+* cache is the tile cache the sibling belongs to                               *
+* index is the number of the sibling, 0 returns cache itself                   *
+*                                                                              *
+* Returns the sibling or NULL on failure                                       *
+*******************************************************************************/
+struct tilecache *tilecache_get_sibling( struct tilecache *cache, int index )
+{
+	struct tilecache **siblings;
+
+	if( index == 0 )
+		return cache;
+
+	if( index > cache->numsiblings )
+	{
+		siblings = realloc( cache->siblings, sizeof( *siblings ) * index );
+		if( siblings == NULL )
+		{
+			perror( "tilecache_get_sibling: realloc" );
+			return NULL;
+		}
+
+		cache->siblings = siblings;
+
+		while( cache->numsiblings < index )
+		{
+			siblings[cache->numsiblings] = tilecache_create( cache->size, cache->blocksize );
+			if( siblings[cache->numsiblings] == NULL )
+				return NULL;
+
+			cache->numsiblings++;
+		}
+	}
+
+	return cache->siblings[index-1];
+}
+
+/*******************************************************************************
+* Function to get the usage statistics of a tile cache and its siblings        *
+*                                                                              *
+* cache is the tile cache to query                                             *
+* numblocks is set to the total number of blocks written to the caches         *
+* hits is set to the total number of cache hits                                *
+*******************************************************************************/
+void tilecache_get_stats( struct tilecache *cache, unsigned long int *numblocks, unsigned long int *hits )
+{
+	int i;
+
+	*numblocks = cache->numblocks;
+	*hits = cache->hits;
+
+	for( i=0; i<cache->numsiblings; i++ )
+	{
+		*numblocks += cache->siblings[i]->numblocks;
+		*hits += cache->siblings[i]->hits;
+	}
 }
 
 /*******************************************************************************
@@ -276,21 +372,45 @@ int tilecache_write( struct tilecache *cache, unsigned int *pixels, int x1, int
 *******************************************************************************/
 void tilecache_read( struct tilecache *cache, unsigned int *pixels, int index, int x1, int x2, int y1, int y2, int width, unsigned int mask )
 {
-	int x, y, i, j;
+	int x, y, i, j, b;
+	int lanes[4];
 	unsigned int invmask;
 	unsigned int *data;
+	unsigned char *dst, *src;
+
+	tilecache_get_lanes( mask, lanes );
 
 	invmask = ~mask;
 	data = cache->tiles[index].data;
 
-	j = 0;
-	for( y=y1; y<y2; y++ )
+	if( ( mask & 0x00FFFFFF ) == 0x00FFFFFF )
 	{
-		i = x1 + y*width;
-		for( x=x1; x<x2; x++ )
+		j = 0;
+		for( y=y1; y<y2; y++ )
 		{
-			pixels[i] &= invmask;
-			pixels[i++] |= data[j++]&mask;
+			i = x1 + y*width;
+			for( x=x1; x<x2; x++ )
+			{
+				pixels[i] &= invmask;
+				pixels[i++] |= data[j++]&mask;
+			}
+		}
+	}
+	else
+	{
+		j = 0;
+		for( y=y1; y<y2; y++ )
+		{
+			i = x1 + y*width;
+			for( x=x1; x<x2; x++ )
+			{
+				dst = (unsigned char *)&pixels[i++];
+				src = (unsigned char *)&data[j++];
+
+				for( b=0; b<4; b++ )
+					if( lanes[b] )
+						dst[b] = src[b];
+			}
 		}
 	}
 }
@@ -308,18 +428,42 @@ void tilecache_read( struct tilecache *cache, unsigned int *pixels, int index, i
 *******************************************************************************/
 void tilecache_add( struct tilecache *cache, unsigned int *pixels, int x1, int x2, int y1, int y2, int width, unsigned int mask )
 {
-	int x, y, i, j;
+	int x, y, i, j, b;
+	int lanes[4];
+	unsigned char *dst, *src;
+
+	tilecache_get_lanes( mask, lanes );
 
 	cache->numblocks++;
 
 	memset( (unsigned char *)cache->tempdata, 0, cache->tilesize );
 
-	j = 0;
-	for( y=y1; y<y2; y++ )
+	if( ( mask & 0x00FFFFFF ) == 0x00FFFFFF )
 	{
-		i = x1 + y*width;
-		for( x=x1; x<x2; x++ )
-			cache->tempdata[j++] = pixels[i++]&mask;
+		j = 0;
+		for( y=y1; y<y2; y++ )
+		{
+			i = x1 + y*width;
+			for( x=x1; x<x2; x++ )
+				cache->tempdata[j++] = pixels[i++]&mask;
+		}
+	}
+	else
+	{
+		j = 0;
+		for( y=y1; y<y2; y++ )
+		{
+			i = x1 + y*width;
+			for( x=x1; x<x2; x++ )
+			{
+				src = (unsigned char *)&pixels[i++];
+				dst = (unsigned char *)&cache->tempdata[j++];
+
+				for( b=0; b<4; b++ )
+					if( lanes[b] )
+						dst[b] = src[b];
+			}
+		}
 	}
 
 	cache->index++;
@@ -52,6 +52,8 @@ struct tile
 * tileindex is a hash table containing tile indices                            *
 * data is the cache data used by the tiles                                     *
 * tempdata is a temporary buffer used for internal operations                  *
+* siblings are additional caches of the same size used by the slices of an     *
+* image, numsiblings is their number                                           *
 *******************************************************************************/
 struct tilecache
 {
@@ -70,12 +72,17 @@ struct tilecache
 
 	unsigned int *data;
 	unsigned int *tempdata;
+
+	struct tilecache **siblings;
+	int numsiblings;
 };
 
 
 extern struct tilecache *tilecache_create( int size, int blocksize );
 extern void tilecache_free( struct tilecache *cache );
 extern void tilecache_reset( struct tilecache *cache );
+extern struct tilecache *tilecache_get_sibling( struct tilecache *cache, int index );
+extern void tilecache_get_stats( struct tilecache *cache, unsigned long int *numblocks, unsigned long int *hits );
 extern int tilecache_write( struct tilecache *cache, unsigned int *pixels, int x1, int x2, int y1, int y2, int width, unsigned int mask );
 extern void tilecache_read( struct tilecache *cache, unsigned int *pixels, int index, int x1, int x2, int y1, int y2, int width, unsigned int mask );
 extern void tilecache_add( struct tilecache *cache, unsigned int *pixels, int x1, int x2, int y1, int y2, int width, unsigned int mask );
@@ -28,8 +28,12 @@
 #include <sys/ipc.h>
 #include <X11/extensions/XShm.h>
 #include <X11/extensions/Xfixes.h>
+#ifdef HAVE_XDAMAGE
+#include <X11/extensions/Xdamage.h>
+#endif
 
 #include "image.h"
+#include "damage.h"
 
 #include "x11grab.h"
 
@@ -157,6 +161,10 @@ int x11grabber_create( struct x11grabber *grabber, char *disp_name, int x, int y
 	grabber->height = cap_h;
 	grabber->mouse = mouse;
 	grabber->image = image;
+	grabber->xdamage = grabber->region = None;
+	grabber->damage_event = 0;
+	grabber->cursor_x = grabber->cursor_y = 0;
+	grabber->cursor_w = grabber->cursor_h = 0;
 
 	return 1;
 }
@@ -175,18 +183,95 @@ void x11grabber_free( struct x11grabber *grabber )
 
 	XDestroyImage( grabber->image );
 
+#ifdef HAVE_XDAMAGE
+	if( grabber->xdamage != None )
+	{
+		XDamageDestroy( grabber->display, grabber->xdamage );
+		XFixesDestroyRegion( grabber->display, grabber->region );
+	}
+#endif
+
 	XCloseDisplay( grabber->display );
 }
 
+/*******************************************************************************
+* Function to find the tiles that changed since the last grabbed frame         *
+* The X server reports the drawn areas through the XDamage extension, so the   *
+* screen is never compared pixel by pixel. It has to be called before the      *
+* frame is grabbed, areas drawn after that are reported with the next frame    *
+*                                                                              *
+* grabber is the x11grabber to use                                             *
+* damage is the damage map to fill                                             *
+*                                                                              *
+* Modifies grabber and damage                                                  *
+*                                                                              *
+* Returns 0 on failure, 1 on success                                           *
+*******************************************************************************/
+static int x11grabber_find_damage( struct x11grabber *grabber, struct damage *damage )
+{
+#ifdef HAVE_XDAMAGE
+	int i, numrects, error_base;
+	XRectangle *rects;
+	XEvent event;
+
+	if( ( damage->width != grabber->width ) || ( damage->height != grabber->height ) )
+	{
+		fputs( "x11grabber_find_damage: Damage map size mismatch\n", stderr );
+		return 0;
+	}
+
+	if( grabber->xdamage == None )
+	{
+		if( ! XDamageQueryExtension( grabber->display, &grabber->damage_event, &error_base ) )
+		{
+			fputs( "x11grabber_find_damage: XDamage not supported\n", stderr );
+			return 0;
+		}
+
+		grabber->xdamage = XDamageCreate( grabber->display, RootWindow( grabber->display, grabber->screen ), XDamageReportNonEmpty );
+		grabber->region = XFixesCreateRegion( grabber->display, NULL, 0 );
+
+		damage_add_all( damage );
+
+		return 1;
+	}
+
+	damage_clear( damage );
+
+	XDamageSubtract( grabber->display, grabber->xdamage, None, grabber->region );
+
+	rects = XFixesFetchRegion( grabber->display, grabber->region, &numrects );
+	if( rects != NULL )
+	{
+		for( i=0; i<numrects; i++ )
+			damage_add_rect( damage, rects[i].x - grabber->x, rects[i].y - grabber->y, rects[i].width, rects[i].height );
+
+		XFree( rects );
+	}
+
+	while( XCheckTypedEvent( grabber->display, grabber->damage_event + XDamageNotify, &event ) );
+
+	return 1;
+#else
+	(void)grabber;
+	(void)damage;
+
+	fputs( "x11grabber_find_damage: Built without XDamage support\n", stderr );
+	return 0;
+#endif
+}
+
 /*******************************************************************************
 * Function to capture a frame using an x11grabber                              *
 *                                                                              *
-* image is an uninitialied image structure to hold the capture                 *
+* image is the image structure to hold the capture, its pixels are reused if   *
+* the size fits, they have to be NULL or allocated by image_create             *
 * grabber is the x11grabber to use                                             *
+* damage is a damage map to receive the changed areas, or NULL                 *
 *                                                                              *
-* Modifies image                                                               *
+* Modifies image and damage                                                    *
 *******************************************************************************/
-int x11grabber_grab_frame( struct image *image, struct x11grabber *grabber )
+int x11grabber_grab_frame( struct image *image, struct x11grabber *grabber, struct damage *damage )
 {
 	int x, y, cx, cy, i, ci;
 	int xmin, xmax, ymin, ymax;
@@ -203,13 +288,23 @@ int x11grabber_grab_frame( struct image *image, struct x11grabber *grabber )
 		}
 	}
 
+	if( damage != NULL )
+	{
+		if( ! x11grabber_find_damage( grabber, damage ) )
+			return 0;
+
+		damage_add_rect( damage, grabber->cursor_x, grabber->cursor_y, grabber->cursor_w, grabber->cursor_h );
+		grabber->cursor_w = grabber->cursor_h = 0;
+	}
+
 	if ( ! XShmGetImage( grabber->display, RootWindow( grabber->display, grabber->screen ), grabber->image, grabber->x, grabber->y, AllPlanes ) )
 	{
 		fputs( "x11grabber_grab_frame: Could not get image\n", stderr );
 		return 0;
 	}
 
-	image_create( image, grabber->width, grabber->height, 1 );
+	if( ! image_resize( image, grabber->width, grabber->height, 1 ) )
+		return 0;
 
 	memcpy( image->pixels, grabber->image->data, image->width * image->height * 4 );
 
@@ -223,6 +318,14 @@ int x11grabber_grab_frame( struct image *image, struct x11grabber *grabber )
 		ymin = cy<0?0:cy;
 		ymax = ((cy + xcim->height)<grabber->height)?(cy + xcim->height):grabber->height;
 
+		grabber->cursor_x = cx;
+		grabber->cursor_y = cy;
+		grabber->cursor_w = xcim->width;
+		grabber->cursor_h = xcim->height;
+
+		if( damage != NULL )
+			damage_add_rect( damage, cx, cy, xcim->width, xcim->height );
+
 		for( y=ymin; y<ymax; y++ )
 		{
 			i = xmin+y*image->width;
@@ -33,6 +33,10 @@
 * mouse indicates wether to capture the mouse cursor or not                    *
 * image is the XSHM image representing the capture aread                       *
 * shminfo is the shared memory info for the image                              *
+* xdamage and region are the XDamage object and region used for damage         *
+* tracking, None until the first damage tracked frame                          *
+* damage_event is the event base of the XDamage extension                      *
+* cursor_x, cursor_y, cursor_w and cursor_h are the last cursor area           *
 *******************************************************************************/
 struct x11grabber
 {
@@ -41,11 +45,14 @@ struct x11grabber
 	int mouse;
 	XImage *image;
 	XShmSegmentInfo shminfo;
+	XID xdamage, region;
+	int damage_event;
+	int cursor_x, cursor_y, cursor_w, cursor_h;
 };
 
 extern int x11grabber_create( struct x11grabber *grabber, char *disp_name, int x, int y, int width, int height, int mouse );
 extern void x11grabber_free( struct x11grabber *grabber );
-extern int x11grabber_grab_frame( struct image *image, struct x11grabber *grabber );
+extern int x11grabber_grab_frame( struct image *image, struct x11grabber *grabber, struct damage *damage );
 
 #endif
 